@@ -0,0 +1,180 @@
+//
+// Created by Vijay Goyal on 2025-01-20.
+//
+
+#include "Benchmark.h"
+#include "../tools/ThreadPool.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+namespace {
+    std::atomic<std::size_t> heap_bytes{0};
+
+    void* countedAlloc(std::size_t size) {
+        heap_bytes.fetch_add(size, std::memory_order_relaxed);
+        void* p = std::malloc(size ? size : 1);
+        if(!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void* countedAlignedAlloc(std::size_t size, std::align_val_t align) {
+        heap_bytes.fetch_add(size, std::memory_order_relaxed);
+        auto alignment = static_cast<std::size_t>(align);
+        void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+        if(!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    std::string escape(const std::string& text) {
+        std::string out;
+        for(char ch : text) {
+            if(ch == '"' || ch == '\\') {
+                out += '\\';
+            }
+            out += ch;
+        }
+        return out;
+    }
+}
+
+// every new in the benchmark binary goes through these so allocations inside a timed loop can be counted
+void* operator new(std::size_t size) { return countedAlloc(size); }
+void* operator new[](std::size_t size) { return countedAlloc(size); }
+void* operator new(std::size_t size, std::align_val_t align) { return countedAlignedAlloc(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return countedAlignedAlloc(size, align); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+std::size_t heapBytesAllocated() {
+    return heap_bytes.load(std::memory_order_relaxed);
+}
+
+bool BenchmarkState::keepRunning() {
+    if(!warmed_up) {
+        warmed_up = true;
+        return true;
+    }
+    if(!running) {
+        running = true;
+        iterations = 1;
+        bytes_at_start = allocated();
+        start = Clock::now();
+        return true;
+    }
+    double so_far = std::chrono::duration<double>(Clock::now() - start).count();
+    if(so_far >= min_time) {
+        stop();
+        return false;
+    }
+    ++iterations;
+    return true;
+}
+
+void BenchmarkState::stop() {
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    bytes = allocated() - bytes_at_start;
+    running = false;
+}
+
+BenchmarkRegistry& BenchmarkRegistry::instance() {
+    static BenchmarkRegistry registry;
+    return registry;
+}
+
+void BenchmarkRegistry::add(std::string name, Function function) {
+    benchmarks.emplace_back(std::move(name), std::move(function));
+}
+
+std::vector<BenchmarkResult> BenchmarkRegistry::run(const std::string& filter, double min_time) const {
+    std::vector<BenchmarkResult> results;
+    std::printf("%-40s %10s %14s %14s %10s %14s\n", "benchmark", "iters", "ms/iter", "images/s", "GFLOP/s", "bytes/iter");
+    for(const auto& [name, function] : benchmarks) {
+        if(name.find(filter) == std::string::npos) {
+            continue;
+        }
+        BenchmarkState state(min_time, allocated ? allocated : BenchmarkState::AllocationCounter(heapBytesAllocated));
+        function(state);
+        if(state.iterationCount() == 0) {
+            throw std::logic_error("Benchmark " + name + " never entered its timed loop.");
+        }
+
+        double per_iteration = state.seconds() / static_cast<double>(state.iterationCount());
+        BenchmarkResult result{name, state.iterationCount(), per_iteration,
+                               state.itemsPerIteration() / per_iteration,
+                               state.flopsPerIteration() / per_iteration * 1e-9,
+                               static_cast<double>(state.bytesAllocated()) / static_cast<double>(state.iterationCount())};
+        std::printf("%-40s %10lld %14.4f %14.1f %10.2f %14.0f\n", name.c_str(), static_cast<long long>(result.iterations),
+                    result.time_per_iteration * 1e3, result.items_per_second, result.gflops, result.bytes_per_iteration);
+        std::fflush(stdout);
+        results.push_back(result);
+    }
+    return results;
+}
+
+void BenchmarkRegistry::writeJson(const std::vector<BenchmarkResult>& results, const std::string& path) const {
+    std::ofstream out(path);
+    if(!out) {
+        throw std::runtime_error("Cannot open " + path + " for writing.");
+    }
+
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    out << "{\n  \"context\": {\n";
+    out << "    \"date\": \"" << date << "\",\n";
+    out << "    \"threads\": " << ThreadPool::instance().size();
+    for(const auto& [key, value] : context) {
+        out << ",\n    \"" << escape(key) << "\": \"" << escape(value) << "\"";
+    }
+    out << "\n  },\n  \"benchmarks\": [";
+    for(std::size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << escape(r.name) << "\", \"iterations\": " << r.iterations
+            << ", \"time_per_iteration_ms\": " << r.time_per_iteration * 1e3
+            << ", \"images_per_second\": " << r.items_per_second
+            << ", \"gflops\": " << r.gflops
+            << ", \"bytes_per_iteration\": " << r.bytes_per_iteration << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int BenchmarkRegistry::main(int argc, char** argv) const {
+    std::string filter;
+    std::string json_path;
+    double min_time = 0.5;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg.rfind("--filter=", 0) == 0) {
+            filter = arg.substr(9);
+        } else if(arg.rfind("--min_time=", 0) == 0) {
+            min_time = std::stod(arg.substr(11));
+        } else if(arg.rfind("--json=", 0) == 0) {
+            json_path = arg.substr(7);
+        } else {
+            std::fprintf(stderr, "usage: %s [--filter=<substring>] [--min_time=<seconds>] [--json=<path>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    auto results = run(filter, min_time);
+    if(!json_path.empty()) {
+        writeJson(results, json_path);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+//
+// Created by Vijay Goyal on 2025-01-20.
+//
+
+#ifndef INC_12_FINALPROJ_2_BENCHMARK_H
+#define INC_12_FINALPROJ_2_BENCHMARK_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A small Google-Benchmark-style harness so the native code can be timed without python in the way.
+ *        - a benchmark is a function taking a BenchmarkState, it does its setup and then loops
+ *          `while(state.keepRunning()) { ... }` around the code being measured
+ *        - the loop runs until min_time has passed (at least once after one untimed warm-up iteration)
+ *        - bytes allocated are counted only inside the timed loop, by default from operator new, the allocation
+ *          counter can be replaced to also include Tensor::allocate
+ *        - results are printed as a table, and written as JSON when asked for, to compare commits
+ */
+class BenchmarkState {
+public:
+    typedef std::function<std::size_t()> AllocationCounter; // running total of bytes allocated
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double min_time;
+    AllocationCounter allocated;
+    std::int64_t iterations = 0;
+    bool warmed_up = false;
+    bool running = false;
+    Clock::time_point start;
+    double elapsed = 0.0;
+    std::size_t bytes_at_start = 0;
+    std::size_t bytes = 0;
+
+    double items_per_iteration = 0.0;
+    double flops_per_iteration = 0.0;
+
+    void stop();
+
+public:
+    BenchmarkState(double min_time, AllocationCounter allocated) : min_time(min_time), allocated(std::move(allocated)) {}
+
+    // true while another iteration should run, the first call is an untimed warm-up
+    bool keepRunning();
+
+    void setItemsProcessed(double items) { items_per_iteration = items; } // images (or other items) per iteration
+    void setFlops(double flops) { flops_per_iteration = flops; }          // floating point operations per iteration
+
+    [[nodiscard]] std::int64_t iterationCount() const { return iterations; }
+    [[nodiscard]] double seconds() const { return elapsed; }
+    [[nodiscard]] std::size_t bytesAllocated() const { return bytes; }
+    [[nodiscard]] double itemsPerIteration() const { return items_per_iteration; }
+    [[nodiscard]] double flopsPerIteration() const { return flops_per_iteration; }
+};
+
+struct BenchmarkResult {
+    std::string name;
+    std::int64_t iterations;
+    double time_per_iteration; // seconds
+    double items_per_second;   // 0 when the benchmark processes no items
+    double gflops;             // 0 when the benchmark counts no flops
+    double bytes_per_iteration;
+};
+
+class BenchmarkRegistry {
+public:
+    typedef std::function<void(BenchmarkState&)> Function;
+
+    static BenchmarkRegistry& instance();
+
+    void add(std::string name, Function function);
+    void setAllocationCounter(BenchmarkState::AllocationCounter counter) { allocated = std::move(counter); }
+    // extra key/value written to the JSON context (e.g. the GEMM micro-kernel in use)
+    void addContext(std::string key, std::string value) { context.emplace_back(std::move(key), std::move(value)); }
+
+    // runs every benchmark whose name contains filter, printing each result as it finishes
+    std::vector<BenchmarkResult> run(const std::string& filter, double min_time) const;
+
+    void writeJson(const std::vector<BenchmarkResult>& results, const std::string& path) const;
+
+    // --filter=<substring> --min_time=<seconds> --json=<path>, returns the process exit code
+    int main(int argc, char** argv) const;
+
+private:
+    std::vector<std::pair<std::string, Function>> benchmarks;
+    BenchmarkState::AllocationCounter allocated;
+    std::vector<std::pair<std::string, std::string>> context;
+};
+
+// process-wide count of bytes requested from operator new, replaced in Benchmark.cpp
+std::size_t heapBytesAllocated();
+
+#endif //INC_12_FINALPROJ_2_BENCHMARK_H
@@ -0,0 +1,134 @@
+//
+// Created by Vijay Goyal on 2025-02-05.
+//
+
+#include "../model/ModularCNN.h"
+#include "../tools/CrossEntropy.h"
+#include "../tools/ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * peak training memory against step time under gradient checkpointing
+ *  - trains the model of python/test.py (3x256x256 images) with no layer recomputed, with each kind of layer
+ *    recomputed, and split into 1 to 7 checkpoint segments (setCheckpointSegments)
+ *  - the memory is the planned activation arena of one step (activations, gradients and backward caches, see
+ *    ComputationGraph), weights and optimizer state are the same in every row
+ *  - "batch" is the batch that fits in the memory of the row without recomputation, activation memory grows
+ *    linearly with it
+ */
+namespace {
+    struct Options {
+        int batch = 32;
+        int image = 256;
+        int steps = 5;
+    };
+
+    std::vector<LayerConfig> testModel(int image) {
+        int features = 16 * (image / 8) * (image / 8);
+        return {LayerConfig::conv(3, 4, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(4, 8, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(8, 16, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::fc(features, 64), LayerConfig::fc(64, 3)};
+    }
+
+    // mean step time in ms and the planned memory of a step, after two warm-up steps
+    std::pair<double, std::size_t> measure(ModularCNN<float>& model, const Options& options) {
+        AMSGrad<float> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+        CrossEntropy<float> criterion(true);
+        auto images = std::make_shared<Tensor<float>>(options.batch, 3, options.image, options.image, 0.0f, false);
+        auto labels = std::make_shared<Tensor<float>>(options.batch, 3, 1, 1, 0.0f, false);
+        std::mt19937 gen(1);
+        std::uniform_real_distribution<float> pixel(0.0f, 1.0f);
+        std::generate(images->data_ptr(), images->data_ptr() + images->size(), [&] { return pixel(gen); });
+        for(int n = 0; n < options.batch; ++n) {
+            labels->data(n, n % 3, 0, 0) = 1.0f;
+        }
+
+        double total = 0.0;
+        for(int step = -2; step < options.steps; ++step) {
+            auto start = std::chrono::steady_clock::now();
+            auto predictions = model.forward(images);
+            criterion.forward(predictions, labels);
+            criterion.backward(predictions, labels);
+            model.backward(predictions);
+            model.update(optimizer);
+            model.zeroGrad();
+            if(step >= 0) {
+                total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+        }
+        return {total / options.steps, model.peakMemoryBytes()};
+    }
+
+    // one letter per layer, k kept and r recomputed
+    std::string pattern(const std::vector<bool>& recomputed) {
+        std::string letters;
+        for(bool r : recomputed) {
+            letters += r ? 'r' : 'k';
+        }
+        return letters;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&](const char* name) { return std::atoi(arg.c_str() + std::strlen(name)); };
+        if(arg.rfind("--batch=", 0) == 0) options.batch = value("--batch=");
+        else if(arg.rfind("--image=", 0) == 0) options.image = value("--image=");
+        else if(arg.rfind("--steps=", 0) == 0) options.steps = value("--steps=");
+        else {
+            std::fprintf(stderr, "usage: %s [--batch=32] [--image=256] [--steps=5]\n", argv[0]);
+            return 1;
+        }
+    }
+    options.batch = std::max(1, options.batch);
+    options.image = std::max(8, options.image / 8 * 8);
+    options.steps = std::max(1, options.steps);
+
+    ModularCNN<float> model(testModel(options.image));
+    const auto& types = model.getLayerTypes();
+    int layers = static_cast<int>(types.size());
+
+    // (label, layers to recompute)
+    std::vector<std::pair<std::string, std::vector<bool>>> rows = {{"none", std::vector<bool>(layers, false)}};
+    for(const char* kind : {"conv", "pool"}) {
+        std::vector<bool> recomputed(layers, false);
+        for(int i = 0; i + 1 < layers; ++i) {
+            recomputed[i] = types[i] == kind;
+        }
+        rows.emplace_back(std::string(kind) + " layers", recomputed);
+    }
+    for(int segments = 1; segments < layers; ++segments) {
+        model.setCheckpointSegments(segments);
+        rows.emplace_back(std::to_string(segments) + " segment" + (segments > 1 ? "s" : ""), model.getRecompute());
+    }
+
+    std::printf("test.py model, batch %d of 3x%dx%d, %d threads\n", options.batch, options.image, options.image, ThreadPool::instance().size());
+    std::printf("%-12s %-9s %11s %8s %10s %8s %7s\n", "recompute", "layers", "memory MB", "memory", "step ms", "time", "batch");
+    double base_ms = 0.0;
+    std::size_t base_bytes = 0;
+    for(const auto& [label, recomputed] : rows) {
+        for(int i = 0; i < layers; ++i) {
+            model.setRecompute(i, recomputed[i]);
+        }
+        auto [ms, bytes] = measure(model, options);
+        if(label == "none") {
+            base_ms = ms;
+            base_bytes = bytes;
+        }
+        std::printf("%-12s %-9s %11.1f %7.0f%% %10.2f %7.0f%% %7d\n", label.c_str(), pattern(recomputed).c_str(),
+                    bytes / 1048576.0, 100.0 * bytes / base_bytes, ms, 100.0 * ms / base_ms,
+                    static_cast<int>(static_cast<double>(options.batch) * base_bytes / bytes));
+    }
+    return 0;
+}
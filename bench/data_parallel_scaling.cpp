@@ -0,0 +1,177 @@
+//
+// Created by Vijay Goyal on 2025-01-27.
+//
+
+#include "../model/DataParallel.h"
+#include "../tools/CrossEntropy.h"
+#include "../tools/ThreadPool.h"
+#include "../tools/UnixSocketTransport.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * scaling curve of data-parallel training on one machine
+ *  - for 1 to --max_processes replicas, forks that many processes which train the model of python/test.py
+ *    (3x256x256 images) over a UnixSocketTransport, each process gets an equal share of the cores as ThreadPool threads
+ *  - strong scaling (default) splits a global batch of --batch images across the replicas, --weak gives every
+ *    replica --batch images
+ *  - reports the step time of rank 0, throughput, speedup and efficiency against 1 process, the time spent in
+ *    allreduce and the part of it backward could not hide
+ *  - run it on an otherwise idle machine, replicas beyond the core count only measure oversubscription
+ */
+namespace {
+    struct Options {
+        int max_processes = 8;
+        int batch = 64;
+        int steps = 10;
+        bool weak = false;
+    };
+
+    struct Result {
+        double step_ms;
+        double communication_ms;
+        double wait_ms;
+        int in_sync;
+        int ok;
+    };
+
+    std::vector<LayerConfig> testModel() {
+        return {LayerConfig::conv(3, 4, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(4, 8, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(8, 16, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::fc(16384, 64), LayerConfig::fc(64, 3)};
+    }
+
+    Result replica(const std::string& path, int rank, int processes, int batch, int steps) {
+        ThreadPool::instance().configure(std::max(1, omp_get_num_procs() / processes), ThreadAffinity::Unpinned);
+        auto transport = std::make_shared<UnixSocketTransport>(path, rank, processes);
+        ModularCNN<float> model(testModel());
+        DataParallel<float> parallel(model, transport);
+        AMSGrad<float> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+        CrossEntropy<float> criterion(true);
+
+        auto images = std::make_shared<Tensor<float>>(batch, 3, 256, 256, 0.0f, false);
+        auto labels = std::make_shared<Tensor<float>>(batch, 3, 1, 1, 0.0f, false);
+        std::mt19937 gen(rank + 1);
+        std::uniform_real_distribution<float> pixel(0.0f, 1.0f);
+        std::generate(images->data_ptr(), images->data_ptr() + images->size(), [&] { return pixel(gen); });
+        for(int n = 0; n < batch; ++n) {
+            labels->data(n, static_cast<int>(gen() % 3), 0, 0) = 1.0f;
+        }
+
+        Result result{0.0, 0.0, 0.0, 0, 1};
+        for(int step = -2; step < steps; ++step) {
+            auto start = std::chrono::steady_clock::now();
+            auto predictions = model.forward(images);
+            criterion.forward(predictions, labels);
+            criterion.backward(predictions, labels);
+            parallel.backward(predictions);
+            model.update(optimizer);
+            model.zeroGrad();
+            if(step >= 0) {
+                result.step_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                result.communication_ms += parallel.lastCommunicationMs();
+                result.wait_ms += parallel.lastWaitMs();
+            }
+        }
+        result.step_ms /= steps;
+        result.communication_ms /= steps;
+        result.wait_ms /= steps;
+        result.in_sync = parallel.inSync();
+        return result;
+    }
+
+    // forks the replicas, rank 0 reports through a pipe
+    Result run(int processes, int batch, int steps) {
+        std::string path = "/tmp/modularcnn_scaling_" + std::to_string(getpid());
+        int report[2];
+        if(pipe(report) != 0) {
+            std::perror("pipe");
+            std::exit(1);
+        }
+        std::vector<pid_t> children;
+        for(int rank = 0; rank < processes; ++rank) {
+            pid_t pid = fork();
+            if(pid == 0) {
+                ::close(report[0]);
+                Result result{0.0, 0.0, 0.0, 0, 0};
+                try {
+                    result = replica(path, rank, processes, batch, steps);
+                }
+                catch(const std::exception& e) {
+                    std::fprintf(stderr, "rank %d: %s\n", rank, e.what());
+                }
+                if(rank == 0 && write(report[1], &result, sizeof(result)) != sizeof(result)) {
+                    _exit(1);
+                }
+                _exit(result.ok ? 0 : 1);
+            }
+            children.push_back(pid);
+        }
+        ::close(report[1]);
+        Result result{0.0, 0.0, 0.0, 0, 0};
+        if(read(report[0], &result, sizeof(result)) != sizeof(result)) {
+            result.ok = 0;
+        }
+        ::close(report[0]);
+        for(pid_t pid : children) {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            result.ok &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        return result;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&](const char* name) { return std::atoi(arg.c_str() + std::strlen(name)); };
+        if(arg.rfind("--max_processes=", 0) == 0) options.max_processes = value("--max_processes=");
+        else if(arg.rfind("--batch=", 0) == 0) options.batch = value("--batch=");
+        else if(arg.rfind("--steps=", 0) == 0) options.steps = value("--steps=");
+        else if(arg == "--weak") options.weak = true;
+        else {
+            std::fprintf(stderr, "usage: %s [--max_processes=8] [--batch=64] [--steps=10] [--weak]\n", argv[0]);
+            return 1;
+        }
+    }
+    options.max_processes = std::max(1, options.max_processes);
+    options.steps = std::max(1, options.steps);
+
+    std::printf("%s scaling, %s batch of %d, %d cores\n", options.weak ? "weak" : "strong",
+                options.weak ? "per-replica" : "global", options.batch, omp_get_num_procs());
+    std::printf("%9s %8s %10s %10s %9s %11s %10s %10s %8s\n", "processes", "threads", "step ms", "images/s",
+                "speedup", "efficiency", "allreduce", "exposed", "in sync");
+    double base_rate = 0.0;
+    for(int processes = 1; processes <= options.max_processes; ++processes) {
+        int batch = options.weak ? options.batch : options.batch / processes;
+        if(batch == 0) {
+            break;
+        }
+        Result r = run(processes, batch, options.steps);
+        if(!r.ok) {
+            std::printf("%9d failed\n", processes);
+            return 1;
+        }
+        double rate = batch * processes / (r.step_ms / 1000.0);
+        if(processes == 1) {
+            base_rate = rate;
+        }
+        double speedup = rate / base_rate;
+        std::printf("%9d %8d %10.2f %10.1f %9.2f %10.0f%% %8.2fms %8.2fms %8s\n", processes,
+                    std::max(1, omp_get_num_procs() / processes), r.step_ms, rate, speedup, 100.0 * speedup / processes,
+                    r.communication_ms, r.wait_ms, r.in_sync ? "yes" : "NO");
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+//
+// Created by Vijay Goyal on 2025-01-29.
+//
+
+#include "../model/InferenceServer.h"
+#include "../tools/ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * closed-loop load generator for InferenceServer
+ *  - a small 3x32x32, 10 class model, each of --clients threads sends one image, waits for its result and sends the
+ *    next, for --seconds per client count
+ *  - every client count runs three times: one image per predict (max_batch 1, the server only serialises the
+ *    requests), micro-batched without a delay (a batch is whatever queued while the previous one ran) and
+ *    micro-batched with --max_batch and --delay_ms
+ *  - reports throughput, p50 / p99 latency and the mean batch size the server formed
+ */
+namespace {
+    struct Options {
+        std::vector<int> clients{1, 4, 16, 64};
+        int max_batch = 32;
+        double delay_ms = 2.0;
+        double seconds = 2.0;
+    };
+
+    std::vector<LayerConfig> testModel() {
+        return {LayerConfig::conv(3, 16, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(16, 32, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::fc(2048, 128), LayerConfig::fc(128, 10)};
+    }
+
+    InferenceStats load(ModularCNN<float>& model, const std::vector<float>& images, int clients, int max_batch,
+                        double delay_ms, double seconds) {
+        constexpr std::size_t IMAGE = 3 * 32 * 32;
+        std::size_t count = images.size() / IMAGE;
+        InferenceServer<float> server(model, 3, 32, 32, max_batch, delay_ms, 5);
+
+        // warm up the activation buffers of every batch size before measuring
+        for(int n = 1; n <= max_batch; ++n) {
+            auto input = std::make_shared<Tensor<float>>(n, 3, 32, 32, 0.0f, false);
+            model.predict(input);
+        }
+
+        std::atomic<bool> running{true};
+        std::vector<std::thread> threads;
+        for(int t = 0; t < clients; ++t) {
+            threads.emplace_back([&, t] {
+                for(std::size_t i = t; running.load(std::memory_order_relaxed); i += clients) {
+                    server.infer(images.data() + (i % count) * IMAGE);
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds * 0.2));
+        server.resetStats();
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        InferenceStats stats = server.stats();
+        running.store(false, std::memory_order_relaxed);
+        for(auto& thread : threads) {
+            thread.join();
+        }
+        return stats;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg.rfind("--clients=", 0) == 0) {
+            options.clients.clear();
+            std::stringstream list(arg.substr(std::strlen("--clients=")));
+            for(std::string item; std::getline(list, item, ',');) {
+                options.clients.push_back(std::max(1, std::atoi(item.c_str())));
+            }
+        }
+        else if(arg.rfind("--max_batch=", 0) == 0) options.max_batch = std::max(1, std::atoi(arg.c_str() + std::strlen("--max_batch=")));
+        else if(arg.rfind("--delay_ms=", 0) == 0) options.delay_ms = std::max(0.0, std::atof(arg.c_str() + std::strlen("--delay_ms=")));
+        else if(arg.rfind("--seconds=", 0) == 0) options.seconds = std::max(0.1, std::atof(arg.c_str() + std::strlen("--seconds=")));
+        else {
+            std::fprintf(stderr, "usage: %s [--clients=1,4,16,64] [--max_batch=32] [--delay_ms=2] [--seconds=2]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    ModularCNN<float> model(testModel());
+    std::vector<float> images(256 * 3 * 32 * 32);
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> pixel(0.0f, 1.0f);
+    std::generate(images.begin(), images.end(), [&] { return pixel(gen); });
+
+    std::printf("3x32x32 images, 10 classes, %d threads, %.1f s per run\n", ThreadPool::instance().size(), options.seconds);
+    std::printf("%8s %10s %10s %12s %10s %10s %10s\n", "clients", "max_batch", "delay ms", "requests/s", "p50 ms",
+                "p99 ms", "mean batch");
+    for(int clients : options.clients) {
+        std::pair<int, double> runs[] = {{1, 0.0}, {options.max_batch, 0.0}, {options.max_batch, options.delay_ms}};
+        for(auto [max_batch, delay_ms] : runs) {
+            InferenceStats s = load(model, images, clients, max_batch, delay_ms, options.seconds);
+            std::printf("%8d %10d %10.2f %12.1f %10.3f %10.3f %10.2f\n", clients, max_batch, delay_ms, s.throughput,
+                        s.p50_ms, s.p99_ms, s.mean_batch);
+        }
+    }
+    return 0;
+}
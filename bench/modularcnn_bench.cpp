@@ -0,0 +1,649 @@
+//
+// Created by Vijay Goyal on 2025-01-20.
+//
+
+#include "Benchmark.h"
+#include "../model/ModularCNN.h"
+#include "../model/MixedPrecisionCNN.h"
+#include "../model/QuantizedCNN.h"
+#include "../tools/CrossEntropy.h"
+#include "../tools/SoftmaxCrossEntropy.h"
+#include "../tools/Gemm.h"
+#include "../tools/ThreadPool.h"
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * benchmarks of every op at the shapes of the python/test.py model, and of its full training step
+ *  - the model takes 3x256x256 images: conv 3->4, pool, conv 4->8, pool, conv 8->16, pool, fc 16384->64, fc 64->3
+ *  - every conv is 3x3 stride 1 padding 1 and every pool is 2x2 stride 2
+ *  - flop counts are multiply-adds times two, and only count the GEMM-shaped work of each op
+ */
+namespace {
+    typedef float Type;
+
+    constexpr int BATCH = 32;
+    constexpr int IMAGE = 256;
+
+    struct ConvShape {
+        int in_channels;
+        int out_channels;
+        int size; // input height and width
+    };
+
+    constexpr ConvShape CONV_SHAPES[] = {{3, 4, 256}, {4, 8, 128}, {8, 16, 64}};
+
+    std::shared_ptr<Tensor<Type>> randomTensor(int n, int c, int h, int w, unsigned seed = 1) {
+        auto tensor = std::make_shared<Tensor<Type>>(n, c, h, w);
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<Type> dist(-1.0f, 1.0f);
+        for(std::size_t i = 0; i < tensor->size(); ++i) {
+            tensor->data_ptr()[i] = dist(gen);
+            tensor->grad_ptr()[i] = dist(gen);
+        }
+        return tensor;
+    }
+
+    std::shared_ptr<Tensor<Type>> oneHot(int n, int classes) {
+        auto labels = std::make_shared<Tensor<Type>>(n, classes, 1, 1);
+        for(int i = 0; i < n; ++i) {
+            labels->data(i, i % classes, 0, 0) = 1.0f;
+        }
+        return labels;
+    }
+
+    std::vector<std::int64_t> classLabels(int n, int classes) {
+        std::vector<std::int64_t> labels(n);
+        for(int i = 0; i < n; ++i) {
+            labels[i] = i % classes;
+        }
+        return labels;
+    }
+
+    std::string convName(const char* pass, const ConvShape& s) {
+        return std::string("conv/") + pass + "/" + std::to_string(s.in_channels) + "x" + std::to_string(s.size) + "x"
+               + std::to_string(s.size) + "->" + std::to_string(s.out_channels) + "/b" + std::to_string(BATCH);
+    }
+
+    std::vector<LayerConfig> testModel() {
+        return {LayerConfig::conv(3, 4, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(4, 8, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(8, 16, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::fc(16384, 64), LayerConfig::fc(64, 3)};
+    }
+
+    // graph models on 3x64x64 images: an Inception block of four branches and two residual blocks, the second with
+    // a 1x1 projection shortcut
+    constexpr int GRAPH_IMAGE = 64;
+
+    std::vector<LayerConfig> inceptionModel() {
+        auto branch1 = LayerConfig::conv(16, 8, 1, 1);
+        auto branch3 = LayerConfig::conv(16, 8, 3, 3, 1, 1);
+        auto branch5 = LayerConfig::conv(16, 8, 5, 5, 1, 2);
+        auto branch_pool = LayerConfig::pool(3, 3, 1, 1);
+        branch3.inputs = branch5.inputs = branch_pool.inputs = {1};
+        return {LayerConfig::conv(3, 16, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                branch1, branch3, branch5, branch_pool, LayerConfig::concat({2, 3, 4, 5}),
+                LayerConfig::pool(2, 2, 2, 0), LayerConfig::fc(40 * 16 * 16, 10)};
+    }
+
+    std::vector<LayerConfig> residualModel() {
+        auto shortcut = LayerConfig::conv(16, 16, 1, 1);
+        auto block2 = LayerConfig::conv(16, 16, 3, 3, 1, 1);
+        shortcut.inputs = block2.inputs = {4};
+        return {LayerConfig::conv(3, 16, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0),
+                LayerConfig::conv(16, 16, 3, 3, 1, 1), LayerConfig::conv(16, 16, 3, 3, 1, 1), LayerConfig::add({3, 1}),
+                block2, LayerConfig::conv(16, 16, 3, 3, 1, 1), shortcut, LayerConfig::add({6, 7}),
+                LayerConfig::pool(2, 2, 2, 0), LayerConfig::fc(16 * 16 * 16, 10)};
+    }
+
+    double modelFlops(int batch) {
+        double flops = 0.0;
+        for(const auto& s : CONV_SHAPES) {
+            flops += 2.0 * batch * s.out_channels * s.size * s.size * s.in_channels * 9;
+        }
+        return flops + 2.0 * batch * (16384.0 * 64 + 64 * 3);
+    }
+
+    void registerGemm(BenchmarkRegistry& registry) {
+        // the per-image GEMMs of the three convolutions (filters x im2col columns) and the fc layer at batch 32
+        struct Shape { int M, N, K; };
+        for(Shape s : {Shape{4, 256 * 256, 27}, Shape{8, 128 * 128, 36}, Shape{16, 64 * 64, 72},
+                       Shape{BATCH, 64, 16384}, Shape{256, 256, 256}, Shape{1024, 1024, 1024}}) {
+            registry.add("gemm/" + std::to_string(s.M) + "x" + std::to_string(s.N) + "x" + std::to_string(s.K),
+                         [s](BenchmarkState& state) {
+                auto A = randomTensor(1, 1, s.M, s.K, 1);
+                auto B = randomTensor(1, 1, s.K, s.N, 2);
+                auto C = randomTensor(1, 1, s.M, s.N, 3);
+                state.setFlops(2.0 * s.M * s.N * s.K);
+                while(state.keepRunning()) {
+                    Gemm<Type>::multiply(false, false, s.M, s.N, s.K, A->data_ptr(), s.K, B->data_ptr(), s.N, C->data_ptr(), s.N);
+                }
+            });
+        }
+
+        // the same convolution and fc shapes on the int8 GEMM of QuantizedCNN (the fc as W * X^T), operands padded and packed
+        for(Shape s : {Shape{4, 256 * 256, 27}, Shape{8, 128 * 128, 36}, Shape{16, 64 * 64, 72}, Shape{64, BATCH, 16384}}) {
+            registry.add("gemm_int8/" + std::to_string(s.M) + "x" + std::to_string(s.N) + "x" + std::to_string(s.K),
+                         [s](BenchmarkState& state) {
+                int rows = QuantizedGemm::padRows(s.M);
+                int columns = QuantizedGemm::padColumns(s.N);
+                int depth = QuantizedGemm::padDepth(s.K);
+                std::vector<std::int8_t> A(static_cast<std::size_t>(rows) * depth);
+                std::vector<std::uint8_t> B(static_cast<std::size_t>(depth) * columns);
+                std::vector<std::int32_t> C(static_cast<std::size_t>(rows) * columns);
+                std::mt19937 gen(1);
+                for(auto& a : A) {
+                    a = static_cast<std::int8_t>(static_cast<int>(gen() % 255) - QuantizedGemm::WEIGHT_MAX);
+                }
+                for(auto& b : B) {
+                    b = static_cast<std::uint8_t>(gen() % (QuantizedGemm::ACTIVATION_MAX + 1));
+                }
+                state.setFlops(2.0 * s.M * s.N * s.K);
+                while(state.keepRunning()) {
+                    QuantizedGemm::multiply(rows, columns, depth, A.data(), depth, B.data(), columns * 4, C.data(), columns);
+                }
+            });
+        }
+    }
+
+    void registerConvolution(BenchmarkRegistry& registry) {
+        for(const ConvShape& s : CONV_SHAPES) {
+            double flops = 2.0 * BATCH * s.out_channels * s.size * s.size * s.in_channels * 9;
+            registry.add(convName("forward", s), [s, flops](BenchmarkState& state) {
+                ConvolutionLayer<Type> layer(s.in_channels, s.out_channels, 3, 3, 1, 1);
+                auto input = randomTensor(BATCH, s.in_channels, s.size, s.size);
+                auto output = std::make_shared<Tensor<Type>>(BATCH, s.out_channels, s.size, s.size);
+                auto pre = std::make_shared<Tensor<Type>>(BATCH, s.out_channels, s.size, s.size, 0.0f, false);
+                state.setItemsProcessed(BATCH);
+                state.setFlops(flops);
+                while(state.keepRunning()) {
+                    layer.forward(input, output, pre);
+                }
+            });
+            registry.add(convName("backward", s), [s, flops](BenchmarkState& state) {
+                ConvolutionLayer<Type> layer(s.in_channels, s.out_channels, 3, 3, 1, 1);
+                auto input = randomTensor(BATCH, s.in_channels, s.size, s.size);
+                auto output = layer.forward(input);
+                auto dOut = randomTensor(BATCH, s.out_channels, s.size, s.size, 4);
+                std::copy(dOut->grad_ptr(), dOut->grad_ptr() + dOut->size(), output->grad_ptr());
+                state.setItemsProcessed(BATCH);
+                state.setFlops(2.0 * flops); // filter and input gradients
+                while(state.keepRunning()) {
+                    layer.backward(output);
+                }
+            });
+        }
+    }
+
+    // every specialised kernel against the generic im2col + GEMM path on the same layer, forward and backward
+    void registerConvolutionKernels(BenchmarkRegistry& registry) {
+        constexpr int batch = 8;
+        for(int filter : {1, 3, 5}) {
+            for(int stride : {1, 2}) {
+                for(int channels : {16, 64}) {
+                    int size = 64;
+                    int padding = filter / 2;
+                    int out = (size + 2 * padding - filter) / stride + 1;
+                    double flops = 2.0 * batch * channels * out * out * channels * filter * filter;
+                    std::string shape = std::to_string(filter) + "x" + std::to_string(filter) + "s" + std::to_string(stride) + "/"
+                                        + std::to_string(channels) + "x" + std::to_string(size) + "x" + std::to_string(size)
+                                        + "->" + std::to_string(channels) + "/b" + std::to_string(batch);
+                    for(bool specialised : {true, false}) {
+                        std::string kind = specialised ? "/specialised" : "/generic";
+                        registry.add("conv_kernel/forward/" + shape + kind, [=](BenchmarkState& state) {
+                            ConvolutionLayer<Type> layer(channels, channels, filter, filter, stride, padding);
+                            layer.setSpecialisedKernels(specialised);
+                            auto input = randomTensor(batch, channels, size, size);
+                            auto output = std::make_shared<Tensor<Type>>(batch, channels, out, out);
+                            auto pre = std::make_shared<Tensor<Type>>(batch, channels, out, out, 0.0f, false);
+                            state.setItemsProcessed(batch);
+                            state.setFlops(flops);
+                            while(state.keepRunning()) {
+                                layer.forward(input, output, pre);
+                            }
+                        });
+                        registry.add("conv_kernel/backward/" + shape + kind, [=](BenchmarkState& state) {
+                            ConvolutionLayer<Type> layer(channels, channels, filter, filter, stride, padding);
+                            layer.setSpecialisedKernels(specialised);
+                            auto input = randomTensor(batch, channels, size, size);
+                            auto output = layer.forward(input);
+                            auto dOut = randomTensor(batch, channels, out, out, 4);
+                            std::copy(dOut->grad_ptr(), dOut->grad_ptr() + dOut->size(), output->grad_ptr());
+                            state.setItemsProcessed(batch);
+                            state.setFlops(2.0 * flops);
+                            while(state.keepRunning()) {
+                                layer.backward(output);
+                            }
+                        });
+                    }
+                }
+            }
+        }
+    }
+
+    // Winograd F(2x2, 3x3) and F(4x4, 3x3) against the direct kernels on the model's convolutions and wider 3x3 layers
+    void registerWinograd(BenchmarkRegistry& registry) {
+        struct Shape { int batch; ConvShape conv; };
+        std::vector<Shape> shapes;
+        for(const ConvShape& s : CONV_SHAPES) {
+            shapes.push_back({BATCH, s});
+        }
+        shapes.push_back({8, {64, 64, 64}});
+        shapes.push_back({8, {128, 128, 32}});
+        for(const auto& [batch, s] : shapes) {
+            double flops = 2.0 * batch * s.out_channels * s.size * s.size * s.in_channels * 9;
+            std::string shape = std::to_string(s.in_channels) + "x" + std::to_string(s.size) + "x" + std::to_string(s.size) + "->"
+                                + std::to_string(s.out_channels) + "/b" + std::to_string(batch);
+            for(int tile : {0, 2, 4}) {
+                std::string kind = tile ? "/f" + std::to_string(tile) + "x" + std::to_string(tile) : "/direct";
+                registry.add("conv_winograd/forward/" + shape + kind, [=](BenchmarkState& state) {
+                    ConvolutionLayer<Type> layer(s.in_channels, s.out_channels, 3, 3, 1, 1);
+                    layer.setWinogradTile(tile);
+                    auto input = randomTensor(batch, s.in_channels, s.size, s.size);
+                    auto output = std::make_shared<Tensor<Type>>(batch, s.out_channels, s.size, s.size);
+                    auto pre = std::make_shared<Tensor<Type>>(batch, s.out_channels, s.size, s.size, 0.0f, false);
+                    state.setItemsProcessed(batch);
+                    state.setFlops(flops); // direct flops, so the rates compare
+                    while(state.keepRunning()) {
+                        layer.forward(input, output, pre);
+                    }
+                });
+            }
+        }
+    }
+
+    void registerPooling(BenchmarkRegistry& registry) {
+        for(const ConvShape& s : CONV_SHAPES) {
+            std::string shape = std::to_string(s.out_channels) + "x" + std::to_string(s.size) + "x" + std::to_string(s.size)
+                                + "/b" + std::to_string(BATCH);
+            registry.add("pool/forward/" + shape, [s](BenchmarkState& state) {
+                MaxPoolingOperation<Type> pool(2, 2, 2, 0);
+                auto input = randomTensor(BATCH, s.out_channels, s.size, s.size);
+                pool.setPlanned({std::make_shared<Tensor<Type>>(BATCH, s.out_channels, s.size / 2, s.size / 2)});
+                state.setItemsProcessed(BATCH);
+                while(state.keepRunning()) {
+                    pool.forward(input);
+                }
+            });
+            registry.add("pool/backward/" + shape, [s](BenchmarkState& state) {
+                MaxPoolingOperation<Type> pool(2, 2, 2, 0);
+                auto input = randomTensor(BATCH, s.out_channels, s.size, s.size);
+                auto output = pool.forward(input);
+                state.setItemsProcessed(BATCH);
+                while(state.keepRunning()) {
+                    pool.backward(output);
+                }
+            });
+            registry.add("pool/infer/" + shape, [s](BenchmarkState& state) {
+                MaxPoolingOperation<Type> pool(2, 2, 2, 0);
+                auto input = randomTensor(BATCH, s.out_channels, s.size, s.size);
+                std::shared_ptr<Tensor<Type>> output;
+                state.setItemsProcessed(BATCH);
+                while(state.keepRunning()) {
+                    pool.infer(input, output);
+                }
+            });
+        }
+    }
+
+    void registerFullyConnected(BenchmarkRegistry& registry) {
+        for(int batch : {1, 32, 256}) {
+            double flops = 2.0 * batch * 16384 * 64;
+            std::string shape = "16384->64/b" + std::to_string(batch);
+            registry.add("fc/forward/" + shape, [batch, flops](BenchmarkState& state) {
+                FullyConnectedLayer<Type> layer(16384, 64);
+                FullyConnectedOperation<Type> op(layer);
+                auto input = randomTensor(batch, 16, 32, 32);
+                state.setItemsProcessed(batch);
+                state.setFlops(flops);
+                while(state.keepRunning()) {
+                    op.forward(input);
+                }
+            });
+            registry.add("fc/backward/" + shape, [batch, flops](BenchmarkState& state) {
+                FullyConnectedLayer<Type> layer(16384, 64);
+                FullyConnectedOperation<Type> op(layer);
+                auto input = randomTensor(batch, 16, 32, 32);
+                auto output = op.forward(input);
+                auto dOut = randomTensor(batch, 64, 1, 1, 4);
+                std::copy(dOut->grad_ptr(), dOut->grad_ptr() + dOut->size(), output->grad_ptr());
+                state.setItemsProcessed(batch);
+                state.setFlops(2.0 * flops);
+                while(state.keepRunning()) {
+                    op.backward(output);
+                }
+            });
+        }
+    }
+
+    void registerLossAndOptimizer(BenchmarkRegistry& registry) {
+        registry.add("cross_entropy/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            CrossEntropy<Type> criterion(true);
+            auto pred = randomTensor(BATCH, 3, 1, 1);
+            for(std::size_t i = 0; i < pred->size(); ++i) {
+                pred->data_ptr()[i] = 0.25f + 0.25f * pred->data_ptr()[i] * pred->data_ptr()[i];
+            }
+            auto labels = oneHot(BATCH, 3);
+            state.setItemsProcessed(BATCH);
+            while(state.keepRunning()) {
+                criterion.forward(pred, labels);
+                criterion.backward(pred, labels);
+            }
+        });
+
+        // fused softmax + loss + gradient from logits, at the test model's output and at a wide classifier's
+        for(auto [batch, classes] : {std::pair{BATCH, 3}, std::pair{256, 1000}}) {
+            registry.add("softmax_cross_entropy/b" + std::to_string(batch) + "x" + std::to_string(classes),
+                         [batch, classes](BenchmarkState& state) {
+                SoftmaxCrossEntropy<Type> criterion;
+                auto logits = randomTensor(batch, classes, 1, 1);
+                auto labels = classLabels(batch, classes);
+                state.setItemsProcessed(batch);
+                while(state.keepRunning()) {
+                    criterion.forward(logits, labels.data(), labels.size());
+                }
+            });
+        }
+
+        registry.add("amsgrad/test_model", [](BenchmarkState& state) {
+            ModularCNN<Type> model(testModel());
+            AMSGrad<Type> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+            model.update(optimizer); // sizes the optimizer state before timing
+            while(state.keepRunning()) {
+                model.update(optimizer);
+            }
+        });
+    }
+
+    void registerModel(BenchmarkRegistry& registry) {
+        registry.add("model/train_step/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            ModularCNN<Type> model(testModel());
+            AMSGrad<Type> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+            CrossEntropy<Type> criterion(true);
+            auto images = randomTensor(BATCH, 3, IMAGE, IMAGE);
+            auto labels = oneHot(BATCH, 3);
+            state.setItemsProcessed(BATCH);
+            state.setFlops(3.0 * modelFlops(BATCH)); // forward, plus weight and input gradients
+            while(state.keepRunning()) {
+                auto predictions = model.forward(images);
+                criterion.forward(predictions, labels);
+                criterion.backward(predictions, labels);
+                model.backward(predictions);
+                model.update(optimizer);
+                model.zeroGrad();
+            }
+        });
+
+        registry.add("model/train_step_fused_loss/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            ModularCNN<Type> model(testModel());
+            AMSGrad<Type> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+            SoftmaxCrossEntropy<Type> criterion;
+            auto images = randomTensor(BATCH, 3, IMAGE, IMAGE);
+            auto labels = classLabels(BATCH, 3);
+            state.setItemsProcessed(BATCH);
+            state.setFlops(3.0 * modelFlops(BATCH));
+            while(state.keepRunning()) {
+                auto logits = model.logits(images);
+                criterion.forward(logits, labels.data(), labels.size());
+                model.backward(logits);
+                model.update(optimizer);
+                model.zeroGrad();
+            }
+        });
+
+        // the same step with the optimizer updating each layer while the layers before it run backward
+        registry.add("model/train_step_overlapped/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            ModularCNN<Type> model(testModel());
+            AMSGrad<Type> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+            SoftmaxCrossEntropy<Type> criterion;
+            auto images = randomTensor(BATCH, 3, IMAGE, IMAGE);
+            auto labels = classLabels(BATCH, 3);
+            state.setItemsProcessed(BATCH);
+            state.setFlops(3.0 * modelFlops(BATCH));
+            while(state.keepRunning()) {
+                auto logits = model.logits(images);
+                criterion.forward(logits, labels.data(), labels.size());
+                model.backwardAndStep(logits, optimizer);
+            }
+        });
+
+        registry.add("model/predict/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            ModularCNN<Type> model(testModel());
+            auto images = randomTensor(BATCH, 3, IMAGE, IMAGE);
+            state.setItemsProcessed(BATCH);
+            state.setFlops(modelFlops(BATCH));
+            while(state.keepRunning()) {
+                model.predict(images);
+            }
+        });
+
+        // the same step with bfloat16 activations and weights, float master weights and optimizer state
+        registry.add("model_bf16/train_step/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            MixedPrecisionCNN<BFloat16> model(testModel());
+            AMSGrad<Type> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+            CrossEntropy<Type> criterion(true);
+            auto images = randomTensor(BATCH, 3, IMAGE, IMAGE);
+            auto labels = oneHot(BATCH, 3);
+            state.setItemsProcessed(BATCH);
+            state.setFlops(3.0 * modelFlops(BATCH));
+            while(state.keepRunning()) {
+                auto predictions = model.forward(images);
+                criterion.forward(predictions, labels);
+                criterion.backward(predictions, labels);
+                model.backward(predictions);
+                model.update(optimizer);
+                model.zeroGrad();
+            }
+        });
+
+        registry.add("model_bf16/predict/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            MixedPrecisionCNN<BFloat16> model(testModel());
+            auto images = randomTensor(BATCH, 3, IMAGE, IMAGE);
+            state.setItemsProcessed(BATCH);
+            state.setFlops(modelFlops(BATCH));
+            while(state.keepRunning()) {
+                model.predict(images);
+            }
+        });
+
+        // the same model quantised to int8, calibrated on the batch it runs
+        registry.add("model_int8/predict/b" + std::to_string(BATCH), [](BenchmarkState& state) {
+            ModularCNN<Type> model(testModel());
+            auto images = randomTensor(BATCH, 3, IMAGE, IMAGE);
+            QuantizedCNN quantized(model, {images});
+            state.setItemsProcessed(BATCH);
+            state.setFlops(modelFlops(BATCH));
+            while(state.keepRunning()) {
+                quantized.predict(images);
+            }
+        });
+    }
+
+    // the graph models with their branches run one at a time (serial) and concurrently (parallel)
+    void registerGraphModels(BenchmarkRegistry& registry) {
+        struct GraphModel {
+            const char* name;
+            std::vector<LayerConfig> (*layers)();
+        };
+        for(GraphModel graph : {GraphModel{"inception", inceptionModel}, GraphModel{"residual", residualModel}}) {
+            for(int workers : {1, 0}) {
+                std::string suffix = std::string(workers == 1 ? "/serial" : "/parallel") + "/b" + std::to_string(BATCH);
+                registry.add(std::string("graph/") + graph.name + "/train_step" + suffix, [graph, workers](BenchmarkState& state) {
+                    ModularCNN<Type> model(graph.layers());
+                    model.setParallelism(workers);
+                    AMSGrad<Type> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+                    SoftmaxCrossEntropy<Type> criterion;
+                    auto images = randomTensor(BATCH, 3, GRAPH_IMAGE, GRAPH_IMAGE);
+                    auto labels = classLabels(BATCH, 10);
+                    state.setItemsProcessed(BATCH);
+                    while(state.keepRunning()) {
+                        auto logits = model.logits(images);
+                        criterion.forward(logits, labels.data(), labels.size());
+                        model.backward(logits);
+                        model.update(optimizer);
+                        model.zeroGrad();
+                    }
+                });
+                registry.add(std::string("graph/") + graph.name + "/predict" + suffix, [graph, workers](BenchmarkState& state) {
+                    ModularCNN<Type> model(graph.layers());
+                    model.setParallelism(workers);
+                    auto images = randomTensor(BATCH, 3, GRAPH_IMAGE, GRAPH_IMAGE);
+                    state.setItemsProcessed(BATCH);
+                    while(state.keepRunning()) {
+                        model.predict(images);
+                    }
+                });
+            }
+        }
+    }
+
+    // every op and model in NCHW and the channel-blocked layouts, the layers of the test model and two wider ones
+    void registerLayouts(BenchmarkRegistry& registry) {
+        constexpr ConvShape LAYOUT_SHAPES[] = {{3, 4, 256}, {4, 8, 128}, {8, 16, 64}, {16, 16, 64}, {32, 32, 32}};
+        for(Layout layout : {Layout::NCHW, Layout::NCHW8c, Layout::NCHW16c}) {
+            int block = channelBlock(layout);
+            // an activation of the given plain shape in the layout
+            auto activation = [layout, block](int n, int c, int h, int w, unsigned seed) {
+                auto plain = randomTensor(n, c, h, w, seed);
+                if(layout == Layout::NCHW) {
+                    return plain;
+                }
+                auto shape = ChannelBlocking<Type>::blocked(plain->shape(), block);
+                auto blocked = std::make_shared<Tensor<Type>>(shape[0], shape[1], shape[2], shape[3]);
+                ChannelBlocking<Type>::toBlocked(*plain, *blocked, block, false, false);
+                ChannelBlocking<Type>::toBlocked(*plain, *blocked, block, true, false);
+                return blocked;
+            };
+            for(const ConvShape& s : LAYOUT_SHAPES) {
+                std::string shape = std::to_string(s.in_channels) + "x" + std::to_string(s.size) + "x" + std::to_string(s.size)
+                                    + "->" + std::to_string(s.out_channels) + "/b" + std::to_string(BATCH) + "/" + layoutName(layout);
+                double flops = 2.0 * BATCH * s.out_channels * s.size * s.size * s.in_channels * 9;
+                registry.add("layout/conv/forward/" + shape, [=](BenchmarkState& state) {
+                    ConvolutionLayer<Type> layer(s.in_channels, s.out_channels, 3, 3, 1, 1);
+                    ConvolutionOperation<Type> conv(layer, layout);
+                    auto input = activation(BATCH, s.in_channels, s.size, s.size, 1);
+                    state.setItemsProcessed(BATCH);
+                    state.setFlops(flops);
+                    while(state.keepRunning()) {
+                        conv.forward(input);
+                    }
+                });
+                registry.add("layout/conv/backward/" + shape, [=](BenchmarkState& state) {
+                    ConvolutionLayer<Type> layer(s.in_channels, s.out_channels, 3, 3, 1, 1);
+                    ConvolutionOperation<Type> conv(layer, layout);
+                    auto input = activation(BATCH, s.in_channels, s.size, s.size, 1);
+                    auto output = conv.forward(input);
+                    auto dOut = activation(BATCH, s.out_channels, s.size, s.size, 4);
+                    std::copy(dOut->grad_ptr(), dOut->grad_ptr() + dOut->size(), output->grad_ptr());
+                    state.setItemsProcessed(BATCH);
+                    state.setFlops(2.0 * flops);
+                    while(state.keepRunning()) {
+                        conv.backward(output);
+                    }
+                });
+                registry.add("layout/pool/forward/" + shape, [=](BenchmarkState& state) {
+                    MaxPoolingOperation<Type> pool(2, 2, 2, 0, layout);
+                    auto input = activation(BATCH, s.out_channels, s.size, s.size, 1);
+                    state.setItemsProcessed(BATCH);
+                    while(state.keepRunning()) {
+                        pool.forward(input);
+                    }
+                });
+                registry.add("layout/pool/backward/" + shape, [=](BenchmarkState& state) {
+                    MaxPoolingOperation<Type> pool(2, 2, 2, 0, layout);
+                    auto input = activation(BATCH, s.out_channels, s.size, s.size, 1);
+                    auto output = pool.forward(input);
+                    state.setItemsProcessed(BATCH);
+                    while(state.keepRunning()) {
+                        pool.backward(output);
+                    }
+                });
+            }
+
+            struct LayoutModel {
+                const char* name;
+                std::vector<LayerConfig> (*layers)();
+                int image;
+                int classes;
+            };
+            for(LayoutModel net : {LayoutModel{"test_model", testModel, IMAGE, 3}, LayoutModel{"inception", inceptionModel, GRAPH_IMAGE, 10}}) {
+                std::string suffix = std::string("/b") + std::to_string(BATCH) + "/" + layoutName(layout);
+                registry.add(std::string("layout/") + net.name + "/train_step" + suffix, [=](BenchmarkState& state) {
+                    ModularCNN<Type> model(net.layers());
+                    model.setLayout(layout);
+                    AMSGrad<Type> optimizer(1e-4, 0.965, 0.999, 1e-8, 1e-2);
+                    SoftmaxCrossEntropy<Type> criterion;
+                    auto images = randomTensor(BATCH, 3, net.image, net.image);
+                    auto labels = classLabels(BATCH, net.classes);
+                    state.setItemsProcessed(BATCH);
+                    while(state.keepRunning()) {
+                        auto logits = model.logits(images);
+                        criterion.forward(logits, labels.data(), labels.size());
+                        model.backward(logits);
+                        model.update(optimizer);
+                        model.zeroGrad();
+                    }
+                });
+                registry.add(std::string("layout/") + net.name + "/predict" + suffix, [=](BenchmarkState& state) {
+                    ModularCNN<Type> model(net.layers());
+                    model.setLayout(layout);
+                    auto images = randomTensor(BATCH, 3, net.image, net.image);
+                    state.setItemsProcessed(BATCH);
+                    while(state.keepRunning()) {
+                        model.predict(images);
+                    }
+                });
+            }
+        }
+    }
+
+    // cost of handing a loop to the pool, with no work and with a streaming loop below and above MIN_SLICE per thread
+    void registerThreadPool(BenchmarkRegistry& registry) {
+        registry.add("thread_pool/empty_loop", [](BenchmarkState& state) {
+            std::size_t slots = ThreadPool::width();
+            while(state.keepRunning()) {
+                ThreadPool::parallelSlots(slots, [](std::size_t) {});
+            }
+        });
+
+        for(std::size_t n : {std::size_t(1) << 16, std::size_t(1) << 22}) {
+            registry.add("thread_pool/axpy/" + std::to_string(n), [n](BenchmarkState& state) {
+                std::vector<Type> x(n, 1.0f);
+                std::vector<Type> y(n, 0.0f);
+                state.setItemsProcessed(static_cast<double>(n));
+                state.setFlops(2.0 * n);
+                while(state.keepRunning()) {
+                    ThreadPool::parallelFor(n, ThreadPool::MIN_SLICE, [&](std::size_t first, std::size_t last) {
+                        #pragma omp simd
+                        for(std::size_t i = first; i < last; ++i) {
+                            y[i] += 0.5f * x[i];
+                        }
+                    });
+                }
+            });
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    auto& registry = BenchmarkRegistry::instance();
+    registry.setAllocationCounter([] { return heapBytesAllocated() + Tensor<Type>::allocatedBytes() + Tensor<BFloat16>::allocatedBytes(); });
+    registry.addContext("gemm_kernel", Gemm<Type>::kernelName());
+    registry.addContext("int8_kernel", QuantizedGemm::kernelName());
+
+    registerGemm(registry);
+    registerConvolution(registry);
+    registerConvolutionKernels(registry);
+    registerWinograd(registry);
+    registerPooling(registry);
+    registerFullyConnected(registry);
+    registerLossAndOptimizer(registry);
+    registerModel(registry);
+    registerGraphModels(registry);
+    registerLayouts(registry);
+    registerThreadPool(registry);
+
+    return registry.main(argc, argv);
+}
@@ -0,0 +1,89 @@
+//
+// Created by Vijay Goyal on 2025-01-23.
+//
+
+#include "../layers/ConvolutionLayer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/*
+ * numerical accuracy of the Winograd path against the direct one
+ *  - every 3x3 stride 1 layer is run in double on the direct kernels as the reference, then in float, bfloat16 and
+ *    double on the direct kernels and on Winograd F(2x2, 3x3) and F(4x4, 3x3) with the same weights and input
+ *  - bfloat16 rounds the input, weights and output to 8 significant bits, its error is dominated by that rounding
+ *  - the error is the largest absolute difference to the reference, and that over the largest reference value
+ *  - inputs and weights are the He-initialised filters of the layer and N(0, 1) images
+ */
+namespace {
+    struct Shape {
+        int in_channels;
+        int out_channels;
+        int size;
+        int padding;
+    };
+
+    struct Error {
+        double max_abs;
+        double relative;
+    };
+
+    template <typename Type>
+    std::vector<double> convolve(const Shape& s, int tile, const std::vector<double>& weights, const std::vector<double>& biases,
+                                 const std::vector<double>& image, int batch) {
+        ConvolutionLayer<Type> layer(s.in_channels, s.out_channels, 3, 3, 1, s.padding);
+        std::transform(weights.begin(), weights.end(), layer.filters->data_ptr(), [](double v) { return static_cast<Type>(v); });
+        std::transform(biases.begin(), biases.end(), layer.biases->data_ptr(), [](double v) { return static_cast<Type>(v); });
+        layer.setWinogradTile(tile);
+
+        auto input = std::make_shared<Tensor<Type>>(batch, s.in_channels, s.size, s.size, static_cast<Type>(0.0), false);
+        std::transform(image.begin(), image.end(), input->data_ptr(), [](double v) { return static_cast<Type>(v); });
+        layer.forward(input);
+        const Type* pre = layer.pre_activation->data_ptr();
+        return std::vector<double>(pre, pre + layer.pre_activation->size());
+    }
+
+    Error compare(const std::vector<double>& result, const std::vector<double>& reference) {
+        double max_abs = 0.0;
+        double max_ref = 0.0;
+        for(std::size_t i = 0; i < reference.size(); ++i) {
+            max_abs = std::max(max_abs, std::abs(result[i] - reference[i]));
+            max_ref = std::max(max_ref, std::abs(reference[i]));
+        }
+        return {max_abs, max_ref > 0.0 ? max_abs / max_ref : 0.0};
+    }
+}
+
+int main() {
+    constexpr int batch = 4;
+    const Shape shapes[] = {{3, 4, 256, 1}, {4, 8, 128, 1}, {8, 16, 64, 1}, {64, 64, 64, 1}, {256, 256, 16, 1}, {16, 16, 33, 0}};
+
+    std::printf("%-22s %-8s %-7s %14s %14s\n", "layer", "path", "type", "max abs error", "relative");
+    for(const Shape& s : shapes) {
+        ConvolutionLayer<double> init(s.in_channels, s.out_channels, 3, 3, 1, s.padding);
+        std::vector<double> weights(init.filters->data_ptr(), init.filters->data_ptr() + init.filters->size());
+        std::vector<double> biases(init.biases->data_ptr(), init.biases->data_ptr() + init.biases->size());
+        std::vector<double> image(static_cast<std::size_t>(batch) * s.in_channels * s.size * s.size);
+        std::mt19937 gen(7);
+        std::normal_distribution<double> dist(0.0, 1.0);
+        std::generate(image.begin(), image.end(), [&] { return dist(gen); });
+
+        std::vector<double> reference = convolve<double>(s, 0, weights, biases, image, batch);
+        char layer[64];
+        std::snprintf(layer, sizeof(layer), "%dx%dx%d->%d p%d", s.in_channels, s.size, s.size, s.out_channels, s.padding);
+        for(int tile : {0, 2, 4}) {
+            const char* path = tile == 0 ? "direct" : tile == 2 ? "F(2,3)" : "F(4,3)";
+            Error f = compare(convolve<float>(s, tile, weights, biases, image, batch), reference);
+            std::printf("%-22s %-8s %-7s %14.3e %14.3e\n", layer, path, "float", f.max_abs, f.relative);
+            Error h = compare(convolve<BFloat16>(s, tile, weights, biases, image, batch), reference);
+            std::printf("%-22s %-8s %-7s %14.3e %14.3e\n", layer, path, "bf16", h.max_abs, h.relative);
+            if(tile) {
+                Error d = compare(convolve<double>(s, tile, weights, biases, image, batch), reference);
+                std::printf("%-22s %-8s %-7s %14.3e %14.3e\n", layer, path, "double", d.max_abs, d.relative);
+            }
+        }
+    }
+    return 0;
+}
@@ -6,7 +6,15 @@
 #include <cmath>
 #include <stdexcept>
 #include <memory>
+#include <algorithm>
+#include <cstdint>
 #include "../tools/Tensor.h"
+#include "../tools/Gemm.h"
+#include "../tools/Im2Col.h"
+#include "../tools/ConvolutionKernels.h"
+#include "../tools/Winograd.h"
+#include "../tools/BlockedKernels.h"
+#include "../tools/MaxPoolingOperation.h"
 #include "Layer.h"
 #include <iostream>
 #include <fstream>
@@ -17,6 +25,7 @@ public:
     typedef std::vector<std::vector<std::vector<Type>>> Tensor3D; // (channels, height, width)
     typedef std::vector<std::vector<std::vector<std::vector<Type>>>> Tensor4D; // (batch_size, channels, height, width)
     typedef std::vector<Tensor3D> Filters; // (out_channels, in_channels, filter_height, filter_width)
+    typedef typename Accumulator<Type>::type Acc; // float for bfloat16, gradients are summed in it
 
     int in_channels;
     int out_channels;
@@ -24,22 +33,66 @@ public:
     int filter_width;
     int stride;
     int padding;
-    Filters filters;
-    std::vector<Type> biases;
+    // parameters, grad holds dFilters / dBiases
+    std::shared_ptr<Tensor<Type>> filters; // (out_channels, in_channels, filter_height, filter_width), row-major [out_channels][K] for the GEMM
+    std::shared_ptr<Tensor<Type>> biases;  // (1, out_channels, 1, 1)
 
-    Filters dFilters;
-    std::vector<Type> dBiases;
+    // cached pre-activation outputs and input for backpropagation
+    std::shared_ptr<Tensor<Type>> pre_activation;
+    std::shared_ptr<Tensor<Type>> cached_input;
 
-    // cached pre-activation outputs for backpropagation
-    Tensor4D pre_activation;
+    // scratch kept between calls so a training step does not allocate
+    std::vector<Acc> partial_grads; // per-thread filter and bias gradients of backward
+    std::vector<Type> flipped_filters; // filters of the input gradient when it runs on a specialised kernel
+    std::vector<Acc> winograd_filters;  // transformed filters of the Winograd path, see prepareWinograd
+    std::vector<Type> batch_conv;       // un-pooled convolution of infer on the Winograd path when a pool is fused
+    std::vector<Acc> blocked_filters;   // filters and biases of the channel-blocked path, see prepareBlocked
+    std::vector<Acc> blocked_biases;
+    std::vector<Acc> transposed_filters; // blocked filters of the input gradient
 
     ConvolutionLayer(int in_channels, int out_channels, int filter_height, int filter_width, int stride = 1, int padding = 0);
+    // layer over existing filters and biases (e.g. views into a mapped model file), nothing is initialised
+    ConvolutionLayer(int in_channels, int out_channels, int filter_height, int filter_width, int stride, int padding,
+                     const std::vector<std::shared_ptr<Tensor<Type>>>& params);
 
     void initializeFilters();
 
-    std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& input);
+    // compile-time kernels for this filter shape and stride, falls back to im2col + GEMM when off or not available
+    void setSpecialisedKernels(bool enabled) { specialised = enabled; }
+    [[nodiscard]] const typename ConvolutionKernels<Type>::Kernels* kernels() const {
+        return specialised ? ConvolutionKernels<Type>::select(filter_height, filter_width, stride) : nullptr;
+    }
 
-    Tensor4D backward(const std::shared_ptr<Tensor<Type>>& dOut);
+    // Winograd F(tile x tile, 3x3) for the forward and inference convolution, 0 (the default) turns it off, 2 or 4 turn it on,
+    // layers that are not 3x3 at stride 1 keep using the kernels above
+    void setWinogradTile(int tile);
+    [[nodiscard]] int winogradTile() const {
+        return Winograd<Type>::supports(filter_height, filter_width, stride) ? winograd_tile : 0;
+    }
+
+    [[nodiscard]] int outputHeight(int input_height) const { return (input_height + 2 * padding - filter_height) / stride + 1; }
+    [[nodiscard]] int outputWidth(int input_width) const { return (input_width + 2 * padding - filter_width) / stride + 1; }
+
+    // output and pre_activation are written in place when given (e.g. by the memory planner), otherwise allocated
+    std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& input,
+                                          std::shared_ptr<Tensor<Type>> output = nullptr,
+                                          std::shared_ptr<Tensor<Type>> pre_activation_out = nullptr);
+
+    // accumulates dInput into the cached input's grad and returns that tensor, skipped if the input has no grad
+    std::shared_ptr<Tensor<Type>> backward(const std::shared_ptr<Tensor<Type>>& dOut);
+
+    // inference only, no caches are written, and a following max pool is fused in when pool is given
+    std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out,
+                                        const MaxPoolingOperation<Type>* pool = nullptr);
+
+    // the same three passes on channel-blocked tensors (see ChannelBlocking) of block channels per block, 8 or 16,
+    // a fused pool must run in the same layout
+    std::shared_ptr<Tensor<Type>> forwardBlocked(int block, const std::shared_ptr<Tensor<Type>>& input,
+                                                 std::shared_ptr<Tensor<Type>> output = nullptr,
+                                                 std::shared_ptr<Tensor<Type>> pre_activation_out = nullptr);
+    std::shared_ptr<Tensor<Type>> backwardBlocked(int block, const std::shared_ptr<Tensor<Type>>& dOut);
+    std::shared_ptr<Tensor<Type>> inferBlocked(int block, const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out,
+                                               const MaxPoolingOperation<Type>* pool = nullptr);
 
     void zeroGrad() override;
 
@@ -48,6 +101,31 @@ public:
     void setFilters(const Filters& new_filters);
     void setBiases(const std::vector<Type>& new_biases);
     std::shared_ptr<WeightStruct<Type>> saveWeights() override;
+
+    std::vector<std::shared_ptr<Tensor<Type>>> parameters() override { return {filters, biases}; } // filters, biases
+    void setParameters(const std::vector<std::shared_ptr<Tensor<Type>>>& tensors) override;
+
+private:
+    bool specialised = true;
+    int winograd_tile = 0;
+    std::uint64_t winograd_version = 0; // filters->version() winograd_filters were made from, 0 when they must be rebuilt
+    int prepared_block = 0;             // block of blocked_filters, 0 before the first call
+    std::uint64_t blocked_version = 0;  // parameterVersion() the blocked filters and biases were made from
+
+    // filters and biases track their writes, whoever makes them (a ParameterBuffer, a model file, this layer)
+    void trackParameters();
+    // changes whenever the filters or biases are written, through the layer or any view of them
+    [[nodiscard]] std::uint64_t parameterVersion() const { return std::max(filters->version(), biases->version()); }
+
+    // transforms the filters when they were written since the last call
+    void prepareWinograd();
+    void prepareBlocked(int block); // same for the blocked filters and biases
+
+    // throws unless input is a blocked tensor of in_channels, returns its plain width
+    int blockedWidth(const Tensor<Type>& input, int block) const;
+
+    // pre-activation of one (in_channels, height, width) sample without the bias, out is (out_channels, out_height, out_width)
+    void convolveSample(const Type* input, int input_height, int input_width, Type* out) const;
 };
 
 #include "ConvolutionLayer.tpp"
@@ -7,8 +7,10 @@
 #include <cstdlib>
 #include <ctime>
 #include <stdexcept>
+#include <algorithm>
 #include <random>
-#include <omp.h>
+#include <utility>
+#include "../tools/ThreadPool.h"
 
 
 template <typename Type>
@@ -19,6 +21,14 @@ ConvolutionLayer<Type>::ConvolutionLayer(int in_channels, int out_channels, int
     initializeFilters();
 }
 
+template <typename Type>
+ConvolutionLayer<Type>::ConvolutionLayer(int in_channels, int out_channels, int filter_height, int filter_width, int stride, int padding,
+                                         const std::vector<std::shared_ptr<Tensor<Type>>>& params)
+        : in_channels(in_channels), out_channels(out_channels), filter_height(filter_height), filter_width(filter_width),
+          stride(stride), padding(padding) {
+    setParameters(params);
+}
+
 /*
  * Initialize the filters and biases with random values using He initialization
  */
@@ -31,203 +41,644 @@ void ConvolutionLayer<Type>::initializeFilters() {
     // initialize random generators (mersenne twister engine)
     std::random_device rd;
 
-    // resize filters and biases
-    filters.resize(out_channels, Tensor3D(in_channels, std::vector<std::vector<Type>>(filter_height, std::vector<Type>(filter_width, static_cast<Type>(0.0)))));
-    biases.resize(out_channels, static_cast<Type>(0.0));
-
-    /// thread-safe He initialization
-    #pragma omp parallel
-    {
-        std::mt19937 gen(rd() + omp_get_thread_num());
-        std::normal_distribution<Type> dist(static_cast<Type>(0.0), std_dev);
-
-        #pragma omp for
-        for (int f = 0; f < out_channels; ++f) {
-            for (int c = 0; c < in_channels; ++c) {
-                for (int h = 0; h < filter_height; ++h) {
-                    for (int w = 0; w < filter_width; ++w) {
-                        filters[f][c][h][w] = dist(gen);
-                    }
-                }
+    // filters and biases with zeroed grads, tensors already bound (e.g. to a model-wide buffer) are refilled in place
+    if(!filters) {
+        filters = std::make_shared<Tensor<Type>>(out_channels, in_channels, filter_height, filter_width);
+        biases = std::make_shared<Tensor<Type>>(1, out_channels, 1, 1);
+    }
+    trackParameters();
+    filters->zeroGrad();
+    biases->zeroGrad();
+    int K = in_channels * filter_height * filter_width;
+    Type* weights = filters->data_ptr();
+    Type* bias = biases->data_ptr();
+
+    /// thread-safe He initialization, one generator per slice of the filters
+    unsigned seed = rd();
+    ThreadPool::parallelFor(out_channels, 1, [&](int first, int last) {
+        std::mt19937 gen(seed + first);
+        std::normal_distribution<typename Accumulator<Type>::type> dist(0.0, std_dev);
+
+        for (int f = first; f < last; ++f) {
+            for (int k = 0; k < K; ++k) {
+                weights[static_cast<std::ptrdiff_t>(f) * K + k] = dist(gen);
             }
-            biases[f] = dist(gen) * static_cast<Type>(0.1);
+            bias[f] = dist(gen) * static_cast<Type>(0.1);
         }
+    });
+}
+
+template <typename Type>
+void ConvolutionLayer<Type>::setWinogradTile(int tile) {
+    if(tile != 0 && !Winograd<Type>::supports(tile)) {
+        throw std::invalid_argument("Winograd tile must be 0 (off), 2 or 4.");
     }
+    winograd_tile = tile;
+    winograd_version = 0;
+}
 
-    // initialize gradients to zero
-    dFilters.resize(out_channels, Tensor3D(in_channels, std::vector<std::vector<Type>>(filter_height, std::vector<Type>(filter_width, static_cast<Type>(0.0)))));
-    dBiases.resize(out_channels, static_cast<Type>(0.0));
+template <typename Type>
+void ConvolutionLayer<Type>::prepareWinograd() {
+    int tile = winogradTile();
+    std::uint64_t version = filters->version();
+    if(!tile || winograd_version == version) {
+        return;
+    }
+    winograd_filters.resize(Winograd<Type>::transformedSize(tile, out_channels, in_channels));
+    Winograd<Type>::transformFilters(tile, std::as_const(*filters).data_ptr(), out_channels, in_channels, winograd_filters.data());
+    winograd_version = version;
+}
+
+template <typename Type>
+void ConvolutionLayer<Type>::trackParameters() {
+    if(!filters->tracksWrites()) {
+        filters->trackWrites();
+    }
+    if(!biases->tracksWrites()) {
+        biases->trackWrites();
+    }
+}
+
+template <typename Type>
+void ConvolutionLayer<Type>::prepareBlocked(int block) {
+    std::uint64_t version = parameterVersion();
+    if(prepared_block == block && blocked_version == version) {
+        return;
+    }
+    if(!BlockedKernels<Type>::supports(block)) {
+        throw std::invalid_argument("Blocked convolution needs blocks of 8 or 16 channels.");
+    }
+    blocked_filters.resize(BlockedKernels<Type>::filterSize(out_channels, in_channels, filter_height, filter_width, block));
+    BlockedKernels<Type>::blockFilters(std::as_const(*filters).data_ptr(), out_channels, in_channels, filter_height, filter_width, block,
+                                       false, blocked_filters.data());
+    blocked_biases.assign(static_cast<std::size_t>((out_channels + block - 1) / block) * block, static_cast<Acc>(0.0));
+    const Type* bias = std::as_const(*biases).data_ptr();
+    std::copy(bias, bias + out_channels, blocked_biases.begin());
+    prepared_block = block;
+    blocked_version = version;
+}
+
+template <typename Type>
+int ConvolutionLayer<Type>::blockedWidth(const Tensor<Type>& input, int block) const {
+    if(input.batch() == 0) {
+        throw std::invalid_argument("Input batch size is zero.");
+    }
+    if(input.channels() != (in_channels + block - 1) / block || input.width() % block != 0 || !input.isContiguous()) {
+        throw std::invalid_argument("Input is not a contiguous blocked tensor of the layer's in_channels.");
+    }
+    return input.width() / block;
+}
+
+/*
+ * convolution of one sample without the bias
+ *  - 1x1 filters at stride 1 and 3x3 and 5x5 filters at stride 1 or 2 run on a kernel specialised for that shape
+ *  - any other shape is lowered with im2col and multiplied as filters[out_channels][K] * col[K][out_height * out_width]
+ */
+template <typename Type>
+void ConvolutionLayer<Type>::convolveSample(const Type* input, int input_height, int input_width, Type* out) const {
+    int out_height = outputHeight(input_height);
+    int out_width = outputWidth(input_width);
+    int spatial = out_height * out_width;
+    int K = in_channels * filter_height * filter_width;
+    const Type* weights = std::as_const(*filters).data_ptr();
+
+    if(auto* kernel = kernels()) {
+        // runs inside the caller's loop over the batch, the kernel is handed source, not the vector
+        thread_local std::vector<Type> padded;
+        const Type* source = input;
+        if(padding > 0 || stride != 1) {
+            padded.resize(static_cast<std::size_t>(in_channels) * (input_height + 2 * padding) * (input_width + 2 * padding));
+            ConvolutionKernels<Type>::pad(input, in_channels, input_height, input_width, padding, stride, padded.data());
+            source = padded.data();
+        }
+        kernel->forward(source, in_channels, input_height + 2 * padding, input_width + 2 * padding,
+                        weights, out_channels, out_height, out_width, out, false);
+        return;
+    }
+
+    // a 1x1 stride 1 unpadded convolution is already a GEMM on the input
+    const Type* columns = input;
+    if(filter_height != 1 || filter_width != 1 || stride != 1 || padding != 0) {
+        thread_local std::vector<Type> col; // reaches the GEMM as columns, a raw pointer
+        col.resize(static_cast<std::size_t>(K) * spatial);
+        Im2Col<Type>::im2col(input, in_channels, input_height, input_width,
+                             filter_height, filter_width, stride, padding, out_height, out_width, col.data());
+        columns = col.data();
+    }
+    Gemm<Type>::multiply(false, false, out_channels, spatial, K, weights, K, columns, spatial, out, spatial);
 }
 
 /*
  * forward pass through the convolutional layer
+ *  - each sample is convolved by convolveSample into pre_activation, or the whole batch at once on the Winograd path
+ *  - bias and ReLU are applied to the result in one pass
  */
 template <typename Type>
-std::shared_ptr<Tensor<Type>> ConvolutionLayer<Type>::forward(const std::shared_ptr<Tensor<Type>>& input) {
-    int batch_size = input->data.size();
+std::shared_ptr<Tensor<Type>> ConvolutionLayer<Type>::forward(const std::shared_ptr<Tensor<Type>>& input,
+                                                              std::shared_ptr<Tensor<Type>> output,
+                                                              std::shared_ptr<Tensor<Type>> pre_activation_out) {
+    int batch_size = input->batch();
     if(batch_size == 0) {
         throw std::invalid_argument("Input batch size is zero.");
     }
 
-    int in_channels_input = input->data[0].size();
+    int in_channels_input = input->channels();
     if(in_channels_input != in_channels) {
         throw std::invalid_argument("Input channels do not match layer's in_channels.");
     }
 
-    int input_height = input->data[0][0].size();
-    int input_width = input->data[0][0][0].size();
+    int input_height = input->height();
+    int input_width = input->width();
 
-    Tensor4D padded_input(batch_size, Tensor3D(in_channels, std::vector<std::vector<Type>>(input_height + 2 * padding, std::vector<Type>(input_width + 2 * padding, static_cast<Type>(0.0)))));
+    int out_height = outputHeight(input_height);
+    int out_width = outputWidth(input_width);
+    int spatial = out_height * out_width;
+    typename Tensor<Type>::Shape out_shape = {batch_size, out_channels, out_height, out_width};
 
-    #pragma omp parallel for
-    for(int n = 0; n < batch_size; ++n) {
-        for(int c = 0; c < in_channels; ++c) {
-            for(int h = 0; h < input_height; ++h) {
-                for(int w = 0; w < input_width; ++w) {
-                    padded_input[n][c][h + padding][w + padding] = input->data[n][c][h][w];
+    cached_input = input;
+    if(!output || output->shape() != out_shape || !output->isContiguous()) {
+        output = std::make_shared<Tensor<Type>>(batch_size, out_channels, out_height, out_width, static_cast<Type>(0.0));
+    }
+
+    // pre_activation cache, it never needs a gradient
+    if(!pre_activation_out || pre_activation_out->shape() != out_shape || !pre_activation_out->isContiguous()) {
+        pre_activation_out = std::make_shared<Tensor<Type>>(batch_size, out_channels, out_height, out_width, static_cast<Type>(0.0), false);
+    }
+    pre_activation = pre_activation_out;
+
+    const Type* bias = std::as_const(*biases).data_ptr();
+    int tile = winogradTile();
+    if(tile) {
+        prepareWinograd();
+        Winograd<Type>::forward(tile, input->data_ptr(), batch_size, input->strides()[0], in_channels, input_height, input_width, padding,
+                                winograd_filters.data(), out_channels, out_height, out_width, pre_activation->data_ptr());
+    }
+
+    // split the batch across threads when there is enough of it, otherwise the kernel or GEMM splits the sample
+    ThreadPool::parallelFor(batch_size, batch_size >= ThreadPool::width() ? 1 : batch_size, [&](int first, int last) {
+        for(int n = first; n < last; ++n) {
+            Type* pre = &pre_activation->data(n, 0, 0, 0);
+            if(!tile) {
+                convolveSample(&input->data(n, 0, 0, 0), input_height, input_width, pre);
+            }
+
+            Type* out = &output->data(n, 0, 0, 0);
+            for(int f = 0; f < out_channels; ++f) {
+                Acc b = bias[f];
+                Type* pre_row = pre + static_cast<std::ptrdiff_t>(f) * spatial;
+                Type* out_row = out + static_cast<std::ptrdiff_t>(f) * spatial;
+                #pragma omp simd
+                for(int i = 0; i < spatial; ++i) {
+                    Acc sum = pre_row[i] + b;
+                    pre_row[i] = sum; // cache pre-activation
+                    out_row[i] = sum > static_cast<Acc>(0) ? sum : static_cast<Acc>(0.0); // relu
                 }
             }
         }
+    });
+
+    return output;
+}
+
+/*
+ * inference pass through the convolutional layer
+ *  - same convolution as forward but pre_activation and the input are not cached
+ *  - with a fused pool the convolution stays in a per-thread scratch plane and only the pooled map is written,
+ *    pooling before bias + ReLU is exact because both are monotonic
+ *  - the Winograd path convolves the whole batch first, into the output or, with a pool, into batch_conv
+ */
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ConvolutionLayer<Type>::infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out,
+                                                            const MaxPoolingOperation<Type>* pool) {
+    int batch_size = input->batch();
+    if(input->channels() != in_channels) {
+        throw std::invalid_argument("Input channels do not match layer's in_channels.");
+    }
+
+    int input_height = input->height();
+    int input_width = input->width();
+    int out_height = outputHeight(input_height);
+    int out_width = outputWidth(input_width);
+    int spatial = out_height * out_width;
+
+    int result_height = pool ? pool->outputHeight(out_height) : out_height;
+    int result_width = pool ? pool->outputWidth(out_width) : out_width;
+    int result_spatial = result_height * result_width;
+    auto& output = Tensor<Type>::reuse(out, batch_size, out_channels, result_height, result_width);
+
+    const Type* bias = std::as_const(*biases).data_ptr();
+    int tile = winogradTile();
+    if(tile) {
+        prepareWinograd();
+        Type* conv_out = output->data_ptr();
+        if(pool) {
+            batch_conv.resize(static_cast<std::size_t>(batch_size) * out_channels * spatial);
+            conv_out = batch_conv.data();
+        }
+        Winograd<Type>::forward(tile, input->data_ptr(), batch_size, input->strides()[0], in_channels, input_height, input_width, padding,
+                                winograd_filters.data(), out_channels, out_height, out_width, conv_out);
     }
 
-    int padded_height = padded_input[0][0].size();
-    int padded_width = padded_input[0][0][0].size();
-
-    int out_height = (padded_height - filter_height) / stride + 1;
-    int out_width = (padded_width - filter_width) / stride + 1;
-
-    auto output = std::make_shared<Tensor<Type>>(batch_size, out_channels, out_height, out_width, static_cast<Type>(0.0));
-
-    // initialize pre_activation cache
-    pre_activation = Tensor4D(batch_size, Tensor3D(out_channels, std::vector<std::vector<Type>>(out_height, std::vector<Type>(out_width, static_cast<Type>(0.0)))));
-
-    // perform convolution for each sample in the batch
-    #pragma omp parallel for 
-    for(int n = 0; n < batch_size; ++n) {
-        for(int f = 0; f < out_channels; ++f) {
-            for(int h = 0; h < out_height; ++h) {
-                for(int w = 0; w < out_width; ++w) {
-                    Type sum = static_cast<Type>(0.0);
-                    for(int c = 0; c < in_channels; ++c) {
-                        for(int kh = 0; kh < filter_height; ++kh) {
-                            #pragma omp simd reduction(+:sum)
-                            for(int kw = 0; kw < filter_width; ++kw) {
-                                int in_h = h * stride + kh;
-                                int in_w = w * stride + kw;
-                                sum += padded_input[n][c][in_h][in_w] * filters[f][c][kh][kw];
-                            }
-                        }
-                    }
-                    sum += biases[f]; // bias
-                    pre_activation[n][f][h][w] = static_cast<Type>(sum); // cache pre-activation
-                    // relu
-                    output->data[n][f][h][w] = sum > static_cast<Type>(0) ? sum : static_cast<Type>(0.0);
+    ThreadPool::parallelFor(batch_size, batch_size >= ThreadPool::width() ? 1 : batch_size, [&](int first, int last) {
+        for(int n = first; n < last; ++n) {
+            thread_local std::vector<Type> conv; // inside the loop body, one per pool thread
+            Type* result = &output->data(n, 0, 0, 0);
+            Type* conv_out = result;
+            if(tile && pool) {
+                conv_out = batch_conv.data() + static_cast<std::ptrdiff_t>(n) * out_channels * spatial;
+            }
+            else if(!tile) {
+                if(pool) {
+                    conv.resize(static_cast<std::size_t>(out_channels) * spatial);
+                    conv_out = conv.data();
                 }
+                convolveSample(&input->data(n, 0, 0, 0), input_height, input_width, conv_out);
             }
+
+            for(int f = 0; f < out_channels; ++f) {
+                Type* row = result + static_cast<std::ptrdiff_t>(f) * result_spatial;
+                if(pool) {
+                    pool->poolPlane(conv_out + static_cast<std::ptrdiff_t>(f) * spatial, out_height, out_width, row);
+                }
+                Acc b = bias[f];
+                #pragma omp simd
+                for(int i = 0; i < result_spatial; ++i) {
+                    Acc sum = row[i] + b;
+                    row[i] = sum > static_cast<Acc>(0) ? sum : static_cast<Acc>(0.0); // relu
+                }
+            }
+        }
+    });
+
+    return output;
+}
+
+/*
+ * forward pass on a blocked input, each sample is padded into a per-thread Acc copy and convolved by BlockedKernels
+ *  - bias, pre-activation and ReLU are written by the kernel, padding lanes of the output stay 0
+ *  - no Winograd or specialised kernels in a blocked layout
+ */
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ConvolutionLayer<Type>::forwardBlocked(int block, const std::shared_ptr<Tensor<Type>>& input,
+                                                                     std::shared_ptr<Tensor<Type>> output,
+                                                                     std::shared_ptr<Tensor<Type>> pre_activation_out) {
+    int input_width = blockedWidth(*input, block);
+    int batch_size = input->batch();
+    int input_height = input->height();
+    int in_blocks = input->channels();
+    int out_blocks = (out_channels + block - 1) / block;
+    int out_height = outputHeight(input_height);
+    int out_width = outputWidth(input_width);
+    int padded_height = input_height + 2 * padding;
+    int padded_width = input_width + 2 * padding;
+    typename Tensor<Type>::Shape out_shape = {batch_size, out_blocks, out_height, out_width * block};
+
+    cached_input = input;
+    if(!output || output->shape() != out_shape || !output->isContiguous()) {
+        output = std::make_shared<Tensor<Type>>(batch_size, out_blocks, out_height, out_width * block, static_cast<Type>(0.0));
+    }
+    if(!pre_activation_out || pre_activation_out->shape() != out_shape || !pre_activation_out->isContiguous()) {
+        pre_activation_out = std::make_shared<Tensor<Type>>(batch_size, out_blocks, out_height, out_width * block, static_cast<Type>(0.0), false);
+    }
+    pre_activation = pre_activation_out;
+    prepareBlocked(block);
+
+    // split the batch across threads when there is enough of it, otherwise the kernel splits the rows
+    ThreadPool::parallelFor(batch_size, batch_size >= ThreadPool::width() ? 1 : batch_size, [&](int first, int last) {
+        for(int n = first; n < last; ++n) {
+            thread_local std::vector<Acc> padded; // declared in the loop body, so each thread pads into its own
+            padded.resize(static_cast<std::size_t>(in_blocks) * padded_height * padded_width * block);
+            BlockedKernels<Type>::pad(&input->data(n, 0, 0, 0), in_blocks, input_height, input_width, padding, block, padded.data());
+            BlockedKernels<Type>::forward(block, padded.data(), in_blocks, padded_height, padded_width, blocked_filters.data(),
+                                          filter_height, filter_width, stride, out_blocks, out_height, out_width, blocked_biases.data(),
+                                          &pre_activation->data(n, 0, 0, 0), &output->data(n, 0, 0, 0));
         }
+    });
+
+    return output;
+}
+
+/*
+ * inference on a blocked input, with a fused pool the convolution of a sample stays in a per-thread scratch and
+ * bias + ReLU are applied to the pooled blocks
+ */
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ConvolutionLayer<Type>::inferBlocked(int block, const std::shared_ptr<Tensor<Type>>& input,
+                                                                   std::shared_ptr<Tensor<Type>>& out,
+                                                                   const MaxPoolingOperation<Type>* pool) {
+    int input_width = blockedWidth(*input, block);
+    int batch_size = input->batch();
+    int input_height = input->height();
+    int in_blocks = input->channels();
+    int out_blocks = (out_channels + block - 1) / block;
+    int out_height = outputHeight(input_height);
+    int out_width = outputWidth(input_width);
+    int padded_height = input_height + 2 * padding;
+    int padded_width = input_width + 2 * padding;
+    std::ptrdiff_t conv_plane = static_cast<std::ptrdiff_t>(out_height) * out_width * block;
+
+    if(pool && pool->block() != block) {
+        throw std::invalid_argument("A pool fused into a blocked convolution must use the same blocks.");
     }
+    int result_height = pool ? pool->outputHeight(out_height) : out_height;
+    int result_width = pool ? pool->outputWidth(out_width) : out_width;
+    std::ptrdiff_t result_plane = static_cast<std::ptrdiff_t>(result_height) * result_width * block;
+    auto& output = Tensor<Type>::reuse(out, batch_size, out_blocks, result_height, result_width * block);
+    prepareBlocked(block);
+    const Acc* bias = blocked_biases.data();
+
+    ThreadPool::parallelFor(batch_size, batch_size >= ThreadPool::width() ? 1 : batch_size, [&](int first, int last) {
+        for(int n = first; n < last; ++n) {
+            // per pool thread, both live inside the loop body
+            thread_local std::vector<Acc> padded;
+            thread_local std::vector<Type> conv;
+            padded.resize(static_cast<std::size_t>(in_blocks) * padded_height * padded_width * block);
+            BlockedKernels<Type>::pad(&input->data(n, 0, 0, 0), in_blocks, input_height, input_width, padding, block, padded.data());
+            Type* result = &output->data(n, 0, 0, 0);
+            if(!pool) {
+                BlockedKernels<Type>::forward(block, padded.data(), in_blocks, padded_height, padded_width, blocked_filters.data(),
+                                              filter_height, filter_width, stride, out_blocks, out_height, out_width, bias, nullptr, result);
+                continue;
+            }
+            conv.resize(static_cast<std::size_t>(out_blocks) * conv_plane);
+            BlockedKernels<Type>::forward(block, padded.data(), in_blocks, padded_height, padded_width, blocked_filters.data(),
+                                          filter_height, filter_width, stride, out_blocks, out_height, out_width, nullptr, conv.data(), nullptr);
+            for(int b = 0; b < out_blocks; ++b) {
+                Type* row = result + b * result_plane;
+                pool->poolPlane(conv.data() + b * conv_plane, out_height, out_width, row);
+                const Acc* lanes = bias + static_cast<std::ptrdiff_t>(b) * block;
+                for(std::ptrdiff_t i = 0; i < result_plane; i += block) {
+                    #pragma omp simd
+                    for(int l = 0; l < block; ++l) {
+                        Acc sum = static_cast<Acc>(row[i + l]) + lanes[l];
+                        row[i + l] = sum > static_cast<Acc>(0) ? sum : static_cast<Acc>(0.0); // relu
+                    }
+                }
+            }
+        }
+    });
 
     return output;
 }
 
 /*
- * backward pass through the convolutional layer
+ * backward pass through the convolutional layer, for each sample with G = relu'(pre_activation) * dOut
+ *  - dFilters = sum over the batch of G * col^T, each thread accumulates its share of the batch privately
+ *  - dCol = filters^T * G, accumulated into the input's grad with col2im (each sample owns its slice of it)
+ *  - at stride 1 on a specialised kernel dFilters is computed directly from a padded copy of the input, and the input
+ *    gradient is the forward kernel run over G padded by filter - 1 - padding with the filters flipped and transposed
+ *  - the per-thread partial sums are reduced in parallel, every thread summing a disjoint slice of the parameters
  */
 template <typename Type>
-std::vector<std::vector<std::vector<std::vector<Type>>>> ConvolutionLayer<Type>::backward(const std::shared_ptr<Tensor<Type>>& dOut) {
-    int batch_size = dOut->data.size();
+std::shared_ptr<Tensor<Type>> ConvolutionLayer<Type>::backward(const std::shared_ptr<Tensor<Type>>& dOut) {
+    int batch_size = dOut->batch();
     if (batch_size == 0) {
         throw std::invalid_argument("dOut batch size is zero.");
     }
+    if (!cached_input || cached_input->batch() != batch_size || !pre_activation || pre_activation->shape() != dOut->shape()) {
+        throw std::runtime_error("ConvolutionLayer has no cached input for this batch. Perform forward pass before backward.");
+    }
 
     // get dimensions
-    int out_channels_dOut = dOut->data[0].size();
-    int out_height = dOut->data[0][0].size();
-    int out_width = dOut->data[0][0][0].size();
-    int padded_height = out_height * stride + filter_height - stride;
-    int padded_width = out_width * stride + filter_width - stride;
-
-    // prepare dInput
-    Tensor4D dPaddedInput(batch_size, Tensor3D(in_channels, 
-        std::vector<std::vector<Type>>(padded_height, std::vector<Type>(padded_width, static_cast<Type>(0.0)))));
-
-    // zero gradients
-    #pragma omp parallel for
-    for (int f = 0; f < out_channels; ++f) {
-        dBiases[f] = static_cast<Type>(0.0);
-        for (int c = 0; c < in_channels; ++c) {
-            for (int kh = 0; kh < filter_height; ++kh) {
-                for (int kw = 0; kw < filter_width; ++kw) {
-                    dFilters[f][c][kh][kw] = static_cast<Type>(0.0);
+    const std::shared_ptr<Tensor<Type>>& input = cached_input;
+    int input_height = input->height();
+    int input_width = input->width();
+    int out_height = dOut->height();
+    int out_width = dOut->width();
+    int spatial = out_height * out_width;
+    int K = in_channels * filter_height * filter_width;
+    std::size_t param_count = static_cast<std::size_t>(out_channels) * K + out_channels; // filters then biases
+
+    // the first layer of a network usually has nothing to propagate into
+    bool propagate = input->grad_ptr() != nullptr;
+
+    const Type* weights = std::as_const(*filters).data_ptr();
+    Type* dFilters = filters->grad_ptr();
+    Type* dBiases = biases->grad_ptr();
+
+    const auto* kernel = kernels();
+    bool direct_filter_grad = kernel && kernel->filterGrad;
+    int padded_height = input_height + 2 * padding;
+    int padded_width = input_width + 2 * padding;
+    int grad_padding = filter_height - 1 - padding;
+    bool direct_input_grad = propagate && direct_filter_grad && filter_height == filter_width && grad_padding >= 0;
+    if(direct_input_grad) {
+        flipped_filters.resize(static_cast<std::size_t>(out_channels) * K);
+        ConvolutionKernels<Type>::flipTranspose(weights, out_channels, in_channels, filter_height, filter_width, flipped_filters.data());
+    }
+    const Type* flipped = flipped_filters.data();
+
+    std::size_t parts = ThreadPool::slices(batch_size, 1);
+    partial_grads.assign(param_count * parts, static_cast<Acc>(0.0));
+    std::vector<Acc>& partial = partial_grads;
+
+    ThreadPool::parallelSlots(parts, [&](std::size_t part) {
+        Acc* dFiltersLocal = partial.data() + param_count * part;
+        Acc* dBiasesLocal = dFiltersLocal + static_cast<std::size_t>(out_channels) * K;
+
+        // scratch of the thread running this part, declared inside the loop body
+        thread_local std::vector<Type> col;
+        thread_local std::vector<Type> dCol;
+        thread_local std::vector<Type> grad;
+        thread_local std::vector<Type> padded;
+        thread_local std::vector<Type> padded_grad;
+        if(direct_filter_grad) {
+            padded.resize(static_cast<std::size_t>(in_channels) * padded_height * padded_width);
+        }
+        else {
+            col.resize(static_cast<std::size_t>(K) * spatial);
+        }
+        if(direct_input_grad) {
+            padded_grad.resize(static_cast<std::size_t>(out_channels) * (out_height + 2 * grad_padding) * (out_width + 2 * grad_padding));
+        }
+        else if(propagate) {
+            dCol.resize(static_cast<std::size_t>(K) * spatial);
+        }
+        grad.resize(static_cast<std::size_t>(out_channels) * spatial);
+
+        for (int n = static_cast<int>(batch_size * part / parts); n < static_cast<int>(batch_size * (part + 1) / parts); ++n) {
+            // apply the ReLU derivative
+            const Type* upstream = &dOut->grad(n, 0, 0, 0);
+            const Type* pre = &pre_activation->data(n, 0, 0, 0);
+            for (int f = 0; f < out_channels; ++f) {
+                std::ptrdiff_t row = static_cast<std::ptrdiff_t>(f) * spatial;
+                Acc sum = static_cast<Acc>(0.0);
+                #pragma omp simd reduction(+:sum)
+                for (int i = 0; i < spatial; ++i) {
+                    Acc g = static_cast<Acc>(pre[row + i]) > static_cast<Acc>(0) ? static_cast<Acc>(upstream[row + i]) : static_cast<Acc>(0.0);
+                    grad[row + i] = g;
+                    sum += g;
                 }
+                dBiasesLocal[f] += sum;
             }
+
+            if(direct_filter_grad) {
+                ConvolutionKernels<Type>::pad(&input->data(n, 0, 0, 0), in_channels, input_height, input_width, padding, 1, padded.data());
+                kernel->filterGrad(padded.data(), in_channels, padded_height, padded_width,
+                                   grad.data(), out_channels, out_height, out_width, dFiltersLocal);
+            }
+            else {
+                Im2Col<Type>::im2col(&input->data(n, 0, 0, 0), in_channels, input_height, input_width,
+                                     filter_height, filter_width, stride, padding, out_height, out_width, col.data());
+                Gemm<Type>::multiply(false, true, out_channels, K, spatial, grad.data(), spatial, col.data(), spatial,
+                                     dFiltersLocal, K, true);
+            }
+
+            if(!propagate) {
+                continue;
+            }
+            if(direct_input_grad) {
+                ConvolutionKernels<Type>::pad(grad.data(), out_channels, out_height, out_width, grad_padding, 1, padded_grad.data());
+                kernel->forward(padded_grad.data(), out_channels, out_height + 2 * grad_padding, out_width + 2 * grad_padding,
+                                flipped, in_channels, input_height, input_width, &input->grad(n, 0, 0, 0), true);
+                continue;
+            }
+            Gemm<Type>::multiply(true, false, K, spatial, out_channels, weights, K, grad.data(), spatial, dCol.data(), spatial);
+            Im2Col<Type>::col2im(dCol.data(), in_channels, input_height, input_width,
+                                 filter_height, filter_width, stride, padding, out_height, out_width, &input->grad(n, 0, 0, 0));
+        }
+
+    });
+
+    // reduce the partial sums, each thread owns a slice of the parameters
+    ThreadPool::parallelFor(static_cast<std::ptrdiff_t>(param_count), 4096, [&](std::ptrdiff_t first, std::ptrdiff_t last) {
+        for (std::ptrdiff_t idx = first; idx < last; ++idx) {
+            Acc sum = static_cast<Acc>(0.0);
+            for (std::size_t t = 0; t < parts; ++t) {
+                sum += partial[param_count * t + idx];
+            }
+            if (idx >= static_cast<std::ptrdiff_t>(out_channels) * K) {
+                dBiases[idx - static_cast<std::ptrdiff_t>(out_channels) * K] = sum;
+                continue;
+            }
+            dFilters[idx] = sum;
         }
+    });
+
+    return cached_input;
+}
+
+/*
+ * backward pass on blocked tensors, the structure of backward with BlockedKernels in place of the GEMMs
+ *  - per-thread partial sums are kept in the blocked filter layout and reduced into the plain dFilters, every
+ *    thread reading a disjoint slice of the filters through filterIndex
+ *  - the input gradient is summed into a per-thread padded copy and its interior is added to the input's grad
+ */
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ConvolutionLayer<Type>::backwardBlocked(int block, const std::shared_ptr<Tensor<Type>>& dOut) {
+    int batch_size = dOut->batch();
+    if (batch_size == 0) {
+        throw std::invalid_argument("dOut batch size is zero.");
+    }
+    if (!cached_input || cached_input->batch() != batch_size || !pre_activation || pre_activation->shape() != dOut->shape()) {
+        throw std::runtime_error("ConvolutionLayer has no cached input for this batch. Perform forward pass before backward.");
     }
 
-    // accumulate gradients
-    #pragma omp parallel
-    {
-        auto dFiltersLocal = dFilters; 
-        auto dBiasesLocal = dBiases;
+    const std::shared_ptr<Tensor<Type>>& input = cached_input;
+    int input_width = blockedWidth(*input, block);
+    int input_height = input->height();
+    int in_blocks = input->channels();
+    int out_blocks = dOut->channels();
+    int out_height = dOut->height();
+    int out_width = dOut->width() / block;
+    int padded_height = input_height + 2 * padding;
+    int padded_width = input_width + 2 * padding;
+    std::size_t sample = static_cast<std::size_t>(out_blocks) * out_height * out_width * block;
+    std::size_t filter_count = BlockedKernels<Type>::filterSize(out_channels, in_channels, filter_height, filter_width, block);
+    std::size_t param_count = filter_count + static_cast<std::size_t>(out_blocks) * block; // blocked filters then biases
+    int K = in_channels * filter_height * filter_width;
+
+    bool propagate = input->grad_ptr() != nullptr;
+    if(propagate) {
+        transposed_filters.resize(filter_count);
+        BlockedKernels<Type>::blockFilters(std::as_const(*filters).data_ptr(), out_channels, in_channels, filter_height, filter_width, block,
+                                           true, transposed_filters.data());
+    }
+    Type* dFilters = filters->grad_ptr();
+    Type* dBiases = biases->grad_ptr();
+
+    std::size_t parts = ThreadPool::slices(batch_size, 1);
+    partial_grads.assign(param_count * parts, static_cast<Acc>(0.0));
+    std::vector<Acc>& partial = partial_grads;
+
+    ThreadPool::parallelSlots(parts, [&](std::size_t part) {
+        Acc* dFiltersLocal = partial.data() + param_count * part;
+        Acc* dBiasesLocal = dFiltersLocal + filter_count;
+
+        // inside the part, so the thread that runs it owns them
+        thread_local std::vector<Acc> grad;
+        thread_local std::vector<Acc> padded;
+        thread_local std::vector<Acc> padded_grad;
+        grad.resize(sample);
+        padded.resize(static_cast<std::size_t>(in_blocks) * padded_height * padded_width * block);
+        if(propagate) {
+            padded_grad.resize(padded.size());
+        }
 
-        #pragma omp for
-        for (int n = 0; n < batch_size; ++n) {
-            for (int f = 0; f < out_channels; ++f) {
-                for (int oh = 0; oh < out_height; ++oh) {
-                    for (int ow = 0; ow < out_width; ++ow) {
-                        Type grad_val = dOut->data[n][f][oh][ow]; // if activation grad was 1, else multiply
-                        dBiasesLocal[f] += grad_val;
-                        for (int c = 0; c < in_channels; ++c) {
-                            for (int kh = 0; kh < filter_height; ++kh) {
-                                for (int kw = 0; kw < filter_width; ++kw) {
-                                    int ph = oh * stride + kh;
-                                    int pw = ow * stride + kw;
-                                    dFiltersLocal[f][c][kh][kw] += /* input[n][c][ph][pw] */ 
-                                                                    // you need stored padded input or pre_activation
-                                                                    grad_val;
-                                    // compute dPaddedInput for backprop
-                                    dPaddedInput[n][c][ph][pw] += filters[f][c][kh][kw] * grad_val;
-                                }
-                            }
-                        }
-                    }
+        for (int n = static_cast<int>(batch_size * part / parts); n < static_cast<int>(batch_size * (part + 1) / parts); ++n) {
+            // apply the ReLU derivative, the bias gradient of a lane sums every pixel of its block
+            const Type* upstream = &dOut->grad(n, 0, 0, 0);
+            const Type* pre = &pre_activation->data(n, 0, 0, 0);
+            for (std::size_t i = 0; i < sample; i += block) {
+                Acc* lanes = dBiasesLocal + (i / (static_cast<std::size_t>(out_height) * out_width * block)) * block;
+                #pragma omp simd
+                for (int l = 0; l < block; ++l) {
+                    Acc g = static_cast<Acc>(pre[i + l]) > static_cast<Acc>(0) ? static_cast<Acc>(upstream[i + l]) : static_cast<Acc>(0.0);
+                    grad[i + l] = g;
+                    lanes[l] += g;
                 }
             }
-        }
 
-        // reduce local accumulations
-        #pragma omp critical
-        {
-            for (int f = 0; f < out_channels; ++f) {
-                dBiases[f] += dBiasesLocal[f];
-                for (int c = 0; c < in_channels; ++c) {
-                    for (int kh = 0; kh < filter_height; ++kh) {
-                        for (int kw = 0; kw < filter_width; ++kw) {
-                            dFilters[f][c][kh][kw] += dFiltersLocal[f][c][kh][kw];
-                        }
+            BlockedKernels<Type>::pad(&input->data(n, 0, 0, 0), in_blocks, input_height, input_width, padding, block, padded.data());
+            BlockedKernels<Type>::filterGrad(block, padded.data(), in_blocks, padded_height, padded_width, grad.data(),
+                                             out_blocks, out_height, out_width, filter_height, filter_width, stride, dFiltersLocal);
+            if(!propagate) {
+                continue;
+            }
+
+            std::fill(padded_grad.begin(), padded_grad.end(), static_cast<Acc>(0.0));
+            BlockedKernels<Type>::inputGrad(block, grad.data(), out_blocks, out_height, out_width, transposed_filters.data(),
+                                            filter_height, filter_width, stride, in_blocks, padded_height, padded_width, padded_grad.data());
+            for(int b = 0; b < in_blocks; ++b) {
+                for(int h = 0; h < input_height; ++h) {
+                    const Acc* src = padded_grad.data() + ((static_cast<std::ptrdiff_t>(b) * padded_height + h + padding) * padded_width + padding) * block;
+                    Type* dst = &input->grad(n, b, h, 0);
+                    #pragma omp simd
+                    for(int i = 0; i < input_width * block; ++i) {
+                        dst[i] = static_cast<Acc>(dst[i]) + src[i];
                     }
                 }
             }
         }
-    }
 
-    // remove any padding from dPaddedInput
-    std::vector<std::vector<std::vector<std::vector<Type>>>> dInput(batch_size,
-        std::vector<std::vector<std::vector<Type>>>(in_channels,
-        std::vector<std::vector<Type>>(padded_height - 2 * padding,
-        std::vector<Type>(padded_width - 2 * padding, static_cast<Type>(0.0)))));
+    });
 
-    #pragma omp parallel for
-    for (int n = 0; n < batch_size; ++n) {
-        for (int c = 0; c < in_channels; ++c) {
-            for (int h = 0; h < static_cast<int>(dInput[n][c].size()); ++h) {
-                for (int w = 0; w < static_cast<int>(dInput[n][c][h].size()); ++w) {
-                    dInput[n][c][h][w] = dPaddedInput[n][c][h + padding][w + padding];
-                }
+    // reduce the partial sums into the plain gradients, each thread owns a slice of the parameters
+    ThreadPool::parallelFor(static_cast<std::ptrdiff_t>(out_channels) * K + out_channels, 4096, [&](std::ptrdiff_t first, std::ptrdiff_t last) {
+        for (std::ptrdiff_t idx = first; idx < last; ++idx) {
+            std::size_t at;
+            if (idx >= static_cast<std::ptrdiff_t>(out_channels) * K) {
+                at = filter_count + (idx - static_cast<std::ptrdiff_t>(out_channels) * K);
+            }
+            else {
+                int f = static_cast<int>(idx / K);
+                int k = static_cast<int>(idx % K);
+                at = BlockedKernels<Type>::filterIndex(f, k / (filter_height * filter_width), (k / filter_width) % filter_height,
+                                                       k % filter_width, in_blocks, filter_height, filter_width, block, false);
+            }
+            Acc sum = static_cast<Acc>(0.0);
+            for (std::size_t t = 0; t < parts; ++t) {
+                sum += partial[param_count * t + at];
             }
+            if (idx >= static_cast<std::ptrdiff_t>(out_channels) * K) {
+                dBiases[idx - static_cast<std::ptrdiff_t>(out_channels) * K] = sum;
+                continue;
+            }
+            dFilters[idx] = sum;
         }
-    }
-    return dInput;
+    });
+
+    return cached_input;
 }
 
 template <typename Type>
@@ -236,13 +687,23 @@ void ConvolutionLayer<Type>::setFilters(const Filters& new_filters) {
         throw std::invalid_argument("Number of filters does not match out_channels.");
     }
     for(int f = 0; f < out_channels; ++f) {
-        if(new_filters[f].size() != in_channels ||
-           new_filters[f][0].size() != filter_height ||
-           new_filters[f][0][0].size() != filter_width) {
+        if(new_filters[f].size() != in_channels) {
             throw std::invalid_argument("Filter dimensions do not match.");
         }
+        for(const auto& channel : new_filters[f]) {
+            if(channel.size() != filter_height ||
+               std::any_of(channel.begin(), channel.end(), [&](const std::vector<Type>& row) { return row.size() != filter_width; })) {
+                throw std::invalid_argument("Filter dimensions do not match.");
+            }
+        }
+    }
+    for(int f = 0; f < out_channels; ++f) {
+        for(int c = 0; c < in_channels; ++c) {
+            for(int kh = 0; kh < filter_height; ++kh) {
+                std::copy(new_filters[f][c][kh].begin(), new_filters[f][c][kh].end(), &filters->data(f, c, kh, 0));
+            }
+        }
     }
-    filters = new_filters;
 }
 
 template <typename Type>
@@ -250,30 +711,33 @@ void ConvolutionLayer<Type>::setBiases(const std::vector<Type>& new_biases) {
     if(new_biases.size() != out_channels) {
         throw std::invalid_argument("Number of biases does not match out_channels.");
     }
-    biases = new_biases;
+    std::copy(new_biases.begin(), new_biases.end(), biases->data_ptr());
+}
+
+template <typename Type>
+void ConvolutionLayer<Type>::setParameters(const std::vector<std::shared_ptr<Tensor<Type>>>& tensors) {
+    typename Tensor<Type>::Shape filters_shape = {out_channels, in_channels, filter_height, filter_width};
+    typename Tensor<Type>::Shape biases_shape = {1, out_channels, 1, 1};
+    if(tensors.size() != 2 || !tensors[0] || !tensors[1] || tensors[0]->shape() != filters_shape || tensors[1]->shape() != biases_shape
+       || !tensors[0]->isContiguous() || !tensors[1]->isContiguous()) {
+        throw std::invalid_argument("ConvolutionLayer::setParameters expects filters and biases of the layer's shape.");
+    }
+    filters = tensors[0];
+    biases = tensors[1];
+    trackParameters();
+    blocked_version = 0;
+    winograd_version = 0;
 }
 
 template <typename Type>
 void ConvolutionLayer<Type>::zeroGrad() {
-    dFilters.assign(out_channels, Tensor3D(in_channels,
-                                           std::vector<std::vector<Type>> (filter_height, std::vector<Type>(filter_width, static_cast<Type>(0.0)))));
-    dBiases.assign(out_channels, static_cast<Type>(0.0));
+    filters->zeroGrad();
+    biases->zeroGrad();
 }
 
 template <typename Type>
 ssize_t ConvolutionLayer<Type>::getNumParams() const {
-    size_t out_channels = filters.size();
-    if(out_channels == 0) return 0;
-    size_t in_channels  = filters[0].size();
-    size_t filter_height = filters[0][0].size();
-    size_t filter_width  = filters[0][0][0].size();
-
-    // param for filters
-    size_t filterParams = out_channels * in_channels * filter_height * filter_width;
-    // param for biases
-    size_t biasParams = biases.size();
-
-    return filterParams + biasParams;
+    return static_cast<ssize_t>(filters->size() + biases->size());
 }
 
 #include "../tools/ConvolutionalWeights.h"
@@ -10,23 +10,22 @@
 #include <stdexcept>
 #include <cmath>
 #include "../tools/Tensor.h"
+#include "../tools/BFloat16.h"
 #include "Layer.h"
 
 template <typename Type>
 class FullyConnectedLayer : public Layer<Type> {
-    typedef std::vector<std::vector<Type>> WeightsMatrix;
 public:
     int in_features;
     int out_features;
 
-    WeightsMatrix weights;
-    std::vector<Type> biases;
-
-    // gradients
-    WeightsMatrix dWeights;
-    std::vector<Type> dBiases;
+    // parameters, grad holds dWeights / dBiases
+    std::shared_ptr<Tensor<Type>> weights; // (out_features, in_features, 1, 1), a row-major [out_features][in_features] matrix
+    std::shared_ptr<Tensor<Type>> biases;  // (1, out_features, 1, 1)
 
     FullyConnectedLayer(int in_features, int out_features);
+    // layer over existing weights and biases (e.g. views into a mapped model file), nothing is initialised
+    FullyConnectedLayer(int in_features, int out_features, const std::vector<std::shared_ptr<Tensor<Type>>>& params);
 
     void initializeParams();
 
@@ -35,6 +34,9 @@ public:
     std::shared_ptr<WeightStruct<Type>> saveWeights() override;
 
     [[nodiscard]] ssize_t getNumParams() const override;
+
+    std::vector<std::shared_ptr<Tensor<Type>>> parameters() override { return {weights, biases}; } // weights, biases
+    void setParameters(const std::vector<std::shared_ptr<Tensor<Type>>>& tensors) override;
 };
 
 #include "FullyConnectedLayer.tpp"
@@ -4,11 +4,11 @@
 
 #include "FullyConnectedLayer.h"
 #include "../tools/ConnectedWeights.h"
+#include "../tools/ThreadPool.h"
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
 #include <stdexcept>
-#include <omp.h>
 #include <random>
 
 template <typename Type>
@@ -16,6 +16,12 @@ FullyConnectedLayer<Type>::FullyConnectedLayer(int in_features, int out_features
     initializeParams();
 }
 
+template <typename Type>
+FullyConnectedLayer<Type>::FullyConnectedLayer(int in_features, int out_features, const std::vector<std::shared_ptr<Tensor<Type>>>& params)
+        : in_features(in_features), out_features(out_features) {
+    setParameters(params);
+}
+
 /*
  * Initialize the weights and biases with random values using He initialization
  */
@@ -25,46 +31,51 @@ void FullyConnectedLayer<Type>::initializeParams() {
     Type fan_in = static_cast<Type>(in_features);
     Type std_dev = sqrt(static_cast<Type>(8.0) / fan_in);
 
-    // resize weights and biases
-    weights.resize(out_features, std::vector<Type>(in_features, static_cast<Type>(0.0)));
-    biases.resize(out_features, static_cast<Type>(0.0));
-
-    dWeights.resize(out_features, std::vector<Type>(in_features, static_cast<Type>(0.0)));
-    dBiases.resize(out_features, static_cast<Type>(0.0));
-
+    // weights and biases with zeroed grads, tensors already bound (e.g. to a model-wide buffer) are refilled in place
+    if(!weights) {
+        weights = std::make_shared<Tensor<Type>>(out_features, in_features, 1, 1);
+        biases = std::make_shared<Tensor<Type>>(1, out_features, 1, 1);
+    }
+    weights->zeroGrad();
+    biases->zeroGrad();
+    Type* w = weights->data_ptr();
+    Type* b = biases->data_ptr();
 
-    // thread-safe random initialization
-    #pragma omp parallel
-    {
-        std::random_device rd;
-        std::mt19937 gen(rd() + omp_get_thread_num());
-        std::normal_distribution<Type> dist(static_cast<Type>(0.0), std_dev);
+    // thread-safe random initialization, one generator per slice of the rows
+    std::random_device rd;
+    unsigned seed = rd();
+    ThreadPool::parallelFor(out_features, 1, [&](int first, int last) {
+        std::mt19937 gen(seed + first);
+        std::normal_distribution<typename Accumulator<Type>::type> dist(0.0, std_dev);
 
-        #pragma omp for
-        for (int i = 0; i < out_features; ++i) {
+        for (int i = first; i < last; ++i) {
             for (int j = 0; j < in_features; ++j) {
-                weights[i][j] = dist(gen);
+                w[static_cast<std::ptrdiff_t>(i) * in_features + j] = dist(gen);
             }
-            biases[i] = dist(gen) * static_cast<Type>(0.1);
+            b[i] = dist(gen) * static_cast<Type>(0.1);
         }
-    }
+    });
 }
 
-
+template <typename Type>
+void FullyConnectedLayer<Type>::setParameters(const std::vector<std::shared_ptr<Tensor<Type>>>& tensors) {
+    typename Tensor<Type>::Shape weights_shape = {out_features, in_features, 1, 1};
+    typename Tensor<Type>::Shape biases_shape = {1, out_features, 1, 1};
+    if(tensors.size() != 2 || !tensors[0] || !tensors[1] || tensors[0]->shape() != weights_shape || tensors[1]->shape() != biases_shape
+       || !tensors[0]->isContiguous() || !tensors[1]->isContiguous()) {
+        throw std::invalid_argument("FullyConnectedLayer::setParameters expects weights and biases of the layer's shape.");
+    }
+    weights = tensors[0];
+    biases = tensors[1];
+}
 
 /*
  * Zero the gradients
  */
 template <typename Type>
 void FullyConnectedLayer<Type>::zeroGrad() {
-    #pragma omp parallel for
-    for(int i = 0; i < out_features; ++i) {
-        std::fill(dWeights[i].begin(), dWeights[i].end(), static_cast<Type>(0.0));
-    }
-    #pragma omp parallel for
-    for(int i = 0; i < out_features; ++i) {
-        dBiases[i] = static_cast<Type>(0.0);
-    }
+    weights->zeroGrad();
+    biases->zeroGrad();
 }
 
 /*
@@ -72,8 +83,8 @@ void FullyConnectedLayer<Type>::zeroGrad() {
  */
 template <typename Type>
 ssize_t FullyConnectedLayer<Type>::getNumParams() const {
-    size_t wParams = (size_t)out_features * (size_t)in_features;
-    size_t bParams = biases.size();
+    size_t wParams = weights->size();
+    size_t bParams = biases->size();
     return wParams + bParams;
 }
 
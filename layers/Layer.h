@@ -6,7 +6,9 @@
 #define INC_12_FINALPROJ_2_LAYER_H
 
 #include "../tools/WeightStruct.h"
+#include "../tools/Tensor.h"
 #include <memory>
+#include <vector>
 
 template <typename Type>
 class Layer {
@@ -15,6 +17,11 @@ public:
    [[nodiscard]] virtual ssize_t getNumParams() const = 0;
    virtual void zeroGrad() = 0;
    virtual std::shared_ptr<WeightStruct<Type>> saveWeights() = 0;
+
+   // trainable parameters in a fixed order, data holds the values and grad their gradients
+   virtual std::vector<std::shared_ptr<Tensor<Type>>> parameters() { return {}; }
+   // rebind the parameters onto these tensors (same order and shapes, e.g. views into a model-wide buffer)
+   virtual void setParameters(const std::vector<std::shared_ptr<Tensor<Type>>>& tensors) {}
 };
 
 //#include "Layer.tpp"
@@ -25,6 +25,8 @@ public:
     MaxPoolingLayer(int pool_height, int pool_width, int stride = 1, int padding = 0);
     std::shared_ptr<Tensor<Type>> forward(std::shared_ptr<Tensor<Type>> &input);
     std::shared_ptr<Tensor<Type>> backward(std::shared_ptr<Tensor<Type>> &dOut);
+    // outside training forward keeps no argmax and backward throws
+    void setTraining(bool is_training) { maxPoolOp->setTraining(is_training); }
     [[nodiscard]] ssize_t getNumParams() const override;
     void zeroGrad() override;
     std::shared_ptr<WeightStruct<Type>> saveWeights() override;
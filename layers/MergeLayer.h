@@ -0,0 +1,28 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#ifndef INC_12_FINALPROJ_2_MERGELAYER_H
+#define INC_12_FINALPROJ_2_MERGELAYER_H
+
+#include "../tools/MergeOperation.h"
+#include "../tools/Tensor.h"
+#include "Layer.h"
+#include <memory>
+
+// "add" or "concat" layer of a graph model, it has no parameters, the graph runs it as a MergeOperation
+template <typename Type>
+class MergeLayer : public Layer<Type> {
+public:
+    MergeKind kind;
+
+    explicit MergeLayer(MergeKind kind);
+    [[nodiscard]] ssize_t getNumParams() const override { return 0; }
+    void zeroGrad() override {}
+    std::shared_ptr<WeightStruct<Type>> saveWeights() override;
+    [[nodiscard]] const char* typeName() const { return kind == MergeKind::Add ? "add" : "concat"; }
+};
+
+#include "MergeLayer.tpp"
+
+#endif //INC_12_FINALPROJ_2_MERGELAYER_H
@@ -0,0 +1,20 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#include "MergeLayer.h"
+#include "../tools/MergeWeights.h"
+#include <stdexcept>
+#include <string>
+
+template <typename Type>
+MergeLayer<Type>::MergeLayer(MergeKind kind) : kind(kind) {
+    if(kind != MergeKind::Add && kind != MergeKind::Concat) {
+        throw std::invalid_argument("MergeLayer: unknown kind " + std::to_string(static_cast<int>(kind)));
+    }
+}
+
+template <typename Type>
+std::shared_ptr<WeightStruct<Type>> MergeLayer<Type>::saveWeights() {
+    return std::make_shared<MergeWeights<Type>>(*this);
+}
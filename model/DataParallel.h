@@ -0,0 +1,86 @@
+//
+// Created by Vijay Goyal on 2025-01-27.
+//
+
+#ifndef INC_12_FINALPROJ_2_DATAPARALLEL_H
+#define INC_12_FINALPROJ_2_DATAPARALLEL_H
+
+#include "ModularCNN.h"
+#include "../tools/Transport.h"
+#include "../tools/BFloat16.h"
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Data-parallel training of one ModularCNN per process, every replica runs a shard of the batch.
+ *        - the constructor copies rank 0's parameters to every replica, after that the replicas stay identical:
+ *          their averaged gradients are the same bytes, so AMSGrad takes the same step everywhere
+ *        - backward reduces each layer's gradients with a ring allreduce (reduce-scatter then allgather over a
+ *          Transport) on a communication thread, started as soon as the layer's backward is done, so the reduction of
+ *          the last layers overlaps with the backward of the first ones
+ *        - the averaged gradient is the one of the whole batch when every replica runs the same shard size
+ *        - every replica must call the collective methods (the constructor, backward, average, broadcast, inSync)
+ *          in the same order
+ */
+template <typename Type>
+class DataParallel {
+private:
+    typedef typename Accumulator<Type>::type Acc;
+
+    // the gradients of one layer, a contiguous range of the model's ParameterBuffer
+    struct Bucket {
+        std::size_t offset;
+        std::size_t count;
+    };
+
+    ModularCNN<Type>& model;
+    std::shared_ptr<Transport> transport;
+
+    std::vector<Bucket> buckets;      // in backward order, last layer first
+    std::vector<int> layer_bucket;    // bucket of each layer, -1 for layers without parameters
+    std::vector<Type> scratch;        // incoming chunk of the reduce-scatter
+
+    std::thread communicator;
+    std::atomic<long long> posted{0};  // buckets whose gradients are final, counted over every step
+    std::atomic<long long> reduced{0}; // buckets averaged across the replicas
+    std::atomic<bool> stopping{false};
+    std::exception_ptr error;          // set by the communication thread, rethrown by backward
+
+    double communication_ms = 0.0; // time the communication thread spent in the last backward
+    double wait_ms = 0.0;          // time the last backward waited for it after the model's backward
+
+    void communicate();
+    // stamps the model's parameters as written when data overlaps them, so the layers rebuild their cached filters
+    void written(const Type* data, std::size_t count);
+
+public:
+    DataParallel(ModularCNN<Type>& model, std::shared_ptr<Transport> transport);
+    ~DataParallel();
+
+    DataParallel(const DataParallel&) = delete;
+    DataParallel& operator=(const DataParallel&) = delete;
+
+    // model.backward, returns once every gradient is the average over the replicas
+    void backward(const std::shared_ptr<Tensor<Type>>& dOut);
+
+    // in place average / copy of rank 0's values over every replica, e.g. for the loss of a step or a model's weights
+    void allreduce(Type* data, std::size_t count);
+    void broadcast(Type* data, std::size_t count);
+    double average(double value);
+
+    // whether every replica holds bit-identical parameters
+    bool inSync();
+
+    [[nodiscard]] int rank() const { return transport->rank(); }
+    [[nodiscard]] int size() const { return transport->size(); }
+    [[nodiscard]] double lastCommunicationMs() const { return communication_ms; }
+    [[nodiscard]] double lastWaitMs() const { return wait_ms; }
+};
+
+#include "DataParallel.tpp"
+
+#endif //INC_12_FINALPROJ_2_DATAPARALLEL_H
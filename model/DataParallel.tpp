@@ -0,0 +1,233 @@
+//
+// Created by Vijay Goyal on 2025-01-27.
+//
+
+#include "DataParallel.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+template <typename Type>
+DataParallel<Type>::DataParallel(ModularCNN<Type>& model, std::shared_ptr<Transport> transport)
+        : model(model), transport(std::move(transport)) {
+    if(!this->transport) {
+        throw std::invalid_argument("DataParallel needs a transport.");
+    }
+
+    // the parameter buffer is in layer order, so a layer's tensors are one range and backward meets them last to first
+    ParameterBuffer<Type>& parameters = model.getParameters();
+    const auto& layers = model.getLayers();
+    layer_bucket.assign(layers.size(), -1);
+    for(std::size_t i = layers.size(); i-- > 0;) {
+        auto tensors = layers[i]->parameters();
+        if(tensors.empty()) {
+            continue;
+        }
+        std::size_t begin = parameters.offsetOf(*tensors.front());
+        std::size_t end = parameters.offsetOf(*tensors.back()) + ParameterBuffer<Type>::alignedSize(tensors.back()->size());
+        layer_bucket[i] = static_cast<int>(buckets.size());
+        buckets.push_back({begin, end - begin});
+    }
+
+    broadcast(parameters.data(), parameters.size());
+    communicator = std::thread(&DataParallel<Type>::communicate, this);
+}
+
+template <typename Type>
+DataParallel<Type>::~DataParallel() {
+    stopping.store(true, std::memory_order_release);
+    posted.store(std::numeric_limits<long long>::max() / 2, std::memory_order_release);
+    posted.notify_all();
+    if(communicator.joinable()) {
+        communicator.join();
+    }
+}
+
+/*
+ * communication thread: reduce the buckets in the order backward posts them, one at a time
+ */
+template <typename Type>
+void DataParallel<Type>::communicate() {
+    long long k = 0;
+    while(true) {
+        long long ready = posted.load(std::memory_order_acquire);
+        while(ready <= k) {
+            posted.wait(ready, std::memory_order_acquire);
+            ready = posted.load(std::memory_order_acquire);
+        }
+        if(stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        for(; k < ready; ++k) {
+            const Bucket& bucket = buckets[k % static_cast<long long>(buckets.size())];
+            auto start = std::chrono::steady_clock::now();
+            try {
+                allreduce(model.getParameters().grad() + bucket.offset, bucket.count);
+            }
+            catch(...) {
+                // backward rethrows it, the replicas are out of step from here on
+                error = std::current_exception();
+                reduced.store(std::numeric_limits<long long>::max() / 2, std::memory_order_release);
+                reduced.notify_all();
+                return;
+            }
+            communication_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            reduced.store(k + 1, std::memory_order_release);
+            reduced.notify_all();
+        }
+    }
+}
+
+template <typename Type>
+void DataParallel<Type>::backward(const std::shared_ptr<Tensor<Type>>& dOut) {
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    communication_ms = 0.0; // the communication thread is idle between steps
+
+    // only this call's backward posts buckets, a plain model.backward keeps its gradients local
+    model.setBackwardHook([this](int layer) {
+        if(layer_bucket[layer] >= 0) {
+            posted.fetch_add(1, std::memory_order_release);
+            posted.notify_one();
+        }
+    });
+    try {
+        model.backward(dOut);
+    }
+    catch(...) {
+        model.setBackwardHook({});
+        throw;
+    }
+    model.setBackwardHook({});
+
+    auto start = std::chrono::steady_clock::now();
+    long long target = posted.load(std::memory_order_relaxed);
+    long long done = reduced.load(std::memory_order_acquire);
+    while(done < target) {
+        reduced.wait(done, std::memory_order_acquire);
+        done = reduced.load(std::memory_order_acquire);
+    }
+    wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/*
+ * ring allreduce over size() chunks of data, chunk j is [count * j / size, count * (j + 1) / size)
+ *  - reduce-scatter: in step s a rank sends chunk rank - s and adds the incoming chunk rank - s - 1 into its own,
+ *    after size - 1 steps it holds the full sum of chunk rank + 1
+ *  - that chunk is scaled to the average, then the allgather passes the finished chunks around the ring, so every
+ *    replica ends up with the same bytes
+ *  - each rank sends and receives 2 * (size - 1) / size of the data, whatever the number of replicas
+ */
+template <typename Type>
+void DataParallel<Type>::allreduce(Type* data, std::size_t count) {
+    int ranks = size();
+    if(ranks == 1 || count == 0) {
+        return;
+    }
+    int r = rank();
+    auto begin = [&](int chunk) { return count * static_cast<std::size_t>(chunk) / static_cast<std::size_t>(ranks); };
+    auto length = [&](int chunk) { return begin(chunk + 1) - begin(chunk); };
+    scratch.resize(std::max(scratch.size(), count / ranks + 1));
+
+    for(int s = 0; s < ranks - 1; ++s) {
+        int send = ((r - s) % ranks + ranks) % ranks;
+        int recv = ((r - s - 1) % ranks + ranks) % ranks;
+        transport->exchange(data + begin(send), length(send) * sizeof(Type), scratch.data(), length(recv) * sizeof(Type));
+        Type* target = data + begin(recv);
+        std::size_t n = length(recv);
+        for(std::size_t i = 0; i < n; ++i) {
+            target[i] = static_cast<Type>(static_cast<Acc>(target[i]) + static_cast<Acc>(scratch[i]));
+        }
+    }
+
+    int owned = (r + 1) % ranks;
+    Acc scale = Acc(1.0) / static_cast<Acc>(ranks);
+    Type* mine = data + begin(owned);
+    for(std::size_t i = 0, n = length(owned); i < n; ++i) {
+        mine[i] = static_cast<Type>(static_cast<Acc>(mine[i]) * scale);
+    }
+
+    for(int s = 0; s < ranks - 1; ++s) {
+        int send = ((r + 1 - s) % ranks + ranks) % ranks;
+        int recv = ((r - s) % ranks + ranks) % ranks;
+        transport->exchange(data + begin(send), length(send) * sizeof(Type), data + begin(recv), length(recv) * sizeof(Type));
+    }
+    written(data, count);
+}
+
+// rank 0 -> 1 -> ... -> size - 1, each rank forwards what it received
+template <typename Type>
+void DataParallel<Type>::broadcast(Type* data, std::size_t count) {
+    int r = rank();
+    std::size_t bytes = count * sizeof(Type);
+    if(size() == 1 || bytes == 0) {
+        return;
+    }
+    if(r != 0) {
+        transport->exchange(nullptr, 0, data, bytes);
+        written(data, count);
+    }
+    if(r != size() - 1) {
+        transport->exchange(data, bytes, nullptr, 0);
+    }
+}
+
+template <typename Type>
+void DataParallel<Type>::written(const Type* data, std::size_t count) {
+    ParameterBuffer<Type>& parameters = model.getParameters();
+    const Type* values = std::as_const(parameters).data();
+    if(data < values + parameters.size() && values < data + count) {
+        parameters.touch();
+    }
+}
+
+// every replica gathers all values and sums them in rank order, so they all get the same result
+template <typename Type>
+double DataParallel<Type>::average(double value) {
+    int ranks = size();
+    int r = rank();
+    std::vector<double> values(ranks, 0.0);
+    values[r] = value;
+    for(int s = 0; s < ranks - 1; ++s) {
+        int send = ((r - s) % ranks + ranks) % ranks;
+        int recv = ((r - s - 1) % ranks + ranks) % ranks;
+        transport->exchange(&values[send], sizeof(double), &values[recv], sizeof(double));
+    }
+    double sum = 0.0;
+    for(double v : values) {
+        sum += v;
+    }
+    return sum / ranks;
+}
+
+/*
+ * FNV-1a hash of the parameter bytes, passed once around the ring: a rank that sees a hash other than its own
+ * marks the job as out of sync, the marks are passed around once more so that every replica gets the same answer
+ */
+template <typename Type>
+bool DataParallel<Type>::inSync() {
+    ParameterBuffer<Type>& parameters = model.getParameters();
+    const auto* bytes = reinterpret_cast<const unsigned char*>(std::as_const(parameters).data());
+    std::uint64_t hash = 1469598103934665603ull;
+    for(std::size_t i = 0, n = parameters.size() * sizeof(Type); i < n; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    int ranks = size();
+    std::uint64_t previous = hash;
+    transport->exchange(&hash, sizeof(hash), &previous, sizeof(previous));
+    std::uint64_t differs = previous != hash;
+    for(int s = 0; s < ranks - 1; ++s) {
+        std::uint64_t incoming = 0;
+        transport->exchange(&differs, sizeof(differs), &incoming, sizeof(incoming));
+        differs |= incoming;
+    }
+    return differs == 0;
+}
@@ -0,0 +1,117 @@
+//
+// Created by Vijay Goyal on 2025-01-29.
+//
+
+#ifndef INC_12_FINALPROJ_2_INFERENCESERVER_H
+#define INC_12_FINALPROJ_2_INFERENCESERVER_H
+
+#include "ModularCNN.h"
+#include "../tools/Tensor.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// answer to one request
+struct InferenceResult {
+    std::vector<float> probabilities;    // one per class
+    std::vector<int> top_classes;        // the top_k most likely classes, most likely first
+    std::vector<float> top_probabilities;
+    double latency_ms = 0.0;             // from submit to the result being ready
+    int batch_size = 0;                  // requests in the micro-batch that served this one
+};
+
+// over the latest requests (at most InferenceServer::LATENCY_WINDOW of them) since the start or resetStats
+struct InferenceStats {
+    std::size_t requests = 0;
+    std::size_t batches = 0;
+    double mean_batch = 0.0;
+    double p50_ms = 0.0;
+    double p90_ms = 0.0;
+    double p99_ms = 0.0;
+    double max_ms = 0.0;
+    double throughput = 0.0; // requests per second, from the first submit to the last result
+};
+
+/**
+ * @brief Thread-safe inference front end that serves single-image requests in micro-batches.
+ *        - any number of threads submit one (channels, height, width) image at a time and get a future of its result
+ *        - a batching thread waits for the first request, then for more until max_batch of them are queued or the
+ *          first one has waited max_delay_ms, and runs them as one batched predict
+ *        - max_delay_ms is the latency spent to buy larger batches: 0 runs whatever is queued at once, so batches only
+ *          grow while the previous one is running
+ *        - each result has the class probabilities, the top_k classes and the request's latency, stats() gives
+ *          latency percentiles and throughput
+ *        - the predictor only ever runs on the batching thread, the model must not be used elsewhere meanwhile
+ *        - the destructor fails the requests still queued
+ */
+template <typename Type>
+class InferenceServer {
+public:
+    // (batch, channels, height, width) images -> (batch, classes, 1, 1) probabilities
+    typedef std::function<std::shared_ptr<Tensor<Type>>(const std::shared_ptr<Tensor<Type>>&)> Predictor;
+
+    static constexpr std::size_t LATENCY_WINDOW = 65536;
+
+    InferenceServer(Predictor predictor, int channels, int height, int width, int max_batch = 32, double max_delay_ms = 2.0,
+                    int top_k = 5);
+    // serves model.predict, model must outlive the server
+    InferenceServer(ModularCNN<Type>& model, int channels, int height, int width, int max_batch = 32, double max_delay_ms = 2.0,
+                    int top_k = 5);
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    // image is channels * height * width values in CHW order, copied before submit returns
+    std::future<InferenceResult> submit(const Type* image);
+    InferenceResult infer(const Type* image) { return submit(image).get(); }
+
+    [[nodiscard]] InferenceStats stats() const;
+    void resetStats();
+
+    [[nodiscard]] std::size_t imageSize() const { return static_cast<std::size_t>(channels) * height * width; }
+    [[nodiscard]] int maxBatch() const { return max_batch; }
+    [[nodiscard]] double maxDelayMs() const { return max_delay.count() / 1000.0; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request {
+        std::vector<Type> image;
+        std::promise<InferenceResult> result;
+        Clock::time_point arrival;
+    };
+
+    Predictor predictor;
+    int channels, height, width;
+    int max_batch;
+    std::chrono::microseconds max_delay;
+    int top_k;
+
+    std::thread batcher;
+
+    mutable std::mutex mutex; // guards everything below
+    std::condition_variable arrived;
+    std::deque<Request> queue;
+    bool stopping = false;
+
+    std::vector<double> latencies;   // ring of the latest LATENCY_WINDOW latencies in ms
+    std::size_t requests = 0;        // served since resetStats, latencies holds the last min(requests, LATENCY_WINDOW)
+    std::size_t batches = 0;
+    Clock::time_point first_arrival; // of the first request served since resetStats
+    Clock::time_point last_done;
+
+    void serve();
+    void run(std::vector<Request>& batch);
+};
+
+#include "InferenceServer.tpp"
+
+#endif //INC_12_FINALPROJ_2_INFERENCESERVER_H
@@ -0,0 +1,214 @@
+//
+// Created by Vijay Goyal on 2025-01-29.
+//
+
+#include "InferenceServer.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+template <typename Type>
+InferenceServer<Type>::InferenceServer(Predictor predictor, int channels, int height, int width, int max_batch,
+                                       double max_delay_ms, int top_k)
+        : predictor(std::move(predictor)), channels(channels), height(height), width(width), max_batch(max_batch),
+          max_delay(static_cast<long long>(max_delay_ms * 1000.0)), top_k(top_k) {
+    if(!this->predictor) {
+        throw std::invalid_argument("InferenceServer needs a predictor.");
+    }
+    if(channels <= 0 || height <= 0 || width <= 0) {
+        throw std::invalid_argument("InferenceServer: image dimensions must be positive.");
+    }
+    if(max_batch <= 0 || top_k <= 0 || max_delay_ms < 0.0) {
+        throw std::invalid_argument("InferenceServer: max_batch and top_k must be positive, max_delay_ms not negative.");
+    }
+    latencies.reserve(LATENCY_WINDOW);
+    batcher = std::thread(&InferenceServer<Type>::serve, this);
+}
+
+template <typename Type>
+InferenceServer<Type>::InferenceServer(ModularCNN<Type>& model, int channels, int height, int width, int max_batch,
+                                       double max_delay_ms, int top_k)
+        : InferenceServer([&model](const std::shared_ptr<Tensor<Type>>& input) { return model.predict(input); },
+                          channels, height, width, max_batch, max_delay_ms, top_k) {}
+
+template <typename Type>
+InferenceServer<Type>::~InferenceServer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    arrived.notify_all();
+    if(batcher.joinable()) {
+        batcher.join();
+    }
+    for(Request& request : queue) {
+        request.result.set_exception(std::make_exception_ptr(std::runtime_error("InferenceServer stopped.")));
+    }
+}
+
+template <typename Type>
+std::future<InferenceResult> InferenceServer<Type>::submit(const Type* image) {
+    Request request;
+    request.image.assign(image, image + imageSize());
+    std::future<InferenceResult> result = request.result.get_future();
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(stopping) {
+            throw std::runtime_error("InferenceServer stopped.");
+        }
+        request.arrival = Clock::now();
+        queue.push_back(std::move(request));
+        // the batcher only needs waking for the first request of a batch and for the one that fills it
+        full = queue.size() == 1 || queue.size() >= static_cast<std::size_t>(max_batch);
+    }
+    if(full) {
+        arrived.notify_one();
+    }
+    return result;
+}
+
+/*
+ * batching thread
+ *  - a batch opens with the oldest queued request and closes when it is full or that request has waited max_delay
+ *  - requests that arrive while a batch runs queue up for the next one, so under load batches fill without waiting
+ */
+template <typename Type>
+void InferenceServer<Type>::serve() {
+    std::vector<Request> batch;
+    batch.reserve(max_batch);
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            arrived.wait(lock, [&] { return stopping || !queue.empty(); });
+            if(stopping) {
+                return;
+            }
+            Clock::time_point deadline = queue.front().arrival + max_delay;
+            arrived.wait_until(lock, deadline, [&] {
+                return stopping || queue.size() >= static_cast<std::size_t>(max_batch);
+            });
+            if(stopping) {
+                return;
+            }
+            std::size_t n = std::min(queue.size(), static_cast<std::size_t>(max_batch));
+            for(std::size_t i = 0; i < n; ++i) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+        }
+        run(batch);
+        batch.clear();
+    }
+}
+
+template <typename Type>
+void InferenceServer<Type>::run(std::vector<Request>& batch) {
+    int n = static_cast<int>(batch.size());
+    std::size_t image_size = imageSize();
+    std::shared_ptr<Tensor<Type>> output;
+    try {
+        auto input = std::make_shared<Tensor<Type>>(n, channels, height, width, static_cast<Type>(0), false);
+        for(int i = 0; i < n; ++i) {
+            std::copy(batch[i].image.begin(), batch[i].image.end(), input->data_ptr() + i * image_size);
+        }
+        output = predictor(input);
+        if(output->batch() != n || output->height() != 1 || output->width() != 1) {
+            throw std::runtime_error("InferenceServer: the predictor returned " + std::to_string(output->batch()) +
+                                     " results for a batch of " + std::to_string(n));
+        }
+    }
+    catch(...) {
+        for(Request& request : batch) {
+            request.result.set_exception(std::current_exception());
+        }
+        return;
+    }
+
+    int classes = output->channels();
+    int k = std::min(top_k, classes);
+    std::vector<int> order(classes);
+    std::vector<InferenceResult> results(n);
+    for(int i = 0; i < n; ++i) {
+        InferenceResult& result = results[i];
+        result.probabilities.resize(classes);
+        for(int c = 0; c < classes; ++c) {
+            result.probabilities[c] = static_cast<float>(output->data(i, c, 0, 0));
+        }
+        std::iota(order.begin(), order.end(), 0);
+        std::partial_sort(order.begin(), order.begin() + k, order.end(), [&](int a, int b) {
+            return result.probabilities[a] > result.probabilities[b] ||
+                   (result.probabilities[a] == result.probabilities[b] && a < b);
+        });
+        result.top_classes.assign(order.begin(), order.begin() + k);
+        for(int c : result.top_classes) {
+            result.top_probabilities.push_back(result.probabilities[c]);
+        }
+        result.batch_size = n;
+    }
+
+    // the statistics are recorded before the results are released, so a client that has its result sees it counted
+    Clock::time_point done = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(requests == 0) {
+            first_arrival = batch.front().arrival;
+        }
+        for(int i = 0; i < n; ++i) {
+            results[i].latency_ms = std::chrono::duration<double, std::milli>(done - batch[i].arrival).count();
+            if(latencies.size() < LATENCY_WINDOW) {
+                latencies.push_back(results[i].latency_ms);
+            }
+            else {
+                latencies[requests % LATENCY_WINDOW] = results[i].latency_ms;
+            }
+            ++requests;
+        }
+        ++batches;
+        last_done = done;
+    }
+    for(int i = 0; i < n; ++i) {
+        batch[i].result.set_value(std::move(results[i]));
+    }
+}
+
+// nearest-rank percentiles over the latency window
+template <typename Type>
+InferenceStats InferenceServer<Type>::stats() const {
+    InferenceStats stats;
+    std::vector<double> window;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.requests = requests;
+        stats.batches = batches;
+        if(requests > 0) {
+            double seconds = std::chrono::duration<double>(last_done - first_arrival).count();
+            stats.throughput = seconds > 0.0 ? requests / seconds : 0.0;
+        }
+        window = latencies;
+    }
+    if(window.empty()) {
+        return stats;
+    }
+    stats.mean_batch = static_cast<double>(stats.requests) / stats.batches;
+    std::sort(window.begin(), window.end());
+    auto percentile = [&](double p) {
+        auto rank = static_cast<std::size_t>(std::ceil(p * window.size()));
+        return window[std::max<std::size_t>(rank, 1) - 1];
+    };
+    stats.p50_ms = percentile(0.50);
+    stats.p90_ms = percentile(0.90);
+    stats.p99_ms = percentile(0.99);
+    stats.max_ms = window.back();
+    return stats;
+}
+
+template <typename Type>
+void InferenceServer<Type>::resetStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    latencies.clear();
+    requests = 0;
+    batches = 0;
+}
@@ -0,0 +1,98 @@
+//
+// Created by Vijay Goyal on 2025-01-24.
+//
+
+#ifndef INC_12_FINALPROJ_2_MIXEDPRECISIONCNN_H
+#define INC_12_FINALPROJ_2_MIXEDPRECISIONCNN_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include "ModularCNN.h"
+#include "../tools/BFloat16.h"
+
+/**
+ * @brief ModularCNN trained in mixed precision: weights, activations and gradients are stored as Half (bfloat16),
+ *        the optimizer works on float master weights.
+ *        - inputs and outputs are float tensors, so CrossEntropy<float> and AMSGrad<float> are used as with ModularCNN
+ *        - the kernels accumulate in float (see Accumulator), only stored values are rounded to Half
+ *        - the loss gradient is multiplied by the loss scale before it enters the network and the weight gradients
+ *          are divided by it again in update, a step whose gradients overflowed is skipped
+ *        - with a dynamic loss scale an overflow halves it and every growth_interval good steps double it
+ *        - bfloat16 has the exponent range of float, so the scale defaults to 1, it is there for small gradients
+ *          that would fall below bfloat16's precision and for 16 bit types with a narrower range
+ *        - activations and their gradients take half the memory and bandwidth of ModularCNN<float>, the master
+ *          weights and the three AMSGrad buffers stay float
+ */
+template <typename Half>
+class MixedPrecisionCNN {
+private:
+    ModularCNN<Half> model;
+
+    std::vector<float> master; // float copy of every parameter, the weights the optimizer updates
+    std::vector<float> grads;  // unscaled float gradients of the last backward
+
+    std::shared_ptr<Tensor<Half>> half_input;  // input of the last forward or predict in Half
+    std::shared_ptr<Tensor<Half>> half_output; // network output of the last forward, backward writes its gradient
+
+    float loss_scale = 1.0f;
+    bool dynamic_scale = false;
+    int growth_interval = 2000;
+    int good_steps = 0;
+    int skipped_steps = 0;
+
+    // element-wise copy between tensors of the same shape, any strides
+    template <typename From, typename To>
+    static void convert(const Tensor<From>& src, Tensor<To>& dst, bool grad, float scale = 1.0f);
+
+    std::shared_ptr<Tensor<Half>> toHalf(const std::shared_ptr<Tensor<float>>& input);
+    void syncMaster(); // master = the Half parameters, when it does not match their count
+
+public:
+    explicit MixedPrecisionCNN(const std::vector<LayerConfig>& configs);
+
+    explicit MixedPrecisionCNN(const std::string path); // maps a Half model file written by saveWeights
+
+    std::shared_ptr<Tensor<float>> forward(const std::shared_ptr<Tensor<float>>& input);
+    std::shared_ptr<Tensor<float>> predict(const std::shared_ptr<Tensor<float>>& input);
+
+    // without the softmax, for SoftmaxCrossEntropy<float>, backward takes the tensor logits returns
+    std::shared_ptr<Tensor<float>> logits(const std::shared_ptr<Tensor<float>>& input);
+    std::shared_ptr<Tensor<float>> predictLogits(const std::shared_ptr<Tensor<float>>& input);
+
+    // dOut is the output returned by the last forward or logits, with the loss gradient in its grad
+    void backward(const std::shared_ptr<Tensor<float>>& dOut);
+
+    // one optimizer step on the master weights, false when it was skipped because the gradients overflowed
+    bool update(AMSGrad<float>& optimizer);
+
+    void zeroGrad() { model.zeroGrad(); }
+
+    void saveWeights(const std::string path) { model.saveWeights(path); }
+
+    // dynamic halves the scale on overflow and doubles it after growth_interval steps without one
+    void setLossScale(float scale, bool dynamic = false, int growth_interval = 2000);
+    [[nodiscard]] float lossScale() const { return loss_scale; }
+    [[nodiscard]] int skippedSteps() const { return skipped_steps; }
+
+    void setMemoryPlanning(bool enabled) { model.setMemoryPlanning(enabled); }
+    [[nodiscard]] std::size_t peakMemoryBytes() const { return model.peakMemoryBytes(); }
+
+    void setParallelism(int workers) { model.setParallelism(workers); }
+
+    void setLayout(Layout layout) { model.setLayout(layout); }
+    [[nodiscard]] Layout getLayout() const { return model.getLayout(); }
+
+    void setRecompute(int layer, bool enabled) { model.setRecompute(layer, enabled); }
+    void setCheckpointSegments(int segments) { model.setCheckpointSegments(segments); }
+    [[nodiscard]] const std::vector<bool>& getRecompute() const { return model.getRecompute(); }
+
+    void setProfiling(bool enabled) { model.setProfiling(enabled); }
+    [[nodiscard]] std::shared_ptr<Profiler> getProfiler() const { return model.getProfiler(); }
+
+    [[nodiscard]] ssize_t getTotalParams() const { return model.getTotalParams(); }
+};
+
+#include "MixedPrecisionCNN.tpp"
+
+#endif //INC_12_FINALPROJ_2_MIXEDPRECISIONCNN_H
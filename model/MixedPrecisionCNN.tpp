@@ -0,0 +1,181 @@
+//
+// Created by Vijay Goyal on 2025-01-24.
+//
+
+#include "MixedPrecisionCNN.h"
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+#include "../tools/ThreadPool.h"
+
+template <typename Half>
+MixedPrecisionCNN<Half>::MixedPrecisionCNN(const std::vector<LayerConfig>& configs) : model(configs) {
+    syncMaster();
+}
+
+template <typename Half>
+MixedPrecisionCNN<Half>::MixedPrecisionCNN(const std::string path) : model(path) {
+    syncMaster();
+}
+
+template <typename Half>
+template <typename From, typename To>
+void MixedPrecisionCNN<Half>::convert(const Tensor<From>& src, Tensor<To>& dst, bool grad, float scale) {
+    int channels = src.channels();
+    int height = src.height();
+    int width = src.width();
+    ThreadPool::parallelFor(src.batch() * channels, ThreadPool::grainFor(static_cast<std::size_t>(height) * width), [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / channels;
+            int c = i % channels;
+            for(int h = 0; h < height; ++h) {
+                const From* in = grad ? &src.grad(n, c, h, 0) : &src.data(n, c, h, 0);
+                To* out = grad ? &dst.grad(n, c, h, 0) : &dst.data(n, c, h, 0);
+                for(int w = 0; w < width; ++w) {
+                    out[w] = static_cast<float>(in[w]) * scale;
+                }
+            }
+        }
+    });
+}
+
+// the Half input buffer is kept between calls, the training graph only reads it until the next forward
+template <typename Half>
+std::shared_ptr<Tensor<Half>> MixedPrecisionCNN<Half>::toHalf(const std::shared_ptr<Tensor<float>>& input) {
+    if(!half_input || half_input->shape() != input->shape()) {
+        const auto& shape = input->shape();
+        half_input = std::make_shared<Tensor<Half>>(shape[0], shape[1], shape[2], shape[3], static_cast<Half>(0.0f), false);
+    }
+    convert(*input, *half_input, false);
+    return half_input;
+}
+
+template <typename Half>
+void MixedPrecisionCNN<Half>::syncMaster() {
+    ParameterBuffer<Half>& parameters = model.getParameters();
+    if(master.size() == parameters.size()) {
+        return;
+    }
+    const Half* values = std::as_const(parameters).data();
+    master.assign(values, values + parameters.size());
+    grads.assign(parameters.size(), 0.0f);
+}
+
+template <typename Half>
+std::shared_ptr<Tensor<float>> MixedPrecisionCNN<Half>::forward(const std::shared_ptr<Tensor<float>>& input) {
+    half_output = model.forward(toHalf(input));
+    const auto& shape = half_output->shape();
+    auto output = std::make_shared<Tensor<float>>(shape[0], shape[1], shape[2], shape[3]);
+    convert(*half_output, *output, false);
+    return output;
+}
+
+template <typename Half>
+std::shared_ptr<Tensor<float>> MixedPrecisionCNN<Half>::predict(const std::shared_ptr<Tensor<float>>& input) {
+    auto result = model.predict(toHalf(input));
+    const auto& shape = result->shape();
+    auto output = std::make_shared<Tensor<float>>(shape[0], shape[1], shape[2], shape[3], 0.0f, false);
+    convert(*result, *output, false);
+    return output;
+}
+
+template <typename Half>
+std::shared_ptr<Tensor<float>> MixedPrecisionCNN<Half>::logits(const std::shared_ptr<Tensor<float>>& input) {
+    half_output = model.logits(toHalf(input));
+    const auto& shape = half_output->shape();
+    auto output = std::make_shared<Tensor<float>>(shape[0], shape[1], shape[2], shape[3]);
+    convert(*half_output, *output, false);
+    return output;
+}
+
+template <typename Half>
+std::shared_ptr<Tensor<float>> MixedPrecisionCNN<Half>::predictLogits(const std::shared_ptr<Tensor<float>>& input) {
+    auto result = model.predictLogits(toHalf(input));
+    const auto& shape = result->shape();
+    auto output = std::make_shared<Tensor<float>>(shape[0], shape[1], shape[2], shape[3], 0.0f, false);
+    convert(*result, *output, false);
+    return output;
+}
+
+template <typename Half>
+void MixedPrecisionCNN<Half>::backward(const std::shared_ptr<Tensor<float>>& dOut) {
+    if(!half_output) {
+        throw std::runtime_error("MixedPrecisionCNN::backward called before forward.");
+    }
+    if(dOut->shape() != half_output->shape() || !dOut->hasGrad()) {
+        throw std::invalid_argument("MixedPrecisionCNN::backward expects the output of the last forward with its gradient.");
+    }
+    convert(*dOut, *half_output, true, loss_scale);
+    model.backward(half_output);
+}
+
+/*
+ * optimizer step on the float master weights
+ *  - the Half gradients are unscaled into grads, an infinite or NaN one (exponent all ones) skips the step
+ *  - the updated master weights are rounded back into the Half parameters the network runs on
+ */
+template <typename Half>
+bool MixedPrecisionCNN<Half>::update(AMSGrad<float>& optimizer) {
+    auto profiler = model.getProfiler();
+    auto mark = profiler->begin(Tensor<Half>::allocatedBytes());
+
+    ParameterBuffer<Half>& parameters = model.getParameters();
+    syncMaster();
+    const std::ptrdiff_t n = static_cast<std::ptrdiff_t>(parameters.size());
+    const Half* half_grads = parameters.grad();
+    float* g = grads.data();
+    const float unscale = 1.0f / loss_scale;
+
+    // tested on the bits, -ffast-math lets the compiler assume std::isfinite is always true
+    std::atomic<bool> finite{true};
+    ThreadPool::parallelFor(n, ThreadPool::MIN_SLICE, [&](std::ptrdiff_t first, std::ptrdiff_t last) {
+        bool slice_finite = true;
+        #pragma omp simd reduction(&&:slice_finite)
+        for(std::ptrdiff_t i = first; i < last; ++i) {
+            slice_finite = slice_finite && (half_grads[i].bits & 0x7f80u) != 0x7f80u;
+            g[i] = static_cast<float>(half_grads[i]) * unscale;
+        }
+        if(!slice_finite) {
+            finite.store(false, std::memory_order_relaxed);
+        }
+    });
+
+    if(!finite.load()) {
+        ++skipped_steps;
+        good_steps = 0;
+        if(dynamic_scale) {
+            loss_scale *= 0.5f;
+        }
+    }
+    else {
+        optimizer.update(master.data(), g, master.size());
+        Half* values = parameters.data();
+        const float* m = master.data();
+        ThreadPool::parallelFor(n, ThreadPool::MIN_SLICE, [&](std::ptrdiff_t first, std::ptrdiff_t last) {
+            #pragma omp simd
+            for(std::ptrdiff_t i = first; i < last; ++i) {
+                values[i] = m[i];
+            }
+        });
+        if(dynamic_scale && ++good_steps >= growth_interval) {
+            loss_scale *= 2.0f;
+            good_steps = 0;
+        }
+    }
+
+    if(profiler->isEnabled()) {
+        profiler->end(mark, "amsgrad", "update", -1, 0.0, Tensor<Half>::allocatedBytes());
+    }
+    return finite.load();
+}
+
+template <typename Half>
+void MixedPrecisionCNN<Half>::setLossScale(float scale, bool dynamic, int growth) {
+    if(!(scale > 0.0f) || growth < 1) {
+        throw std::invalid_argument("Loss scale must be positive and the growth interval at least 1.");
+    }
+    loss_scale = scale;
+    dynamic_scale = dynamic;
+    growth_interval = growth;
+    good_steps = 0;
+}
@@ -9,14 +9,19 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <functional>
 #include "../tools/LayerConfig.h"
 #include "../layers/ConvolutionLayer.h"
 #include "../layers/MaxPoolingLayer.h"
 #include "../layers/FullyConnectedLayer.h"
+#include "../layers/MergeLayer.h"
 #include "../tools/ComputationGraph.h"
 #include "../tools/ConvolutionOperation.h"
 #include "../tools/MaxPoolingOperation.h"
 #include "../tools/FullyConnectedOperation.h"
+#include "../tools/MergeOperation.h"
+#include "../tools/ReorderOperation.h"
+#include "../tools/Layout.h"
 #include "../tools/Tensor.h"
 #include "../layers/Layer.h"
 #include "../tools/WeightStruct.h"
@@ -26,41 +31,128 @@
 #include "../tools/ConvolutionalWeights.h"
 #include "../tools/PoolingWeights.h"
 #include "../tools/AMSGrad.h"
+#include "../tools/OverlappedUpdate.h"
+#include "../tools/ParameterBuffer.h"
+#include "../tools/ModelFile.h"
+#include "../tools/Profiler.h"
 
 /**
  * @brief A fully modular CNN class that allows specifying an arbitrary sequence
  *        of convolution, pooling, and fully connected layers. The user can define
  *        the structure (layer types + shapes) up front, then we build a
  *        ComputationGraph from it.
+ *        - with LayerConfig::inputs and add/concat layers the layers form a graph instead (Inception branches,
+ *          residual connections), the last layer is the output, independent branches run at the same time
+ *        - activations are NCHW or, with setLayout, channel-blocked between a reorder after the input and one before
+ *          the output, inputs and outputs of the model stay NCHW either way
+ *        - layers marked recompute (LayerConfig::recompute, setRecompute, setCheckpointSegments) give their activation
+ *          memory back after forward and run forward again during backward, trading step time for training memory
  */
 template <typename Type>
 class ModularCNN {
 private:
+    typedef typename Accumulator<Type>::type Acc;
+
     // store the sequence of layers
     std::vector<std::string> layerTypes; // "conv", "pool", "fc", etc.
 
     std::vector<std::shared_ptr<Layer<Type>>> layers;
 
+    std::vector<std::vector<int>> layerInputs; // layers (or -1, the input) each layer reads, {i - 1} in a sequence
+
     ComputationGraph<Type> graph;
+
+    ParameterBuffer<Type> parameters; // every layer's parameters and gradients, also the weight image of a model file
+
+    std::shared_ptr<Profiler> profiler = std::make_shared<Profiler>(); // shared with the graph, survives buildGraph
+
+    std::function<void(int)> backward_hook; // survives buildGraph as well
+    int parallelism = 0;                    // so does this
+    Layout layout = Layout::NCHW;           // and this
+    std::vector<bool> recomputed;           // and the layers backward recomputes
+
+    std::vector<int> layerOps; // operation of each layer, reorders of a blocked layout sit between them
+
+    std::shared_ptr<OverlappedUpdate<Type>> overlapped; // worker of backwardAndStep, started by its first call
+
+    // backward_hook as the graph calls it, with operation indices turned into layer indices and reorders skipped
+    std::function<void(int)> layerHook() const;
+
 public:
     explicit ModularCNN(const std::vector<LayerConfig>& configs);
 
-    explicit ModularCNN(const std::string path);
+    explicit ModularCNN(const std::string path); // maps a file written by saveWeights, throws if it is not one
 
     void buildGraph();
 
     std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& input);
-    int forwards(const std::shared_ptr<Tensor<Type>>& input);
+    int forwards(const std::shared_ptr<Tensor<Type>>& input); // most likely class of the first image
+    std::vector<int> classify(const std::shared_ptr<Tensor<Type>>& input); // most likely class of every image
+
+    // inference only: no gradient buffers, argmax indices or pre-activation caches, activations are reused between calls
+    std::shared_ptr<Tensor<Type>> predict(const std::shared_ptr<Tensor<Type>>& input);
+
+    // the raw network output without the softmax, for SoftmaxCrossEntropy: logits trains like forward, predictLogits
+    // infers like predict
+    std::shared_ptr<Tensor<Type>> logits(const std::shared_ptr<Tensor<Type>>& input) { return graph.forward(input); }
+    std::shared_ptr<Tensor<Type>> predictLogits(const std::shared_ptr<Tensor<Type>>& input) { return graph.infer(input); }
 
     void backward(const std::shared_ptr<Tensor<Type>>& dOut);
 
-    void update(AMSGrad<Type>& optimizer);
+    void update(AMSGrad<Type>& optimizer); // one fused optimizer step over every parameter
+
+    // backward, update and zeroGrad in one: each layer's parameters take their optimizer step, and get their gradients
+    // zeroed, on a worker thread as soon as backward has finished them, while backward goes on with the layers before,
+    // the parameters end up the same as with the three calls, a backward hook is still called first for each layer
+    void backwardAndStep(const std::shared_ptr<Tensor<Type>>& dOut, AMSGrad<Type>& optimizer);
 
     void zeroGrad();
 
     void saveWeights(const std::string path);
 
+    // training activations are placed in one planned arena, see ComputationGraph
+    void setMemoryPlanning(bool enabled) { graph.setMemoryPlanning(enabled); }
+    [[nodiscard]] std::size_t peakMemoryBytes() const { return graph.peakMemoryBytes(); }
+
+    // threads running independent layers at once, 0 (the default) uses up to the widest level of the graph, 1 runs
+    // the layers one at a time, a sequence always does, see ComputationGraph
+    void setParallelism(int workers);
+    [[nodiscard]] int getParallelism() const { return parallelism; }
+
+    // activation layout inside the graph, rebuilds it: NCHW (the default) or NCHW8c / NCHW16c, where every layer
+    // vectorises over a block of channels, see ChannelBlocking, fully connected layers gather their blocked input
+    void setLayout(Layout new_layout);
+    [[nodiscard]] Layout getLayout() const { return layout; }
+
+    // gradient checkpointing: a recomputed layer keeps neither its output nor its backward caches between forward and
+    // backward, the first backward needing them recomputes the layer from the kept outputs before it, the last layer
+    // is always kept and nothing is recomputed with memory planning off, see ComputationGraph
+    void setRecompute(int layer, bool enabled);
+    // splits the layers into that many runs of consecutive layers and recomputes all but the last layer of each run,
+    // 0 recomputes nothing
+    void setCheckpointSegments(int segments);
+    [[nodiscard]] const std::vector<bool>& getRecompute() const { return recomputed; }
+
+    // per-operation timing of forward, backward, predict and update, off by default
+    void setProfiling(bool enabled) { profiler->setEnabled(enabled); }
+    [[nodiscard]] std::shared_ptr<Profiler> getProfiler() const { return profiler; }
+
+    // called with the index of each layer once backward has finished its gradients, last layer first, see DataParallel
+    void setBackwardHook(std::function<void(int)> hook);
+
     [[nodiscard]] ssize_t getTotalParams() const;
+
+    // every parameter and gradient of the model, e.g. for an optimizer that keeps its own copy of the weights
+    ParameterBuffer<Type>& getParameters() { return parameters; }
+
+    // the layers in order with their type names ("conv", "pool", "fc", "add", "concat"), e.g. to quantise the model
+    [[nodiscard]] const std::vector<std::shared_ptr<Layer<Type>>>& getLayers() const { return layers; }
+    [[nodiscard]] const std::vector<std::string>& getLayerTypes() const { return layerTypes; }
+    [[nodiscard]] const std::vector<std::vector<int>>& getLayerInputs() const { return layerInputs; }
+    [[nodiscard]] bool isSequential() const; // every layer reads only the one before it
+
+    static void softmax(Tensor<Type>& logits); // in place, per sample over the channel dimension
+    static std::vector<int> argmax(const Tensor<Type>& scores); // per sample, the channel with the highest score
 };
 
 #include "ModularCNN.tpp"
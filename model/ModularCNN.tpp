@@ -5,6 +5,10 @@
 #include "ModularCNN.h"
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
 
 template <typename Type>
 ModularCNN<Type>::ModularCNN(const std::vector<LayerConfig>& configs) {
@@ -19,6 +23,7 @@ ModularCNN<Type>::ModularCNN(const std::vector<LayerConfig>& configs) {
                     cfg.stride,
                     cfg.padding
             );
+            conv->setWinogradTile(cfg.winograd_tile);
             layers.push_back(conv);
             layerTypes.emplace_back("conv");
         }
@@ -40,126 +45,248 @@ ModularCNN<Type>::ModularCNN(const std::vector<LayerConfig>& configs) {
             layers.push_back(fc);
             layerTypes.emplace_back("fc");
         }
+        else if(cfg.type == "add" || cfg.type == "concat") {
+            layers.push_back(std::make_shared<MergeLayer<Type>>(cfg.type == "add" ? MergeKind::Add : MergeKind::Concat));
+            layerTypes.push_back(cfg.type);
+        }
         else {
             throw std::runtime_error("Unknown layer type: " + cfg.type);
         }
+        int index = static_cast<int>(layerInputs.size());
+        layerInputs.push_back(cfg.inputs.empty() ? std::vector<int>{index - 1} : cfg.inputs);
+        recomputed.push_back(cfg.recompute);
     }
 
-    // automatically build the graph
+    // move every layer's parameters into one buffer for the optimizer, then build the graph
+    parameters.pack(layers);
     buildGraph();
 }
 
+/*
+ * one operation per layer, reading the operations of the layers in layerInputs
+ *  - in a blocked layout the input is reordered into blocks once, by an operation every layer reading the input
+ *    shares (fully connected layers read the NCHW input itself), and the output is reordered back unless a fully
+ *    connected layer produced it
+ *  - the channels of every layer are tracked for concat and the output reorder, the input's are those of the first
+ *    convolution reading it
+ */
 template <typename Type>
 void ModularCNN<Type>::buildGraph() {
     // clear existing ops
     graph = ComputationGraph<Type>();
+    graph.setProfiler(profiler);
+    graph.setParallelism(parallelism);
+    layerOps.assign(layers.size(), ComputationGraph<Type>::INPUT);
 
-    // iterate over layers in order
+    bool blocked = layout != Layout::NCHW;
+    std::vector<int> channels(layers.size(), 0);
+    int input_channels = 0;
+    bool reads_input = false; // a layer other than fc reads the input
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        if(std::find(layerInputs[i].begin(), layerInputs[i].end(), -1) == layerInputs[i].end() || layerTypes[i] == "fc") {
+            continue;
+        }
+        reads_input = true;
+        auto convPtr = std::dynamic_pointer_cast<ConvolutionLayer<Type>>(layers[i]);
+        if(convPtr && !input_channels) {
+            input_channels = convPtr->in_channels;
+        }
+    }
+    int blocked_input = ComputationGraph<Type>::INPUT;
+    if(blocked && reads_input) {
+        blocked_input = graph.addOperation(std::make_shared<ReorderOperation<Type>>(layout, true), {ComputationGraph<Type>::INPUT});
+    }
+    auto channelsOf = [&](std::size_t i, int p) {
+        int count = p < 0 ? input_channels : channels[p];
+        if(!count) {
+            throw std::invalid_argument("Layer " + std::to_string(i) + " (" + layerTypes[i] + ") needs the channels of the input in " +
+                                        layoutName(layout) + ", give it a convolution reading the input.");
+        }
+        return count;
+    };
+
+    // iterate over layers in order, each reads the layers listed in layerInputs
     for(std::size_t i = 0; i < layers.size(); ++i) {
         std::string t = layerTypes[i];
+        const std::vector<int>& inputs = layerInputs[i];
+        if(t != "add" && t != "concat" && inputs.size() != 1) {
+            throw std::invalid_argument("Layer " + std::to_string(i) + " (" + t + ") must read exactly one input, only add and concat merge several");
+        }
+        std::vector<int> ops;
+        for(int p : inputs) {
+            if(p < -1 || p >= static_cast<int>(i)) {
+                throw std::invalid_argument("Layer " + std::to_string(i) + " (" + t + ") can only read the input or an earlier layer, not " + std::to_string(p));
+            }
+            if(blocked && t != "fc" && p >= 0 && layerTypes[p] == "fc") {
+                throw std::invalid_argument("Layer " + std::to_string(i) + " (" + t + ") reads a fully connected layer, in " +
+                                            layoutName(layout) + " only fully connected layers can follow one.");
+            }
+            ops.push_back(p >= 0 ? layerOps[p] : t == "fc" ? ComputationGraph<Type>::INPUT : blocked_input);
+        }
+        // the layout of the layer's input, fully connected outputs and the graph input are NCHW
+        Layout input_layout = t == "fc" && (inputs[0] < 0 || layerTypes[inputs[0]] == "fc") ? Layout::NCHW : layout;
+
         if(t == "conv") {
             // dynamic_cast to ConvolutionLayer<Type>*
             auto convPtr = std::dynamic_pointer_cast<ConvolutionLayer<Type>>(layers[i]);
             if(!convPtr) {
                 throw std::runtime_error("Failed dynamic_cast to ConvolutionLayer in buildGraph");
             }
-            graph.addOperation(std::make_shared<ConvolutionOperation<Type>>(*convPtr));
+            channels[i] = convPtr->out_channels;
+            layerOps[i] = graph.addOperation(std::make_shared<ConvolutionOperation<Type>>(*convPtr, layout), ops);
         } else if (t == "pool") {
             // dynamic_cast to MaxPoolingLayer<Type>*
             auto poolPtr = std::dynamic_pointer_cast<MaxPoolingLayer<Type>>(layers[i]);
             if(!poolPtr) {
                 throw std::runtime_error("Failed dynamic_cast to MaxPoolingLayer in buildGraph");
             }
-            graph.addOperation(std::make_shared<MaxPoolingOperation<Type>>(
-                    poolPtr->pool_height, poolPtr->pool_width, poolPtr->stride, poolPtr->padding));
+            channels[i] = inputs[0] < 0 ? input_channels : channels[inputs[0]];
+            layerOps[i] = graph.addOperation(std::make_shared<MaxPoolingOperation<Type>>(
+                    poolPtr->pool_height, poolPtr->pool_width, poolPtr->stride, poolPtr->padding, layout), ops);
         } else if (t == "fc") {
             // dynamic_cast to FullyConnectedLayer<Type>*
             auto fcPtr = std::dynamic_pointer_cast<FullyConnectedLayer<Type>>(layers[i]);
             if(!fcPtr) {
                 throw std::runtime_error("Failed dynamic_cast to FullyConnectedLayer in buildGraph");
             }
-            graph.addOperation(std::make_shared<FullyConnectedOperation<Type>>(*fcPtr));
+            channels[i] = fcPtr->out_features;
+            layerOps[i] = graph.addOperation(std::make_shared<FullyConnectedOperation<Type>>(*fcPtr, true, input_layout), ops);
+        } else if (t == "add" || t == "concat") {
+            auto mergePtr = std::dynamic_pointer_cast<MergeLayer<Type>>(layers[i]);
+            if(!mergePtr) {
+                throw std::runtime_error("Failed dynamic_cast to MergeLayer in buildGraph");
+            }
+            std::vector<int> input_counts;
+            if(t == "concat" && blocked) {
+                for(int p : inputs) {
+                    input_counts.push_back(channelsOf(i, p));
+                }
+            }
+            for(int p : t == "add" ? std::vector<int>{inputs[0]} : inputs) {
+                channels[i] += p < 0 ? input_channels : channels[p];
+            }
+            layerOps[i] = graph.addOperation(std::make_shared<MergeOperation<Type>>(mergePtr->kind, layout, input_counts), ops);
         } else {
             throw std::runtime_error("Unknown layer type in buildGraph: " + t);
         }
     }
+
+    if(blocked && !layers.empty() && layerTypes.back() != "fc") {
+        std::size_t last = layers.size() - 1;
+        if(!channels[last]) {
+            throw std::invalid_argument("The output of layer " + std::to_string(last) + " needs the channels of the input in " +
+                                        layoutName(layout) + ", give it a convolution reading the input.");
+        }
+        graph.addOperation(std::make_shared<ReorderOperation<Type>>(layout, false, channels[last]), {layerOps[last]});
+    }
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        graph.setRecompute(layerOps[i], recomputed[i]);
+    }
+    graph.setBackwardHook(layerHook());
 }
 
-template<typename Type>
-ModularCNN<Type>::ModularCNN(const std::string path) {
-    std::ifstream file(path);
-    if (!file) {
-        std::cerr<< "Error opening file" << std::endl;
-        return;
+template <typename Type>
+std::function<void(int)> ModularCNN<Type>::layerHook() const {
+    if(!backward_hook || graph.size() == static_cast<int>(layers.size())) {
+        return backward_hook;
+    }
+    std::vector<int> layer_of(graph.size(), -1);
+    for(std::size_t i = 0; i < layerOps.size(); ++i) {
+        layer_of[layerOps[i]] = static_cast<int>(i);
     }
-    uint32_t count = 0;
-    file.read(reinterpret_cast<char*>(&count), sizeof(count));
-    for (uint32_t i = 0; i < count; ++i) {
-        uint32_t typeVal = 0;
-        file.read(reinterpret_cast<char*>(&typeVal), sizeof(typeVal));
-
-        switch (auto type = static_cast<WeightStructType>(typeVal)) {
-            case WeightStructType::ConvolutionalWeights:
-                layers.emplace_back(ConvolutionalWeights<Type>::deserialize(file));
-                layerTypes.emplace_back("conv");
-                break;
-            case WeightStructType::ConnectedWeights:
-                layers.emplace_back(ConnectedWeights<Type>::deserialize(file));
-                layerTypes.emplace_back("fc");
-                break;
-            case WeightStructType::PoolingWeights:
-                layers.emplace_back(PoolingWeights<Type>::deserialize(file));
-                layerTypes.emplace_back("pool");
-                break;
+    return [hook = backward_hook, layer_of](int op) {
+        if(layer_of[op] >= 0) {
+            hook(layer_of[op]);
         }
+    };
+}
+
+template <typename Type>
+void ModularCNN<Type>::setLayout(Layout new_layout) {
+    Layout previous = layout;
+    layout = new_layout;
+    try {
+        buildGraph();
+    }
+    catch(...) {
+        layout = previous; // a graph that cannot be blocked keeps the layout it had
+        buildGraph();
+        throw;
     }
+}
+
+template<typename Type>
+ModularCNN<Type>::ModularCNN(const std::string path) {
+    // the weights stay in the mapped file, see ModelFile
+    ModelFile<Type>::load(path, layers, layerTypes, layerInputs, parameters);
+    recomputed.assign(layers.size(), false);
     buildGraph();
 }
 
 
 template <typename Type>
-std::shared_ptr<Tensor<Type>> ModularCNN<Type>::forward(const std::shared_ptr<Tensor<Type>>& input) {
-    auto output = graph.forward(input);
+void ModularCNN<Type>::softmax(Tensor<Type>& output) {
+    int batch_size = output.batch();
+    int num_classes = output.channels();
 
     // Process each batch
-   for (auto& batch : output->data) {
-    // Pre-allocate vectors to avoid reallocation
-    std::vector<Type> logits(batch.size());
-    std::vector<Type> scaled(batch.size());
+    for (int n = 0; n < batch_size; n++) {
+        Type* logits = &output.data(n, 0, 0, 0);
 
-    // Direct indexing instead of push_back
-    for (size_t i = 0; i < batch.size(); i++) {
-        logits[i] = batch[i][0][0];
-    }
+        // computed in Acc, for bfloat16 only the stored exponentials and probabilities are rounded
+        Acc maxVal = *std::max_element(logits, logits + num_classes);
+        Acc sum = 0;
 
-    Type maxVal = *std::max_element(logits.begin(), logits.end());
-    Type sum = 0;
+        // exponentiate in place, the logits are not needed afterwards
+        for (int i = 0; i < num_classes; i++) {
+            Acc e = std::exp((static_cast<Acc>(logits[i]) - maxVal) / Acc(100.0) + Acc(1e-7));
+            logits[i] = e;
+            sum += e;
+        }
 
-    // Combine loops to minimize memory access
-    for (size_t i = 0; i < logits.size(); i++) {
-        scaled[i] = std::exp((logits[i] - maxVal) / Type(100.0) + Type(1e-7));
-        sum += scaled[i];
+        // Single pass for normalization
+        for (int i = 0; i < num_classes; i++) {
+            logits[i] = static_cast<Acc>(logits[i]) / sum;
+        }
     }
+}
 
-    // Single pass for normalization
-    for (size_t i = 0; i < batch.size(); i++) {
-        batch[i][0][0] = scaled[i] / sum;
-    }
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ModularCNN<Type>::forward(const std::shared_ptr<Tensor<Type>>& input) {
+    auto output = graph.forward(input);
+    softmax(*output);
+    return output;
 }
 
-return output;
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ModularCNN<Type>::predict(const std::shared_ptr<Tensor<Type>>& input) {
+    auto output = graph.infer(input);
+    softmax(*output);
+    return output;
 }
 
 template <typename Type>
-int ModularCNN<Type>::forwards(const std::shared_ptr<Tensor<Type>>& input) {
-    auto output = graph.forward(input);
-    int maxIndex = 0;
-    for (int i = 0; i < output->data.size(); i++) {
-        if (output->data[i][0][0][0] > output->data[maxIndex][0][0][0]) {
-            maxIndex = i;
+std::vector<int> ModularCNN<Type>::argmax(const Tensor<Type>& scores) {
+    std::vector<int> classes(scores.batch(), 0);
+    for(int n = 0; n < scores.batch(); ++n) {
+        for(int c = 1; c < scores.channels(); ++c) {
+            if(scores.data(n, c, 0, 0) > scores.data(n, classes[n], 0, 0)) {
+                classes[n] = c;
+            }
         }
     }
-    return maxIndex;
+    return classes;
+}
+
+// the softmax does not change the order, so the logits are compared directly
+template <typename Type>
+int ModularCNN<Type>::forwards(const std::shared_ptr<Tensor<Type>>& input) {
+    return argmax(*graph.infer(input->sliceBatch(0, 1))).front();
+}
+
+template <typename Type>
+std::vector<int> ModularCNN<Type>::classify(const std::shared_ptr<Tensor<Type>>& input) {
+    return argmax(*graph.infer(input));
 }
 
 template <typename Type>
@@ -167,52 +294,118 @@ void ModularCNN<Type>::backward(const std::shared_ptr<Tensor<Type>>& dOut) {
     graph.backward(dOut);
 }
 
+template <typename Type>
+void ModularCNN<Type>::setBackwardHook(std::function<void(int)> hook) {
+    backward_hook = std::move(hook);
+    graph.setBackwardHook(layerHook());
+}
+
+template <typename Type>
+void ModularCNN<Type>::setParallelism(int workers) {
+    graph.setParallelism(workers);
+    parallelism = workers;
+}
+
+template <typename Type>
+void ModularCNN<Type>::setRecompute(int layer, bool enabled) {
+    if(layer < 0 || layer >= static_cast<int>(layers.size())) {
+        throw std::out_of_range("ModularCNN: no layer " + std::to_string(layer) + " to recompute.");
+    }
+    recomputed[layer] = enabled;
+    graph.setRecompute(layerOps[layer], enabled);
+}
+
+template <typename Type>
+void ModularCNN<Type>::setCheckpointSegments(int segments) {
+    if(segments < 0) {
+        throw std::invalid_argument("ModularCNN: the number of checkpoint segments cannot be negative.");
+    }
+    int count = static_cast<int>(layers.size());
+    for(int i = 0; i < count; ++i) {
+        // layer i ends segment s when the next layer starts segment s + 1
+        bool kept = segments == 0 || i == count - 1 || static_cast<long long>(i) * segments / count != static_cast<long long>(i + 1) * segments / count;
+        setRecompute(i, !kept);
+    }
+}
+
+template <typename Type>
+bool ModularCNN<Type>::isSequential() const {
+    for(std::size_t i = 0; i < layerInputs.size(); ++i) {
+        if(layerInputs[i] != std::vector<int>{static_cast<int>(i) - 1}) {
+            return false;
+        }
+    }
+    return true;
+}
+
 template <typename Type>
 void ModularCNN<Type>::update(AMSGrad<Type>& optimizer) {
-    int index = 0;
-    for(auto &layerPtr : layers) {
-        if (layerTypes[index] == "conv") {
-            auto *temp = dynamic_cast<ConvolutionLayer<Type>*>(layerPtr.get());
-            if (!temp) {
-                throw std::invalid_argument("Layer cast to ConvolutionLayer failed.");
-            }
+    if(!profiler->isEnabled()) {
+        optimizer.update(parameters);
+        return;
+    }
+    auto mark = profiler->begin(Tensor<Type>::allocatedBytes());
+    optimizer.update(parameters);
+    profiler->end(mark, "amsgrad", "update", -1, 0.0, Tensor<Type>::allocatedBytes());
+}
 
-            // Verify dBiases size matches out_channels
-            size_t out_channels = temp->filters.size();
-            if (temp->dBiases.size() != out_channels) {
-                throw std::out_of_range(
-                    "dBiases size (" + std::to_string(temp->dBiases.size()) +
-                    ") does not match out_channels (" + std::to_string(out_channels) + ") in ConvolutionLayer."
-                );
-            }
-            optimizer.update(*temp, temp->dFilters, temp->dBiases);
+/*
+ * the parameter buffer is in layer order, so a layer's tensors are one range of it (with the padding between them)
+ * and the ranges of all layers cover it, a profiled step runs the three passes one after the other
+ */
+template <typename Type>
+void ModularCNN<Type>::backwardAndStep(const std::shared_ptr<Tensor<Type>>& dOut, AMSGrad<Type>& optimizer) {
+    if(profiler->isEnabled()) {
+        backward(dOut);
+        update(optimizer);
+        zeroGrad();
+        return;
+    }
+    std::vector<std::pair<std::size_t, std::size_t>> ranges(layers.size(), {0, 0});
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        auto tensors = layers[i]->parameters();
+        if(!tensors.empty()) {
+            std::size_t begin = parameters.offsetOf(*tensors.front());
+            std::size_t end = parameters.offsetOf(*tensors.back()) + ParameterBuffer<Type>::alignedSize(tensors.back()->size());
+            ranges[i] = {begin, end - begin};
         }
-        if (layerTypes[index] == "fc") {
-            auto *temp = dynamic_cast<FullyConnectedLayer<Type>*>(layerPtr.get());
-            if (!temp) {
-                throw std::invalid_argument("Layer cast to FullyConnectedLayer failed.");
-            }
+    }
+    if(!overlapped) {
+        overlapped = std::make_shared<OverlappedUpdate<Type>>(layers.size());
+    }
+    overlapped->begin(optimizer, parameters);
 
-            // Verify dBiases size matches out_features
-            size_t out_features = temp->out_features;
-            if (temp->dBiases.size() != out_features) {
-                throw std::out_of_range(
-                    "dBiases size (" + std::to_string(temp->dBiases.size()) +
-                    ") does not match out_features (" + std::to_string(out_features) + ") in FullyConnectedLayer."
-                );
-            }
-            optimizer.update(*temp, temp->dWeights, temp->dBiases);
+    auto user_hook = backward_hook;
+    backward_hook = [&](int layer) {
+        if(user_hook) {
+            user_hook(layer);
         }
-        index++;
+        if(ranges[layer].second) {
+            overlapped->post(ranges[layer].first, ranges[layer].second);
+        }
+    };
+    graph.setBackwardHook(layerHook());
+    backward_hook = user_hook;
+    try {
+        graph.backward(dOut);
     }
+    catch(...) {
+        graph.setBackwardHook(layerHook());
+        try {
+            overlapped->finish();
+        }
+        catch(...) {
+            // the backward error is the one to report
+        }
+        throw;
+    }
+    graph.setBackwardHook(layerHook());
+    overlapped->finish();
 }
 
 template <typename Type>
 void ModularCNN<Type>::zeroGrad() {
-    // loop over all layers in 'layers'
-    for(auto &layerPtr : layers) {
-        layerPtr->zeroGrad();
-    }
+    parameters.zeroGrad();
 }
 
 // Count all parameters
@@ -228,27 +421,5 @@ ssize_t ModularCNN<Type>::getTotalParams() const {
 // Save all weights to a bin file
 template <typename Type>
 void ModularCNN<Type>::saveWeights(const std::string path) {
-    std::vector<std::shared_ptr<WeightStruct<Type>>> weights;
-
-    for(auto &layerPtr : layers) {
-        weights.emplace_back(layerPtr->saveWeights());
-    }
-
-    std::ofstream file(path, std::ios::binary | std::ios::trunc);
-
-    if (!file) {
-        std::cerr << "Error opening file for writing.\n";
-        return;
-    }
-
-    uint32_t count = static_cast<uint32_t>(weights.size());
-    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
-
-    for (const auto &obj : weights) {
-        uint32_t typeVal = static_cast<uint32_t>(obj->getType());
-        file.write(reinterpret_cast<const char*>(&typeVal), sizeof(typeVal));
-        obj->serialize(file);
-    }
-    file.close();
+    ModelFile<Type>::save(path, layers, parameters, isSequential() ? std::vector<std::vector<int>>{} : layerInputs);
 }
-
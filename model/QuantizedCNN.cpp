@@ -0,0 +1,611 @@
+//
+// Created by Vijay Goyal on 2025-01-25.
+//
+
+#include "QuantizedCNN.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include "../tools/ThreadPool.h"
+
+std::string QuantizationReport::summary() const {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%d samples: float accuracy %.4f, int8 accuracy %.4f, agreement %.4f, max probability error %.3g",
+                  samples, floatAccuracy(), quantizedAccuracy(), agreement(), max_probability_error);
+    return line;
+}
+
+namespace {
+    // max pool of one plane, windows are clipped to the plane like MaxPoolingOperation::poolPlane
+    template <typename Value>
+    void poolPlane(const Value* src, int height, int width, const LayerConfig& config, Value* dst) {
+        int out_height = (height + 2 * config.padding - config.pool_height) / config.stride + 1;
+        int out_width = (width + 2 * config.padding - config.pool_width) / config.stride + 1;
+        if(config.pool_height == 2 && config.pool_width == 2 && config.stride == 2 && config.padding == 0) {
+            for(int h = 0; h < out_height; ++h) {
+                const Value* top = src + static_cast<std::ptrdiff_t>(2 * h) * width;
+                const Value* bottom = top + width;
+                Value* row = dst + static_cast<std::ptrdiff_t>(h) * out_width;
+                #pragma omp simd
+                for(int w = 0; w < out_width; ++w) {
+                    row[w] = std::max(std::max(top[2 * w], top[2 * w + 1]), std::max(bottom[2 * w], bottom[2 * w + 1]));
+                }
+            }
+            return;
+        }
+        for(int h = 0; h < out_height; ++h) {
+            int h_start = std::max(h * config.stride - config.padding, 0);
+            int h_end = std::min(h * config.stride - config.padding + config.pool_height, height);
+            for(int w = 0; w < out_width; ++w) {
+                int w_start = std::max(w * config.stride - config.padding, 0);
+                int w_end = std::min(w * config.stride - config.padding + config.pool_width, width);
+                Value max_val = std::numeric_limits<Value>::lowest();
+                for(int ph = h_start; ph < h_end; ++ph) {
+                    for(int pw = w_start; pw < w_end; ++pw) {
+                        max_val = std::max(max_val, src[static_cast<std::ptrdiff_t>(ph) * width + pw]);
+                    }
+                }
+                dst[h * out_width + w] = max_val;
+            }
+        }
+    }
+
+    int pooledSize(int size, int pool, const LayerConfig& config) {
+        return (size + 2 * config.padding - pool) / config.stride + 1;
+    }
+
+    // requantise n int32 sums of one output channel: bias, ReLU, then uint8 at the output scale or float when it is 0
+    void requantize(const std::int32_t* sums, int n, float multiplier, float offset, float output_scale,
+                    std::uint8_t* out, float* result) {
+        if(output_scale == 0.0f) {
+            #pragma omp simd
+            for(int i = 0; i < n; ++i) {
+                result[i] = std::max(static_cast<float>(sums[i]) * multiplier + offset, 0.0f);
+            }
+            return;
+        }
+        float inverse = 1.0f / output_scale;
+        #pragma omp simd
+        for(int i = 0; i < n; ++i) {
+            float q = std::max(static_cast<float>(sums[i]) * multiplier + offset, 0.0f) * inverse + 0.5f;
+            out[i] = static_cast<std::uint8_t>(std::min(q, static_cast<float>(QuantizedCNN::ACTIVATION_MAX)));
+        }
+    }
+}
+
+/*
+ * quantise a trained model
+ *  - the calibration batches go through the float layers one at a time, recording the range of every layer's input
+ *  - weights get one scale per output channel, the network input and every conv or fc output get the scale of the
+ *    range seen where it is consumed, i.e. at the input of the next conv or fc (a max pool does not change the scale)
+ */
+QuantizedCNN::QuantizedCNN(ModularCNN<float>& model, const std::vector<std::shared_ptr<Tensor<float>>>& calibration) {
+    const auto& float_layers = model.getLayers();
+    const auto& types = model.getLayerTypes();
+    if(calibration.empty()) {
+        throw std::invalid_argument("QuantizedCNN needs at least one calibration batch.");
+    }
+    if(!model.isSequential()) {
+        throw std::invalid_argument("QuantizedCNN only quantises a sequence of layers, not a graph with branches or merges.");
+    }
+
+    std::vector<std::shared_ptr<Operation<float>>> operations;
+    for(std::size_t i = 0; i < float_layers.size(); ++i) {
+        QuantizedLayer layer;
+        if(types[i] == "conv") {
+            auto conv = std::dynamic_pointer_cast<ConvolutionLayer<float>>(float_layers[i]);
+            layer.config = LayerConfig::conv(conv->in_channels, conv->out_channels, conv->filter_height, conv->filter_width,
+                                             conv->stride, conv->padding);
+            quantizeWeights(std::as_const(*conv->filters).data_ptr(), conv->out_channels, conv->in_channels * conv->filter_height * conv->filter_width,
+                            std::as_const(*conv->biases).data_ptr(), layer);
+            operations.push_back(std::make_shared<ConvolutionOperation<float>>(*conv));
+        }
+        else if(types[i] == "pool") {
+            auto pool = std::dynamic_pointer_cast<MaxPoolingLayer<float>>(float_layers[i]);
+            layer.config = LayerConfig::pool(pool->pool_height, pool->pool_width, pool->stride, pool->padding);
+            operations.push_back(std::make_shared<MaxPoolingOperation<float>>(pool->pool_height, pool->pool_width, pool->stride, pool->padding));
+        }
+        else if(types[i] == "fc") {
+            auto fc = std::dynamic_pointer_cast<FullyConnectedLayer<float>>(float_layers[i]);
+            layer.config = LayerConfig::fc(fc->in_features, fc->out_features);
+            quantizeWeights(std::as_const(*fc->weights).data_ptr(), fc->out_features, fc->in_features, std::as_const(*fc->biases).data_ptr(), layer);
+            operations.push_back(std::make_shared<FullyConnectedOperation<float>>(*fc));
+        }
+        else {
+            throw std::runtime_error("QuantizedCNN: unknown layer type " + types[i]);
+        }
+        layers.push_back(std::move(layer));
+    }
+
+    // range of the input of every layer, starting from 0 so every range contains it
+    std::vector<float> lo(layers.size(), 0.0f);
+    std::vector<float> hi(layers.size(), 0.0f);
+    std::vector<std::shared_ptr<Tensor<float>>> buffers(operations.size());
+    for(const auto& batch : calibration) {
+        std::shared_ptr<Tensor<float>> current = batch;
+        for(std::size_t i = 0; i < operations.size(); ++i) {
+            for(int n = 0; n < current->batch(); ++n) {
+                for(int c = 0; c < current->channels(); ++c) {
+                    for(int h = 0; h < current->height(); ++h) {
+                        const float* row = &current->data(n, c, h, 0);
+                        auto [min_it, max_it] = std::minmax_element(row, row + current->width());
+                        lo[i] = std::min(lo[i], *min_it);
+                        hi[i] = std::max(hi[i], *max_it);
+                    }
+                }
+            }
+            current = operations[i]->infer(current, buffers[i]);
+        }
+    }
+
+    // every conv and fc is rescaled to the input of the next one, the last keeps a float output
+    std::size_t first = layers.size();
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        if(layers[i].config.type == "pool") {
+            continue;
+        }
+        if(first == layers.size()) {
+            first = i;
+            continue;
+        }
+        std::int32_t zero_point = 0;
+        float scale = 0.0f;
+        activationScale(0.0f, hi[i], scale, zero_point); // after a ReLU, so never below 0
+        for(std::size_t j = i; j-- > 0;) {
+            if(layers[j].config.type != "pool") {
+                layers[j].output_scale = scale;
+                break;
+            }
+        }
+    }
+    if(first == layers.size()) {
+        throw std::invalid_argument("QuantizedCNN needs at least one conv or fc layer.");
+    }
+    activationScale(lo[first], hi[first], input_scale, input_zero_point);
+    link();
+}
+
+QuantizedCNN::QuantizedCNN(const std::string path) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) {
+        throw std::runtime_error("QuantizedCNN: cannot open " + path + ".");
+    }
+    FileHeader header = {};
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("QuantizedCNN: " + path + " is not a quantised model file.");
+    }
+    if(header.version != VERSION) {
+        throw std::runtime_error("QuantizedCNN: " + path + " has format version " + std::to_string(header.version) +
+                                 ", expected " + std::to_string(VERSION) + ".");
+    }
+    if(header.byte_order != ENDIAN_MARK) {
+        throw std::runtime_error("QuantizedCNN: " + path + " was written with a different byte order.");
+    }
+    if(header.layer_count > 4096 || !(header.input_scale > 0.0f) || header.input_zero_point < 0 || header.input_zero_point > ACTIVATION_MAX) {
+        throw std::runtime_error("QuantizedCNN: " + path + " is corrupt.");
+    }
+    input_scale = header.input_scale;
+    input_zero_point = header.input_zero_point;
+
+    std::vector<FileRecord> records(header.layer_count);
+    file.read(reinterpret_cast<char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(FileRecord)));
+    for(const FileRecord& record : records) {
+        QuantizedLayer layer;
+        const std::int32_t* c = record.config;
+        switch(static_cast<WeightStructType>(record.type)) {
+            case WeightStructType::ConvolutionalWeights:
+                layer.config = LayerConfig::conv(c[0], c[1], c[2], c[3], c[4], c[5]);
+                break;
+            case WeightStructType::PoolingWeights:
+                layer.config = LayerConfig::pool(c[0], c[1], c[2], c[3]);
+                break;
+            case WeightStructType::ConnectedWeights:
+                layer.config = LayerConfig::fc(c[0], c[1]);
+                break;
+            default:
+                throw std::runtime_error("QuantizedCNN: unknown layer type " + std::to_string(record.type) + " in " + path + ".");
+        }
+        layer.output_scale = record.output_scale;
+        if(layer.config.type != "pool") {
+            const LayerConfig& cfg = layer.config;
+            int inputs = cfg.type == "conv" ? cfg.in_channels * cfg.filter_height * cfg.filter_width : cfg.in_features;
+            if(cfg.type == "conv" && (cfg.filter_height <= 0 || cfg.filter_width <= 0 || cfg.stride <= 0 || cfg.padding < 0)) {
+                throw std::runtime_error("QuantizedCNN: " + path + " has a convolution with an invalid shape.");
+            }
+            if(layer.outputs() <= 0 || inputs <= 0 || record.rows != static_cast<std::uint32_t>(QuantizedGemm::padRows(layer.outputs()))
+               || record.depth != static_cast<std::uint32_t>(QuantizedGemm::padDepth(inputs)) || layer.output_scale < 0.0f) {
+                throw std::runtime_error("QuantizedCNN: " + path + " has a layer whose weights do not match its shape.");
+            }
+            layer.rows = static_cast<int>(record.rows);
+            layer.depth = static_cast<int>(record.depth);
+        }
+        else if(layer.config.pool_height <= 0 || layer.config.pool_width <= 0 || layer.config.stride <= 0 || layer.config.padding < 0) {
+            throw std::runtime_error("QuantizedCNN: " + path + " has a pool with an invalid shape.");
+        }
+        layers.push_back(std::move(layer));
+    }
+
+    for(QuantizedLayer& layer : layers) {
+        if(layer.config.type == "pool") {
+            continue;
+        }
+        layer.weights.resize(static_cast<std::size_t>(layer.rows) * layer.depth);
+        layer.weight_scales.resize(layer.outputs());
+        layer.biases.resize(layer.outputs());
+        file.read(reinterpret_cast<char*>(layer.weights.data()), static_cast<std::streamsize>(layer.weights.size()));
+        file.read(reinterpret_cast<char*>(layer.weight_scales.data()), static_cast<std::streamsize>(layer.weight_scales.size() * sizeof(float)));
+        file.read(reinterpret_cast<char*>(layer.biases.data()), static_cast<std::streamsize>(layer.biases.size() * sizeof(float)));
+    }
+    if(!file) {
+        throw std::runtime_error("QuantizedCNN: " + path + " is truncated.");
+    }
+    link();
+}
+
+void QuantizedCNN::saveWeights(const std::string path) const {
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = ENDIAN_MARK;
+    header.layer_count = static_cast<std::uint32_t>(layers.size());
+    header.input_scale = input_scale;
+    header.input_zero_point = input_zero_point;
+
+    std::vector<FileRecord> records(layers.size());
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        const LayerConfig& cfg = layers[i].config;
+        FileRecord& record = records[i];
+        record = {};
+        if(cfg.type == "conv") {
+            record.type = static_cast<std::uint32_t>(WeightStructType::ConvolutionalWeights);
+            std::int32_t config[6] = {cfg.in_channels, cfg.out_channels, cfg.filter_height, cfg.filter_width, cfg.stride, cfg.padding};
+            std::copy(config, config + 6, record.config);
+        }
+        else if(cfg.type == "pool") {
+            record.type = static_cast<std::uint32_t>(WeightStructType::PoolingWeights);
+            std::int32_t config[4] = {cfg.pool_height, cfg.pool_width, cfg.stride, cfg.padding};
+            std::copy(config, config + 4, record.config);
+        }
+        else {
+            record.type = static_cast<std::uint32_t>(WeightStructType::ConnectedWeights);
+            record.config[0] = cfg.in_features;
+            record.config[1] = cfg.out_features;
+        }
+        record.output_scale = layers[i].output_scale;
+        record.rows = static_cast<std::uint32_t>(layers[i].rows);
+        record.depth = static_cast<std::uint32_t>(layers[i].depth);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file) {
+        throw std::runtime_error("QuantizedCNN: cannot open " + path + " for writing.");
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(FileRecord)));
+    for(const QuantizedLayer& layer : layers) {
+        file.write(reinterpret_cast<const char*>(layer.weights.data()), static_cast<std::streamsize>(layer.weights.size()));
+        file.write(reinterpret_cast<const char*>(layer.weight_scales.data()), static_cast<std::streamsize>(layer.weight_scales.size() * sizeof(float)));
+        file.write(reinterpret_cast<const char*>(layer.biases.data()), static_cast<std::streamsize>(layer.biases.size() * sizeof(float)));
+    }
+    if(!file) {
+        throw std::runtime_error("QuantizedCNN: failed writing " + path + ".");
+    }
+}
+
+void QuantizedCNN::activationScale(float lo, float hi, float& scale, std::int32_t& zero_point) {
+    lo = std::min(lo, 0.0f);
+    hi = std::max(hi, 0.0f);
+    scale = hi > lo ? (hi - lo) / ACTIVATION_MAX : 1.0f;
+    zero_point = std::clamp(static_cast<std::int32_t>(std::lround(-lo / scale)), 0, ACTIVATION_MAX);
+}
+
+// symmetric per output channel: the largest magnitude of a row maps to WEIGHT_MAX
+void QuantizedCNN::quantizeWeights(const float* weights, int outputs, int inputs, const float* biases, QuantizedLayer& layer) {
+    layer.rows = QuantizedGemm::padRows(outputs);
+    layer.depth = QuantizedGemm::padDepth(inputs);
+    layer.weights.assign(static_cast<std::size_t>(layer.rows) * layer.depth, 0);
+    layer.weight_scales.resize(outputs);
+    layer.biases.assign(biases, biases + outputs);
+    for(int o = 0; o < outputs; ++o) {
+        const float* row = weights + static_cast<std::ptrdiff_t>(o) * inputs;
+        float largest = 0.0f;
+        for(int k = 0; k < inputs; ++k) {
+            largest = std::max(largest, std::abs(row[k]));
+        }
+        float scale = largest > 0.0f ? largest / QuantizedGemm::WEIGHT_MAX : 1.0f;
+        layer.weight_scales[o] = scale;
+        std::int8_t* q = layer.weights.data() + static_cast<std::ptrdiff_t>(o) * layer.depth;
+        for(int k = 0; k < inputs; ++k) {
+            q[k] = static_cast<std::int8_t>(std::clamp(static_cast<int>(std::lround(row[k] / scale)), -QuantizedGemm::WEIGHT_MAX, QuantizedGemm::WEIGHT_MAX));
+        }
+    }
+}
+
+void QuantizedCNN::link() {
+    std::size_t last = layers.size();
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        QuantizedLayer& layer = layers[i];
+        if(layer.config.type == "pool") {
+            continue;
+        }
+        last = i;
+        layer.row_sums.assign(layer.outputs(), 0);
+        for(int o = 0; o < layer.outputs(); ++o) {
+            const std::int8_t* row = layer.weights.data() + static_cast<std::ptrdiff_t>(o) * layer.depth;
+            for(int k = 0; k < layer.depth; ++k) {
+                layer.row_sums[o] += row[k];
+            }
+        }
+    }
+    if(last == layers.size()) {
+        throw std::invalid_argument("QuantizedCNN needs at least one conv or fc layer.");
+    }
+    bool fused_pool = last + 1 < layers.size() && layers[last].config.type == "conv";
+    if(layers.size() - last > (fused_pool ? 2u : 1u)) {
+        throw std::invalid_argument("QuantizedCNN: only a single pool may follow the last conv or fc layer.");
+    }
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        if(layers[i].config.type != "pool" && (layers[i].output_scale == 0.0f) != (i == last)) {
+            throw std::invalid_argument("QuantizedCNN: only the last conv or fc layer may have a float output.");
+        }
+    }
+}
+
+void QuantizedCNN::quantizeInput(const Tensor<float>& input, std::uint8_t* out) const {
+    int channels = input.channels();
+    int height = input.height();
+    int width = input.width();
+    float inverse = 1.0f / input_scale;
+    float zero_point = static_cast<float>(input_zero_point) + 0.5f;
+    ThreadPool::parallelFor(input.batch() * channels, ThreadPool::grainFor(static_cast<std::size_t>(height) * width), [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / channels;
+            int c = i % channels;
+            for(int h = 0; h < height; ++h) {
+                const float* row = &input.data(n, c, h, 0);
+                std::uint8_t* dst = out + ((static_cast<std::ptrdiff_t>(n) * channels + c) * height + h) * width;
+                #pragma omp simd
+                for(int w = 0; w < width; ++w) {
+                    float q = std::clamp(row[w] * inverse + zero_point, 0.0f, static_cast<float>(ACTIVATION_MAX));
+                    dst[w] = static_cast<std::uint8_t>(q);
+                }
+            }
+        }
+    });
+}
+
+/*
+ * one sample at a time: im2col into packed quads, one integer GEMM, then per output channel
+ *  - the fused pool is taken on the int32 sums, exact because the rescale, bias and ReLU that follow are monotonic
+ *  - sum_k w * (q - zero_point) = sum_k w * q - zero_point * row_sum, the correction goes into the per-channel offset
+ */
+void QuantizedCNN::convolution(const QuantizedLayer& layer, const LayerConfig* pool, const std::uint8_t* input, float scale,
+                               std::int32_t zero_point, int batch_size, int height, int width, std::uint8_t* out, float* result) {
+    const LayerConfig& cfg = layer.config;
+    int out_height = (height + 2 * cfg.padding - cfg.filter_height) / cfg.stride + 1;
+    int out_width = (width + 2 * cfg.padding - cfg.filter_width) / cfg.stride + 1;
+    int spatial = out_height * out_width;
+    int columns = QuantizedGemm::padColumns(spatial);
+    int result_height = pool ? pooledSize(out_height, pool->pool_height, *pool) : out_height;
+    int result_width = pool ? pooledSize(out_width, pool->pool_width, *pool) : out_width;
+    int result_spatial = result_height * result_width;
+    std::size_t sample = static_cast<std::size_t>(cfg.in_channels) * height * width;
+
+    ThreadPool::parallelFor(batch_size, batch_size >= ThreadPool::width() ? 1 : batch_size, [&](int first, int last) {
+        for(int n = first; n < last; ++n) {
+            // inside the loop body, each pool thread packs into its own
+            thread_local std::vector<std::uint8_t> packed;
+            thread_local std::vector<std::int32_t> sums;
+            thread_local std::vector<std::int32_t> pooled;
+            packed.resize(static_cast<std::size_t>(layer.depth) * columns);
+            sums.resize(static_cast<std::size_t>(layer.rows) * columns);
+            QuantizedGemm::packColumns(input + n * sample, cfg.in_channels, height, width, cfg.filter_height, cfg.filter_width,
+                                       cfg.stride, cfg.padding, static_cast<std::uint8_t>(zero_point), out_height, out_width, packed.data());
+            QuantizedGemm::multiply(layer.rows, columns, layer.depth, layer.weights.data(), layer.depth, packed.data(), columns * 4,
+                                    sums.data(), columns);
+
+            for(int f = 0; f < cfg.out_channels; ++f) {
+                const std::int32_t* plane = sums.data() + static_cast<std::ptrdiff_t>(f) * columns;
+                if(pool) {
+                    pooled.resize(result_spatial);
+                    poolPlane(plane, out_height, out_width, *pool, pooled.data());
+                    plane = pooled.data();
+                }
+                float multiplier = scale * layer.weight_scales[f];
+                float offset = layer.biases[f] - static_cast<float>(zero_point) * static_cast<float>(layer.row_sums[f]) * multiplier;
+                std::ptrdiff_t at = (static_cast<std::ptrdiff_t>(n) * cfg.out_channels + f) * result_spatial;
+                requantize(plane, result_spatial, multiplier, offset, layer.output_scale, out ? out + at : nullptr, result ? result + at : nullptr);
+            }
+        }
+    });
+}
+
+/*
+ * the whole batch as one integer GEMM, W[out][in] * X^T[in][batch], so the weights are read once per call
+ */
+void QuantizedCNN::fullyConnected(const QuantizedLayer& layer, const std::uint8_t* input, float scale, std::int32_t zero_point,
+                                  int batch_size, std::uint8_t* out, float* result) {
+    // QuantizedGemm::multiply gets packed and sums as raw pointers, so its pool threads use this thread's buffers
+    thread_local std::vector<std::uint8_t> packed;
+    thread_local std::vector<std::int32_t> sums;
+    thread_local std::vector<float> multipliers;
+    thread_local std::vector<float> offsets;
+    int outputs = layer.config.out_features;
+    int columns = QuantizedGemm::padColumns(batch_size);
+    packed.resize(static_cast<std::size_t>(layer.depth) * columns);
+    sums.resize(static_cast<std::size_t>(layer.rows) * columns);
+    QuantizedGemm::packRows(input, batch_size, layer.config.in_features, packed.data());
+    QuantizedGemm::multiply(layer.rows, columns, layer.depth, layer.weights.data(), layer.depth, packed.data(), columns * 4,
+                            sums.data(), columns);
+
+    multipliers.resize(outputs);
+    offsets.resize(outputs);
+    for(int o = 0; o < outputs; ++o) {
+        multipliers[o] = scale * layer.weight_scales[o];
+        offsets[o] = layer.biases[o] - static_cast<float>(zero_point) * static_cast<float>(layer.row_sums[o]) * multipliers[o];
+    }
+    float inverse = layer.output_scale > 0.0f ? 1.0f / layer.output_scale : 0.0f;
+    for(int n = 0; n < batch_size; ++n) {
+        for(int o = 0; o < outputs; ++o) {
+            float value = std::max(static_cast<float>(sums[static_cast<std::ptrdiff_t>(o) * columns + n]) * multipliers[o] + offsets[o], 0.0f);
+            std::ptrdiff_t at = static_cast<std::ptrdiff_t>(n) * outputs + o;
+            if(result) {
+                result[at] = value;
+            }
+            else {
+                out[at] = static_cast<std::uint8_t>(std::min(value * inverse + 0.5f, static_cast<float>(ACTIVATION_MAX)));
+            }
+        }
+    }
+}
+
+void QuantizedCNN::pool(const LayerConfig& config, const std::uint8_t* input, int planes, int height, int width, std::uint8_t* out) {
+    std::ptrdiff_t out_plane = static_cast<std::ptrdiff_t>(pooledSize(height, config.pool_height, config)) * pooledSize(width, config.pool_width, config);
+    ThreadPool::parallelFor(planes, ThreadPool::grainFor(static_cast<std::size_t>(height) * width), [&](int first, int last) {
+        for(int p = first; p < last; ++p) {
+            poolPlane(input + static_cast<std::ptrdiff_t>(p) * height * width, height, width, config, out + p * out_plane);
+        }
+    });
+}
+
+/*
+ * inference on the quantised layers
+ *  - the input is quantised once, every layer then reads and writes uint8 in activations until the last conv or fc,
+ *    which writes the float result
+ */
+std::shared_ptr<Tensor<float>> QuantizedCNN::logits(const std::shared_ptr<Tensor<float>>& input) {
+    int batch_size = input->batch();
+    int channels = input->channels();
+    int height = input->height();
+    int width = input->width();
+    activations.resize(layers.size() + 1);
+    activations[0].resize(input->size());
+    quantizeInput(*input, activations[0].data());
+
+    float scale = input_scale;
+    std::int32_t zero_point = input_zero_point;
+    std::shared_ptr<Tensor<float>> result;
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        const QuantizedLayer& layer = layers[i];
+        const LayerConfig& cfg = layer.config;
+        const std::uint8_t* current = activations[i].data();
+
+        if(cfg.type == "pool") {
+            int out_height = pooledSize(height, cfg.pool_height, cfg);
+            int out_width = pooledSize(width, cfg.pool_width, cfg);
+            activations[i + 1].resize(static_cast<std::size_t>(batch_size) * channels * out_height * out_width);
+            pool(cfg, current, batch_size * channels, height, width, activations[i + 1].data());
+            height = out_height;
+            width = out_width;
+            continue;
+        }
+
+        int in_height = height;
+        int in_width = width;
+        const LayerConfig* fused = nullptr;
+        if(cfg.type == "conv") {
+            if(channels != cfg.in_channels) {
+                throw std::invalid_argument("QuantizedCNN: input channels do not match the convolution's in_channels.");
+            }
+            height = (height + 2 * cfg.padding - cfg.filter_height) / cfg.stride + 1;
+            width = (width + 2 * cfg.padding - cfg.filter_width) / cfg.stride + 1;
+            if(i + 1 < layers.size() && layers[i + 1].config.type == "pool") {
+                fused = &layers[i + 1].config;
+                height = pooledSize(height, fused->pool_height, *fused);
+                width = pooledSize(width, fused->pool_width, *fused);
+            }
+            channels = cfg.out_channels;
+        }
+        else {
+            if(static_cast<std::size_t>(channels) * height * width != static_cast<std::size_t>(cfg.in_features)) {
+                throw std::invalid_argument("QuantizedCNN: flattened input size does not match the fc layer's in_features.");
+            }
+            channels = cfg.out_features;
+            height = 1;
+            width = 1;
+        }
+
+        // a fused pool's output is the input of the layer after it
+        std::size_t next = fused ? i + 2 : i + 1;
+        std::uint8_t* out = nullptr;
+        if(layer.output_scale == 0.0f) {
+            result = std::make_shared<Tensor<float>>(batch_size, channels, height, width, 0.0f, false);
+        }
+        else {
+            activations[next].resize(static_cast<std::size_t>(batch_size) * channels * height * width);
+            out = activations[next].data();
+        }
+        float* dst = result ? result->data_ptr() : nullptr;
+
+        if(cfg.type == "conv") {
+            convolution(layer, fused, current, scale, zero_point, batch_size, in_height, in_width, out, dst);
+        }
+        else {
+            fullyConnected(layer, current, scale, zero_point, batch_size, out, dst);
+        }
+        i = next - 1;
+        scale = layer.output_scale;
+        zero_point = 0;
+    }
+    return result;
+}
+
+std::shared_ptr<Tensor<float>> QuantizedCNN::predict(const std::shared_ptr<Tensor<float>>& input) {
+    auto output = logits(input);
+    ModularCNN<float>::softmax(*output);
+    return output;
+}
+
+int QuantizedCNN::forwards(const std::shared_ptr<Tensor<float>>& input) {
+    return ModularCNN<float>::argmax(*logits(input->sliceBatch(0, 1))).front();
+}
+
+std::vector<int> QuantizedCNN::classify(const std::shared_ptr<Tensor<float>>& input) {
+    return ModularCNN<float>::argmax(*logits(input));
+}
+
+void QuantizedCNN::compare(ModularCNN<float>& model, const std::shared_ptr<Tensor<float>>& input, const std::shared_ptr<Tensor<float>>& labels,
+                           QuantizationReport& report) {
+    auto expected = model.predict(input);
+    auto actual = predict(input);
+    if(expected->shape() != actual->shape() || labels->batch() != actual->batch() || labels->channels() != actual->channels()) {
+        throw std::invalid_argument("QuantizedCNN::compare: the labels do not match the models' output.");
+    }
+
+    // class with the largest value of sample n, the first one on ties
+    auto argmax = [](const Tensor<float>& t, int n) {
+        int best = 0;
+        for(int c = 1; c < t.channels(); ++c) {
+            if(t.data(n, c, 0, 0) > t.data(n, best, 0, 0)) {
+                best = c;
+            }
+        }
+        return best;
+    };
+    for(int n = 0; n < actual->batch(); ++n) {
+        int label = argmax(*labels, n);
+        int float_class = argmax(*expected, n);
+        int quantized_class = argmax(*actual, n);
+        report.float_correct += float_class == label;
+        report.quantized_correct += quantized_class == label;
+        report.agreements += float_class == quantized_class;
+        for(int c = 0; c < actual->channels(); ++c) {
+            double error = std::abs(static_cast<double>(expected->data(n, c, 0, 0)) - actual->data(n, c, 0, 0));
+            report.max_probability_error = std::max(report.max_probability_error, error);
+        }
+    }
+    report.samples += actual->batch();
+}
+
+std::size_t QuantizedCNN::weightBytes() const {
+    std::size_t bytes = 0;
+    for(const QuantizedLayer& layer : layers) {
+        bytes += layer.weights.size() + (layer.weight_scales.size() + layer.biases.size()) * sizeof(float);
+    }
+    return bytes;
+}
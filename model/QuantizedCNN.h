@@ -0,0 +1,135 @@
+//
+// Created by Vijay Goyal on 2025-01-25.
+//
+
+#ifndef INC_12_FINALPROJ_2_QUANTIZEDCNN_H
+#define INC_12_FINALPROJ_2_QUANTIZEDCNN_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include "ModularCNN.h"
+#include "../tools/LayerConfig.h"
+#include "../tools/QuantizedGemm.h"
+#include "../tools/Tensor.h"
+
+// running comparison of a QuantizedCNN against the float model it was made from, filled in by QuantizedCNN::compare
+struct QuantizationReport {
+    int samples = 0;
+    int float_correct = 0;     // samples the float model classifies as their label
+    int quantized_correct = 0; // samples the quantised model classifies as their label
+    int agreements = 0;        // samples both models put in the same class
+    double max_probability_error = 0.0; // largest difference between the two models' output probabilities
+
+    [[nodiscard]] double floatAccuracy() const { return samples ? static_cast<double>(float_correct) / samples : 0.0; }
+    [[nodiscard]] double quantizedAccuracy() const { return samples ? static_cast<double>(quantized_correct) / samples : 0.0; }
+    [[nodiscard]] double agreement() const { return samples ? static_cast<double>(agreements) / samples : 0.0; }
+    [[nodiscard]] std::string summary() const;
+};
+
+/**
+ * @brief Post-training int8 quantisation of a ModularCNN<float>, and the integer engine that runs it for inference.
+ *        - conv and fc weights are int8 with one symmetric scale per output channel, biases stay float
+ *        - activations are uint8 with one scale (and zero point) per layer input, calibrated from the largest and
+ *          smallest value the float model produces there over the calibration batches
+ *        - activations are limited to [0, ACTIVATION_MAX] (7 bits) so the AVX2 kernel cannot saturate, see QuantizedGemm,
+ *          every hidden activation follows a ReLU so its zero point is 0 and only the network input uses one
+ *        - each conv and fc is one QuantizedGemm into int32, bias, ReLU and the rescale to the next layer's input
+ *          scale are one pass over it, a max pool straight after a conv is taken on the int32 sums before that pass
+ *        - the last layer is dequantised and put through the same softmax as ModularCNN::predict
+ *        - saveWeights writes its own format (see FileHeader), not readable by ModularCNN
+ */
+class QuantizedCNN {
+public:
+    static constexpr int ACTIVATION_MAX = QuantizedGemm::ACTIVATION_MAX;
+
+    static constexpr char MAGIC[8] = {'M', 'C', 'N', 'N', 'I', 'N', 'T', '8'};
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::uint32_t ENDIAN_MARK = 0x01020304;
+
+    // file layout: this header, one FileRecord per layer, then for every conv and fc layer its int8 weights
+    // (rows x depth), float weight scales and float biases (out_channels each), in layer order
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t layer_count;
+        float input_scale;         // quantisation of the network input
+        std::int32_t input_zero_point;
+        std::uint8_t reserved[36];
+    };
+    static_assert(sizeof(FileHeader) == 64, "FileHeader is part of the file format");
+
+    struct FileRecord {
+        std::uint32_t type;     // WeightStructType
+        std::int32_t config[6]; // conv: in, out, filter height, width, stride, padding; pool: height, width, stride, padding; fc: in, out
+        float output_scale;     // quantisation of the output, 0 for a layer whose output is dequantised
+        std::uint32_t rows;     // conv and fc: output channels padded to QuantizedGemm::MR
+        std::uint32_t depth;    // conv and fc: weights per output channel padded to a multiple of 4
+        std::uint8_t reserved[24];
+    };
+    static_assert(sizeof(FileRecord) == 64, "FileRecord is part of the file format");
+
+    struct QuantizedLayer {
+        LayerConfig config;
+        float output_scale = 0.0f; // scale of the uint8 output, 0 on the last conv or fc, whose output is float
+
+        // conv and fc only
+        int rows = 0;
+        int depth = 0;
+        std::vector<std::int8_t> weights;  // [rows][depth], zero padded, a row is one output channel
+        std::vector<float> weight_scales;  // per output channel
+        std::vector<float> biases;
+        std::vector<std::int32_t> row_sums; // per output channel, the weights' sum for the input zero point
+
+        [[nodiscard]] int outputs() const { return config.type == "conv" ? config.out_channels : config.out_features; }
+    };
+
+    // quantise a trained model, every calibration batch is run through it once to find the activation ranges
+    QuantizedCNN(ModularCNN<float>& model, const std::vector<std::shared_ptr<Tensor<float>>>& calibration);
+
+    explicit QuantizedCNN(const std::string path); // reads a file written by saveWeights, throws if it is not one
+
+    // class probabilities like ModularCNN::predict, activations are reused between calls
+    std::shared_ptr<Tensor<float>> predict(const std::shared_ptr<Tensor<float>>& input);
+    int forwards(const std::shared_ptr<Tensor<float>>& input); // same selection as ModularCNN::forwards
+    std::vector<int> classify(const std::shared_ptr<Tensor<float>>& input); // same as ModularCNN::classify
+
+    // run one batch through both models and add the result to report, labels are one-hot (batch, classes, 1, 1)
+    void compare(ModularCNN<float>& model, const std::shared_ptr<Tensor<float>>& input, const std::shared_ptr<Tensor<float>>& labels,
+                 QuantizationReport& report);
+
+    void saveWeights(const std::string path) const;
+
+    [[nodiscard]] const std::vector<QuantizedLayer>& getLayers() const { return layers; }
+    [[nodiscard]] std::size_t weightBytes() const; // int8 weights plus float scales and biases
+    static const char* kernelName() { return QuantizedGemm::kernelName(); }
+
+private:
+    std::vector<QuantizedLayer> layers;
+    float input_scale = 1.0f;
+    std::int32_t input_zero_point = 0;
+
+    std::vector<std::vector<std::uint8_t>> activations; // uint8 input of each layer, reused between calls
+
+    // scale and zero point that map [lo, hi] (widened to contain 0) onto [0, ACTIVATION_MAX]
+    static void activationScale(float lo, float hi, float& scale, std::int32_t& zero_point);
+    static void quantizeWeights(const float* weights, int outputs, int inputs, const float* biases, QuantizedLayer& layer);
+
+    void link(); // row sums, and checks that at most one pool follows the last conv or fc
+    void quantizeInput(const Tensor<float>& input, std::uint8_t* out) const;
+
+    // output of the last layer before the softmax, i.e. what ModularCNN's graph infers
+    std::shared_ptr<Tensor<float>> logits(const std::shared_ptr<Tensor<float>>& input);
+
+    // one conv or fc on a uint8 input of the given scale and zero point, a conv also applies pool when it is given,
+    // writes uint8 to out or, when the layer's output_scale is 0, float to result
+    static void convolution(const QuantizedLayer& layer, const LayerConfig* pool, const std::uint8_t* input, float scale,
+                            std::int32_t zero_point, int batch_size, int height, int width, std::uint8_t* out, float* result);
+    static void fullyConnected(const QuantizedLayer& layer, const std::uint8_t* input, float scale, std::int32_t zero_point,
+                               int batch_size, std::uint8_t* out, float* result);
+    static void pool(const LayerConfig& config, const std::uint8_t* input, int planes, int height, int width, std::uint8_t* out);
+};
+
+#endif //INC_12_FINALPROJ_2_QUANTIZEDCNN_H
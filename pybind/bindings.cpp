@@ -3,6 +3,7 @@
 //
 
 #include <cstddef>
+#include <algorithm>
 #include <string>
 typedef size_t rsize_t;
 #include <_string.h>
@@ -10,10 +11,12 @@ typedef size_t rsize_t;
 #include "../tools/LayerConfig.h"
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
 #include <stdfloat>
 #include <vector>
 
 #include "../tools/Tensor.h"
+#include "../tools/TensorConversion.h"
 #include "../tools/WeightStruct.h"
 #include "../tools/ConvolutionalWeights.h"
 #include "../tools/ConnectedWeights.h"
@@ -27,29 +30,216 @@ typedef size_t rsize_t;
 #include "../tools/FullyConnectedOperation.h"
 #include "../tools/ConvolutionOperation.h"
 #include "../tools/ComputationGraph.h"
+#include "../tools/Layout.h"
 
 #include "../layers/MaxPoolingLayer.h"
 #include "../tools/AMSGrad.h"
 #include "../model/ModularCNN.h"
+#include "../model/MixedPrecisionCNN.h"
+#include "../model/QuantizedCNN.h"
+#include "../model/DataParallel.h"
+#include "../model/InferenceServer.h"
+#include "../tools/UnixSocketTransport.h"
 
 #include "../tools/CrossEntropy.h"
+#include "../tools/SoftmaxCrossEntropy.h"
+#include "../tools/Profiler.h"
+#include "../tools/DataLoader.h"
+#include "../tools/ThreadPool.h"
 
 
 using bfloat = float;
 
 using namespace pybind11;
 
+// numpy view over a tensor buffer, the capsule keeps the tensor (and so the buffer) alive as long as the array
+//  - the data of a tensor that tracks its writes (a layer parameter) is read-only, numpy writes would bypass the
+//    version a layer keys its cached filters on, copyData writes it instead
+static array_t<bfloat> toNumpy(const std::shared_ptr<Tensor<bfloat>>& tensor, bool grad) {
+    if(grad && !tensor->hasGrad()) {
+        throw value_error("Tensor has no gradient buffer (created for inference)");
+    }
+    auto* owner = new std::shared_ptr<Tensor<bfloat>>(tensor);
+    capsule base(owner, [](void* p) { delete static_cast<std::shared_ptr<Tensor<bfloat>>*>(p); });
+    const auto& shape = tensor->shape();
+    const auto& strides = tensor->strides();
+    std::vector<ssize_t> dims(shape.begin(), shape.end());
+    std::vector<ssize_t> byte_strides;
+    for(auto stride : strides) {
+        byte_strides.push_back(static_cast<ssize_t>(stride * sizeof(bfloat)));
+    }
+    const Tensor<bfloat>& source = *tensor;
+    array_t<bfloat> result(dims, byte_strides, grad ? source.grad_ptr() : source.data_ptr(), base);
+    if(!grad && source.tracksWrites()) {
+        result.attr("setflags")(arg("write") = false);
+    }
+    return result;
+}
+
+// copy an array of the tensor's shape into its data, the write is stamped like any other
+static void copyData(const std::shared_ptr<Tensor<bfloat>>& tensor, const array_t<bfloat, array::c_style | array::forcecast>& values) {
+    const auto& shape = tensor->shape();
+    if(values.ndim() != 4 || !std::equal(shape.begin(), shape.end(), values.shape())) {
+        throw value_error("Array must have the tensor's shape");
+    }
+    const bfloat* src = values.data();
+    for(int n = 0; n < shape[0]; ++n) {
+        for(int c = 0; c < shape[1]; ++c) {
+            for(int h = 0; h < shape[2]; ++h) {
+                src = std::copy(src, src + shape[3], &tensor->data(n, c, h, 0));
+            }
+        }
+    }
+}
+
+/*
+ * build a Tensor from a 4D numpy array in one pass
+ *  - layout is "NCHW", "NHWC" or "auto" (NHWC when the last dimension looks like image channels)
+ *  - uint8 input is scaled to [0, 1] when normalize is set
+ *  - a writeable C-contiguous float32 NCHW array is wrapped without copying
+ */
+static std::shared_ptr<Tensor<bfloat>> fromNumpy(const array& input, std::string layout, bool normalize) {
+    if(input.ndim() != 4) {
+        throw value_error("Input array must have 4 dimensions");
+    }
+    if(layout == "auto") {
+        layout = (input.shape(3) == 1 || input.shape(3) == 3) && input.shape(1) > 10 ? "NHWC" : "NCHW";
+    }
+    if(layout != "NCHW" && layout != "NHWC") {
+        throw value_error("layout must be 'NCHW', 'NHWC' or 'auto'");
+    }
+    bool nhwc = layout == "NHWC";
+    int batch_size = static_cast<int>(input.shape(0));
+    int channels = static_cast<int>(nhwc ? input.shape(3) : input.shape(1));
+    int height = static_cast<int>(nhwc ? input.shape(1) : input.shape(2));
+    int width = static_cast<int>(nhwc ? input.shape(2) : input.shape(3));
+
+    bool is_uint8 = isinstance<array_t<uint8_t>>(input);
+    bfloat scale = (is_uint8 && normalize) ? static_cast<bfloat>(1.0 / 255.0) : static_cast<bfloat>(1.0);
+
+    if(!nhwc && isinstance<array_t<bfloat>>(input) && (input.flags() & array::c_style) && input.writeable()) {
+        // zero-copy, the numpy array is released (under the GIL) once the last view of the tensor is gone, a read-only
+        // array is copied below, since anything holding the tensor may write its data
+        auto* keep = new object(input);
+        std::shared_ptr<bfloat> data(static_cast<bfloat*>(input.mutable_data()), [keep](bfloat*) {
+            gil_scoped_acquire gil;
+            delete keep;
+        });
+        return Tensor<bfloat>::wrap(data, batch_size, channels, height, width);
+    }
+
+    auto tensor = std::make_shared<Tensor<bfloat>>(batch_size, channels, height, width, static_cast<bfloat>(0.0));
+    if(is_uint8) {
+        auto src = array_t<uint8_t, array::c_style>::ensure(input);
+        gil_scoped_release release;
+        if(nhwc) TensorConversion<bfloat>::fromNHWC(src.data(), batch_size, height, width, channels, scale, tensor->data_ptr());
+        else TensorConversion<bfloat>::fromNCHW(src.data(), tensor->size(), scale, tensor->data_ptr());
+    }
+    else {
+        auto src = array_t<bfloat, array::c_style | array::forcecast>::ensure(input);
+        if(!src) {
+            throw value_error("Input array must be convertible to float32");
+        }
+        gil_scoped_release release;
+        if(nhwc) TensorConversion<bfloat>::fromNHWC(src.data(), batch_size, height, width, channels, scale, tensor->data_ptr());
+        else TensorConversion<bfloat>::fromNCHW(src.data(), tensor->size(), scale, tensor->data_ptr());
+    }
+    return tensor;
+}
+
+// integer labels -> one-hot (batch, num_classes, 1, 1) tensor
+static std::shared_ptr<Tensor<bfloat>> oneHot(const array_t<int64_t, array::c_style | array::forcecast>& labels, int num_classes) {
+    if(labels.ndim() != 1) {
+        throw value_error("Labels must be a 1D array");
+    }
+    int batch_size = static_cast<int>(labels.shape(0));
+    auto tensor = std::make_shared<Tensor<bfloat>>(batch_size, num_classes, 1, 1, static_cast<bfloat>(0.0));
+    TensorConversion<bfloat>::oneHot(labels.data(), batch_size, num_classes, tensor->data_ptr());
+    return tensor;
+}
+
+/*
+ * DataLoader over a uint8 (count, height, width, channels) numpy array and its integer labels
+ *  - the array is shared, not copied, and released (under the GIL) with the loader
+ *  - a 3D array is taken as single channel images
+ */
+static std::shared_ptr<DataLoader<bfloat>> makeDataLoader(const array_t<uint8_t, array::c_style | array::forcecast>& images,
+                                                          const array_t<int64_t, array::c_style | array::forcecast>& labels,
+                                                          int num_classes, int batch_size, bool shuffle, uint64_t seed, int workers,
+                                                          int prefetch, bool drop_last, bool one_hot) {
+    if(images.ndim() != 3 && images.ndim() != 4) {
+        throw value_error("Images must be a (count, height, width[, channels]) array");
+    }
+    if(labels.ndim() != 1 || labels.shape(0) != images.shape(0)) {
+        throw value_error("Labels must be a 1D array with one label per image");
+    }
+    int channels = images.ndim() == 4 ? static_cast<int>(images.shape(3)) : 1;
+    auto* keep = new object(images);
+    std::shared_ptr<const uint8_t> data(images.data(), [keep](const uint8_t*) {
+        gil_scoped_acquire gil;
+        delete keep;
+    });
+    return std::make_shared<DataLoader<bfloat>>(data, labels.data(), static_cast<int>(images.shape(0)),
+                                                static_cast<int>(images.shape(1)), static_cast<int>(images.shape(2)), channels,
+                                                num_classes, batch_size, shuffle, seed, workers, prefetch, drop_last,
+                                                one_hot);
+}
+
 PYBIND11_MODULE(ModularCNN, m) {
     m.doc() = "Modular CNN implementation in C++";
 
     class_<Tensor<bfloat>, std::shared_ptr<Tensor<bfloat>>>(m, "Tensor")
             .def(init<int, int, int, int, bfloat>())
+            .def(init<int, int, int, int, bfloat, bool>())
             .def(init<>())
-            .def_readwrite("data", &Tensor<bfloat>::data)
-            .def_readwrite("grad", &Tensor<bfloat>::grad)
+            .def_static("from_numpy", &fromNumpy, arg("array"), arg("layout") = "auto", arg("normalize") = true)
+            .def_static("one_hot", &oneHot, arg("labels"), arg("num_classes"))
+            .def_property_readonly("data", [](const std::shared_ptr<Tensor<bfloat>>& t) { return toNumpy(t, false); })
+            .def_property_readonly("grad", [](const std::shared_ptr<Tensor<bfloat>>& t) { return toNumpy(t, true); })
+            .def("copyData", &copyData, arg("values"))
+            .def_property_readonly("shape", &Tensor<bfloat>::shape)
             .def_readwrite("creator", &Tensor<bfloat>::creator)
+            .def("reshape", &Tensor<bfloat>::reshape)
+            .def("sliceBatch", &Tensor<bfloat>::sliceBatch)
+            .def("isContiguous", &Tensor<bfloat>::isContiguous)
+            .def("hasGrad", &Tensor<bfloat>::hasGrad)
             .def("zeroGrad", &Tensor<bfloat>::zeroGrad)
-            .def("setValue", &Tensor<bfloat>::setValue);;
+            .def("setValue", &Tensor<bfloat>::setValue)
+            .def("getValue", &Tensor<bfloat>::getValue);
+
+    // iterating yields (images, labels) pairs of one epoch, each new iteration starts the next epoch, labels are a one-hot
+    // Tensor or, with one_hot=False, an int64 array for SoftmaxCrossEntropy
+    class_<DataLoader<bfloat>, std::shared_ptr<DataLoader<bfloat>>>(m, "DataLoader")
+        .def(init(&makeDataLoader), arg("images"), arg("labels"), arg("num_classes"), arg("batch_size"), arg("shuffle") = true,
+             arg("seed") = 0, arg("workers") = 2, arg("prefetch") = 4, arg("drop_last") = false, arg("one_hot") = true)
+        .def("start", static_cast<void (DataLoader<bfloat>::*)(int)>(&DataLoader<bfloat>::start), arg("epoch"),
+             call_guard<gil_scoped_release>())
+        .def("__iter__", [](const std::shared_ptr<DataLoader<bfloat>>& loader) {
+            gil_scoped_release release;
+            loader->start();
+            return loader;
+        })
+        .def("__next__", [](DataLoader<bfloat>& loader) {
+            DataLoader<bfloat>::Batch batch;
+            bool more;
+            {
+                gil_scoped_release release;
+                more = loader.next(batch);
+            }
+            if(!more) {
+                throw stop_iteration();
+            }
+            if(!batch.labels) {
+                return make_tuple(batch.images, array_t<int64_t>(static_cast<ssize_t>(batch.classes.size()), batch.classes.data()));
+            }
+            return make_tuple(batch.images, batch.labels);
+        })
+        .def("__len__", &DataLoader<bfloat>::batches)
+        .def("shard", &DataLoader<bfloat>::shard, arg("rank"), arg("replicas"))
+        .def("batches", &DataLoader<bfloat>::batches)
+        .def("samples", &DataLoader<bfloat>::samples)
+        .def("currentEpoch", &DataLoader<bfloat>::currentEpoch)
+        .def("order", &DataLoader<bfloat>::order);
 
     class_<Layer<bfloat>, std::shared_ptr<Layer<bfloat>>>(m, "Layer")
         .def("getNumParams", &Layer<bfloat>::getNumParams)
@@ -63,40 +253,225 @@ PYBIND11_MODULE(ModularCNN, m) {
 
     class_<CrossEntropy<bfloat>, std::shared_ptr<CrossEntropy<bfloat>>>(m, "CrossEntropy")
         .def(init<bool>())
-        .def("forward", &CrossEntropy<bfloat>::forward)
-        .def("backward", &CrossEntropy<bfloat>::backward);
+        .def("forward", &CrossEntropy<bfloat>::forward, call_guard<gil_scoped_release>())
+        .def("backward", &CrossEntropy<bfloat>::backward, call_guard<gil_scoped_release>());
+
+    // softmax + cross-entropy on logits against integer labels, forward also writes the gradient into logits.grad
+    class_<SoftmaxCrossEntropy<bfloat>, std::shared_ptr<SoftmaxCrossEntropy<bfloat>>>(m, "SoftmaxCrossEntropy")
+        .def(init<double, bool>(), arg("temperature") = 1.0, arg("reduction_mean") = true)
+        .def("forward", [](const SoftmaxCrossEntropy<bfloat>& loss, const std::shared_ptr<Tensor<bfloat>>& logits,
+                           const array_t<int64_t, array::c_style | array::forcecast>& labels) {
+            gil_scoped_release release;
+            return loss.forward(logits, labels.data(), static_cast<std::size_t>(labels.size()));
+        }, arg("logits"), arg("labels"))
+        .def("loss", [](const SoftmaxCrossEntropy<bfloat>& loss, const std::shared_ptr<Tensor<bfloat>>& logits,
+                        const array_t<int64_t, array::c_style | array::forcecast>& labels) {
+            gil_scoped_release release;
+            return loss.loss(logits, labels.data(), static_cast<std::size_t>(labels.size()));
+        }, arg("logits"), arg("labels"))
+        .def("getTemperature", &SoftmaxCrossEntropy<bfloat>::getTemperature);
 
     class_<ComputationGraph<bfloat>, std::shared_ptr<ComputationGraph<bfloat>>>(m, "ComputationGraph")
         .def(init<>())
-        .def("addOperation", &ComputationGraph<bfloat>::addOperation)
-        .def("forward", &ComputationGraph<bfloat>::forward)
-        .def("backward", &ComputationGraph<bfloat>::backward);
+        .def("addOperation", static_cast<int (ComputationGraph<bfloat>::*)(const std::shared_ptr<Operation<bfloat>>&)>(
+                &ComputationGraph<bfloat>::addOperation), arg("operation"))
+        .def("addOperation", static_cast<int (ComputationGraph<bfloat>::*)(const std::shared_ptr<Operation<bfloat>>&, const std::vector<int>&)>(
+                &ComputationGraph<bfloat>::addOperation), arg("operation"), arg("inputs"))
+        .def("forward", &ComputationGraph<bfloat>::forward, call_guard<gil_scoped_release>())
+        .def("infer", &ComputationGraph<bfloat>::infer, call_guard<gil_scoped_release>())
+        .def("backward", &ComputationGraph<bfloat>::backward, call_guard<gil_scoped_release>())
+        .def("setMemoryPlanning", &ComputationGraph<bfloat>::setMemoryPlanning)
+        .def("memoryPlanning", &ComputationGraph<bfloat>::memoryPlanning)
+        .def("peakMemoryBytes", &ComputationGraph<bfloat>::peakMemoryBytes)
+        .def("unplannedMemoryBytes", &ComputationGraph<bfloat>::unplannedMemoryBytes)
+        .def("setParallelism", &ComputationGraph<bfloat>::setParallelism, arg("workers"))
+        .def("parallelism", &ComputationGraph<bfloat>::parallelism)
+        .def("effectiveParallelism", &ComputationGraph<bfloat>::effectiveParallelism)
+        .def("width", &ComputationGraph<bfloat>::width)
+        .def("setRecompute", &ComputationGraph<bfloat>::setRecompute, arg("operation"), arg("enabled"))
+        .def("recomputes", &ComputationGraph<bfloat>::recomputes, arg("operation"))
+        .def("size", &ComputationGraph<bfloat>::size);
+
+    // activation layout of a model's graph, see ModularCNN::setLayout
+    enum_<Layout>(m, "Layout")
+        .value("NCHW", Layout::NCHW)
+        .value("NCHW8c", Layout::NCHW8c)
+        .value("NCHW16c", Layout::NCHW16c);
+
+    // the thread pool every kernel runs its loops on, see ThreadPool::configure
+    enum_<ThreadAffinity>(m, "ThreadAffinity")
+        .value("Unpinned", ThreadAffinity::Unpinned)
+        .value("Compact", ThreadAffinity::Compact)
+        .value("Spread", ThreadAffinity::Spread);
+
+    m.def("setThreads", [](int threads, ThreadAffinity affinity) { ThreadPool::instance().configure(threads, affinity); },
+          arg("threads"), arg("affinity") = ThreadAffinity::Unpinned, call_guard<gil_scoped_release>());
+    m.def("getThreads", [] { return ThreadPool::instance().size(); });
+    m.def("getThreadAffinity", [] { return ThreadPool::instance().getAffinity(); });
+    m.def("getThreadCpus", [] { return ThreadPool::instance().getCpus(); });
+    m.def("numaNodes", &ThreadPool::numaNodes);
 
     class_<ModularCNN<bfloat>, std::shared_ptr<ModularCNN<bfloat>>>(m, "ModularCNN")
         .def(init<std::vector<LayerConfig>>())
         .def(init<std::string>())
         .def("buildGraph", &ModularCNN<bfloat>::buildGraph)
-        .def("forward", &ModularCNN<bfloat>::forward)
-        .def("forwards", &ModularCNN<bfloat>::forwards)
-        .def("backward", &ModularCNN<bfloat>::backward)
-        .def("update", &ModularCNN<bfloat>::update)
-        .def("zeroGrad", &ModularCNN<bfloat>::zeroGrad)
+        .def("forward", &ModularCNN<bfloat>::forward, call_guard<gil_scoped_release>())
+        .def("forwards", &ModularCNN<bfloat>::forwards, call_guard<gil_scoped_release>())
+        .def("classify", &ModularCNN<bfloat>::classify, call_guard<gil_scoped_release>())
+        .def("predict", &ModularCNN<bfloat>::predict, call_guard<gil_scoped_release>())
+        .def("logits", &ModularCNN<bfloat>::logits, call_guard<gil_scoped_release>())
+        .def("predictLogits", &ModularCNN<bfloat>::predictLogits, call_guard<gil_scoped_release>())
+        .def("backward", &ModularCNN<bfloat>::backward, call_guard<gil_scoped_release>())
+        .def("update", &ModularCNN<bfloat>::update, call_guard<gil_scoped_release>())
+        .def("backwardAndStep", &ModularCNN<bfloat>::backwardAndStep, arg("dOut"), arg("optimizer"), call_guard<gil_scoped_release>())
+        .def("zeroGrad", &ModularCNN<bfloat>::zeroGrad, call_guard<gil_scoped_release>())
         .def("saveWeights", &ModularCNN<bfloat>::saveWeights)
+        .def("setMemoryPlanning", &ModularCNN<bfloat>::setMemoryPlanning)
+        .def("peakMemoryBytes", &ModularCNN<bfloat>::peakMemoryBytes)
+        .def("setProfiling", &ModularCNN<bfloat>::setProfiling)
+        .def("getProfiler", &ModularCNN<bfloat>::getProfiler)
+        .def("setParallelism", &ModularCNN<bfloat>::setParallelism, arg("workers"))
+        .def("getParallelism", &ModularCNN<bfloat>::getParallelism)
+        .def("setLayout", &ModularCNN<bfloat>::setLayout, arg("layout"))
+        .def("getLayout", &ModularCNN<bfloat>::getLayout)
+        .def("setRecompute", &ModularCNN<bfloat>::setRecompute, arg("layer"), arg("enabled"))
+        .def("setCheckpointSegments", &ModularCNN<bfloat>::setCheckpointSegments, arg("segments"))
+        .def("getRecompute", &ModularCNN<bfloat>::getRecompute)
+        .def("getLayerTypes", &ModularCNN<bfloat>::getLayerTypes)
+        .def("getLayerInputs", &ModularCNN<bfloat>::getLayerInputs)
+        .def("isSequential", &ModularCNN<bfloat>::isSequential)
         .def("getTotalParams", &ModularCNN<bfloat>::getTotalParams);
 
+    // bfloat16 weights and activations with float master weights, takes and returns the same float Tensors
+    class_<MixedPrecisionCNN<BFloat16>, std::shared_ptr<MixedPrecisionCNN<BFloat16>>>(m, "ModularCNNBF16")
+        .def(init<std::vector<LayerConfig>>())
+        .def(init<std::string>())
+        .def("forward", &MixedPrecisionCNN<BFloat16>::forward, call_guard<gil_scoped_release>())
+        .def("predict", &MixedPrecisionCNN<BFloat16>::predict, call_guard<gil_scoped_release>())
+        .def("logits", &MixedPrecisionCNN<BFloat16>::logits, call_guard<gil_scoped_release>())
+        .def("predictLogits", &MixedPrecisionCNN<BFloat16>::predictLogits, call_guard<gil_scoped_release>())
+        .def("backward", &MixedPrecisionCNN<BFloat16>::backward, call_guard<gil_scoped_release>())
+        .def("update", &MixedPrecisionCNN<BFloat16>::update, call_guard<gil_scoped_release>())
+        .def("zeroGrad", &MixedPrecisionCNN<BFloat16>::zeroGrad, call_guard<gil_scoped_release>())
+        .def("saveWeights", &MixedPrecisionCNN<BFloat16>::saveWeights)
+        .def("setLossScale", &MixedPrecisionCNN<BFloat16>::setLossScale, arg("scale"), arg("dynamic") = false, arg("growth_interval") = 2000)
+        .def("lossScale", &MixedPrecisionCNN<BFloat16>::lossScale)
+        .def("skippedSteps", &MixedPrecisionCNN<BFloat16>::skippedSteps)
+        .def("setMemoryPlanning", &MixedPrecisionCNN<BFloat16>::setMemoryPlanning)
+        .def("peakMemoryBytes", &MixedPrecisionCNN<BFloat16>::peakMemoryBytes)
+        .def("setParallelism", &MixedPrecisionCNN<BFloat16>::setParallelism, arg("workers"))
+        .def("setLayout", &MixedPrecisionCNN<BFloat16>::setLayout, arg("layout"))
+        .def("getLayout", &MixedPrecisionCNN<BFloat16>::getLayout)
+        .def("setRecompute", &MixedPrecisionCNN<BFloat16>::setRecompute, arg("layer"), arg("enabled"))
+        .def("setCheckpointSegments", &MixedPrecisionCNN<BFloat16>::setCheckpointSegments, arg("segments"))
+        .def("getRecompute", &MixedPrecisionCNN<BFloat16>::getRecompute)
+        .def("setProfiling", &MixedPrecisionCNN<BFloat16>::setProfiling)
+        .def("getProfiler", &MixedPrecisionCNN<BFloat16>::getProfiler)
+        .def("getTotalParams", &MixedPrecisionCNN<BFloat16>::getTotalParams);
+
+    class_<QuantizationReport>(m, "QuantizationReport")
+        .def(init<>())
+        .def_readonly("samples", &QuantizationReport::samples)
+        .def_readonly("float_correct", &QuantizationReport::float_correct)
+        .def_readonly("quantized_correct", &QuantizationReport::quantized_correct)
+        .def_readonly("agreements", &QuantizationReport::agreements)
+        .def_readonly("max_probability_error", &QuantizationReport::max_probability_error)
+        .def("floatAccuracy", &QuantizationReport::floatAccuracy)
+        .def("quantizedAccuracy", &QuantizationReport::quantizedAccuracy)
+        .def("agreement", &QuantizationReport::agreement)
+        .def("__repr__", &QuantizationReport::summary);
+
+    // int8 inference engine made from a trained ModularCNN and a list of calibration batches
+    class_<QuantizedCNN, std::shared_ptr<QuantizedCNN>>(m, "QuantizedCNN")
+        .def(init<ModularCNN<bfloat>&, const std::vector<std::shared_ptr<Tensor<bfloat>>>&>(), arg("model"), arg("calibration"),
+             call_guard<gil_scoped_release>())
+        .def(init<std::string>())
+        .def("predict", &QuantizedCNN::predict, call_guard<gil_scoped_release>())
+        .def("forwards", &QuantizedCNN::forwards, call_guard<gil_scoped_release>())
+        .def("classify", &QuantizedCNN::classify, call_guard<gil_scoped_release>())
+        .def("compare", &QuantizedCNN::compare, arg("model"), arg("input"), arg("labels"), arg("report"), call_guard<gil_scoped_release>())
+        .def("saveWeights", &QuantizedCNN::saveWeights)
+        .def("weightBytes", &QuantizedCNN::weightBytes)
+        .def_static("kernelName", &QuantizedCNN::kernelName);
+
+    class_<Transport, std::shared_ptr<Transport>>(m, "Transport")
+        .def("rank", &Transport::rank)
+        .def("size", &Transport::size);
+
+    // every process of a job on this machine passes the same path and size, and its own rank
+    class_<UnixSocketTransport, Transport, std::shared_ptr<UnixSocketTransport>>(m, "UnixSocketTransport")
+        .def(init<const std::string&, int, int, double>(), arg("path"), arg("rank"), arg("size"), arg("timeout_seconds") = 60.0,
+             call_guard<gil_scoped_release>());
+
+    // one replica of a data-parallel job, backward averages the gradients of every replica
+    class_<DataParallel<bfloat>, std::shared_ptr<DataParallel<bfloat>>>(m, "DataParallel")
+        .def(init<ModularCNN<bfloat>&, std::shared_ptr<Transport>>(), arg("model"), arg("transport"), keep_alive<1, 2>(),
+             call_guard<gil_scoped_release>())
+        .def("backward", &DataParallel<bfloat>::backward, call_guard<gil_scoped_release>())
+        .def("average", &DataParallel<bfloat>::average, call_guard<gil_scoped_release>())
+        .def("inSync", &DataParallel<bfloat>::inSync, call_guard<gil_scoped_release>())
+        .def("rank", &DataParallel<bfloat>::rank)
+        .def("size", &DataParallel<bfloat>::size)
+        .def("lastCommunicationMs", &DataParallel<bfloat>::lastCommunicationMs)
+        .def("lastWaitMs", &DataParallel<bfloat>::lastWaitMs);
+
+    class_<InferenceResult>(m, "InferenceResult")
+        .def_readonly("probabilities", &InferenceResult::probabilities)
+        .def_readonly("top_classes", &InferenceResult::top_classes)
+        .def_readonly("top_probabilities", &InferenceResult::top_probabilities)
+        .def_readonly("latency_ms", &InferenceResult::latency_ms)
+        .def_readonly("batch_size", &InferenceResult::batch_size);
+
+    class_<InferenceStats>(m, "InferenceStats")
+        .def_readonly("requests", &InferenceStats::requests)
+        .def_readonly("batches", &InferenceStats::batches)
+        .def_readonly("mean_batch", &InferenceStats::mean_batch)
+        .def_readonly("p50_ms", &InferenceStats::p50_ms)
+        .def_readonly("p90_ms", &InferenceStats::p90_ms)
+        .def_readonly("p99_ms", &InferenceStats::p99_ms)
+        .def_readonly("max_ms", &InferenceStats::max_ms)
+        .def_readonly("throughput", &InferenceStats::throughput);
+
+    // micro-batches the infer calls of any number of Python threads into one predict of a ModularCNN or QuantizedCNN
+    class_<InferenceServer<bfloat>, std::shared_ptr<InferenceServer<bfloat>>>(m, "InferenceServer")
+        .def(init<ModularCNN<bfloat>&, int, int, int, int, double, int>(), arg("model"), arg("channels"), arg("height"),
+             arg("width"), arg("max_batch") = 32, arg("max_delay_ms") = 2.0, arg("top_k") = 5, keep_alive<1, 2>())
+        .def(init([](const std::shared_ptr<QuantizedCNN>& model, int channels, int height, int width, int max_batch,
+                     double max_delay_ms, int top_k) {
+                 return std::make_shared<InferenceServer<bfloat>>(
+                         [model](const std::shared_ptr<Tensor<bfloat>>& input) { return model->predict(input); }, channels,
+                         height, width, max_batch, max_delay_ms, top_k);
+             }), arg("model"), arg("channels"), arg("height"), arg("width"), arg("max_batch") = 32, arg("max_delay_ms") = 2.0,
+             arg("top_k") = 5)
+        // one (channels, height, width) float32 image, blocks without the GIL until its batch has run
+        .def("infer", [](InferenceServer<bfloat>& server, const array_t<bfloat, array::c_style | array::forcecast>& image) {
+            if(image.ndim() != 3 || static_cast<std::size_t>(image.size()) != server.imageSize()) {
+                throw value_error("Image must be a (channels, height, width) array of the server's image size");
+            }
+            gil_scoped_release release;
+            return server.infer(image.data());
+        }, arg("image"))
+        .def("stats", &InferenceServer<bfloat>::stats)
+        .def("resetStats", &InferenceServer<bfloat>::resetStats)
+        .def("maxBatch", &InferenceServer<bfloat>::maxBatch)
+        .def("maxDelayMs", &InferenceServer<bfloat>::maxDelayMs);
+
     class_<ConvolutionLayer<bfloat>, std::shared_ptr<ConvolutionLayer<bfloat>>>(m, "ConvolutionLayer")
         .def(init<int, int, int, int, int, int>())
         .def_readwrite("in_channels", &ConvolutionLayer<bfloat>::in_channels)
         .def_readwrite("out_channels", &ConvolutionLayer<bfloat>::out_channels)
         .def_readwrite("filter_height", &ConvolutionLayer<bfloat>::filter_height)
         .def_readwrite("filter_width", &ConvolutionLayer<bfloat>::filter_width)
-        .def_readwrite("filters", &ConvolutionLayer<bfloat>::filters)
-        .def_readwrite("biases", &ConvolutionLayer<bfloat>::biases)
-        .def_readwrite("dFilters", &ConvolutionLayer<bfloat>::dFilters)
-        .def_readwrite("dBiases", &ConvolutionLayer<bfloat>::dBiases)
+        .def_readonly("filters", &ConvolutionLayer<bfloat>::filters)
+        .def_readonly("biases", &ConvolutionLayer<bfloat>::biases)
+        .def_property_readonly("dFilters", [](const ConvolutionLayer<bfloat>& layer) { return toNumpy(layer.filters, true); })
+        .def_property_readonly("dBiases", [](const ConvolutionLayer<bfloat>& layer) { return toNumpy(layer.biases, true); })
         .def("initializeFilters", &ConvolutionLayer<bfloat>::initializeFilters)
-        .def("forward", &ConvolutionLayer<bfloat>::forward)
-        .def("backward", &ConvolutionLayer<bfloat>::backward)
+        .def("setWinogradTile", &ConvolutionLayer<bfloat>::setWinogradTile)
+        .def("winogradTile", &ConvolutionLayer<bfloat>::winogradTile)
+        .def("forward", &ConvolutionLayer<bfloat>::forward, arg("input"), arg("output") = nullptr, arg("pre_activation") = nullptr,
+             call_guard<gil_scoped_release>())
+        .def("backward", &ConvolutionLayer<bfloat>::backward, call_guard<gil_scoped_release>())
         .def("getNumParams", &ConvolutionLayer<bfloat>::getNumParams)
         .def("zeroGrad", &ConvolutionLayer<bfloat>::zeroGrad)
         .def("setFilters", &ConvolutionLayer<bfloat>::setFilters)
@@ -109,8 +484,9 @@ PYBIND11_MODULE(ModularCNN, m) {
         .def_readwrite("pool_width", &MaxPoolingLayer<bfloat>::pool_width)
         .def_readwrite("stride", &MaxPoolingLayer<bfloat>::stride)
         .def_readwrite("padding", &MaxPoolingLayer<bfloat>::padding)
-        .def("forward", &MaxPoolingLayer<bfloat>::forward)
-        .def("backward", &MaxPoolingLayer<bfloat>::backward)
+        .def("forward", &MaxPoolingLayer<bfloat>::forward, call_guard<gil_scoped_release>())
+        .def("backward", &MaxPoolingLayer<bfloat>::backward, call_guard<gil_scoped_release>())
+        .def("setTraining", &MaxPoolingLayer<bfloat>::setTraining)
         .def("zeroGrad", &MaxPoolingLayer<bfloat>::zeroGrad)
         .def("getNumParams", &MaxPoolingLayer<bfloat>::getNumParams)
         .def("saveWeights", &MaxPoolingLayer<bfloat>::saveWeights);
@@ -119,10 +495,10 @@ PYBIND11_MODULE(ModularCNN, m) {
         .def(init<int, int>())
         .def_readwrite("in_features", &FullyConnectedLayer<bfloat>::in_features)
         .def_readwrite("out_features", &FullyConnectedLayer<bfloat>::out_features)
-        .def_readwrite("weights", &FullyConnectedLayer<bfloat>::weights)
-        .def_readwrite("biases", &FullyConnectedLayer<bfloat>::biases)
-        .def_readwrite("dWeights", &FullyConnectedLayer<bfloat>::dWeights)
-        .def_readwrite("dBiases", &FullyConnectedLayer<bfloat>::dBiases)
+        .def_readonly("weights", &FullyConnectedLayer<bfloat>::weights)
+        .def_readonly("biases", &FullyConnectedLayer<bfloat>::biases)
+        .def_property_readonly("dWeights", [](const FullyConnectedLayer<bfloat>& layer) { return toNumpy(layer.weights, true); })
+        .def_property_readonly("dBiases", [](const FullyConnectedLayer<bfloat>& layer) { return toNumpy(layer.biases, true); })
         .def("initializeParams", &FullyConnectedLayer<bfloat>::initializeParams)
         .def("zeroGrad", &FullyConnectedLayer<bfloat>::zeroGrad)
         .def("getNumParams", &FullyConnectedLayer<bfloat>::getNumParams)
@@ -130,33 +506,45 @@ PYBIND11_MODULE(ModularCNN, m) {
 
     class_<ConvolutionOperation<bfloat>, std::shared_ptr<ConvolutionOperation<bfloat>>>(m, "ConvolutionOperation")
         .def(init<ConvolutionLayer<bfloat>&>())
-        .def("forward", &ConvolutionOperation<bfloat>::forward)
-        .def("backward", &ConvolutionOperation<bfloat>::backward);
+        .def("forward", &ConvolutionOperation<bfloat>::forward, call_guard<gil_scoped_release>())
+        .def("backward", &ConvolutionOperation<bfloat>::backward, call_guard<gil_scoped_release>());
 
     class_<MaxPoolingOperation<bfloat>, std::shared_ptr<MaxPoolingOperation<bfloat>>>(m, "MaxPoolingOperation")
         .def(init<int, int, int, int>())
-        .def("forward", &MaxPoolingOperation<bfloat>::forward)
-        .def("backward", &MaxPoolingOperation<bfloat>::backward);
+        .def("forward", &MaxPoolingOperation<bfloat>::forward, call_guard<gil_scoped_release>())
+        .def("backward", &MaxPoolingOperation<bfloat>::backward, call_guard<gil_scoped_release>())
+        .def("setTraining", &MaxPoolingOperation<bfloat>::setTraining)
+        .def("isTraining", &MaxPoolingOperation<bfloat>::isTraining);
 
     class_<FullyConnectedOperation<bfloat>, std::shared_ptr<FullyConnectedOperation<bfloat>>>(m, "FullyConnectedOperation")
         .def(init<FullyConnectedLayer<bfloat>&>())
-        .def("forward", &FullyConnectedOperation<bfloat>::forward)
-        .def("backward", &FullyConnectedOperation<bfloat>::backward);
+        .def("forward", &FullyConnectedOperation<bfloat>::forward, call_guard<gil_scoped_release>())
+        .def("backward", &FullyConnectedOperation<bfloat>::backward, call_guard<gil_scoped_release>());
 
     class_<AMSGrad<bfloat>, std::shared_ptr<AMSGrad<bfloat>>>(m, "AMSGrad")
         .def(init<double, double, double, double, double>())
-        .def("initializeConv", &AMSGrad<bfloat>::initializeConv)
-        .def("update", overload_cast<ConvolutionLayer<bfloat>&,
-                const std::vector<std::vector<std::vector<std::vector<bfloat>>>>&,
-                const std::vector<bfloat>&>(&AMSGrad<bfloat>::update))
-        .def("initializeFC", &AMSGrad<bfloat>::initializeFC)
-        .def("update", overload_cast<FullyConnectedLayer<bfloat>&,
-                const std::vector<std::vector<bfloat>>&,
-                const std::vector<bfloat>&>(&AMSGrad<bfloat>::update));
+        .def("timeStep", &AMSGrad<bfloat>::timeStep);
+
+    class_<ProfileRecord>(m, "ProfileRecord")
+        .def_readonly("name", &ProfileRecord::name)
+        .def_readonly("phase", &ProfileRecord::phase)
+        .def_readonly("index", &ProfileRecord::index)
+        .def_readonly("start_us", &ProfileRecord::start_us)
+        .def_readonly("duration_us", &ProfileRecord::duration_us)
+        .def_readonly("flops", &ProfileRecord::flops)
+        .def_readonly("bytes", &ProfileRecord::bytes)
+        .def_readonly("utilisation", &ProfileRecord::utilisation);
+
+    class_<Profiler, std::shared_ptr<Profiler>>(m, "Profiler")
+        .def("setEnabled", &Profiler::setEnabled)
+        .def("isEnabled", &Profiler::isEnabled)
+        .def("getRecords", &Profiler::getRecords)
+        .def("clear", &Profiler::clear)
+        .def("summary", &Profiler::summary)
+        .def("writeChromeTrace", &Profiler::writeChromeTrace);
 
     class_<WeightStruct<bfloat>, std::shared_ptr<WeightStruct<bfloat>>>(m, "WeightStruct")
-        .def("getType", &WeightStruct<bfloat>::getType)
-        .def("serialize", &WeightStruct<bfloat>::serialize);
+        .def("getType", &WeightStruct<bfloat>::getType);
 
     class_<ConvolutionalWeights<bfloat>, std::shared_ptr<ConvolutionalWeights<bfloat>>>(m, "ConvolutionalWeights")
         .def(init<const ConvolutionLayer<bfloat>&>())
@@ -166,21 +554,13 @@ PYBIND11_MODULE(ModularCNN, m) {
         .def_readwrite("filter_width", &ConvolutionalWeights<bfloat>::filter_width)
         .def_readwrite("stride", &ConvolutionalWeights<bfloat>::stride)
         .def_readwrite("padding", &ConvolutionalWeights<bfloat>::padding)
-        .def_readwrite("filters", &ConvolutionalWeights<bfloat>::filters)
-        .def_readwrite("biases", &ConvolutionalWeights<bfloat>::biases)
-        .def("getType", &ConvolutionalWeights<bfloat>::getType)
-        .def("serialize", &ConvolutionalWeights<bfloat>::serialize)
-        .def_static("deserialize", &ConvolutionalWeights<bfloat>::deserialize);
+        .def("getType", &ConvolutionalWeights<bfloat>::getType);
 
     class_<ConnectedWeights<bfloat>, std::shared_ptr<ConnectedWeights<bfloat>>>(m, "ConnectedWeights")
         .def(init<const FullyConnectedLayer<bfloat>&>())
         .def_readwrite("in_features", &ConnectedWeights<bfloat>::in_features)
         .def_readwrite("out_features", &ConnectedWeights<bfloat>::out_features)
-        .def_readwrite("weights", &ConnectedWeights<bfloat>::weights)
-        .def_readwrite("biases", &ConnectedWeights<bfloat>::biases)
-        .def("getType", &ConnectedWeights<bfloat>::getType)
-        .def("serialize", &ConnectedWeights<bfloat>::serialize)
-        .def_static("deserialize", &ConnectedWeights<bfloat>::deserialize);
+        .def("getType", &ConnectedWeights<bfloat>::getType);
 
     class_<PoolingWeights<bfloat>, std::shared_ptr<PoolingWeights<bfloat>>>(m, "PoolingWeights")
         .def(init<const MaxPoolingLayer<bfloat>&>())
@@ -188,21 +568,24 @@ PYBIND11_MODULE(ModularCNN, m) {
         .def_readwrite("pool_width", &PoolingWeights<bfloat>::pool_width)
         .def_readwrite("stride", &PoolingWeights<bfloat>::stride)
         .def_readwrite("padding", &PoolingWeights<bfloat>::padding)
-        .def("getType", &PoolingWeights<bfloat>::getType)
-        .def("serialize", &PoolingWeights<bfloat>::serialize)
-        .def_static("deserialize", &PoolingWeights<bfloat>::deserialize);
+        .def("getType", &PoolingWeights<bfloat>::getType);
 
     class_<LayerConfig, std::shared_ptr<LayerConfig>>(m, "LayerConfig")
             .def_static("conv", &LayerConfig::conv)
             .def_static("pool", &LayerConfig::pool)
             .def_static("fc", &LayerConfig::fc)
+            .def_static("add", &LayerConfig::add, arg("inputs"))
+            .def_static("concat", &LayerConfig::concat, arg("inputs"))
             .def_readwrite("type", &LayerConfig::type)
+            .def_readwrite("inputs", &LayerConfig::inputs)
+            .def_readwrite("recompute", &LayerConfig::recompute)
             .def_readwrite("in_channels", &LayerConfig::in_channels)
             .def_readwrite("out_channels", &LayerConfig::out_channels)
             .def_readwrite("filter_height", &LayerConfig::filter_height)
             .def_readwrite("filter_width", &LayerConfig::filter_width)
             .def_readwrite("stride", &LayerConfig::stride)
             .def_readwrite("padding", &LayerConfig::padding)
+            .def_readwrite("winograd_tile", &LayerConfig::winograd_tile)
             .def_readwrite("pool_height", &LayerConfig::pool_height)
             .def_readwrite("pool_width", &LayerConfig::pool_width)
             .def_readwrite("in_features", &LayerConfig::in_features)
@@ -0,0 +1,39 @@
+import ModularCNN
+from datasets import load_dataset
+from tqdm import tqdm
+
+# Configuration
+batch_size = 32
+calibration_batches = 16
+model_path = "models/train_0.bin"
+save_path = "models/train_0.int8"
+
+# Same split as test.py, so the test split is images the model has not been trained on
+ds = load_dataset("AlvaroVasquezAI/Animal_Image_Classification_Dataset")
+split_ds = ds["train"].train_test_split(test_size=0.1, seed=24)
+train_ds = split_ds["train"]
+test_ds = split_ds["test"]
+train_ds.set_format(type="numpy", columns=["image", "label"])
+test_ds.set_format(type="numpy", columns=["image", "label"])
+
+model = ModularCNN.ModularCNN(model_path)
+
+# Activation ranges come from running the float model on a few training batches
+calibration = []
+for batch in train_ds.iter(batch_size=batch_size):
+    calibration.append(ModularCNN.Tensor.from_numpy(batch["image"], "auto", True))
+    if len(calibration) == calibration_batches:
+        break
+
+quantized = ModularCNN.QuantizedCNN(model, calibration)
+print(f"int8 kernel: {ModularCNN.QuantizedCNN.kernelName()}, weights: {quantized.weightBytes()} bytes")
+
+# Accuracy of the float and the int8 model on the test split
+report = ModularCNN.QuantizationReport()
+for batch in tqdm(test_ds.iter(batch_size=batch_size), desc="Comparing"):
+    images = ModularCNN.Tensor.from_numpy(batch["image"], "auto", True)
+    labels = ModularCNN.Tensor.one_hot(batch["label"].astype("int64"), 3)
+    quantized.compare(model, images, labels, report)
+
+print(report)
+quantized.saveWeights(save_path)
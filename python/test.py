@@ -85,53 +85,22 @@ def numpy_to_tensor(np_array, TensorClass):
     """
     Converts a NumPy array of shape (batch_size, height, width, channels)
     to a Tensor object using the exposed TensorClass from C++.
-    If the images are in HWC order, transpose them to CHW.
+    The HWC -> CHW transpose and uint8 -> [0, 1] float scaling happen in a single C++ pass.
     """
-    # If np_array.shape is (batch, height, width, channels), transpose to (batch, channels, height, width)
     if np_array.ndim != 4:
         raise ValueError("Input array must have 4 dimensions")
-
-    # Check whether the last dimension is 3 or 1 (commonly the number of channels for an image)
-    # and assume that if it's 3 (or 1) and not in the expected CHW order, we transpose it.
-    batch_size, d2, d3, d4 = np_array.shape
-    # A simple heuristic: if the last dimension is 3 or 1, and the second dimension is large (e.g., 256)
-    # then the array is likely in HWC order.
-    if d4 in (1, 3) and d2 > 10:
-        np_array = np_array.transpose(0, 3, 1, 2)  # Rearranged to (batch, channels, height, width)
-
-    np_array = np.ascontiguousarray(np_array, dtype=np.float32)
-    batch_size, channels, height, width = np_array.shape
-
-    tensor_obj = TensorClass(batch_size, channels, height, width, 0.0)
-    for b in range(batch_size):
-        for c in range(channels):
-            for h in range(height):
-                for w in range(width):
-                    tensor_obj.setValue(b, c, h, w, np_array[b, c, h, w])
-    return tensor_obj
+    return TensorClass.from_numpy(np_array, "auto", True)
 
 
 def labels_to_tensor(labels_array, TensorClass):
     """Convert labels to one-hot encoded tensor"""
-    batch_size = labels_array.shape[0]
-    channels, height, width = 3, 1, 1
-    
-    # Create tensor
-    tensor_labels = TensorClass(batch_size, channels, height, width, 0.0)
-    
-    # Fill one-hot encoded values using setter
-    for b in range(batch_size):
-        label = int(labels_array[b])
-        if label < 0 or label >= channels:
-            raise ValueError(f"Label {label} at index {b} is invalid")
-        tensor_labels.setValue(b, label, 0, 0, 1.0)
-    
-    return tensor_labels
+    return TensorClass.one_hot(np.asarray(labels_array, dtype=np.int64), 3)
 
 
 # Initialize model, optimizer, criterion, and layer configurations
 optimizer = ModularCNN.AMSGrad(1e-4, 0.965, 0.999, 1e-8, 1e-2)
-criterion = ModularCNN.CrossEntropy(True)
+# Softmax and cross-entropy fused on the logits, with predict's temperature of 100 so eval and train losses agree
+criterion = ModularCNN.SoftmaxCrossEntropy(100.0, True)
 layers = [
     ModularCNN.LayerConfig.conv(3, 4, 3, 3, 1, 1),
     ModularCNN.LayerConfig.pool(2, 2, 2, 0),
@@ -148,33 +117,22 @@ model = ModularCNN.ModularCNN(layers)
 print(f"Number of parameters: {model.getTotalParams()}")
 print("Training model")
 
+# Background loader over the whole training split, each pass over it is one shuffled epoch
+train_loader = ModularCNN.DataLoader(np.stack(train_ds["image"]), np.asarray(train_ds["label"], dtype=np.int64), 3, batch_size,
+                                     shuffle=True, seed=24, workers=2, prefetch=4, one_hot=False)
+
 # Training and evaluation loops
 for epoch in range(num_epochs):
     # Training loop
-    train_iter = tqdm(train_ds.iter(batch_size=batch_size), desc=f"Epoch {epoch+1} (Train)")
-    for batch in train_iter:
-        images = batch["image"]
-        labels = batch["label"]
-
-        # print(labels)
-
-        # labels = np.array(labels)
-
-        # Convert NumPy images/labels to your custom Tensors
-        images = numpy_to_tensor(images, ModularCNN.Tensor)
-        labels = labels_to_tensor(labels, ModularCNN.Tensor)
+    train_iter = tqdm(train_loader, desc=f"Epoch {epoch+1} (Train)")
+    for images, labels in train_iter:
+        # Batches arrive as ready Tensors, converted and shuffled by the loader's worker threads during the previous step
 
         # print(images.data)
 
-        predictions = model.forward(images)
-
-        # print("Predictions")
-        # print(predictions.data)
-
-        # print("Labels")
-        # print(labels.data)
-        loss = criterion.forward(predictions, labels)
-        criterion.backward(predictions, labels)
+        # labels are the integer classes, the loss also writes its gradient into logits.grad
+        logits = model.logits(images)
+        loss = criterion.forward(logits, labels)
 
         # print("Grad")
         # print(len(grad.data))
@@ -182,7 +140,7 @@ for epoch in range(num_epochs):
         # print(len(grad.data[0][0]))
         # print(len(grad.data[0][0][0]))
 
-        model.backward(predictions)
+        model.backward(logits)
         model.update(optimizer)
         model.zeroGrad()
 
@@ -198,10 +156,8 @@ for epoch in range(num_epochs):
         # labels = np.array(labels)
 
         images = numpy_to_tensor(images, ModularCNN.Tensor)
-        labels = labels_to_tensor(labels, ModularCNN.Tensor)
 
-        predictions = model.forward(images)
-        loss = criterion.forward(predictions, labels)
+        loss = criterion.loss(model.predictLogits(images), np.asarray(labels, dtype=np.int64))
         cuml_loss += loss
 
     print(f"Epoch {epoch+1}, Eval Loss: {cuml_loss}")
@@ -0,0 +1,73 @@
+import os
+import sys
+import multiprocessing as mp
+
+import numpy as np
+import ModularCNN
+from datasets import load_dataset
+
+# Configuration
+processes = int(sys.argv[1]) if len(sys.argv) > 1 else 2
+batch_size = 32  # per replica, the global batch is batch_size * processes
+num_epochs = 5
+save_dir = "models/train_parallel.bin"
+socket_path = f"/tmp/modularcnn_{os.getpid()}"
+
+layers = [
+    ModularCNN.LayerConfig.conv(3, 4, 3, 3, 1, 1),
+    ModularCNN.LayerConfig.pool(2, 2, 2, 0),
+    ModularCNN.LayerConfig.conv(4, 8, 3, 3, 1, 1),
+    ModularCNN.LayerConfig.pool(2, 2, 2, 0),
+    ModularCNN.LayerConfig.conv(8, 16, 3, 3, 1, 1),
+    ModularCNN.LayerConfig.pool(2, 2, 2, 0),
+    ModularCNN.LayerConfig.fc(16384, 64),
+    ModularCNN.LayerConfig.fc(64, 3)
+]
+
+
+def train(rank):
+    # Every replica loads the same split, its DataLoader shard picks its share of each epoch
+    ds = load_dataset("AlvaroVasquezAI/Animal_Image_Classification_Dataset")
+    train_ds = ds["train"].train_test_split(test_size=0.1, seed=24)["train"]
+    train_ds.set_format(type="numpy", columns=["image", "label"])
+
+    transport = ModularCNN.UnixSocketTransport(socket_path, rank, processes)
+    model = ModularCNN.ModularCNN(layers)
+    parallel = ModularCNN.DataParallel(model, transport)  # every replica starts from rank 0's weights
+    optimizer = ModularCNN.AMSGrad(1e-4, 0.965, 0.999, 1e-8, 1e-2)
+    criterion = ModularCNN.SoftmaxCrossEntropy(100.0, True)
+
+    loader = ModularCNN.DataLoader(np.stack(train_ds["image"]), np.asarray(train_ds["label"], dtype=np.int64), 3, batch_size,
+                                   shuffle=True, seed=24, workers=2, prefetch=4, one_hot=False)
+    loader.shard(rank, processes)
+
+    for epoch in range(num_epochs):
+        total = 0.0
+        for images, labels in loader:
+            logits = model.logits(images)
+            loss = criterion.forward(logits, labels)
+            parallel.backward(logits)
+            model.update(optimizer)
+            model.zeroGrad()
+            total += parallel.average(loss)
+        if rank == 0:
+            print(f"Epoch {epoch+1}, Train Loss: {total / len(loader)}, "
+                  f"allreduce {parallel.lastCommunicationMs():.1f} ms ({parallel.lastWaitMs():.1f} ms not hidden)")
+
+    if not parallel.inSync():
+        raise RuntimeError(f"rank {rank}: replicas diverged")
+    if rank == 0:
+        model.saveWeights(save_dir)
+
+
+if __name__ == "__main__":
+    # Fresh interpreters, so no replica inherits another's pool threads, OMP_NUM_THREADS sizes each one's ThreadPool to an
+    # equal share of the cores
+    os.environ["OMP_NUM_THREADS"] = str(max(1, os.cpu_count() // processes))
+    ctx = mp.get_context("spawn")
+    workers = [ctx.Process(target=train, args=(rank,)) for rank in range(processes)]
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        worker.join()
+    sys.exit(max(worker.exitcode for worker in workers))
@@ -0,0 +1,288 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#include "../model/ModularCNN.h"
+#include "../tools/CrossEntropy.h"
+#include "../tools/SoftmaxCrossEntropy.h"
+#include "../tools/ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * finite-difference check of the gradients of convolution, fully connected and max pooling layers
+ *  - in double, over every layout (NCHW, NCHW8c, NCHW16c), with and without recomputation, and on the Winograd path
+ *  - the loss is sum(w * logits) for fixed random w, so dOut is w and every gradient is checked against
+ *    (loss(p + h) - loss(p - h)) / 2h
+ *  - the parameters are perturbed through the ParameterBuffer with no backward in between, so a layer that keeps
+ *    cached filters (Winograd, channel-blocked) must notice the write on its own
+ *  - a forward and backward must not count as parameter writes, or every step would rebuild the cached filters
+ *  - SoftmaxCrossEntropy against a log-sum-exp computed here in double, and its gradient against finite differences of
+ *    its loss, for few and many classes, a temperature and both reductions, on 4 threads with a batch that splits
+ *  - CrossEntropy and SoftmaxCrossEntropy on a batch that splits across 4 threads give the same loss and gradient,
+ *    bit for bit, as on 1 thread
+ *  - exits with 1 if any check fails
+ */
+namespace {
+    constexpr int BATCH = 2;
+    constexpr int SIZE = 12;
+    constexpr int PROBES = 24; // sampled parameters and input values per configuration
+    constexpr double STEP = 1e-6;
+    constexpr double TOLERANCE = 1e-5;
+    constexpr double LOSS_STEP = 1e-4; // the loss has no layers to amplify the step's truncation error, only rounding
+
+    // every conv path: 3x3 padded, 5x5 at stride 2, 1x1, odd channel counts that leave a partial block
+    std::vector<LayerConfig> network() {
+        return {LayerConfig::conv(3, 5, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0), LayerConfig::conv(5, 9, 5, 5, 2, 2),
+                LayerConfig::conv(9, 6, 1, 1), LayerConfig::pool(3, 3, 1, 1), LayerConfig::fc(6 * 3 * 3, 7), LayerConfig::fc(7, 4)};
+    }
+
+    struct Config {
+        std::string name;
+        Layout layout;
+        bool recompute;
+        int winograd_tile;
+    };
+
+    // largest parameter version of the conv layers, see Tensor::trackWrites
+    std::uint64_t parameterVersion(const ModularCNN<double>& model) {
+        std::uint64_t version = 0;
+        for(const auto& layer : model.getLayers()) {
+            for(const auto& tensor : layer->parameters()) {
+                version = std::max(version, tensor->version());
+            }
+        }
+        return version;
+    }
+
+    bool check(const Config& config) {
+        ModularCNN<double> model(network());
+        model.setLayout(config.layout);
+        if(config.recompute) {
+            for(int i = 0; i < static_cast<int>(model.getLayers().size()); ++i) {
+                model.setRecompute(i, true);
+            }
+        }
+        for(const auto& layer : model.getLayers()) {
+            if(auto conv = std::dynamic_pointer_cast<ConvolutionLayer<double>>(layer)) {
+                conv->setWinogradTile(config.winograd_tile);
+            }
+        }
+
+        // seeded weights instead of the random initialisation, so every run checks the same model
+        std::mt19937 rng(7);
+        std::normal_distribution<double> normal(0.0, 1.0);
+        ParameterBuffer<double>& parameters = model.getParameters();
+        for(std::size_t i = 0; i < parameters.size(); ++i) {
+            parameters.data()[i] = 0.4 * normal(rng);
+        }
+        auto input = std::make_shared<Tensor<double>>(BATCH, 3, SIZE, SIZE);
+        for(std::size_t i = 0; i < input->size(); ++i) {
+            input->data_ptr()[i] = normal(rng);
+        }
+        std::vector<double> weights(static_cast<std::size_t>(BATCH) * 4);
+        for(double& w : weights) {
+            w = normal(rng);
+        }
+        auto loss = [&] {
+            auto out = model.logits(input);
+            double sum = 0.0;
+            for(std::size_t i = 0; i < out->size(); ++i) {
+                sum += weights[i] * out->data_ptr()[i];
+            }
+            return sum;
+        };
+
+        // one forward first, so the cached filters exist before the parameters are written
+        loss();
+        model.zeroGrad();
+        input->zeroGrad();
+        std::uint64_t version = parameterVersion(model);
+        auto out = model.logits(input);
+        std::copy(weights.begin(), weights.end(), out->grad_ptr());
+        model.backward(out);
+        bool untouched = parameterVersion(model) == version;
+
+        std::vector<double> grads(parameters.grad(), parameters.grad() + parameters.size());
+        std::vector<double> input_grads(input->grad_ptr(), input->grad_ptr() + input->size());
+
+        auto error = [](double numeric, double analytic) { return std::abs(numeric - analytic) / std::max(1.0, std::abs(analytic)); };
+        double worst_parameter = 0.0;
+        for(int probe = 0; probe < PROBES; ++probe) {
+            std::size_t i = rng() % parameters.size();
+            double saved = parameters.data()[i];
+            parameters.data()[i] = saved + STEP;
+            double plus = loss();
+            parameters.data()[i] = saved - STEP;
+            double minus = loss();
+            parameters.data()[i] = saved;
+            worst_parameter = std::max(worst_parameter, error((plus - minus) / (2.0 * STEP), grads[i]));
+        }
+        double worst_input = 0.0;
+        for(int probe = 0; probe < PROBES; ++probe) {
+            std::size_t i = rng() % input->size();
+            double saved = input->data_ptr()[i];
+            input->data_ptr()[i] = saved + STEP;
+            double plus = loss();
+            input->data_ptr()[i] = saved - STEP;
+            double minus = loss();
+            input->data_ptr()[i] = saved;
+            worst_input = std::max(worst_input, error((plus - minus) / (2.0 * STEP), input_grads[i]));
+        }
+
+        double largest = 0.0;
+        for(double g : grads) {
+            largest = std::max(largest, std::abs(g));
+        }
+        bool passed = largest > 0.0 && untouched && worst_parameter < TOLERANCE && worst_input < TOLERANCE;
+        std::printf("%-24s parameters %.2e  input %.2e  forward/backward %s  %s\n", config.name.c_str(), worst_parameter, worst_input,
+                    untouched ? "read-only" : "WROTE PARAMETERS", passed ? "ok" : "FAILED");
+        return passed;
+    }
+
+    // few classes take the [class][sample] path, and its batch is large enough to split into more than one slice
+    bool fusedLoss(int rows, int classes, double temperature, bool mean) {
+        std::mt19937 rng(static_cast<unsigned>(rows + classes));
+        std::normal_distribution<double> normal(0.0, 3.0);
+        std::vector<std::int64_t> labels(rows);
+        auto logits = std::make_shared<Tensor<double>>(rows, classes, 1, 1);
+        double* x = logits->data_ptr();
+        for(int n = 0; n < rows; ++n) {
+            labels[n] = static_cast<std::int64_t>(rng() % classes);
+            double offset = n % 97 == 0 ? 2000.0 : 0.0; // exp overflows unless the max is taken out first
+            for(int c = 0; c < classes; ++c) {
+                x[static_cast<std::size_t>(n) * classes + c] = offset + normal(rng);
+            }
+        }
+
+        double expected = 0.0;
+        for(int n = 0; n < rows; ++n) {
+            const double* z = x + static_cast<std::size_t>(n) * classes;
+            double top = *std::max_element(z, z + classes) / temperature;
+            double sum = 0.0;
+            for(int c = 0; c < classes; ++c) {
+                sum += std::exp(z[c] / temperature - top);
+            }
+            expected += top + std::log(sum) - z[labels[n]] / temperature;
+        }
+        if(mean) {
+            expected /= rows;
+        }
+
+        SoftmaxCrossEntropy<double> criterion(temperature, mean);
+        double value = criterion.forward(logits, labels.data(), labels.size());
+        std::vector<double> grads(logits->grad_ptr(), logits->grad_ptr() + logits->size());
+        double value_error = std::abs(value - expected) / std::max(1.0, std::abs(expected));
+
+        // half the probes on a label, where the gradient has the -1 of the one-hot
+        double largest = 0.0;
+        for(double g : grads) {
+            largest = std::max(largest, std::abs(g));
+        }
+        double worst = 0.0;
+        for(int probe = 0; probe < 2 * PROBES; ++probe) {
+            int n = static_cast<int>(rng() % rows);
+            int c = probe % 2 == 0 ? static_cast<int>(labels[n]) : static_cast<int>(rng() % classes);
+            std::size_t i = static_cast<std::size_t>(n) * classes + c;
+            double saved = x[i];
+            x[i] = saved + LOSS_STEP;
+            double plus = criterion.loss(logits, labels.data(), labels.size());
+            x[i] = saved - LOSS_STEP;
+            double minus = criterion.loss(logits, labels.data(), labels.size());
+            x[i] = saved;
+            worst = std::max(worst, std::abs((plus - minus) / (2.0 * LOSS_STEP) - grads[i]) / largest);
+        }
+
+        bool passed = std::isfinite(value) && value_error < 1e-12 && largest > 0.0 && worst < TOLERANCE;
+        std::string name = "fused " + std::to_string(rows) + "x" + std::to_string(classes) + (mean ? " mean" : " sum");
+        std::printf("%-24s t %.1f  value %.2e  gradient %.2e  %s\n", name.c_str(), temperature, value_error, worst,
+                    passed ? "ok" : "FAILED");
+        return passed;
+    }
+
+    // losses of a batch that splits across the pool, on 1 thread and on 4
+    bool threadedLosses() {
+        constexpr int ROWS = 1024;
+        constexpr int CLASSES = 1000;
+        std::mt19937 rng(11);
+        std::normal_distribution<double> normal(0.0, 2.0);
+        std::vector<std::int64_t> labels(ROWS);
+        auto logits = std::make_shared<Tensor<float>>(ROWS, CLASSES, 1, 1);
+        auto probabilities = std::make_shared<Tensor<float>>(ROWS, CLASSES, 1, 1);
+        auto target = std::make_shared<Tensor<float>>(ROWS, CLASSES, 1, 1, 0.0f, false);
+        for(int n = 0; n < ROWS; ++n) {
+            labels[n] = static_cast<std::int64_t>(rng() % CLASSES);
+            target->data(n, static_cast<int>(labels[n]), 0, 0) = 1.0f;
+            double total = 0.0;
+            for(int c = 0; c < CLASSES; ++c) {
+                logits->data(n, c, 0, 0) = static_cast<float>(normal(rng));
+                total += std::exp(static_cast<double>(logits->data(n, c, 0, 0)));
+            }
+            for(int c = 0; c < CLASSES; ++c) {
+                probabilities->data(n, c, 0, 0) = static_cast<float>(std::exp(static_cast<double>(logits->data(n, c, 0, 0))) / total);
+            }
+        }
+
+        struct Result {
+            float entropy;
+            double fused;
+            std::vector<float> grad;
+        };
+        auto run = [&](int threads) {
+            ThreadPool::instance().configure(threads, ThreadAffinity::Unpinned);
+            Result result;
+            result.entropy = CrossEntropy<float>().forward(probabilities, target);
+            result.fused = SoftmaxCrossEntropy<float>().forward(logits, labels.data(), labels.size());
+            result.grad.assign(logits->grad_ptr(), logits->grad_ptr() + logits->size());
+            return result;
+        };
+        int previous = ThreadPool::instance().size();
+        ThreadAffinity affinity = ThreadPool::instance().getAffinity();
+        Result single = run(1);
+        Result threaded = run(4);
+        ThreadPool::instance().configure(previous, affinity);
+
+        bool passed = std::isfinite(single.fused) && single.entropy == threaded.entropy && single.fused == threaded.fused &&
+                      single.grad == threaded.grad;
+        std::printf("%-24s cross-entropy %.6f / %.6f  fused %.6f / %.6f  %s\n", "losses on 1 / 4 threads", single.entropy,
+                    threaded.entropy, single.fused, threaded.fused, passed ? "ok" : "FAILED");
+        return passed;
+    }
+}
+
+int main() {
+    std::vector<Config> configs;
+    for(Layout layout : {Layout::NCHW, Layout::NCHW8c, Layout::NCHW16c}) {
+        for(bool recompute : {false, true}) {
+            configs.push_back({layoutName(layout) + (recompute ? " recompute" : ""), layout, recompute, 0});
+        }
+    }
+    configs.push_back({"nchw winograd 2", Layout::NCHW, false, 2});
+    configs.push_back({"nchw winograd 4", Layout::NCHW, true, 4});
+
+    bool passed = true;
+    for(const auto& config : configs) {
+        passed = check(config) && passed;
+    }
+
+    // 8192 samples of 10 classes are 32 blocks of 256 and 1024 of 300 are 4, both split on 4 threads
+    int previous = ThreadPool::instance().size();
+    ThreadAffinity affinity = ThreadPool::instance().getAffinity();
+    ThreadPool::instance().configure(4, ThreadAffinity::Unpinned);
+    for(double temperature : {1.0, 2.5}) {
+        for(bool mean : {true, false}) {
+            passed = fusedLoss(8192, 10, temperature, mean) && passed;
+            passed = fusedLoss(1024, 300, temperature, mean) && passed;
+        }
+    }
+    ThreadPool::instance().configure(previous, affinity);
+    passed = threadedLosses() && passed;
+    std::printf(passed ? "all gradient checks passed\n" : "gradient checks FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#include "../model/ModularCNN.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * save / load round trips of ModelFile
+ *  - a chain (no input table) and a graph with add and concat records (input table) load back with the same layer
+ *    types, inputs and bit-identical predictions, and training a loaded model never writes back to the file
+ *  - a chain file marked version 1 (before the input table) still loads
+ *  - writes through the ParameterBuffer of a loaded model reach the layers' cached filters
+ *  - truncated files and corrupt headers, records and input tables are rejected with an exception
+ *  - exits with 1 if any check fails
+ */
+namespace {
+    typedef ModelFile<float>::Header Header;
+
+    const std::string DIRECTORY = "/tmp";
+
+    bool passed = true;
+
+    void expect(bool condition, const std::string& what) {
+        std::printf("%-60s %s\n", what.c_str(), condition ? "ok" : "FAILED");
+        passed = condition && passed;
+    }
+
+    std::vector<LayerConfig> chain() {
+        return {LayerConfig::conv(3, 5, 3, 3, 1, 1), LayerConfig::pool(2, 2, 2, 0), LayerConfig::conv(5, 6, 3, 3, 2, 0),
+                LayerConfig::fc(6 * 1 * 1, 4)};
+    }
+
+    // conv branches joined by concat, a residual add, then pool and fc
+    std::vector<LayerConfig> graph() {
+        auto stem = LayerConfig::conv(3, 4, 3, 3, 1, 1);
+        auto left = LayerConfig::conv(4, 3, 1, 1);
+        left.inputs = {0};
+        auto right = LayerConfig::conv(4, 1, 3, 3, 1, 1);
+        right.inputs = {0};
+        auto joined = LayerConfig::concat({1, 2});
+        auto residual = LayerConfig::add({3, 0});
+        return {stem, left, right, joined, residual, LayerConfig::pool(2, 2, 2, 0), LayerConfig::fc(4 * 4 * 4, 5)};
+    }
+
+    std::shared_ptr<Tensor<float>> images() {
+        auto input = std::make_shared<Tensor<float>>(2, 3, 8, 8, 0.0f, false);
+        for(std::size_t i = 0; i < input->size(); ++i) {
+            input->data_ptr()[i] = std::sin(static_cast<float>(i) * 0.37f);
+        }
+        return input;
+    }
+
+    std::vector<float> predict(ModularCNN<float>& model) {
+        auto out = model.predictLogits(images());
+        return {out->data_ptr(), out->data_ptr() + out->size()};
+    }
+
+    std::string read(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    }
+
+    void write(const std::string& path, const std::string& bytes) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    Header header(const std::string& bytes) {
+        Header result;
+        std::memcpy(&result, bytes.data(), sizeof(result));
+        return result;
+    }
+
+    std::string withHeader(std::string bytes, const std::function<void(Header&)>& edit) {
+        Header edited = header(bytes);
+        edit(edited);
+        std::memcpy(bytes.data(), &edited, sizeof(edited));
+        return bytes;
+    }
+
+    bool rejected(const std::string& bytes) {
+        std::string path = DIRECTORY + "/modularcnn_corrupt.bin";
+        write(path, bytes);
+        try {
+            ModularCNN<float> model(path);
+            return false;
+        }
+        catch(const std::exception&) {
+            return true;
+        }
+    }
+
+    void roundTrip(const std::string& name, const std::vector<LayerConfig>& configs) {
+        std::string path = DIRECTORY + "/modularcnn_" + name + ".bin";
+        ModularCNN<float> saved(configs);
+        std::vector<float> expected = predict(saved);
+        saved.saveWeights(path);
+        std::string bytes = read(path);
+
+        ModularCNN<float> loaded(path);
+        expect(loaded.getLayerTypes() == saved.getLayerTypes() && loaded.getLayerInputs() == saved.getLayerInputs(),
+               name + ": layer types and inputs");
+        expect(predict(loaded) == expected, name + ": predictions are bit-identical");
+
+        AMSGrad<float> optimizer;
+        auto out = loaded.logits(images());
+        std::fill(out->grad_ptr(), out->grad_ptr() + out->size(), 0.1f);
+        loaded.backward(out);
+        loaded.update(optimizer);
+        expect(predict(loaded) != expected && read(path) == bytes, name + ": training the loaded model leaves the file alone");
+    }
+}
+
+int main() {
+    roundTrip("chain", chain());
+    roundTrip("graph", graph());
+
+    std::string chain_path = DIRECTORY + "/modularcnn_chain.bin";
+    std::string graph_path = DIRECTORY + "/modularcnn_graph.bin";
+    std::string chain_bytes = read(chain_path);
+    std::string graph_bytes = read(graph_path);
+    expect(header(chain_bytes).inputs_count == 0 && header(graph_bytes).inputs_count > 0, "a chain has no input table, a graph has one");
+
+    // version 1, before the input table
+    {
+        ModularCNN<float> current(chain_path);
+        std::string path = DIRECTORY + "/modularcnn_version1.bin";
+        write(path, withHeader(chain_bytes, [](Header& h) { h.version = 1; }));
+        ModularCNN<float> old(path);
+        expect(predict(old) == predict(current) && old.isSequential(), "version 1 file loads as a chain");
+    }
+
+    // the blocked filters of a mapped model follow writes made through its ParameterBuffer
+    {
+        ModularCNN<float> loaded(chain_path);
+        loaded.setLayout(Layout::NCHW8c);
+        predict(loaded);
+        ParameterBuffer<float>& parameters = loaded.getParameters();
+        for(std::size_t i = 0; i < parameters.size(); ++i) {
+            parameters.data()[i] *= 0.5f;
+        }
+        std::vector<float> blocked = predict(loaded);
+        loaded.setLayout(Layout::NCHW);
+        std::vector<float> plain = predict(loaded);
+        double difference = 0.0;
+        for(std::size_t i = 0; i < plain.size(); ++i) {
+            difference = std::max(difference, static_cast<double>(std::abs(blocked[i] - plain[i])));
+        }
+        expect(difference < 1e-4, "writes to a loaded model reach its blocked filters");
+    }
+
+    // wrong element type
+    try {
+        ModularCNN<double> wrong(chain_path);
+        expect(false, "float file rejected as double");
+    }
+    catch(const std::exception&) {
+        expect(true, "float file rejected as double");
+    }
+
+    // truncated and corrupt files
+    const Header good = header(graph_bytes);
+    expect(rejected(graph_bytes.substr(0, sizeof(Header) - 1)), "shorter than a header");
+    expect(rejected(graph_bytes.substr(0, graph_bytes.size() - sizeof(float))), "weight image cut short");
+    expect(rejected(graph_bytes.substr(0, good.records_offset + sizeof(LayerRecord))), "records cut short");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.magic[0] = 'X'; })), "bad magic");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.version = ModelFile<float>::VERSION + 1; })), "unknown version");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.byte_order = 0x04030201; })), "other byte order");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.layer_count = 1u << 30; })), "layer count past the end");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.records_offset = ~0ull; })), "records offset past the end");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.weights_offset += 4; })), "misaligned weight image");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.weights_count += 1; })), "weight count past the end");
+    expect(rejected(withHeader(graph_bytes, [](Header& h) { h.inputs_offset = ~0ull; })), "input table past the end");
+
+    // corrupt records and input table
+    auto record = [&](std::string bytes, int layer, const std::function<void(LayerRecord&)>& edit) {
+        LayerRecord r;
+        std::size_t at = good.records_offset + static_cast<std::size_t>(layer) * sizeof(LayerRecord);
+        std::memcpy(&r, bytes.data() + at, sizeof(r));
+        edit(r);
+        std::memcpy(bytes.data() + at, &r, sizeof(r));
+        return bytes;
+    };
+    expect(rejected(record(graph_bytes, 0, [](LayerRecord& r) { r.type = 99; })), "unknown layer type");
+    expect(rejected(record(graph_bytes, 0, [&](LayerRecord& r) { r.offset[0] = good.weights_count; })), "conv filters past the weight image");
+    expect(rejected(record(graph_bytes, 6, [&](LayerRecord& r) { r.offset[1] = good.weights_count - 1; })), "fc biases past the weight image");
+    auto table = [&](std::size_t index, std::int32_t value) {
+        std::string bytes = graph_bytes;
+        std::memcpy(bytes.data() + good.inputs_offset + index * sizeof(std::int32_t), &value, sizeof(value));
+        return bytes;
+    };
+    expect(rejected(table(0, 0)), "layer with no inputs");
+    expect(rejected(table(1, 3)), "layer reading a later layer");
+    expect(rejected(table(0, 1 << 20)), "input count past the table");
+
+    std::printf(passed ? "all model file checks passed\n" : "model file checks FAILED\n");
+    return passed ? 0 : 1;
+}
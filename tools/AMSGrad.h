@@ -8,20 +8,22 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
-#include <unordered_map>
-#include "../layers/ConvolutionLayer.h"
-#include "../layers/FullyConnectedLayer.h"
+#include <cstddef>
+#include <type_traits>
+#include "ParameterBuffer.h"
 
 /**
  * @brief AdamW + AMSGrad optimizer.
  *        - Adam with decoupled weight decay (AdamW)
  *        - AMSGrad ensures a non-decreasing second-moment estimate v_hat.
+ *        - m, v and v_hat are flat buffers parallel to a model's ParameterBuffer, one fused loop updates every
+ *          parameter of the model in a single parallel pass, and time_step advances once per step
+ *        - a step can also be taken in pieces, e.g. one layer at a time as backward finishes its gradients: beginStep,
+ *          then updateRange over ranges covering the buffer, which gives the same parameters as update
  *        - TIME COMPLEXITY: O(n) for n parameters
- *            - There are n parameters to update, and each update requires O(1) operations, although there are up to 5 nested for-loops,
- *           these simply iterate over the dimensions of the weights/filters and biases, and do not depend on the number of parameters.
+ *            - each parameter takes O(1) work per step
  *         - SPACE COMPLEXITY: O(n) for n parameters
  *              - The optimizer maintains 3 states: m, v, and v_hat, each of which requires the same amount of memory as the parameters being optimized.
- *              - Each of these states is stored in a separate map, which requires O(n) memory.
  *              - So technically, the space complexity is O(3n) -> O(n).
  */
 
@@ -34,47 +36,30 @@
      double epsilon;
      double weight_decay; // decoupled weight decay factor
      int time_step;
- 
-     // Structures to hold optimizer state for Convolutional Layers
-     struct ConvLayerState {
-         std::vector<std::vector<std::vector<std::vector<Type>>>> m_filters;     // first moment
-         std::vector<std::vector<std::vector<std::vector<Type>>>> v_filters;     // second moment
-         std::vector<std::vector<std::vector<std::vector<Type>>>> v_hat_filters; // max of v
- 
-         std::vector<Type> m_biases;
-         std::vector<Type> v_biases;
-         std::vector<Type> v_hat_biases;
-     };
- 
-     // Structures to hold optimizer state for Fully Connected Layers
-     struct FCLayerState {
-         std::vector<std::vector<Type>> m_weights;     // first moment
-         std::vector<std::vector<Type>> v_weights;     // second moment
-         std::vector<std::vector<Type>> v_hat_weights; // max of v
- 
-         std::vector<Type> m_biases;
-         std::vector<Type> v_biases;
-         std::vector<Type> v_hat_biases;
-     };
- 
-     // Maps to associate layers with their optimizer states
-     std::unordered_map<ConvolutionLayer<Type>*, ConvLayerState> conv_states;
-     std::unordered_map<FullyConnectedLayer<Type>*, FCLayerState> fc_states;
- 
+
+     // optimizer state, element i belongs to parameter i
+     std::vector<Type> m;     // first moment
+     std::vector<Type> v;     // second moment
+     std::vector<Type> v_hat; // max of v
+
+     // moments and parameters of [offset, offset + count) for the current step, and zeroed gradients when Zero is set
+     template <bool Zero>
+     void step(Type* params, std::conditional_t<Zero, Type*, const Type*> grads, std::size_t offset, std::size_t count);
+
  public:
      explicit AMSGrad(double lr = 1e-3, double b1 = 0.9, double b2 = 0.999, double eps = 1e-8, double wd = 1e-2);
- 
-     // convolution
-     void initializeConv(const ConvolutionLayer<Type>& layer);
-     void update(ConvolutionLayer<Type>& layer,
-                 const std::vector<std::vector<std::vector<std::vector<Type>>>>& dFilters,
-                 const std::vector<Type>& dBiases);
- 
-     // fully connected
-     void initializeFC(const FullyConnectedLayer<Type>& layer);
-     void update(FullyConnectedLayer<Type>& layer,
-                 const std::vector<std::vector<Type>>& dWeights,
-                 const std::vector<Type>& dBiases);
+
+     // one optimizer step over count parameters and their gradients
+     void update(Type* params, const Type* grads, std::size_t count);
+     void update(ParameterBuffer<Type>& parameters) { update(parameters.data(), parameters.grad(), parameters.size()); }
+
+     // the same step in pieces: beginStep advances the step for a buffer of count parameters, then updateRange steps
+     // parameters [offset, offset + count) of it, params and grads pointing at the first one, and zeroes their
+     // gradients, ranges of one step may run on any thread as long as they do not overlap
+     void beginStep(std::size_t count);
+     void updateRange(Type* params, Type* grads, std::size_t offset, std::size_t count);
+
+     [[nodiscard]] int timeStep() const { return time_step; }
  };
  
  #include "AMSGrad.tpp"
@@ -0,0 +1,55 @@
+//
+// Created by Vijay Goyal on 2025-01-24.
+//
+
+#ifndef INC_12_FINALPROJ_2_BFLOAT16_H
+#define INC_12_FINALPROJ_2_BFLOAT16_H
+
+#include <bit>
+#include <cstdint>
+
+/**
+ * @brief bfloat16 storage type: the top 16 bits of a float (8 exponent bits, 7 mantissa bits).
+ *        - same range as float, so activations and gradients need no loss scaling, only precision is lost
+ *        - converts implicitly to and from float, arithmetic on it happens in float
+ *        - rounds to nearest even when narrowing, NaN stays NaN
+ *        - used instead of std::bfloat16_t so the storage and rounding are the same on every compiler
+ */
+struct BFloat16 {
+    std::uint16_t bits; // left uninitialised like a float, so buffers of it are trivial to allocate
+
+    BFloat16() = default;
+    BFloat16(float value) : bits(narrow(value)) {}
+    BFloat16& operator=(float value) {
+        bits = narrow(value);
+        return *this;
+    }
+
+    operator float() const { return std::bit_cast<float>(static_cast<std::uint32_t>(bits) << 16); }
+
+    BFloat16& operator+=(float value) { return *this = static_cast<float>(*this) + value; }
+    BFloat16& operator-=(float value) { return *this = static_cast<float>(*this) - value; }
+    BFloat16& operator*=(float value) { return *this = static_cast<float>(*this) * value; }
+    BFloat16& operator/=(float value) { return *this = static_cast<float>(*this) / value; }
+
+    static std::uint16_t narrow(float value) {
+        // branch free so loops storing bfloat16 vectorise
+        std::uint32_t u = std::bit_cast<std::uint32_t>(value);
+        std::uint32_t rounded = (u + 0x7fffu + ((u >> 16) & 1u)) >> 16;
+        std::uint32_t nan = (u >> 16) | 0x40u; // quiet NaN
+        return static_cast<std::uint16_t>((u & 0x7fffffffu) > 0x7f800000u ? nan : rounded);
+    }
+};
+
+// type the kernels accumulate in for a storage type, float for bfloat16 and the type itself otherwise
+template <typename Type>
+struct Accumulator {
+    typedef Type type;
+};
+
+template <>
+struct Accumulator<BFloat16> {
+    typedef float type;
+};
+
+#endif //INC_12_FINALPROJ_2_BFLOAT16_H
@@ -0,0 +1,93 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#ifndef INC_12_FINALPROJ_2_BLOCKEDKERNELS_H
+#define INC_12_FINALPROJ_2_BLOCKEDKERNELS_H
+
+#include <algorithm>
+#include <cstddef>
+#include "BFloat16.h"
+
+/**
+ * @brief Direct convolution kernels on channel-blocked tensors (see ChannelBlocking), for one sample.
+ *        - the block size B (8 or 16) is a template parameter, every inner loop runs over the B channels of a block,
+ *          which sit next to each other in memory, so they vectorise whatever the image width or channel count
+ *        - filters are laid out as [out / B][in / B][FH][FW][in % B][out % B]: forward broadcasts one input value
+ *          and multiplies it by the B output channels of one filter tap, keeping TILE pixels x B channels of
+ *          accumulators in registers; the transposed layout [..][out % B][in % B] serves the input gradient
+ *        - inputs are read from a zero-padded copy made by pad(), in Acc (float for bfloat16)
+ *        - filterGrad keeps a few input channels x B output channels of accumulators per filter tap over the
+ *          whole image, inputGrad scatters TILE pixels at a time into a padded gradient
+ *        - any filter size, stride and padding, there is no Winograd or im2col path in a blocked layout
+ */
+template <typename Type>
+class BlockedKernels {
+public:
+    typedef typename Accumulator<Type>::type Acc;
+
+    static bool supports(int block) { return block == 8 || block == 16; }
+
+    static std::size_t filterSize(int out_channels, int in_channels, int filter_height, int filter_width, int block);
+    // position of filter (out, in, kh, kw) in the blocked layout
+    static std::size_t filterIndex(int out, int in, int kh, int kw, int in_blocks, int filter_height, int filter_width,
+                                   int block, bool transposed);
+    // filters[out][in][FH][FW] into the blocked layout (or the transposed one), lanes past the channel counts are 0
+    static void blockFilters(const Type* filters, int out_channels, int in_channels, int filter_height, int filter_width,
+                             int block, bool transposed, Acc* blocked);
+
+    // one sample [blocks][height][width * B] into [blocks][height + 2 * padding][(width + 2 * padding) * B] with zero borders
+    static void pad(const Type* input, int blocks, int height, int width, int padding, int block, Acc* padded);
+
+    // pre = convolution + bias and out = ReLU(pre) for one sample, each output may be nullptr and so may bias,
+    // rows are split across threads unless the caller is already parallel
+    static void forward(int block, const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                        const Acc* filters, int filter_height, int filter_width, int stride,
+                        int out_blocks, int out_height, int out_width, const Acc* bias, Type* pre, Type* out);
+
+    // dFilters (blocked layout) += filter gradient of one sample, grad is the ReLU-masked output gradient
+    static void filterGrad(int block, const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                           const Acc* grad, int out_blocks, int out_height, int out_width,
+                           int filter_height, int filter_width, int stride, Acc* dFilters);
+
+    // dPadded[in_blocks][padded_height][padded_width * B] += input gradient of one sample, from the transposed filters
+    static void inputGrad(int block, const Acc* grad, int out_blocks, int out_height, int out_width,
+                          const Acc* transposed, int filter_height, int filter_width, int stride,
+                          int in_blocks, int padded_height, int padded_width, Acc* dPadded);
+
+private:
+    // pixels (forward, inputGrad) or input channels (filterGrad) per register tile, TILE x B accumulators fill 256 bytes
+    template <int B>
+    static constexpr int tile() { return std::max(1, std::min(B, static_cast<int>(256 / (B * sizeof(Acc))))); }
+
+    // S is the stride when known at compile time (1 or 2), 0 reads it from stride
+    template <int B, int T, int S>
+    static void forwardTile(const Acc* padded, int in_blocks, std::ptrdiff_t in_plane, int padded_width,
+                            const Acc* filters, int filter_height, int filter_width, int stride, int oh, int ow0,
+                            const Acc* bias, Type* pre, Type* out);
+
+    template <int B>
+    static void forwardBlocks(const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                              const Acc* filters, int filter_height, int filter_width, int stride,
+                              int out_blocks, int out_height, int out_width, const Acc* bias, Type* pre, Type* out);
+
+    template <int B, int T, int S>
+    static void filterGradTile(const Acc* x, const Acc* grad, int padded_width, int out_height, int out_width, int stride, Acc* dw);
+
+    template <int B>
+    static void filterGradBlocks(const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                                 const Acc* grad, int out_blocks, int out_height, int out_width,
+                                 int filter_height, int filter_width, int stride, Acc* dFilters);
+
+    template <int B, int T, int S>
+    static void inputGradTile(const Acc* grad, const Acc* w, int stride, Acc* dPadded);
+
+    template <int B>
+    static void inputGradBlocks(const Acc* grad, int out_blocks, int out_height, int out_width,
+                                const Acc* transposed, int filter_height, int filter_width, int stride,
+                                int in_blocks, int padded_height, int padded_width, Acc* dPadded);
+};
+
+#include "BlockedKernels.tpp"
+
+#endif //INC_12_FINALPROJ_2_BLOCKEDKERNELS_H
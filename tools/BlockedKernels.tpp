@@ -0,0 +1,342 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#include "BlockedKernels.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "ThreadPool.h"
+
+template <typename Type>
+std::size_t BlockedKernels<Type>::filterSize(int out_channels, int in_channels, int filter_height, int filter_width, int block) {
+    std::size_t out_blocks = (out_channels + block - 1) / block;
+    std::size_t in_blocks = (in_channels + block - 1) / block;
+    return out_blocks * in_blocks * filter_height * filter_width * block * block;
+}
+
+template <typename Type>
+std::size_t BlockedKernels<Type>::filterIndex(int out, int in, int kh, int kw, int in_blocks, int filter_height, int filter_width,
+                                              int block, bool transposed) {
+    std::size_t tap = ((static_cast<std::size_t>(out / block) * in_blocks + in / block) * filter_height + kh) * filter_width + kw;
+    std::size_t lane = transposed ? static_cast<std::size_t>(out % block) * block + in % block
+                                  : static_cast<std::size_t>(in % block) * block + out % block;
+    return tap * block * block + lane;
+}
+
+template <typename Type>
+void BlockedKernels<Type>::blockFilters(const Type* filters, int out_channels, int in_channels, int filter_height, int filter_width,
+                                        int block, bool transposed, Acc* blocked) {
+    int in_blocks = (in_channels + block - 1) / block;
+    std::fill(blocked, blocked + filterSize(out_channels, in_channels, filter_height, filter_width, block), static_cast<Acc>(0.0));
+    for(int f = 0; f < out_channels; ++f) {
+        for(int c = 0; c < in_channels; ++c) {
+            for(int kh = 0; kh < filter_height; ++kh) {
+                for(int kw = 0; kw < filter_width; ++kw) {
+                    blocked[filterIndex(f, c, kh, kw, in_blocks, filter_height, filter_width, block, transposed)] =
+                            filters[((static_cast<std::ptrdiff_t>(f) * in_channels + c) * filter_height + kh) * filter_width + kw];
+                }
+            }
+        }
+    }
+}
+
+template <typename Type>
+void BlockedKernels<Type>::pad(const Type* input, int blocks, int height, int width, int padding, int block, Acc* padded) {
+    std::ptrdiff_t row = static_cast<std::ptrdiff_t>(width) * block;
+    std::ptrdiff_t padded_row = static_cast<std::ptrdiff_t>(width + 2 * padding) * block;
+    std::ptrdiff_t border = static_cast<std::ptrdiff_t>(padding) * block;
+    int padded_height = height + 2 * padding;
+    for(int b = 0; b < blocks; ++b) {
+        const Type* src = input + static_cast<std::ptrdiff_t>(b) * height * row;
+        Acc* dst = padded + static_cast<std::ptrdiff_t>(b) * padded_height * padded_row;
+        std::fill(dst, dst + padding * padded_row, static_cast<Acc>(0.0));
+        for(int h = 0; h < height; ++h) {
+            Acc* out_row = dst + (h + padding) * padded_row;
+            std::fill(out_row, out_row + border, static_cast<Acc>(0.0));
+            std::copy(src + h * row, src + (h + 1) * row, out_row + border);
+            std::fill(out_row + border + row, out_row + padded_row, static_cast<Acc>(0.0));
+        }
+        std::fill(dst + (padding + height) * padded_row, dst + padded_height * padded_row, static_cast<Acc>(0.0));
+    }
+}
+
+/*
+ * T pixels of one output row and one block of B output channels
+ *  - every input value is loaded once per filter tap and multiplied by the B filter values of that tap, the T x B
+ *    accumulators stay in registers over every input block and tap
+ *  - bias, the pre-activation and the ReLU are applied on the way out
+ */
+template <typename Type>
+template <int B, int T, int S>
+void BlockedKernels<Type>::forwardTile(const Acc* padded, int in_blocks, std::ptrdiff_t in_plane, int padded_width,
+                                       const Acc* filters, int filter_height, int filter_width, int stride, int oh, int ow0,
+                                       const Acc* bias, Type* pre, Type* out) {
+    typedef Acc Vec __attribute__((vector_size(B * sizeof(Acc))));
+    const int step = S > 0 ? S : stride; // a compile-time stride keeps the input offsets out of registers
+    Vec acc[T] = {};
+    for(int ib = 0; ib < in_blocks; ++ib) {
+        for(int kw = 0; kw < filter_width; ++kw) {
+            for(int kh = 0; kh < filter_height; ++kh) {
+                const Acc* x = padded + ib * in_plane + (static_cast<std::ptrdiff_t>(oh * step + kh) * padded_width + ow0 * step + kw) * B;
+                const Acc* w = filters + ((static_cast<std::ptrdiff_t>(ib) * filter_height + kh) * filter_width + kw) * B * B;
+                #pragma GCC unroll 16
+                for(int ic = 0; ic < B; ++ic) {
+                    Vec weights;
+                    std::memcpy(&weights, w + ic * B, sizeof(Vec));
+                    #pragma GCC unroll 8
+                    for(int t = 0; t < T; ++t) {
+                        acc[t] += x[t * step * B + ic] * weights;
+                    }
+                }
+            }
+        }
+    }
+    #pragma GCC unroll 8
+    for(int t = 0; t < T; ++t) {
+        std::ptrdiff_t at = static_cast<std::ptrdiff_t>(ow0 + t) * B;
+        #pragma omp simd
+        for(int o = 0; o < B; ++o) {
+            Acc sum = acc[t][o] + (bias ? bias[o] : static_cast<Acc>(0.0));
+            if(pre) {
+                pre[at + o] = sum;
+            }
+            if(out) {
+                out[at + o] = sum > static_cast<Acc>(0) ? sum : static_cast<Acc>(0.0);
+            }
+        }
+    }
+}
+
+template <typename Type>
+template <int B>
+void BlockedKernels<Type>::forwardBlocks(const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                                         const Acc* filters, int filter_height, int filter_width, int stride,
+                                         int out_blocks, int out_height, int out_width, const Acc* bias, Type* pre, Type* out) {
+    constexpr int T = tile<B>();
+    std::ptrdiff_t in_plane = static_cast<std::ptrdiff_t>(padded_height) * padded_width * B;
+    std::ptrdiff_t out_plane = static_cast<std::ptrdiff_t>(out_height) * out_width * B;
+    std::ptrdiff_t block_filters = static_cast<std::ptrdiff_t>(in_blocks) * filter_height * filter_width * B * B;
+
+    // rows split across threads, inline when the caller is already in a loop (e.g. over the batch)
+    ThreadPool::parallelFor(out_blocks * out_height, 1, [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int ob = i / out_height;
+            int oh = i % out_height;
+            const Acc* w = filters + ob * block_filters;
+            const Acc* b = bias ? bias + ob * B : nullptr;
+            std::ptrdiff_t at = ob * out_plane + static_cast<std::ptrdiff_t>(oh) * out_width * B;
+            Type* pre_row = pre ? pre + at : nullptr;
+            Type* out_row = out ? out + at : nullptr;
+            int ow0 = 0;
+            for(; ow0 + T <= out_width; ow0 += T) {
+                if(stride == 1) {
+                    forwardTile<B, T, 1>(padded, in_blocks, in_plane, padded_width, w, filter_height, filter_width, stride, oh, ow0, b, pre_row, out_row);
+                }
+                else if(stride == 2) {
+                    forwardTile<B, T, 2>(padded, in_blocks, in_plane, padded_width, w, filter_height, filter_width, stride, oh, ow0, b, pre_row, out_row);
+                }
+                else {
+                    forwardTile<B, T, 0>(padded, in_blocks, in_plane, padded_width, w, filter_height, filter_width, stride, oh, ow0, b, pre_row, out_row);
+                }
+            }
+            for(; ow0 < out_width; ++ow0) {
+                forwardTile<B, 1, 0>(padded, in_blocks, in_plane, padded_width, w, filter_height, filter_width, stride, oh, ow0, b, pre_row, out_row);
+            }
+        }
+    });
+}
+
+template <typename Type>
+void BlockedKernels<Type>::forward(int block, const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                                   const Acc* filters, int filter_height, int filter_width, int stride,
+                                   int out_blocks, int out_height, int out_width, const Acc* bias, Type* pre, Type* out) {
+    if(block == 8) {
+        forwardBlocks<8>(padded, in_blocks, padded_height, padded_width, filters, filter_height, filter_width, stride,
+                         out_blocks, out_height, out_width, bias, pre, out);
+    }
+    else if(block == 16) {
+        forwardBlocks<16>(padded, in_blocks, padded_height, padded_width, filters, filter_height, filter_width, stride,
+                          out_blocks, out_height, out_width, bias, pre, out);
+    }
+    else {
+        throw std::invalid_argument("BlockedKernels: unsupported block of " + std::to_string(block) + " channels.");
+    }
+}
+
+/*
+ * T input channels x B output channels of one filter tap, summed over every output pixel
+ *  - one pixel of the gradient is a vector of B output channels, it is multiplied by each of the T input values
+ *    under the tap
+ */
+template <typename Type>
+template <int B, int T, int S>
+void BlockedKernels<Type>::filterGradTile(const Acc* x, const Acc* grad, int padded_width, int out_height, int out_width,
+                                          int stride, Acc* dw) {
+    typedef Acc Vec __attribute__((vector_size(B * sizeof(Acc))));
+    const int step = S > 0 ? S : stride;
+    Vec acc[T] = {};
+    for(int oh = 0; oh < out_height; ++oh) {
+        const Acc* x_row = x + static_cast<std::ptrdiff_t>(oh * step) * padded_width * B;
+        const Acc* g_row = grad + static_cast<std::ptrdiff_t>(oh) * out_width * B;
+        for(int ow = 0; ow < out_width; ++ow) {
+            Vec g;
+            std::memcpy(&g, g_row + static_cast<std::ptrdiff_t>(ow) * B, sizeof(Vec));
+            const Acc* pixel = x_row + static_cast<std::ptrdiff_t>(ow) * step * B;
+            #pragma GCC unroll 16
+            for(int i = 0; i < T; ++i) {
+                acc[i] += pixel[i] * g;
+            }
+        }
+    }
+    #pragma GCC unroll 16
+    for(int i = 0; i < T; ++i) {
+        #pragma omp simd
+        for(int o = 0; o < B; ++o) {
+            dw[i * B + o] += acc[i][o];
+        }
+    }
+}
+
+template <typename Type>
+template <int B>
+void BlockedKernels<Type>::filterGradBlocks(const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                                            const Acc* grad, int out_blocks, int out_height, int out_width,
+                                            int filter_height, int filter_width, int stride, Acc* dFilters) {
+    constexpr int T = tile<B>();
+    std::ptrdiff_t in_plane = static_cast<std::ptrdiff_t>(padded_height) * padded_width * B;
+    std::ptrdiff_t out_plane = static_cast<std::ptrdiff_t>(out_height) * out_width * B;
+
+    ThreadPool::parallelFor(out_blocks * in_blocks, 1, [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int ob = i / in_blocks;
+            int ib = i % in_blocks;
+            const Acc* g = grad + ob * out_plane;
+            for(int kh = 0; kh < filter_height; ++kh) {
+                for(int kw = 0; kw < filter_width; ++kw) {
+                    Acc* dw = dFilters + (((static_cast<std::ptrdiff_t>(ob) * in_blocks + ib) * filter_height + kh) * filter_width + kw) * B * B;
+                    const Acc* x = padded + ib * in_plane + (static_cast<std::ptrdiff_t>(kh) * padded_width + kw) * B;
+                    for(int ic0 = 0; ic0 < B; ic0 += T) {
+                        if(stride == 1) {
+                            filterGradTile<B, T, 1>(x + ic0, g, padded_width, out_height, out_width, stride, dw + ic0 * B);
+                        }
+                        else if(stride == 2) {
+                            filterGradTile<B, T, 2>(x + ic0, g, padded_width, out_height, out_width, stride, dw + ic0 * B);
+                        }
+                        else {
+                            filterGradTile<B, T, 0>(x + ic0, g, padded_width, out_height, out_width, stride, dw + ic0 * B);
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename Type>
+void BlockedKernels<Type>::filterGrad(int block, const Acc* padded, int in_blocks, int padded_height, int padded_width,
+                                      const Acc* grad, int out_blocks, int out_height, int out_width,
+                                      int filter_height, int filter_width, int stride, Acc* dFilters) {
+    if(block == 8) {
+        filterGradBlocks<8>(padded, in_blocks, padded_height, padded_width, grad, out_blocks, out_height, out_width,
+                            filter_height, filter_width, stride, dFilters);
+    }
+    else if(block == 16) {
+        filterGradBlocks<16>(padded, in_blocks, padded_height, padded_width, grad, out_blocks, out_height, out_width,
+                             filter_height, filter_width, stride, dFilters);
+    }
+    else {
+        throw std::invalid_argument("BlockedKernels: unsupported block of " + std::to_string(block) + " channels.");
+    }
+}
+
+/*
+ * every output pixel adds its gradient, through each filter tap, to the input pixel under that tap
+ *  - T pixels x B input channels are summed in registers over the B output channels of a block, then added to
+ *    the padded input gradient, each input block is written by one thread
+ */
+template <typename Type>
+template <int B, int T, int S>
+void BlockedKernels<Type>::inputGradTile(const Acc* grad, const Acc* w, int stride, Acc* dPadded) {
+    typedef Acc Vec __attribute__((vector_size(B * sizeof(Acc))));
+    const int step = S > 0 ? S : stride;
+    Vec acc[T] = {};
+    #pragma GCC unroll 16
+    for(int oc = 0; oc < B; ++oc) {
+        Vec weights;
+        std::memcpy(&weights, w + oc * B, sizeof(Vec));
+        #pragma GCC unroll 8
+        for(int t = 0; t < T; ++t) {
+            acc[t] += grad[t * B + oc] * weights;
+        }
+    }
+    #pragma GCC unroll 8
+    for(int t = 0; t < T; ++t) {
+        Acc* d = dPadded + static_cast<std::ptrdiff_t>(t) * step * B;
+        #pragma omp simd
+        for(int i = 0; i < B; ++i) {
+            d[i] += acc[t][i];
+        }
+    }
+}
+
+template <typename Type>
+template <int B>
+void BlockedKernels<Type>::inputGradBlocks(const Acc* grad, int out_blocks, int out_height, int out_width,
+                                           const Acc* transposed, int filter_height, int filter_width, int stride,
+                                           int in_blocks, int padded_height, int padded_width, Acc* dPadded) {
+    constexpr int T = tile<B>();
+    std::ptrdiff_t in_plane = static_cast<std::ptrdiff_t>(padded_height) * padded_width * B;
+    std::ptrdiff_t out_plane = static_cast<std::ptrdiff_t>(out_height) * out_width * B;
+
+    ThreadPool::parallelFor(in_blocks, 1, [&](int first, int last) {
+        for(int ib = first; ib < last; ++ib) {
+            for(int ob = 0; ob < out_blocks; ++ob) {
+                for(int kh = 0; kh < filter_height; ++kh) {
+                    for(int kw = 0; kw < filter_width; ++kw) {
+                        const Acc* w = transposed + (((static_cast<std::ptrdiff_t>(ob) * in_blocks + ib) * filter_height + kh) * filter_width + kw) * B * B;
+                        for(int oh = 0; oh < out_height; ++oh) {
+                            const Acc* g_row = grad + ob * out_plane + static_cast<std::ptrdiff_t>(oh) * out_width * B;
+                            Acc* d_row = dPadded + ib * in_plane + static_cast<std::ptrdiff_t>(oh * stride + kh) * padded_width * B + kw * B;
+                            int ow0 = 0;
+                            for(; ow0 + T <= out_width; ow0 += T) {
+                                const Acc* g = g_row + static_cast<std::ptrdiff_t>(ow0) * B;
+                                Acc* d = d_row + static_cast<std::ptrdiff_t>(ow0) * stride * B;
+                                if(stride == 1) {
+                                    inputGradTile<B, T, 1>(g, w, stride, d);
+                                }
+                                else if(stride == 2) {
+                                    inputGradTile<B, T, 2>(g, w, stride, d);
+                                }
+                                else {
+                                    inputGradTile<B, T, 0>(g, w, stride, d);
+                                }
+                            }
+                            for(; ow0 < out_width; ++ow0) {
+                                inputGradTile<B, 1, 0>(g_row + static_cast<std::ptrdiff_t>(ow0) * B, w, stride,
+                                                       d_row + static_cast<std::ptrdiff_t>(ow0) * stride * B);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename Type>
+void BlockedKernels<Type>::inputGrad(int block, const Acc* grad, int out_blocks, int out_height, int out_width,
+                                     const Acc* transposed, int filter_height, int filter_width, int stride,
+                                     int in_blocks, int padded_height, int padded_width, Acc* dPadded) {
+    if(block == 8) {
+        inputGradBlocks<8>(grad, out_blocks, out_height, out_width, transposed, filter_height, filter_width, stride,
+                           in_blocks, padded_height, padded_width, dPadded);
+    }
+    else if(block == 16) {
+        inputGradBlocks<16>(grad, out_blocks, out_height, out_width, transposed, filter_height, filter_width, stride,
+                            in_blocks, padded_height, padded_width, dPadded);
+    }
+    else {
+        throw std::invalid_argument("BlockedKernels: unsupported block of " + std::to_string(block) + " channels.");
+    }
+}
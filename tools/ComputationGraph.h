@@ -7,18 +7,151 @@
 
 #include "Operation.h"
 #include "Tensor.h"
+#include "BFloat16.h"
+#include "ConvolutionOperation.h"
+#include "GraphExecutor.h"
+#include "MaxPoolingOperation.h"
+#include "MemoryPlanner.h"
+#include "Profiler.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
 #include <vector>
 #include <memory>
 
+/**
+ * @brief Directed acyclic graph of operations, e.g. a chain, Inception branches or residual connections.
+ *        - operations are added in a topological order, each reads the outputs of earlier operations (or the graph
+ *          input) and the last one added is the graph output
+ *        - forward, backward and infer run operations that do not depend on each other at the same time on a
+ *          work-stealing GraphExecutor whose workers split the ThreadPool between them, a graph without
+ *          independent operations (a chain) runs serially with every thread on each operation as before
+ *        - an output read by several operations gets one gradient per reader: the last reader accumulates into the
+ *          output's own gradient and the others into private buffers summed in by the producer's backward, so
+ *          concurrent backward passes never write the same memory and the sum has a fixed order
+ *        - forward/backward place every activation, gradient, private gradient and backward cache in one arena laid
+ *          out by a MemoryPlanner for the current input shape, buffers share memory only when the graph orders
+ *          their lifetimes, so a training step with an unchanged input shape allocates nothing
+ *        - tensors returned by forward live in that arena and are overwritten by the next forward
+ *        - with an enabled Profiler attached, every forward, backward and infer call of an operation is recorded (the
+ *          graph then runs serially)
+ *        - a backward hook is called with the index of each operation once its backward and the backward of every
+ *          operation after it are done, in descending order, when the gradients of its parameters are final (e.g.
+ *          to start reducing them while the ops before it run)
+ *        - a recomputed operation (gradient checkpointing) keeps neither its output nor its backward caches from
+ *          forward to backward: the plan lets other buffers use their memory in between, and the first backward that
+ *          needs them runs its forward again, after the recomputed operations it reads, so a run of recomputed
+ *          operations is recomputed at once from the kept outputs before it
+ */
 template <typename Type>
 class ComputationGraph {
+public:
+    static constexpr int INPUT = -1; // the graph input, as the input of an operation
+
 private:
-    std::vector<std::shared_ptr<Operation<Type>>> operations; // list of operations in the graph
+    typedef typename Tensor<Type>::Shape Shape;
+    typedef typename Accumulator<Type>::type Acc;
+
+    struct Edge {
+        int op;    // consumer
+        int input; // argument of the consumer
+    };
+
+    struct PlannedGrad {
+        std::shared_ptr<Type> buffer; // nullptr when unplanned
+        Shape shape;
+    };
+
+    // per operation, in insertion (topological) order
+    std::vector<std::shared_ptr<Operation<Type>>> operations;
+    std::vector<std::vector<int>> inputs;            // producer of each argument, an earlier operation or INPUT
+    std::vector<std::vector<bool>> private_grad;     // whether an argument accumulates into a private gradient
+    std::vector<std::vector<int>> forward_successors;  // distinct consumers, the dependencies of backward
+    std::vector<std::vector<int>> backward_successors; // distinct producers, the dependencies of forward
+    // per producer (INPUT at 0, operation i at i + 1): the reader writing its gradient, and the readers with a private one
+    std::vector<Edge> owners;
+    std::vector<std::vector<Edge>> private_edges;
+    std::vector<int> levels; // longest path from the graph input, ops of one level never depend on each other
+    int widest = 0;          // most operations on one level
+
+    std::vector<std::shared_ptr<Tensor<Type>>> inference_buffers; // activations reused between infer calls, one per operation
+
+    // tensors of the last forward, kept for backward
+    std::shared_ptr<Tensor<Type>> graph_input;
+    std::vector<std::shared_ptr<Tensor<Type>>> outputs;
+    std::vector<typename Operation<Type>::Inputs> arguments; // as passed to each operation, private gradients included
+
+    MemoryPlanner<Type> planner;
+    bool memory_planning = true;
+    Shape planned_shape = {0, 0, 0, 0}; // input shape the current plan was made for
+    std::vector<std::vector<PlannedGrad>> planned_private; // of each argument that has a private gradient
+    bool planned_step = false; // whether the last forward ran on the plan
+
+    int workers = 0; // 0 picks min(widest, ThreadPool width)
+    std::shared_ptr<GraphExecutor> executor;
+
+    std::shared_ptr<Profiler> profiler;
+    std::vector<std::vector<Shape>> input_shapes; // input shapes of each operation in the last profiled forward
+
+    std::function<void(int)> backward_hook;
+    std::shared_ptr<std::mutex> hook_lock = std::make_shared<std::mutex>(); // behind a pointer so the graph stays movable
+    std::vector<char> finished; // backward done, per operation
+    int next_hook = -1;         // highest operation whose hook has not been called
+
+    std::vector<char> recompute;   // per operation, as set by setRecompute
+    std::vector<char> recomputing; // under the current plan: recompute set, planned and not the graph output
+    std::vector<char> restored;    // recomputed since the last forward
+    std::shared_ptr<std::mutex> restore_lock = std::make_shared<std::mutex>();
+
+    [[nodiscard]] bool profiling() const { return profiler && profiler->isEnabled(); }
+
+    void checkConnected() const;
+    [[nodiscard]] int fusedPool(int i) const; // the max pool infer runs together with convolution i, or -1
+    void planMemory(const Shape& input_shape);
+    void dropPlan();
+
+    // runs task on every operation, in index order (or reversed) or on the executor along the edges
+    void schedule(bool reverse, const std::function<void(int)>& task);
+    void forwardOperation(int i, const char* phase = "forward");
+    void restore(int i); // recomputes operation i, after the recomputed operations it reads, unless done since forward
+    void backwardOperation(int i, const std::shared_ptr<Tensor<Type>>& loss_grad);
+    void finishBackward(int i);
+    static void accumulate(Tensor<Type>& into, const Tensor<Type>& from); // into.grad += from.grad
 
 public:
-    void addOperation(const std::shared_ptr<Operation<Type>> &operation); // add an operation to the graph
+    int addOperation(const std::shared_ptr<Operation<Type>> &operation); // reads the previous operation (or the graph input), returns its index
+    int addOperation(const std::shared_ptr<Operation<Type>> &operation, const std::vector<int>& operation_inputs); // one producer per argument
     std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>> &input); // perform a forward pass through the graph
     void backward(const std::shared_ptr<Tensor<Type>> &loss_grad); // perform a backward pass through the graph
+    std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>> &input); // forward pass without training caches
+
+    void setMemoryPlanning(bool enabled); // when off every forward allocates its own tensors
+    [[nodiscard]] bool memoryPlanning() const { return memory_planning; }
+
+    // threads running operations at once, 0 (the default) picks min(widest level, pool threads), 1 runs serially,
+    // each worker's operations get pool threads / workers threads, so a graph that is a chain apart from a few
+    // small branches can be faster with 1
+    void setParallelism(int worker_count);
+    [[nodiscard]] int parallelism() const { return workers; }
+    [[nodiscard]] int effectiveParallelism() const; // what the next pass uses
+    [[nodiscard]] int width() const { return widest; }
+
+    [[nodiscard]] int size() const { return static_cast<int>(operations.size()); }
+    [[nodiscard]] const std::vector<int>& operationInputs(int i) const { return inputs.at(i); }
+
+    // activation memory of one training step under the current plan, and what it takes without sharing
+    [[nodiscard]] std::size_t peakMemoryBytes() const { return planner.peakBytes(); }
+    [[nodiscard]] std::size_t unplannedMemoryBytes() const { return planner.unplannedBytes(); }
+
+    void setProfiler(std::shared_ptr<Profiler> p) { profiler = std::move(p); }
+
+    void setBackwardHook(std::function<void(int)> hook) { backward_hook = std::move(hook); } // an empty function removes it
+
+    // recompute operation i in backward instead of keeping its activations, takes effect with memory planning on, the
+    // last operation and operations that do not plan their tensors are always kept
+    void setRecompute(int i, bool enabled);
+    [[nodiscard]] bool recomputes(int i) const { return recompute.at(i) != 0; }
 };
 
 #include "ComputationGraph.tpp"
@@ -3,56 +3,616 @@
 //
 
 #include "ComputationGraph.h"
-#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "ThreadPool.h"
 
 template <typename Type>
-void ComputationGraph<Type>::addOperation(const std::shared_ptr<Operation<Type>>& operation) {
+int ComputationGraph<Type>::addOperation(const std::shared_ptr<Operation<Type>>& operation) {
+    return addOperation(operation, {size() - 1}); // the first operation reads INPUT
+}
+
+/*
+ * the new operation becomes the last reader of each of its producers, the reader that was last before it switches to
+ * a private gradient, so the reader whose backward runs first in a serial pass is the one writing the gradient itself
+ */
+template <typename Type>
+int ComputationGraph<Type>::addOperation(const std::shared_ptr<Operation<Type>>& operation, const std::vector<int>& operation_inputs) {
+    int index = size();
+    if(!operation) {
+        throw std::invalid_argument("ComputationGraph: cannot add a null operation.");
+    }
+    if(operation_inputs.empty()) {
+        throw std::invalid_argument("ComputationGraph: operation " + std::to_string(index) + " needs at least one input.");
+    }
+    for(int p : operation_inputs) {
+        if(p < INPUT || p >= index) {
+            throw std::invalid_argument("ComputationGraph: operation " + std::to_string(index) +
+                                        " can only read the graph input or an earlier operation, not " + std::to_string(p));
+        }
+    }
+
+    if(owners.empty()) {
+        owners.push_back({-1, -1});
+        private_edges.emplace_back();
+    }
     operations.push_back(operation);
+    inputs.push_back(operation_inputs);
+    recompute.push_back(0);
+    private_grad.emplace_back(operation_inputs.size(), false);
+    forward_successors.emplace_back();
+    backward_successors.emplace_back();
+    owners.push_back({-1, -1});
+    private_edges.emplace_back();
+
+    int level = 0;
+    for(int k = 0; k < static_cast<int>(operation_inputs.size()); ++k) {
+        int p = operation_inputs[k];
+        Edge& owner = owners[p + 1];
+        if(owner.op >= 0) {
+            private_grad[owner.op][owner.input] = true;
+            private_edges[p + 1].push_back(owner);
+        }
+        owner = {index, k};
+        if(p == INPUT) {
+            continue;
+        }
+        auto& producers = backward_successors[index];
+        if(std::find(producers.begin(), producers.end(), p) == producers.end()) {
+            producers.push_back(p);
+            forward_successors[p].push_back(index);
+        }
+        level = std::max(level, levels[p] + 1);
+    }
+    levels.push_back(level);
+    widest = std::max(widest, static_cast<int>(std::count(levels.begin(), levels.end(), level)));
+
+    dropPlan();
+    return index;
 }
 
 template <typename Type>
-std::shared_ptr<Tensor<Type>> ComputationGraph<Type>::forward(const std::shared_ptr<Tensor<Type>>& input) {
-    std::shared_ptr<Tensor<Type>> current = input;
+void ComputationGraph<Type>::setMemoryPlanning(bool enabled) {
+    memory_planning = enabled;
+    if(!enabled) {
+        dropPlan();
+    }
+}
+
+template <typename Type>
+void ComputationGraph<Type>::setParallelism(int worker_count) {
+    if(worker_count < 0) {
+        throw std::invalid_argument("ComputationGraph: parallelism must be 0 (automatic) or a number of threads.");
+    }
+    workers = worker_count;
+}
+
+template <typename Type>
+void ComputationGraph<Type>::setRecompute(int i, bool enabled) {
+    if(i < 0 || i >= size()) {
+        throw std::out_of_range("ComputationGraph: no operation " + std::to_string(i) + " to recompute.");
+    }
+    if(recompute[i] != enabled) {
+        recompute[i] = enabled;
+        dropPlan();
+    }
+}
+
+template <typename Type>
+int ComputationGraph<Type>::effectiveParallelism() const {
+    return std::max(1, workers > 0 ? workers : std::min(widest, ThreadPool::width()));
+}
+
+template <typename Type>
+void ComputationGraph<Type>::dropPlan() {
     for(auto& op : operations) {
-        current = op->forward({current});
-    }
-    return current;
-
-    // // Print input shape and values
-    // std::cout << "Input shape: " << input->data.size() << "x" 
-    //           << input->data[0].size() << "x"
-    //           << input->data[0][0].size() << "x" 
-    //           << input->data[0][0][0].size() << std::endl;
-
-    // std::shared_ptr<Tensor<Type>> current = input;
-    
-    // // Track and print each operation's output
-    // for(size_t i = 0; i < operations.size(); i++) {
-    //     current = operations[i]->forward({current});
-        
-    //     std::cout << "Operation " << i << " output shape: "
-    //               << current->data.size() << "x"
-    //               << current->data[0].size() << "x" 
-    //               << current->data[0][0].size() << "x"
-    //               << current->data[0][0][0].size() << std::endl;
-        
-    //     std::cout << "First few values: ";
-    //     if(!current->data.empty() && !current->data[0].empty() && 
-    //        !current->data[0][0].empty() && !current->data[0][0][0].empty()) {
-    //         for(int j = 0; j < std::min(5, (int)current->data[0][0][0].size()); j++) {
-    //             std::cout << current->data[0][0][0][j] << " ";
-    //         }
-    //     }
-    //     std::cout << std::endl;
-    // }
-    
-    // return current;
+        op->setPlanned({});
+    }
+    planned_private.clear();
+    recomputing.clear();
+    planned_shape = {0, 0, 0, 0};
+    planned_step = false;
+    planner.clear();
+}
+
+template <typename Type>
+void ComputationGraph<Type>::checkConnected() const {
+    for(int i = 0; i + 1 < size(); ++i) {
+        if(forward_successors[i].empty()) {
+            throw std::runtime_error("ComputationGraph: the output of operation " + std::to_string(i) +
+                                     " is never read, only the last operation can be unused.");
+        }
+    }
+}
+
+template <typename Type>
+int ComputationGraph<Type>::fusedPool(int i) const {
+    if(i == size() - 1 || forward_successors[i].size() != 1) {
+        return -1;
+    }
+    int j = forward_successors[i].front();
+    if(inputs[j].size() != 1 || !dynamic_cast<ConvolutionOperation<Type>*>(operations[i].get()) ||
+       !dynamic_cast<MaxPoolingOperation<Type>*>(operations[j].get())) {
+        return -1;
+    }
+    return j;
+}
+
+/*
+ * lay out one training step in the arena
+ *  - a buffer is used by the forward (F) or backward (B) of some operations, by the loss or at the end of the step:
+ *    an output is written by F(i) and read by F and B of each reader, its gradient is written by B of the reader
+ *    that owns it (by the loss for the graph output) and read by B(i), a private gradient is written by B of its
+ *    reader and read by B of the producer, caches an op keeps for backward live from F(i) to B(i)
+ *  - F(a) runs before F(b) when b depends on a, B(a) before B(b) when a depends on b, every forward before the loss
+ *    and every backward after it, two buffers share memory only if every use of one runs before the other is written
+ *  - in a chain this is the serial schedule of steps F(i) = i, loss = n, B(i) = 2n - i, which also gives the steps
+ *    recorded in the plan
+ *  - the output and caches of a recomputed operation are alive twice: in forward until its readers are done, and
+ *    again from its recomputation R(i) on, R(i) runs at the start of the first backward that restores it (a trigger),
+ *    so it follows a backward that precedes every trigger and precedes a backward that follows any, and it follows
+ *    the recomputation of the operations it restores first
+ * an operation that does not describe its tensors, and everything reading it, allocates its own
+ */
+template <typename Type>
+void ComputationGraph<Type>::planMemory(const Shape& input_shape) {
+    dropPlan();
+    int n = size();
+
+    std::vector<std::vector<Shape>> shapes(n);
+    for(int i = 0; i < n; ++i) {
+        std::vector<Shape> argument_shapes;
+        for(int p : inputs[i]) {
+            if(p != INPUT && shapes[p].empty()) {
+                break;
+            }
+            argument_shapes.push_back(p == INPUT ? input_shape : shapes[p][0]);
+        }
+        if(argument_shapes.size() == inputs[i].size()) {
+            shapes[i] = operations[i]->plannedShapesInputs(argument_shapes);
+        }
+    }
+
+    // descendants of each operation as bit sets, filled from the last operation back
+    std::size_t words = (n + 63) / 64;
+    std::vector<std::vector<std::uint64_t>> descendants(n, std::vector<std::uint64_t>(words, 0));
+    for(int i = n - 1; i >= 0; --i) {
+        for(int c : forward_successors[i]) {
+            descendants[i][c / 64] |= std::uint64_t(1) << (c % 64);
+            for(std::size_t w = 0; w < words; ++w) {
+                descendants[i][w] |= descendants[c][w];
+            }
+        }
+    }
+    auto depends = [&](int a, int b) { return (descendants[b][a / 64] >> (a % 64)) & 1; }; // a depends on b
+    auto bit = [](const std::vector<std::uint64_t>& set, int i) { return (set[i / 64] >> (i % 64)) & 1; };
+
+    // recomputed operations, those restored before each one, and the backwards that trigger each
+    recomputing.assign(n, 0);
+    for(int i = 0; i + 1 < n; ++i) {
+        recomputing[i] = recompute[i] && !shapes[i].empty();
+    }
+    std::vector<std::vector<std::uint64_t>> restored_first(n, std::vector<std::uint64_t>(words, 0));
+    std::vector<std::vector<std::uint64_t>> triggers(n, std::vector<std::uint64_t>(words, 0));
+    std::vector<int> last_trigger(n, -1);
+    for(int j = 0; j < n; ++j) {
+        std::vector<std::uint64_t> restores(words, 0);
+        auto add = [&](int x) {
+            if(x == INPUT || !recomputing[x]) {
+                return;
+            }
+            restores[x / 64] |= std::uint64_t(1) << (x % 64);
+            for(std::size_t w = 0; w < words; ++w) {
+                restores[w] |= restored_first[x][w];
+            }
+        };
+        for(int p : inputs[j]) {
+            add(p);
+            if(p != INPUT && recomputing[p] && recomputing[j]) {
+                restored_first[j][p / 64] |= std::uint64_t(1) << (p % 64);
+                for(std::size_t w = 0; w < words; ++w) {
+                    restored_first[j][w] |= restored_first[p][w];
+                }
+            }
+        }
+        add(j);
+        for(int x = 0; x < n; ++x) {
+            if(bit(restores, x)) {
+                triggers[x][j / 64] |= std::uint64_t(1) << (j % 64);
+                last_trigger[x] = j;
+            }
+        }
+    }
+    auto anyTrigger = [&](int x, const std::function<bool(int)>& test) {
+        for(int t = 0; t < n; ++t) {
+            if(bit(triggers[x], t) && test(t)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    struct Use {
+        int phase; // 0 forward, 1 loss, 2 backward, 3 end of the step
+        int op;
+        bool recompute = false; // in phase 2, R(op) instead of B(op)
+    };
+    auto before = [&](const Use& a, const Use& b) -> bool {
+        if(a.phase != b.phase) {
+            return a.phase < b.phase;
+        }
+        if(a.op == b.op && a.recompute == b.recompute) {
+            return false;
+        }
+        if(a.phase == 0) {
+            return depends(b.op, a.op);
+        }
+        if(a.phase != 2) {
+            return false;
+        }
+        if(a.recompute && b.recompute) {
+            return bit(restored_first[b.op], a.op);
+        }
+        if(a.recompute) {
+            return bit(triggers[a.op], b.op) || anyTrigger(a.op, [&](int t) { return t != b.op && depends(t, b.op); });
+        }
+        if(b.recompute) {
+            return !anyTrigger(b.op, [&](int t) { return t == a.op || !depends(a.op, t); });
+        }
+        return depends(a.op, b.op);
+    };
+    auto step = [&](const Use& u) {
+        if(u.recompute) {
+            return 2 * n - last_trigger[u.op];
+        }
+        return u.phase == 0 ? u.op : u.phase == 1 ? n : u.phase == 2 ? 2 * n - u.op : 2 * n + 1;
+    };
+
+    // of each requested buffer, the spans it is alive in, the first use of a span writes it
+    std::vector<std::vector<std::vector<Use>>> spans;
+    auto request = [&](const Shape& shape, std::vector<std::vector<Use>> buffer_spans) {
+        int first = step(buffer_spans.front().front());
+        int last = first;
+        for(const auto& span : buffer_spans) {
+            for(const Use& u : span) {
+                last = std::max(last, step(u));
+            }
+        }
+        std::size_t count = static_cast<std::size_t>(shape[0]) * shape[1] * shape[2] * shape[3];
+        int id = planner.request(count, first, last);
+        spans.push_back(std::move(buffer_spans));
+        return id;
+    };
+
+    struct Request {
+        Shape shape;
+        int data;
+        int grad;
+    };
+    std::vector<std::vector<Request>> requests(n);
+    for(int i = 0; i < n; ++i) {
+        bool last = i == n - 1;
+        for(std::size_t k = 0; k < shapes[i].size(); ++k) {
+            const Shape& shape = shapes[i][k];
+            if(k > 0) {
+                auto cache_spans = recomputing[i] ? std::vector<std::vector<Use>>{{{0, i}}, {{2, i, true}, {2, i}}}
+                                                  : std::vector<std::vector<Use>>{{{0, i}, {2, i}}};
+                requests[i].push_back({shape, request(shape, std::move(cache_spans)), -1});
+                continue;
+            }
+            std::vector<Use> data_uses = {{0, i}};
+            std::vector<Use> restored_uses = {{2, i, true}};
+            for(int c : forward_successors[i]) {
+                data_uses.push_back({0, c});
+                (recomputing[i] ? restored_uses : data_uses).push_back({2, c});
+                if(recomputing[i] && recomputing[c]) {
+                    restored_uses.push_back({2, c, true});
+                }
+            }
+            if(last) {
+                data_uses.push_back({1, i});
+                data_uses.push_back({3, i});
+            }
+            std::vector<std::vector<Use>> data_spans = {std::move(data_uses)};
+            if(recomputing[i]) {
+                data_spans.push_back(std::move(restored_uses));
+            }
+            std::vector<Use> grad_uses = last ? std::vector<Use>{{1, i}, {2, i}} : std::vector<Use>{{2, owners[i + 1].op}, {2, i}};
+            int data = request(shape, std::move(data_spans));
+            requests[i].push_back({shape, data, request(shape, {std::move(grad_uses)})});
+        }
+    }
+
+    std::vector<std::vector<int>> private_requests(n);
+    for(int i = 0; i < n; ++i) {
+        private_requests[i].assign(inputs[i].size(), -1);
+    }
+    for(int p = INPUT; p < n; ++p) {
+        if(p != INPUT && shapes[p].empty()) {
+            continue;
+        }
+        const Shape& shape = p == INPUT ? input_shape : shapes[p][0];
+        for(const Edge& e : private_edges[p + 1]) {
+            private_requests[e.op][e.input] = request(shape, {{{2, e.op}, {p == INPUT ? 3 : 2, p}}});
+        }
+    }
+
+    planner.plan([&](int a, int b) {
+        auto precedes = [&](const std::vector<Use>& x, const std::vector<Use>& y) {
+            return std::all_of(x.begin(), x.end(), [&](const Use& u) { return before(u, y.front()); });
+        };
+        for(const auto& x : spans[a]) {
+            for(const auto& y : spans[b]) {
+                if(!precedes(x, y) && !precedes(y, x)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    });
+
+    planned_private.assign(n, {});
+    for(int i = 0; i < n; ++i) {
+        planned_private[i].resize(inputs[i].size());
+        for(std::size_t k = 0; k < inputs[i].size(); ++k) {
+            int id = private_requests[i][k];
+            if(id >= 0) {
+                int p = inputs[i][k];
+                planned_private[i][k] = {planner.buffer(id), p == INPUT ? input_shape : shapes[p][0]};
+            }
+        }
+        if(requests[i].empty()) {
+            continue;
+        }
+        std::vector<std::shared_ptr<Tensor<Type>>> tensors;
+        for(const auto& r : requests[i]) {
+            tensors.push_back(Tensor<Type>::wrap(planner.buffer(r.data), r.grad < 0 ? nullptr : planner.buffer(r.grad),
+                                                 r.shape[0], r.shape[1], r.shape[2], r.shape[3]));
+        }
+        operations[i]->setPlanned(std::move(tensors));
+    }
+    planned_shape = input_shape;
+}
+
+template <typename Type>
+void ComputationGraph<Type>::schedule(bool reverse, const std::function<void(int)>& task) {
+    int n = size();
+    int threads = profiling() ? 1 : effectiveParallelism();
+    if(threads <= 1) {
+        for(int i = 0; i < n; ++i) {
+            task(reverse ? n - 1 - i : i);
+        }
+        return;
+    }
+
+    if(!executor || executor->size() != threads) {
+        executor = std::make_shared<GraphExecutor>(threads);
+    }
+    const auto& successors = reverse ? backward_successors : forward_successors;
+    const auto& predecessors = reverse ? forward_successors : backward_successors;
+    std::vector<int> dependencies(n);
+    for(int i = 0; i < n; ++i) {
+        dependencies[i] = static_cast<int>(predecessors[i].size());
+    }
+    executor->run(successors, dependencies, task);
+}
+
+// into.grad += from.grad, nothing when either has no gradient
+template <typename Type>
+void ComputationGraph<Type>::accumulate(Tensor<Type>& into, const Tensor<Type>& from) {
+    if(!into.grad_ptr() || !from.grad_ptr()) {
+        return;
+    }
+    if(into.shape() != from.shape() || !into.isContiguous() || !from.isContiguous()) {
+        throw std::invalid_argument("ComputationGraph: gradients of one output must be contiguous and of one shape.");
+    }
+    Type* dst = into.grad_ptr();
+    const Type* src = from.grad_ptr();
+    std::size_t count = into.size();
+    ThreadPool::parallelFor(count, ThreadPool::MIN_SLICE, [&](std::size_t first, std::size_t last) {
+        #pragma omp simd
+        for(std::size_t j = first; j < last; ++j) {
+            dst[j] = static_cast<Type>(static_cast<Acc>(dst[j]) + static_cast<Acc>(src[j]));
+        }
+    });
+}
+
+// arguments with a private gradient are views of the producer's data with a (planned or fresh) gradient of their own
+template <typename Type>
+void ComputationGraph<Type>::forwardOperation(int i, const char* phase) {
+    auto& args = arguments[i];
+    args.resize(inputs[i].size());
+    for(std::size_t k = 0; k < inputs[i].size(); ++k) {
+        int p = inputs[i][k];
+        const auto& source = p == INPUT ? graph_input : outputs[p];
+        if(!private_grad[i][k]) {
+            args[k] = source;
+            continue;
+        }
+        std::shared_ptr<Type> grad;
+        if(source->grad_ptr()) {
+            const PlannedGrad* planned = planned_step ? &planned_private[i][k] : nullptr;
+            grad = planned && planned->buffer && planned->shape == source->shape() ? planned->buffer
+                                                                                   : Tensor<Type>::allocate(source->size(), static_cast<Type>(0.0));
+        }
+        args[k] = source->withGrad(std::move(grad));
+    }
+
+    auto& op = operations[i];
+    if(!profiling()) {
+        outputs[i] = op->forwardInputs(args);
+        return;
+    }
+    input_shapes[i].clear();
+    for(const auto& arg : args) {
+        input_shapes[i].push_back(arg->shape());
+    }
+    auto mark = profiler->begin(Tensor<Type>::allocatedBytes());
+    outputs[i] = op->forwardInputs(args);
+    profiler->end(mark, op->name(), phase, i, op->flopsInputs(input_shapes[i], false), Tensor<Type>::allocatedBytes());
+}
+
+// the planned output of i is the tensor its readers keep, so its forward refills it in place
+template <typename Type>
+void ComputationGraph<Type>::restore(int i) {
+    if(i == INPUT || !recomputing[i] || restored[i]) {
+        return;
+    }
+    for(int p : inputs[i]) {
+        restore(p);
+    }
+    auto kept = outputs[i];
+    forwardOperation(i, "recompute");
+    if(outputs[i] != kept) {
+        throw std::logic_error("ComputationGraph: operation " + std::to_string(i) + " did not recompute into its planned output.");
+    }
+    restored[i] = 1;
+}
+
+template <typename Type>
+void ComputationGraph<Type>::backwardOperation(int i, const std::shared_ptr<Tensor<Type>>& loss_grad) {
+    if(planned_step && std::find(recomputing.begin(), recomputing.end(), 1) != recomputing.end()) {
+        std::lock_guard<std::mutex> guard(*restore_lock);
+        restore(i);
+        for(int p : inputs[i]) {
+            restore(p);
+        }
+    }
+    const auto& output = i == size() - 1 ? loss_grad : outputs[i];
+    for(const Edge& e : private_edges[i + 1]) {
+        accumulate(*output, *arguments[e.op][e.input]);
+    }
+    // planned gradients share memory with tensors that are dead by now, clear the ones this backward accumulates into
+    if(planned_step) {
+        for(std::size_t k = 0; k < inputs[i].size(); ++k) {
+            if(inputs[i][k] != INPUT || private_grad[i][k]) {
+                arguments[i][k]->zeroGrad();
+            }
+        }
+    }
+
+    auto& op = operations[i];
+    if(!profiling()) {
+        op->backward(output);
+        return;
+    }
+    auto mark = profiler->begin(Tensor<Type>::allocatedBytes());
+    op->backward(output);
+    double flops = i < static_cast<int>(input_shapes.size()) && !input_shapes[i].empty() ? op->flopsInputs(input_shapes[i], true) : 0.0;
+    profiler->end(mark, op->name(), "backward", i, flops, Tensor<Type>::allocatedBytes());
+}
+
+// hooks run in descending order, each once the operations after it are done as well
+template <typename Type>
+void ComputationGraph<Type>::finishBackward(int i) {
+    if(!backward_hook) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(*hook_lock);
+    finished[i] = 1;
+    while(next_hook >= 0 && finished[next_hook]) {
+        backward_hook(next_hook);
+        --next_hook;
+    }
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ComputationGraph<Type>::forward(const std::shared_ptr<Tensor<Type>>& input) {
+    int n = size();
+    if(n == 0) {
+        return input;
+    }
+    checkConnected();
+    if(memory_planning && input->shape() != planned_shape) {
+        planMemory(input->shape());
+    }
+    planned_step = memory_planning;
+
+    graph_input = input;
+    outputs.assign(n, nullptr);
+    restored.assign(n, 0);
+    arguments.resize(n);
+    if(profiling()) {
+        input_shapes.assign(n, {});
+    }
+    schedule(false, [this](int i) { forwardOperation(i); });
+    return outputs.back();
 }
 
 template <typename Type>
 void ComputationGraph<Type>::backward(const std::shared_ptr<Tensor<Type>>& loss_grad) {
-    std::shared_ptr<Tensor<Type>> current_grad = loss_grad;
-    for(auto it = operations.rbegin(); it != operations.rend(); ++it) {
-        current_grad = (*it)->backward(current_grad);
+    int n = size();
+    if(n == 0) {
+        return;
+    }
+    if(static_cast<int>(outputs.size()) != n || !outputs.back()) {
+        throw std::runtime_error("ComputationGraph: run forward before backward.");
+    }
+    finished.assign(n, 0);
+    next_hook = n - 1;
+    schedule(true, [&](int i) {
+        backwardOperation(i, loss_grad);
+        finishBackward(i);
+    });
+    // the graph input has no backward of its own, its private gradients are summed in here
+    for(const Edge& e : private_edges[0]) {
+        accumulate(*graph_input, *arguments[e.op][e.input]);
+    }
+}
+
+/*
+ * inference pass through the graph
+ *  - intermediate activations live in inference_buffers and are overwritten by the next call
+ *  - a convolution whose only reader is a max pool runs as one fused operation
+ *  - the returned tensor is never one of the reused buffers
+ */
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ComputationGraph<Type>::infer(const std::shared_ptr<Tensor<Type>>& input) {
+    int n = size();
+    if(n == 0) {
+        return input;
     }
-}
\ No newline at end of file
+    checkConnected();
+    inference_buffers.resize(n);
+    std::vector<std::shared_ptr<Tensor<Type>>> results(n);
+    bool profiled = profiling();
+
+    schedule(false, [&](int i) {
+        if(inputs[i].size() == 1 && inputs[i][0] != INPUT && fusedPool(inputs[i][0]) == i) {
+            return; // ran with its convolution
+        }
+        typename Operation<Type>::Inputs args;
+        std::vector<Shape> shapes;
+        for(int p : inputs[i]) {
+            args.push_back(p == INPUT ? input : results[p]);
+            shapes.push_back(args.back()->shape());
+        }
+        Profiler::Mark mark{};
+        if(profiled) {
+            mark = profiler->begin(Tensor<Type>::allocatedBytes());
+        }
+        int j = fusedPool(i);
+        if(j >= 0) {
+            auto& conv = static_cast<ConvolutionOperation<Type>&>(*operations[i]);
+            auto& pool = static_cast<MaxPoolingOperation<Type>&>(*operations[j]);
+            results[j] = conv.inferPooled(args[0], inference_buffers[j], pool);
+            if(profiled) {
+                double flops = conv.flops(shapes[0], false) + pool.flops(conv.plannedShapes(shapes[0])[0], false);
+                profiler->end(mark, "conv+pool", "infer", i, flops, Tensor<Type>::allocatedBytes());
+            }
+            return;
+        }
+        results[i] = operations[i]->inferInputs(args, inference_buffers[i]);
+        if(profiled) {
+            profiler->end(mark, operations[i]->name(), "infer", i, operations[i]->flopsInputs(shapes, false),
+                          Tensor<Type>::allocatedBytes());
+        }
+    });
+
+    auto output = results.back();
+    if(output == inference_buffers.back()) {
+        inference_buffers.back().reset(); // hand the output to the caller, the next call allocates a new one
+    }
+    return output;
+}
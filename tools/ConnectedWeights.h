@@ -6,24 +6,27 @@
 #define CONNECTEDWEIGHTS_H
 
 #include <vector>
+#include "WeightStruct.h"
 
 template <typename Type>
 class FullyConnectedLayer;
 
+/**
+ * @brief Fully connected layer entry of a model file.
+ *        - config: in_features, out_features
+ *        - tensors: weights (out_features, in_features, 1, 1), biases (1, out_features, 1, 1)
+ */
 template <typename Type>
 struct ConnectedWeights : public WeightStruct<Type> {
-    typedef std::vector<std::vector<Type>> WeightsMatrix;
-
     int in_features;
     int out_features;
 
-    WeightsMatrix weights;
-    std::vector<Type> biases;
-
     explicit ConnectedWeights(const FullyConnectedLayer<Type>& layer);
     [[nodiscard]] WeightStructType getType() const override;
-    void serialize(std::ofstream& out) const override;
-    static std::shared_ptr<FullyConnectedLayer<Type>> deserialize(std::ifstream& in);
+    void describe(LayerRecord& record) const override;
+    // layer whose parameters are views into a weight image of count elements, nothing is copied
+    static std::shared_ptr<FullyConnectedLayer<Type>> deserialize(const LayerRecord& record, const std::shared_ptr<Type>& values,
+                                                                  const std::shared_ptr<Type>& grads, std::size_t count);
 };
 
 #include "ConnectedWeights.tpp"
@@ -8,8 +8,6 @@ template <typename Type>
 ConnectedWeights<Type>::ConnectedWeights(FullyConnectedLayer<Type> const& layer) {
     in_features = layer.in_features;
     out_features = layer.out_features;
-    weights = layer.weights;
-    biases = layer.biases;
 }
 
 template <typename Type>
@@ -18,28 +16,23 @@ WeightStructType ConnectedWeights<Type>::getType() const {
 }
 
 template<typename Type>
-void ConnectedWeights<Type>::serialize(std::ofstream &out) const {
-    out.write(reinterpret_cast<const char*>(&in_features), sizeof(in_features));
-    out.write(reinterpret_cast<const char*>(&out_features), sizeof(out_features));
-    out.write(reinterpret_cast<const char*>(&weights), sizeof(weights));
-    out.write(reinterpret_cast<const char*>(&biases), sizeof(biases));
+void ConnectedWeights<Type>::describe(LayerRecord& record) const {
+    record.type = static_cast<std::uint32_t>(getType());
+    record.tensor_count = 2;
+    record.config[0] = in_features;
+    record.config[1] = out_features;
 }
 
 template<typename Type>
-std::shared_ptr<FullyConnectedLayer<Type>> ConnectedWeights<Type>::deserialize(std::ifstream &in) {
-    int in_features_t;
-    int out_features_t;
-    WeightsMatrix weights_t;
-    std::vector<Type> biases_t;
-
-    in.read(reinterpret_cast<char*>(&in_features_t), sizeof(in_features_t));
-    in.read(reinterpret_cast<char*>(&out_features_t), sizeof(out_features_t));
-    in.read(reinterpret_cast<char*>(&weights_t), sizeof(weights_t));
-    in.read(reinterpret_cast<char*>(&biases_t), sizeof(biases_t));
-
-    auto temp = std::make_shared<FullyConnectedLayer<Type>>(in_features_t, out_features_t);
-    temp->weights = weights_t;
-    temp->biases = biases_t;
-    return temp;
+std::shared_ptr<FullyConnectedLayer<Type>> ConnectedWeights<Type>::deserialize(const LayerRecord& record, const std::shared_ptr<Type>& values,
+                                                                               const std::shared_ptr<Type>& grads, std::size_t count) {
+    int in_features_t = record.config[0];
+    int out_features_t = record.config[1];
+    if(record.tensor_count != 2) {
+        throw std::runtime_error("Model file: a fully connected layer must store weights and biases.");
+    }
+
+    auto weights_t = WeightStruct<Type>::view(values, grads, count, record.offset[0], out_features_t, in_features_t, 1, 1);
+    auto biases_t = WeightStruct<Type>::view(values, grads, count, record.offset[1], 1, out_features_t, 1, 1);
+    return std::make_shared<FullyConnectedLayer<Type>>(in_features_t, out_features_t, std::vector{weights_t, biases_t});
 }
-
@@ -0,0 +1,87 @@
+//
+// Created by Vijay Goyal on 2025-01-22.
+//
+
+#ifndef INC_12_FINALPROJ_2_CONVOLUTIONKERNELS_H
+#define INC_12_FINALPROJ_2_CONVOLUTIONKERNELS_H
+
+#include <cstddef>
+#include <vector>
+#include "Gemm.h"
+
+/**
+ * @brief Direct convolution kernels with the filter size and stride fixed at compile time, for one sample.
+ *        - instantiated for 1x1 at stride 1 and 3x3 and 5x5 at stride 1 and 2, select() returns nullptr for any other
+ *          shape and the layer falls back to im2col + GEMM
+ *        - inputs are read from a zero-padded copy made by pad(), so the unrolled filter window needs no bounds checks,
+ *          for stride 2 each padded row is stored as its even columns followed by its odd ones so every load is contiguous
+ *        - a 1x1 window is a matrix product and runs on the GEMM without im2col
+ *        - forward keeps a FILTER_BLOCK x TILE block of outputs (TILE = one cache line of Acc) in registers
+ *          while it walks every channel and filter tap, the stride 1 input gradient is the same kernel run
+ *          over the padded output gradient with the filters flipped and transposed
+ *        - filterGrad keeps one accumulator row per filter tap, it only exists for stride 1, at stride 2 the
+ *          GEMM on im2col columns is faster
+ *        - accumulators are of Acc (float for bfloat16), filterGrad adds into a filter gradient of Acc as well, bfloat16
+ *          inputs and filters are widened to Acc once per call rather than on every filter tap
+ */
+template <typename Type>
+class ConvolutionKernels {
+public:
+    typedef typename Accumulator<Type>::type Acc;
+
+    static constexpr int TILE = 64 / sizeof(Acc); // output columns per register tile
+    static constexpr int FILTER_BLOCK = 4;          // output channels per register tile
+
+    // out[out_channels][out_height][out_width] (+)= filters[out_channels][channels][FH][FW] (*) padded[channels][padded_height][padded_width]
+    typedef void (*Forward)(const Type* padded, int channels, int padded_height, int padded_width,
+                            const Type* filters, int out_channels, int out_height, int out_width, Type* out, bool accumulate);
+
+    // stride 1 dFilters[out_channels][channels][FH][FW] += sum over outputs of grad[out_channels][out_height][out_width] * window of padded
+    typedef void (*FilterGrad)(const Type* padded, int channels, int padded_height, int padded_width,
+                               const Type* grad, int out_channels, int out_height, int out_width, Acc* dFilters);
+
+    struct Kernels {
+        int filter_height;
+        int filter_width;
+        int stride;
+        Forward forward;
+        FilterGrad filterGrad; // nullptr when the GEMM path is faster
+        const char* name;
+    };
+
+    static const Kernels* select(int filter_height, int filter_width, int stride);
+
+    // copy of one sample with padding zeros on every side, in the column order the kernels of this stride read
+    static void pad(const Type* input, int channels, int height, int width, int padding, int stride, Type* padded);
+
+    // filters[out][in][FH][FW] -> flipped[in][out][FH][FW] rotated by 180 degrees, the filters of the input gradient
+    static void flipTranspose(const Type* filters, int out_channels, int in_channels, int filter_height, int filter_width, Type* flipped);
+
+    template <int FH, int FW, int S>
+    static void forward(const Type* padded, int channels, int padded_height, int padded_width,
+                        const Type* filters, int out_channels, int out_height, int out_width, Type* out, bool accumulate);
+
+    template <int FH, int FW>
+    static void filterGrad(const Type* padded, int channels, int padded_height, int padded_width,
+                           const Type* grad, int out_channels, int out_height, int out_width, Acc* dFilters);
+
+private:
+    // offset of padded column ow * S + kw in a row laid out by pad()
+    template <int S>
+    static std::ptrdiff_t column(int ow, int kw, int half) { return S == 1 ? ow + kw : (kw & 1) * half + ow + (kw >> 1); }
+
+    // src as Acc, the input itself when Type is Acc and otherwise a widened copy kept in scratch
+    static const Acc* widen(const Type* src, std::size_t count, std::vector<Acc>& scratch);
+
+    template <int FH, int FW, int S, int FB, bool FULL>
+    static void forwardTile(const Acc* row, int channels, std::ptrdiff_t plane, int padded_width,
+                            const Acc* filters, int K, int ow0, int count, Type* out, std::ptrdiff_t out_plane, bool accumulate);
+
+    template <int FH, int FW, int S, int FB>
+    static void forwardRow(const Acc* padded, int channels, std::ptrdiff_t plane, int padded_width,
+                           const Acc* filters, int K, int oh, int out_width, Type* out, std::ptrdiff_t out_plane, bool accumulate);
+};
+
+#include "ConvolutionKernels.tpp"
+
+#endif //INC_12_FINALPROJ_2_CONVOLUTIONKERNELS_H
@@ -0,0 +1,266 @@
+//
+// Created by Vijay Goyal on 2025-01-22.
+//
+
+#include "ConvolutionKernels.h"
+#include <algorithm>
+#include <type_traits>
+#include "ThreadPool.h"
+
+template <typename Type>
+const typename ConvolutionKernels<Type>::Kernels* ConvolutionKernels<Type>::select(int filter_height, int filter_width, int stride) {
+    // a 1x1 stride 2 window is only a subsampling gather, which is what im2col already does before its GEMM
+    static const Kernels table[] = {
+        {1, 1, 1, &forward<1, 1, 1>, &filterGrad<1, 1>, "1x1s1"},
+        {3, 3, 1, &forward<3, 3, 1>, &filterGrad<3, 3>, "3x3s1"},
+        {3, 3, 2, &forward<3, 3, 2>, nullptr, "3x3s2"},
+        {5, 5, 1, &forward<5, 5, 1>, &filterGrad<5, 5>, "5x5s1"},
+        {5, 5, 2, &forward<5, 5, 2>, nullptr, "5x5s2"},
+    };
+    for(const Kernels& k : table) {
+        if(k.filter_height == filter_height && k.filter_width == filter_width && k.stride == stride) {
+            return &k;
+        }
+    }
+    return nullptr;
+}
+
+template <typename Type>
+void ConvolutionKernels<Type>::pad(const Type* input, int channels, int height, int width, int padding, int stride, Type* padded) {
+    int padded_height = height + 2 * padding;
+    int padded_width = width + 2 * padding;
+    int half = (padded_width + 1) / 2;
+    for(int c = 0; c < channels; ++c) {
+        const Type* src = input + static_cast<std::ptrdiff_t>(c) * height * width;
+        Type* dst = padded + static_cast<std::ptrdiff_t>(c) * padded_height * padded_width;
+        std::fill(dst, dst + static_cast<std::ptrdiff_t>(padding) * padded_width, static_cast<Type>(0.0));
+        for(int h = 0; h < height; ++h) {
+            const Type* in_row = src + static_cast<std::ptrdiff_t>(h) * width;
+            Type* row = dst + static_cast<std::ptrdiff_t>(h + padding) * padded_width;
+            if(stride == 2) {
+                // even padded columns first, then the odd ones
+                for(int j = 0; j < padded_width; ++j) {
+                    int w = j - padding;
+                    row[(j & 1) * half + (j >> 1)] = w >= 0 && w < width ? in_row[w] : static_cast<Type>(0.0);
+                }
+                continue;
+            }
+            std::fill(row, row + padding, static_cast<Type>(0.0));
+            std::copy(in_row, in_row + width, row + padding);
+            std::fill(row + padding + width, row + padded_width, static_cast<Type>(0.0));
+        }
+        std::fill(dst + static_cast<std::ptrdiff_t>(padding + height) * padded_width,
+                  dst + static_cast<std::ptrdiff_t>(padded_height) * padded_width, static_cast<Type>(0.0));
+    }
+}
+
+template <typename Type>
+void ConvolutionKernels<Type>::flipTranspose(const Type* filters, int out_channels, int in_channels, int filter_height, int filter_width,
+                                             Type* flipped) {
+    int taps = filter_height * filter_width;
+    for(int f = 0; f < out_channels; ++f) {
+        for(int c = 0; c < in_channels; ++c) {
+            const Type* src = filters + (static_cast<std::ptrdiff_t>(f) * in_channels + c) * taps;
+            Type* dst = flipped + (static_cast<std::ptrdiff_t>(c) * out_channels + f) * taps;
+            for(int k = 0; k < taps; ++k) {
+                dst[k] = src[taps - 1 - k];
+            }
+        }
+    }
+}
+
+template <typename Type>
+const typename ConvolutionKernels<Type>::Acc* ConvolutionKernels<Type>::widen(const Type* src, std::size_t count, std::vector<Acc>& scratch) {
+    if constexpr(std::is_same_v<Type, Acc>) {
+        return src;
+    }
+    else {
+        scratch.resize(count);
+        std::copy(src, src + count, scratch.begin());
+        return scratch.data();
+    }
+}
+
+/*
+ * FB consecutive filters over TILE (or count) output columns of one row
+ *  - the FB x TILE accumulators stay in registers for the whole channel and filter-tap loop, every input vector
+ *    loaded is used by FB filters
+ *  - at stride 2 the padded rows are split into even and odd columns, so every load is contiguous
+ */
+template <typename Type>
+template <int FH, int FW, int S, int FB, bool FULL>
+void ConvolutionKernels<Type>::forwardTile(const Acc* row, int channels, std::ptrdiff_t plane, int padded_width,
+                                           const Acc* filters, int K, int ow0, int count, Type* out, std::ptrdiff_t out_plane,
+                                           bool accumulate) {
+    constexpr int N = TILE;
+    int half = (padded_width + 1) / 2;
+    Acc acc[FB][N] = {};
+    for(int c = 0; c < channels; ++c) {
+        const Acc* src_c = row + c * plane;
+        const Acc* w_c = filters + c * FH * FW;
+        #pragma GCC unroll 5
+        for(int kh = 0; kh < FH; ++kh) {
+            #pragma GCC unroll 5
+            for(int kw = 0; kw < FW; ++kw) {
+                const Acc* src = src_c + kh * padded_width + column<S>(ow0, kw, half);
+                Acc w[FB];
+                #pragma GCC unroll 4
+                for(int fb = 0; fb < FB; ++fb) {
+                    w[fb] = w_c[fb * K + kh * FW + kw];
+                }
+                #pragma omp simd
+                for(int t = 0; t < (FULL ? N : count); ++t) {
+                    #pragma GCC unroll 4
+                    for(int fb = 0; fb < FB; ++fb) {
+                        acc[fb][t] += w[fb] * src[t];
+                    }
+                }
+            }
+        }
+    }
+    #pragma GCC unroll 4
+    for(int fb = 0; fb < FB; ++fb) {
+        Type* dst = out + fb * out_plane + ow0;
+        if(accumulate) {
+            #pragma omp simd
+            for(int t = 0; t < (FULL ? N : count); ++t) {
+                dst[t] += acc[fb][t];
+            }
+        }
+        else {
+            #pragma omp simd
+            for(int t = 0; t < (FULL ? N : count); ++t) {
+                dst[t] = acc[fb][t];
+            }
+        }
+    }
+}
+
+template <typename Type>
+template <int FH, int FW, int S, int FB>
+void ConvolutionKernels<Type>::forwardRow(const Acc* padded, int channels, std::ptrdiff_t plane, int padded_width,
+                                          const Acc* filters, int K, int oh, int out_width, Type* out, std::ptrdiff_t out_plane,
+                                          bool accumulate) {
+    const Acc* row = padded + static_cast<std::ptrdiff_t>(oh) * S * padded_width;
+    Type* out_row = out + static_cast<std::ptrdiff_t>(oh) * out_width;
+    int ow0 = 0;
+    for(; ow0 + TILE <= out_width; ow0 += TILE) {
+        forwardTile<FH, FW, S, FB, true>(row, channels, plane, padded_width, filters, K, ow0, TILE, out_row, out_plane, accumulate);
+    }
+    if(ow0 < out_width) {
+        forwardTile<FH, FW, S, FB, false>(row, channels, plane, padded_width, filters, K, ow0, out_width - ow0, out_row, out_plane, accumulate);
+    }
+}
+
+template <typename Type>
+template <int FH, int FW, int S>
+void ConvolutionKernels<Type>::forward(const Type* padded, int channels, int padded_height, int padded_width,
+                                       const Type* filters, int out_channels, int out_height, int out_width, Type* out, bool accumulate) {
+    std::ptrdiff_t plane = static_cast<std::ptrdiff_t>(padded_height) * padded_width;
+    std::ptrdiff_t out_plane = static_cast<std::ptrdiff_t>(out_height) * out_width;
+    int K = channels * FH * FW;
+
+    // a 1x1 window is a plain matrix product, and the padded sample is already its [channels][out_height * out_width] operand
+    if constexpr(FH == 1 && FW == 1 && S == 1) {
+        int spatial = out_height * out_width;
+        Gemm<Type>::multiply(false, false, out_channels, spatial, channels, filters, channels, padded, spatial, out, spatial, accumulate);
+        return;
+    }
+
+    int blocks = (out_channels + FILTER_BLOCK - 1) / FILTER_BLOCK;
+    // the loop below reads them through source and weights, taken here, never by name on another thread
+    thread_local std::vector<Acc> wide_padded;
+    thread_local std::vector<Acc> wide_filters;
+    const Acc* source = widen(padded, static_cast<std::size_t>(channels) * plane, wide_padded);
+    const Acc* weights = widen(filters, static_cast<std::size_t>(out_channels) * K, wide_filters);
+
+    // rows split across threads, inline when the caller is already in a loop (e.g. over the batch)
+    ThreadPool::parallelFor(blocks * out_height, 1, [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int b = i / out_height;
+            int oh = i % out_height;
+            int f0 = b * FILTER_BLOCK;
+            if(f0 + FILTER_BLOCK <= out_channels) {
+                forwardRow<FH, FW, S, FILTER_BLOCK>(source, channels, plane, padded_width, weights + static_cast<std::ptrdiff_t>(f0) * K, K,
+                                                   oh, out_width, out + f0 * out_plane, out_plane, accumulate);
+                continue;
+            }
+            for(int f = f0; f < out_channels; ++f) {
+                forwardRow<FH, FW, S, 1>(source, channels, plane, padded_width, weights + static_cast<std::ptrdiff_t>(f) * K, K,
+                                         oh, out_width, out + f * out_plane, out_plane, accumulate);
+            }
+        }
+    });
+}
+
+/*
+ * stride 1 filter gradient of one sample, each (filter, channel) pair keeps FH * FW accumulator rows of TILE columns
+ * and reduces them once at the end
+ */
+template <typename Type>
+template <int FH, int FW>
+void ConvolutionKernels<Type>::filterGrad(const Type* padded, int channels, int padded_height, int padded_width,
+                                          const Type* grad, int out_channels, int out_height, int out_width, Acc* dFilters) {
+    std::ptrdiff_t plane = static_cast<std::ptrdiff_t>(padded_height) * padded_width;
+    std::ptrdiff_t out_plane = static_cast<std::ptrdiff_t>(out_height) * out_width;
+    constexpr int N = TILE;
+
+    if constexpr(FH == 1 && FW == 1) {
+        int spatial = out_height * out_width;
+        Gemm<Type>::multiply(false, true, out_channels, channels, spatial, grad, spatial, padded, spatial, dFilters, channels, true);
+        return;
+    }
+
+    // same as forward, the pool threads only see the source and gradient pointers
+    thread_local std::vector<Acc> wide_padded;
+    thread_local std::vector<Acc> wide_grad;
+    const Acc* source = widen(padded, static_cast<std::size_t>(channels) * plane, wide_padded);
+    const Acc* gradient = widen(grad, static_cast<std::size_t>(out_channels) * out_plane, wide_grad);
+
+    ThreadPool::parallelFor(out_channels * channels, 1, [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int f = i / channels;
+            int c = i % channels;
+            Acc acc[FH * FW][N] = {};
+            const Acc* g_f = gradient + f * out_plane;
+            const Acc* in_c = source + c * plane;
+            for(int oh = 0; oh < out_height; ++oh) {
+                const Acc* g_row = g_f + static_cast<std::ptrdiff_t>(oh) * out_width;
+                const Acc* in_row = in_c + static_cast<std::ptrdiff_t>(oh) * padded_width;
+                int ow0 = 0;
+                for(; ow0 + N <= out_width; ow0 += N) {
+                    const Acc* g = g_row + ow0;
+                    #pragma GCC unroll 5
+                    for(int kh = 0; kh < FH; ++kh) {
+                        #pragma GCC unroll 5
+                        for(int kw = 0; kw < FW; ++kw) {
+                            const Acc* x = in_row + kh * padded_width + ow0 + kw;
+                            #pragma omp simd
+                            for(int t = 0; t < N; ++t) {
+                                acc[kh * FW + kw][t] += g[t] * x[t];
+                            }
+                        }
+                    }
+                }
+                for(int ow = ow0; ow < out_width; ++ow) {
+                    Acc g = g_row[ow];
+                    for(int kh = 0; kh < FH; ++kh) {
+                        for(int kw = 0; kw < FW; ++kw) {
+                            acc[kh * FW + kw][ow - ow0] += g * in_row[kh * padded_width + ow + kw];
+                        }
+                    }
+                }
+            }
+
+            Acc* dw = dFilters + (static_cast<std::ptrdiff_t>(f) * channels + c) * FH * FW;
+            for(int k = 0; k < FH * FW; ++k) {
+                Acc sum = static_cast<Acc>(0.0);
+                #pragma omp simd reduction(+:sum)
+                for(int t = 0; t < N; ++t) {
+                    sum += acc[k][t];
+                }
+                dw[k] += sum;
+            }
+        }
+    });
+}
@@ -7,18 +7,30 @@
 
 #include "Operation.h"
 #include "../layers/ConvolutionLayer.h"
+#include "MaxPoolingOperation.h"
+#include "Layout.h"
 
 template <typename Type>
 class ConvolutionOperation : public Operation<Type> {
-    typedef std::vector<std::vector<std::vector<std::vector<Type>>>> Tensor4D;
 private:
     ConvolutionLayer<Type>& convolutionLayer;
     std::shared_ptr<Tensor<Type>> input;
+    int block; // channels per block of a blocked layout, 1 runs the layer's NCHW passes
 
 public:
-    explicit ConvolutionOperation(ConvolutionLayer<Type>& convolutionLayer);
+    // in a blocked layout input and output are ChannelBlocking tensors and the layer runs its blocked passes
+    explicit ConvolutionOperation(ConvolutionLayer<Type>& convolutionLayer, Layout layout = Layout::NCHW);
     std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& input) override;
     std::shared_ptr<Tensor<Type>> backward(const std::shared_ptr<Tensor<Type>>& output_grad) override;
+    std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) override;
+    std::vector<typename Tensor<Type>::Shape> plannedShapes(const typename Tensor<Type>::Shape& input_shape) const override; // output, pre-activation
+
+    [[nodiscard]] const char* name() const override { return "conv"; }
+    [[nodiscard]] double flops(const typename Tensor<Type>::Shape& input_shape, bool backward) const override;
+
+    // conv + bias + ReLU + max pool in one pass, the un-pooled activation is never written out
+    std::shared_ptr<Tensor<Type>> inferPooled(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out,
+                                              const MaxPoolingOperation<Type>& pool);
 };
 
 #include "ConvolutionOperation.tpp"
@@ -3,31 +3,69 @@
 //
 
 #include "ConvolutionOperation.h"
+#include <stdexcept>
 
 template <typename Type>
-ConvolutionOperation<Type>::ConvolutionOperation(ConvolutionLayer<Type>& layer) : convolutionLayer(layer), input(std::make_shared<Tensor<Type>>(0, 0, 0, 0, static_cast<Type>(0.0))) {}
+ConvolutionOperation<Type>::ConvolutionOperation(ConvolutionLayer<Type>& layer, Layout layout)
+        : convolutionLayer(layer), input(std::make_shared<Tensor<Type>>(0, 0, 0, 0, static_cast<Type>(0.0))), block(channelBlock(layout)) {
+    if(block > 1 && !BlockedKernels<Type>::supports(block)) {
+        throw std::invalid_argument("ConvolutionOperation: unsupported layout " + layoutName(layout));
+    }
+}
 
 template <typename Type>
 std::shared_ptr<Tensor<Type>> ConvolutionOperation<Type>::forward(const std::shared_ptr<Tensor<Type>>& input_tensor) {
     input = input_tensor; // cache input for backpropagation
-    std::shared_ptr<Tensor<Type>> output = convolutionLayer.forward(input); // perform convolution
-    return output;
+    auto shape = plannedShapes(input->shape()).front();
+    auto output = this->acquire(0, shape[0], shape[1], shape[2], shape[3]);
+    auto pre = this->acquire(1, shape[0], shape[1], shape[2], shape[3], false);
+    if(block > 1) {
+        return convolutionLayer.forwardBlocked(block, input, output, pre);
+    }
+    return convolutionLayer.forward(input, output, pre); // perform convolution
 }
 
 template <typename Type>
-std::shared_ptr<Tensor<Type>> ConvolutionOperation<Type>::backward(const std::shared_ptr<Tensor<Type>>& output_grad) {
-    Tensor4D dInput = convolutionLayer.backward(output_grad);
-
-    // accumulate gradients
-    for(int n = 0; n < dInput.size(); ++n) {
-        for(int c = 0; c < dInput[0].size(); ++c) {
-            for(int h = 0; h < dInput[0][0].size(); ++h) {
-                for(int w = 0; w < dInput[0][0][0].size(); ++w) {
-                    input->grad[n][c][h][w] += dInput[n][c][h][w];
-                }
-            }
-        }
+std::vector<typename Tensor<Type>::Shape> ConvolutionOperation<Type>::plannedShapes(const typename Tensor<Type>::Shape& input_shape) const {
+    typename Tensor<Type>::Shape out = {input_shape[0], (convolutionLayer.out_channels + block - 1) / block,
+                                        convolutionLayer.outputHeight(input_shape[2]),
+                                        convolutionLayer.outputWidth(input_shape[3] / block) * block};
+    return {out, out};
+}
+
+// 2 flops per multiply-add of the GEMM, backward runs one GEMM for the filter gradient and one for the input gradient,
+// padding lanes of a blocked layout are not counted
+template <typename Type>
+double ConvolutionOperation<Type>::flops(const typename Tensor<Type>::Shape& input_shape, bool backward) const {
+    const auto& layer = convolutionLayer;
+    double forward = 2.0 * input_shape[0] * layer.out_channels * layer.outputHeight(input_shape[2]) * layer.outputWidth(input_shape[3] / block)
+                     * layer.in_channels * layer.filter_height * layer.filter_width;
+    return backward ? 2.0 * forward : forward;
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ConvolutionOperation<Type>::infer(const std::shared_ptr<Tensor<Type>>& input_tensor, std::shared_ptr<Tensor<Type>>& out) {
+    if(block > 1) {
+        return convolutionLayer.inferBlocked(block, input_tensor, out);
     }
+    return convolutionLayer.infer(input_tensor, out);
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ConvolutionOperation<Type>::inferPooled(const std::shared_ptr<Tensor<Type>>& input_tensor, std::shared_ptr<Tensor<Type>>& out,
+                                                                      const MaxPoolingOperation<Type>& pool) {
+    if(block > 1) {
+        return convolutionLayer.inferBlocked(block, input_tensor, out, &pool);
+    }
+    return convolutionLayer.infer(input_tensor, out, &pool);
+}
 
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ConvolutionOperation<Type>::backward(const std::shared_ptr<Tensor<Type>>& output_grad) {
+    if(block > 1) {
+        convolutionLayer.backwardBlocked(block, output_grad);
+        return input;
+    }
+    convolutionLayer.backward(output_grad); // accumulates straight into input->grad
     return input;
-}
\ No newline at end of file
+}
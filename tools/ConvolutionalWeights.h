@@ -12,25 +12,26 @@
 template <typename Type>
 class ConvolutionLayer;
 
+/**
+ * @brief Convolution layer entry of a model file.
+ *        - config: in_channels, out_channels, filter_height, filter_width, stride, padding
+ *        - tensors: filters (out_channels, in_channels, filter_height, filter_width), biases (1, out_channels, 1, 1)
+ */
 template <typename Type>
 struct ConvolutionalWeights : public WeightStruct<Type> {
-    typedef std::vector<std::vector<std::vector<Type>>> Tensor3D; // (channels, height, width)
-    typedef std::vector<std::vector<std::vector<std::vector<Type>>>> Tensor4D; // (batch_size, channels, height, width)
-    typedef std::vector<Tensor3D> Filters; // (out_channels, in_channels, filter_height, filter_width)
-
     int in_channels;
     int out_channels;
     int filter_height;
     int filter_width;
     int stride;
     int padding;
-    Filters filters;
-    std::vector<Type> biases;
 
     explicit ConvolutionalWeights(const ConvolutionLayer<Type>& layer);
     [[nodiscard]] WeightStructType getType() const override;
-    void serialize(std::ofstream& out) const override;
-    static std::shared_ptr<ConvolutionLayer<Type>> deserialize(std::ifstream& in);
+    void describe(LayerRecord& record) const override;
+    // layer whose parameters are views into a weight image of count elements, nothing is copied
+    static std::shared_ptr<ConvolutionLayer<Type>> deserialize(const LayerRecord& record, const std::shared_ptr<Type>& values,
+                                                               const std::shared_ptr<Type>& grads, std::size_t count);
 };
 
 #include "ConvolutionalWeights.tpp"
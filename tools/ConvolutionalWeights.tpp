@@ -12,8 +12,6 @@ ConvolutionalWeights<Type>::ConvolutionalWeights(ConvolutionLayer<Type> const& l
     filter_width = layer.filter_width;
     stride = layer.stride;
     padding = layer.padding;
-    filters = layer.filters;
-    biases = layer.biases;
 }
 
 template <typename Type>
@@ -22,40 +20,30 @@ WeightStructType ConvolutionalWeights<Type>::getType() const {
 }
 
 template<typename Type>
-void ConvolutionalWeights<Type>::serialize(std::ofstream &out) const {
-    out.write(reinterpret_cast<const char*>(&in_channels), sizeof(in_channels));
-    out.write(reinterpret_cast<const char*>(&out_channels), sizeof(out_channels));
-    out.write(reinterpret_cast<const char*>(&filter_height), sizeof(filter_height));
-    out.write(reinterpret_cast<const char*>(&filter_width), sizeof(filter_width));
-    out.write(reinterpret_cast<const char*>(&stride), sizeof(stride));
-    out.write(reinterpret_cast<const char*>(&padding), sizeof(padding));
-    out.write(reinterpret_cast<const char*>(&filters), sizeof(filters));
-    out.write(reinterpret_cast<const char*>(&biases), sizeof(biases));
+void ConvolutionalWeights<Type>::describe(LayerRecord& record) const {
+    record.type = static_cast<std::uint32_t>(getType());
+    record.tensor_count = 2;
+    record.config[0] = in_channels;
+    record.config[1] = out_channels;
+    record.config[2] = filter_height;
+    record.config[3] = filter_width;
+    record.config[4] = stride;
+    record.config[5] = padding;
 }
 
 template<typename Type>
-std::shared_ptr<ConvolutionLayer<Type>> ConvolutionalWeights<Type>::deserialize(std::ifstream &in) {
-    int in_channels_t;
-    int out_channels_t;
-    int filter_height_t;
-    int filter_width_t;
-    int stride_t;
-    int padding_t;
-    Filters filters_t;
-    std::vector<Type> biases_t;
-
-    in.read(reinterpret_cast<char*>(&in_channels_t), sizeof(in_channels_t));
-    in.read(reinterpret_cast<char*>(&out_channels_t), sizeof(out_channels_t));
-    in.read(reinterpret_cast<char*>(&filter_height_t), sizeof(filter_height_t));
-    in.read(reinterpret_cast<char*>(&filter_width_t), sizeof(filter_width_t));
-    in.read(reinterpret_cast<char*>(&stride_t), sizeof(stride_t));
-    in.read(reinterpret_cast<char*>(&padding_t), sizeof(padding_t));
-    in.read(reinterpret_cast<char*>(&filters_t), sizeof(filters_t));
-    in.read(reinterpret_cast<char*>(&biases_t), sizeof(biases_t));
-
-
-    auto temp = std::make_shared<ConvolutionLayer<Type>>(in_channels_t, out_channels_t, filter_height_t, filter_width_t, stride_t, padding_t);
-    temp->filters = filters_t;
-    temp->biases = biases_t;
-    return temp;
-}
\ No newline at end of file
+std::shared_ptr<ConvolutionLayer<Type>> ConvolutionalWeights<Type>::deserialize(const LayerRecord& record, const std::shared_ptr<Type>& values,
+                                                                                const std::shared_ptr<Type>& grads, std::size_t count) {
+    int in_channels_t = record.config[0];
+    int out_channels_t = record.config[1];
+    int filter_height_t = record.config[2];
+    int filter_width_t = record.config[3];
+    if(record.tensor_count != 2) {
+        throw std::runtime_error("Model file: a convolution layer must store filters and biases.");
+    }
+
+    auto filters_t = WeightStruct<Type>::view(values, grads, count, record.offset[0], out_channels_t, in_channels_t, filter_height_t, filter_width_t);
+    auto biases_t = WeightStruct<Type>::view(values, grads, count, record.offset[1], 1, out_channels_t, 1, 1);
+    return std::make_shared<ConvolutionLayer<Type>>(in_channels_t, out_channels_t, filter_height_t, filter_width_t,
+                                                    record.config[4], record.config[5], std::vector{filters_t, biases_t});
+}
@@ -0,0 +1,102 @@
+//
+// Created by Vijay Goyal on 2025-01-26.
+//
+
+#ifndef INC_12_FINALPROJ_2_DATALOADER_H
+#define INC_12_FINALPROJ_2_DATALOADER_H
+
+#include "Tensor.h"
+#include "TensorConversion.h"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Background batch pipeline over an in-memory image dataset, so conversion overlaps with the training step.
+ *        - images are raw uint8 (count, height, width, channels), each batch is scaled to [0, 1], transposed to NCHW
+ *          and its labels gathered (and one-hot encoded unless one_hot is off) by a pool of worker threads
+ *        - up to prefetch batches are kept ready in a ring of slots, workers claim batch indices with an atomic counter
+ *          and hand batches over through atomics only (std::atomic wait / notify), there is no lock
+ *        - the sample order of every epoch is a Fisher-Yates shuffle driven by seed and the epoch number, the same on
+ *          every run and platform, so a run is reproducible whatever the number of workers
+ *        - every batch is a fresh pair of gradient-free tensors, a batch the caller keeps is never overwritten
+ *        - a worker converts its batch on its own thread without the ThreadPool, so a few workers leave the training step its cores
+ *        - for data-parallel training each replica loads one shard of every epoch, see shard()
+ */
+template <typename Type>
+class DataLoader {
+public:
+    struct Batch {
+        std::shared_ptr<Tensor<Type>> images; // (batch, channels, height, width)
+        std::shared_ptr<Tensor<Type>> labels; // (batch, num_classes, 1, 1), nullptr without one_hot
+        std::vector<std::int64_t> classes;    // label of each sample, e.g. for SoftmaxCrossEntropy
+    };
+
+    // images stays shared with the caller (e.g. a numpy array) for the loader's lifetime, labels are copied
+    DataLoader(std::shared_ptr<const std::uint8_t> images, const std::int64_t* labels, int count, int height, int width, int channels,
+               int num_classes, int batch_size, bool shuffle = true, std::uint64_t seed = 0, int workers = 2, int prefetch = 4,
+               bool drop_last = false, bool one_hot = true);
+    ~DataLoader();
+
+    DataLoader(const DataLoader&) = delete;
+    DataLoader& operator=(const DataLoader&) = delete;
+
+    void start(int epoch); // (re)starts the workers on the given epoch, dropping whatever is left of the current one
+    void start() { start(epoch + 1); } // the next epoch, 0 the first time
+
+    // blocks until the next batch of the epoch is ready, false once the epoch is done, rethrows a worker's error
+    bool next(Batch& batch);
+
+    // from the next start on, only the samples rank, rank + replicas, ... of each epoch's order, so every replica of a
+    // job with the same seed gets as many batches and no sample twice
+    void shard(int rank, int replicas);
+
+    [[nodiscard]] int batches() const; // batches per epoch
+    [[nodiscard]] int samples() const; // samples per epoch
+    [[nodiscard]] int currentEpoch() const { return epoch; }
+    [[nodiscard]] const std::vector<int>& order() const { return indices; } // sample order of the current epoch
+
+private:
+    struct Slot {
+        std::atomic<long long> ready{-1}; // index of the batch it holds, -1 while empty
+        Batch batch;
+        std::exception_ptr error;
+    };
+
+    std::shared_ptr<const std::uint8_t> images;
+    std::vector<std::int64_t> labels;
+    int count;
+    int height;
+    int width;
+    int channels;
+    int num_classes;
+    int batch_size;
+    bool shuffle;
+    std::uint64_t seed;
+    int num_workers;
+    bool drop_last;
+    bool one_hot;
+    int shard_rank = 0;
+    int shards = 1;
+
+    int epoch = -1;
+    std::vector<int> indices; // sample order of the epoch
+    std::vector<Slot> slots;  // batch b lives in slot b % slots.size()
+    std::vector<std::thread> workers;
+
+    std::atomic<long long> claimed{0};  // next batch index a worker takes
+    std::atomic<long long> consumed{0}; // batches handed to the caller, a worker may fill batch b once b < consumed + slots
+    std::atomic<bool> stopping{false};
+    long long handed = 0; // consumer side copy of consumed
+
+    void stop();
+    void work();
+    Batch assemble(long long b) const;
+};
+
+#include "DataLoader.tpp"
+
+#endif //INC_12_FINALPROJ_2_DATALOADER_H
@@ -0,0 +1,193 @@
+//
+// Created by Vijay Goyal on 2025-01-26.
+//
+
+#include "DataLoader.h"
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "ThreadPool.h"
+
+template <typename Type>
+DataLoader<Type>::DataLoader(std::shared_ptr<const std::uint8_t> images, const std::int64_t* labels, int count, int height, int width,
+                             int channels, int num_classes, int batch_size, bool shuffle, std::uint64_t seed, int workers, int prefetch,
+                             bool drop_last, bool one_hot)
+        : images(std::move(images)), labels(labels, labels + std::max(count, 0)), count(count), height(height), width(width),
+          channels(channels), num_classes(num_classes), batch_size(batch_size), shuffle(shuffle), seed(seed), num_workers(workers),
+          drop_last(drop_last), one_hot(one_hot), slots(std::max(prefetch, 1)) {
+    if(count < 0 || height <= 0 || width <= 0 || channels <= 0 || num_classes <= 0 || batch_size <= 0 || workers <= 0 || prefetch <= 0) {
+        throw std::invalid_argument("DataLoader needs positive image dimensions, classes, batch size, workers and prefetch.");
+    }
+    for(int i = 0; i < count; ++i) {
+        if(this->labels[i] < 0 || this->labels[i] >= num_classes) {
+            throw std::invalid_argument("Label " + std::to_string(this->labels[i]) + " at index " + std::to_string(i) + " is invalid");
+        }
+    }
+}
+
+template <typename Type>
+DataLoader<Type>::~DataLoader() {
+    stop();
+}
+
+template <typename Type>
+int DataLoader<Type>::samples() const {
+    return count / shards;
+}
+
+template <typename Type>
+int DataLoader<Type>::batches() const {
+    return drop_last ? samples() / batch_size : (samples() + batch_size - 1) / batch_size;
+}
+
+template <typename Type>
+void DataLoader<Type>::shard(int rank, int replicas) {
+    if(replicas <= 0 || rank < 0 || rank >= replicas) {
+        throw std::invalid_argument("DataLoader: shard " + std::to_string(rank) + " of " + std::to_string(replicas) + " is invalid");
+    }
+    stop();
+    epoch = -1;
+    shard_rank = rank;
+    shards = replicas;
+}
+
+/*
+ * the permutation is drawn with a 64-bit Mersenne Twister and a multiply-shift bounded draw instead of std::shuffle
+ * and std::uniform_int_distribution, whose results differ between standard libraries
+ */
+template <typename Type>
+void DataLoader<Type>::start(int e) {
+    stop();
+    epoch = e;
+    indices.resize(count);
+    for(int i = 0; i < count; ++i) {
+        indices[i] = i;
+    }
+    if(shuffle) {
+        std::mt19937_64 gen(seed ^ (0x9e3779b97f4a7c15ull * (static_cast<std::uint64_t>(epoch) + 1)));
+        for(int i = count - 1; i > 0; --i) {
+            auto j = static_cast<int>((static_cast<unsigned __int128>(gen()) * static_cast<std::uint64_t>(i + 1)) >> 64);
+            std::swap(indices[i], indices[j]);
+        }
+    }
+    if(shards > 1) {
+        // every replica draws the same permutation and keeps every shards-th sample of it, the remainder is dropped
+        for(int i = 0; i < samples(); ++i) {
+            indices[i] = indices[i * shards + shard_rank];
+        }
+        indices.resize(samples());
+    }
+
+    for(Slot& slot : slots) {
+        slot.ready.store(-1, std::memory_order_relaxed);
+        slot.batch = {};
+        slot.error = nullptr;
+    }
+    claimed.store(0, std::memory_order_relaxed);
+    consumed.store(0, std::memory_order_relaxed);
+    stopping.store(false, std::memory_order_relaxed);
+    handed = 0;
+    for(int i = 0; i < num_workers; ++i) {
+        workers.emplace_back(&DataLoader<Type>::work, this);
+    }
+}
+
+template <typename Type>
+void DataLoader<Type>::stop() {
+    stopping.store(true, std::memory_order_release);
+    // wakes every worker waiting for a free slot, they see stopping and leave
+    consumed.store(std::numeric_limits<long long>::max() / 2, std::memory_order_release);
+    consumed.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+template <typename Type>
+typename DataLoader<Type>::Batch DataLoader<Type>::assemble(long long b) const {
+    int first = static_cast<int>(b * batch_size);
+    int size = std::min(batch_size, samples() - first);
+    Batch batch;
+    batch.images = std::make_shared<Tensor<Type>>(size, channels, height, width, static_cast<Type>(0.0), false);
+
+    std::size_t image_size = static_cast<std::size_t>(height) * width * channels;
+    Type scale = static_cast<Type>(1.0 / 255.0);
+    batch.classes.resize(size);
+    for(int n = 0; n < size; ++n) {
+        int sample = indices[first + n];
+        TensorConversion<Type>::fromHWC(images.get() + sample * image_size, height, width, channels, scale, &batch.images->data(n, 0, 0, 0));
+        batch.classes[n] = labels[sample];
+    }
+    if(one_hot) {
+        batch.labels = std::make_shared<Tensor<Type>>(size, num_classes, 1, 1, static_cast<Type>(0.0), false);
+        TensorConversion<Type>::oneHot(batch.classes.data(), size, num_classes, batch.labels->data_ptr());
+    }
+    return batch;
+}
+
+/*
+ * worker loop: claim the next batch index, wait until its slot has been handed out, fill it and publish it
+ */
+template <typename Type>
+void DataLoader<Type>::work() {
+    ThreadPool::Limit single(1);
+    long long total = batches();
+    long long ring = static_cast<long long>(slots.size());
+    while(true) {
+        long long b = claimed.fetch_add(1, std::memory_order_relaxed);
+        if(b >= total) {
+            return;
+        }
+        long long done = consumed.load(std::memory_order_acquire);
+        while(b >= done + ring) {
+            consumed.wait(done, std::memory_order_acquire);
+            done = consumed.load(std::memory_order_acquire);
+        }
+        if(stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        Slot& slot = slots[b % ring];
+        try {
+            slot.batch = assemble(b);
+        }
+        catch(...) {
+            slot.error = std::current_exception();
+        }
+        slot.ready.store(b, std::memory_order_release);
+        slot.ready.notify_one();
+    }
+}
+
+template <typename Type>
+bool DataLoader<Type>::next(Batch& batch) {
+    if(epoch < 0) {
+        start();
+    }
+    if(handed >= batches()) {
+        return false;
+    }
+
+    Slot& slot = slots[handed % static_cast<long long>(slots.size())];
+    long long ready = slot.ready.load(std::memory_order_acquire);
+    while(ready != handed) {
+        slot.ready.wait(ready, std::memory_order_acquire);
+        ready = slot.ready.load(std::memory_order_acquire);
+    }
+    std::exception_ptr error = std::exchange(slot.error, nullptr);
+    batch = std::move(slot.batch);
+    slot.batch = {};
+    slot.ready.store(-1, std::memory_order_relaxed);
+
+    // the slot is free for batch handed + slots
+    consumed.store(++handed, std::memory_order_release);
+    consumed.notify_all();
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    return true;
+}
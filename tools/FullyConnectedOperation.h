@@ -8,23 +8,57 @@
 #include "Operation.h"
 #include "../layers/FullyConnectedLayer.h"
 #include "Tensor.h"
+#include "Gemm.h"
+#include "Layout.h"
 #include <memory>
+#include <vector>
 
+/**
+ * @brief Fully connected layer over a batch, run as matrix multiplies on the flattened [batch][in_features] input.
+ *        - forward:  Y = X * W^T + b, then ReLU when activated
+ *        - backward: dW = G^T * X, db = column sums of G, dX += G * W, with G the ReLU-masked output gradient
+ *        - a channel-blocked input is gathered into NCHW order first and dX is scattered back into its blocks, so the
+ *          weights keep the NCHW feature order whatever the layout
+ */
 template <typename Type>
 class FullyConnectedOperation : public Operation<Type> {
-    typedef std::vector<std::vector<std::vector<std::vector<Type>>>> Tensor4D;
 private:
+    typedef typename Accumulator<Type>::type Acc; // dot products and gradient sums, float for bfloat16
+
     FullyConnectedLayer<Type>& fcLayer;
 
     bool is_activated;
+    int block; // of a blocked input, 1 in NCHW
+
+    static constexpr int GEMV_BATCH = 4; // batches smaller than this skip the GEMM for Y and dW
+
+    std::shared_ptr<Tensor<Type>> pre_activation; // cached W * x + b of the last forward, only when activated
 
-    static std::vector<Type> flattenSample(const Tensor4D& data, int n);
+    // scratch kept between calls
+    std::vector<Type> flat_input;  // input copy when it is not contiguous or blocked
+    std::vector<Type> masked_grad;  // G
+    std::vector<Type> flat_grad;    // dX of a blocked input before it is scattered into the blocks
+
+    // the input as a row-major [batch][in_features] matrix, a view of the tensor whenever it is contiguous NCHW
+    const Type* flatten(const Tensor<Type>& data, std::vector<Type>& scratch) const;
+    [[nodiscard]] std::size_t features(const Tensor<Type>& data) const; // per sample, without padding lanes
+
+    void compute(const Tensor<Type>& input, Tensor<Type>& output, Tensor<Type>* pre); // output = act(W * flatten(input) + b)
 
 public:
-    explicit FullyConnectedOperation(FullyConnectedLayer<Type>& fcLayer, bool is_activated = true);
+    // layout is that of the input, the output is always (batch, out_features, 1, 1)
+    explicit FullyConnectedOperation(FullyConnectedLayer<Type>& fcLayer, bool is_activated = true, Layout layout = Layout::NCHW);
 
     std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& inputs) override;
     std::shared_ptr<Tensor<Type>> backward(const std::shared_ptr<Tensor<Type>>& output_grad) override;
+    std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) override;
+    std::vector<typename Tensor<Type>::Shape> plannedShapes(const typename Tensor<Type>::Shape& input_shape) const override; // output, pre-activation
+
+    [[nodiscard]] const char* name() const override { return "fc"; }
+    [[nodiscard]] double flops(const typename Tensor<Type>::Shape& input_shape, bool backward) const override {
+        double forward = 2.0 * input_shape[0] * fcLayer.in_features * fcLayer.out_features;
+        return backward ? 2.0 * forward : forward; // dW and dX
+    }
 };
 
 #include "FullyConnectedOperation.tpp"
@@ -5,210 +5,276 @@
 #include "FullyConnectedOperation.h"
 #include <stdexcept>
 #include <algorithm>
-#include <omp.h>
+#include <utility>
+#include "ThreadPool.h"
 
 template <typename Type>
-FullyConnectedOperation<Type>::FullyConnectedOperation(FullyConnectedLayer<Type>& layer, bool is_activated): fcLayer(layer), is_activated(is_activated) {}
+FullyConnectedOperation<Type>::FullyConnectedOperation(FullyConnectedLayer<Type>& layer, bool is_activated, Layout layout)
+        : fcLayer(layer), is_activated(is_activated), block(channelBlock(layout)) {}
 
+// a blocked sample of (blocks, height, width * block) holds in_features / (height * width) channels
 template <typename Type>
-std::vector<Type> FullyConnectedOperation<Type>::flattenSample(const Tensor4D& data, int n) {
-    // channels = data[0].size(), height = data[0][0].size(), width = data[0][0][0].size()
-    int channels = data[n].size();
-    int height = data[n][0].size();
-    int width = data[n][0][0].size();
-
-    std::vector<Type> flattened(channels * height * width, static_cast<Type>(0.0));
-    int idx = 0;
-    for(int c = 0; c < channels; ++c) {
-        for(int h = 0; h < height; ++h) {
-            for(int w = 0; w < width; ++w) {
-                flattened[idx++] = data[n][c][h][w];
+std::size_t FullyConnectedOperation<Type>::features(const Tensor<Type>& data) const {
+    if(block == 1) {
+        return data.sampleSize();
+    }
+    std::size_t pixels = static_cast<std::size_t>(data.height()) * (data.width() / block);
+    std::size_t channels = pixels ? fcLayer.in_features / pixels : 0;
+    if(data.width() % block != 0 || channels * pixels != static_cast<std::size_t>(fcLayer.in_features) ||
+       static_cast<std::size_t>(data.channels()) != (channels + block - 1) / block) {
+        return 0;
+    }
+    return channels * pixels;
+}
+
+template <typename Type>
+const Type* FullyConnectedOperation<Type>::flatten(const Tensor<Type>& data, std::vector<Type>& scratch) const {
+    if(block > 1) {
+        // feature (c, h, w) of a sample is lane c % block of pixel (h, w) in block c / block
+        int pixels = data.height() * (data.width() / block);
+        int in_features = fcLayer.in_features;
+        scratch.resize(static_cast<std::size_t>(data.batch()) * in_features);
+        ThreadPool::parallelFor(data.batch(), ThreadPool::grainFor(in_features), [&](int first, int last) {
+            for(int n = first; n < last; ++n) {
+                const Type* sample = &data.data(n, 0, 0, 0);
+                Type* row = scratch.data() + static_cast<std::ptrdiff_t>(n) * in_features;
+                for(int c = 0; c < in_features / pixels; ++c) {
+                    const Type* src = sample + static_cast<std::ptrdiff_t>(c / block) * pixels * block + c % block;
+                    for(int i = 0; i < pixels; ++i) {
+                        row[c * pixels + i] = src[static_cast<std::ptrdiff_t>(i) * block];
+                    }
+                }
+            }
+        });
+        return scratch.data();
+    }
+    if(data.isContiguous()) {
+        return data.data_ptr();
+    }
+
+    // channels = data.channels(), height = data.height(), width = data.width()
+    int channels = data.channels();
+    int height = data.height();
+    int width = data.width();
+    scratch.resize(data.size());
+    std::size_t idx = 0;
+    for(int n = 0; n < data.batch(); ++n) {
+        for(int c = 0; c < channels; ++c) {
+            for(int h = 0; h < height; ++h) {
+                const Type* row = &data.data(n, c, h, 0);
+                for(int w = 0; w < width; ++w) {
+                    scratch[idx++] = row[w];
+                }
             }
         }
     }
-    return flattened;
+    return scratch.data();
 }
 
+/*
+ * Y[batch][out_features] = X[batch][in_features] * W^T in one GEMM, then bias and ReLU
+ */
 template <typename Type>
-std::shared_ptr<Tensor<Type>> FullyConnectedOperation<Type>::forward(const std::shared_ptr<Tensor<Type>> &inputs) {
-    auto input = inputs;
-    this->inputs = inputs; // store for backward
-
-    // assume input has shape: (batch_size, channels, height, width)
-    int batch_size = input->data.size();
-    int channels   = input->data[0].size();
-    int height     = input->data[0][0].size();
-    int width      = input->data[0][0][0].size();
+void FullyConnectedOperation<Type>::compute(const Tensor<Type>& input, Tensor<Type>& output, Tensor<Type>* pre) {
+    int batch_size = input.batch();
 
     // flatten dimension = channels*height*width must match fcLayer.in_features
-    int flatten_dim = channels * height * width;
+    int flatten_dim = static_cast<int>(features(input));
     if(flatten_dim != fcLayer.in_features) {
         throw std::invalid_argument("FullyConnectedOperation: Flattened input size does not match fcLayer.in_features.");
     }
 
-    auto output = std::make_shared<Tensor<Type>>(batch_size, fcLayer.out_features, 1, 1, static_cast<Type>(0.0));
-
-    // Parallelize over the batch dimension
-    #pragma omp parallel for
-    for(int n = 0; n < batch_size; ++n) {
-        std::vector<Type> x = flattenSample(input->data, n);
-        for(int out_i = 0; out_i < fcLayer.out_features; ++out_i) {
-            Type sum = fcLayer.biases[out_i];
-            #pragma omp simd reduction(+:sum)
-            for(int in_j = 0; in_j < fcLayer.in_features; ++in_j) {
-                sum += fcLayer.weights[out_i][in_j] * x[in_j];
+    int in_features = fcLayer.in_features;
+    int out_features = fcLayer.out_features;
+    const Type* x = flatten(input, flat_input);
+    const Type* weights = std::as_const(*fcLayer.weights).data_ptr();
+
+    Type* y = output.data_ptr();
+    if(batch_size < GEMV_BATCH) {
+        // a few rows are bound by reading W, stream it once with dot products instead of packing it for the GEMM
+        const Type* w = weights;
+        ThreadPool::parallelFor(batch_size * out_features, ThreadPool::grainFor(in_features), [&](int first, int last) {
+            for(int i = first; i < last; ++i) {
+                int n = i / out_features;
+                int out_i = i % out_features;
+                const Type* x_row = x + static_cast<std::ptrdiff_t>(n) * in_features;
+                const Type* w_row = w + static_cast<std::ptrdiff_t>(out_i) * in_features;
+                Acc sum = static_cast<Acc>(0.0);
+                #pragma omp simd reduction(+:sum)
+                for(int in_j = 0; in_j < in_features; ++in_j) {
+                    sum += static_cast<Acc>(w_row[in_j]) * static_cast<Acc>(x_row[in_j]);
+                }
+                y[i] = sum;
             }
-            if (is_activated) {
-                sum = std::max(static_cast<Type>(0.0), sum); // ReLU activation
+        });
+    }
+    else {
+        Gemm<Type>::multiply(false, true, batch_size, out_features, in_features, x, in_features, weights, in_features, y, out_features);
+    }
+
+    Type* z = pre ? pre->data_ptr() : nullptr;
+    const Type* biases = std::as_const(*fcLayer.biases).data_ptr();
+    ThreadPool::parallelFor(batch_size, ThreadPool::grainFor(out_features), [&](int first, int last) {
+        for(int n = first; n < last; ++n) {
+            Type* row = y + static_cast<std::ptrdiff_t>(n) * out_features;
+            Type* pre_row = z ? z + static_cast<std::ptrdiff_t>(n) * out_features : nullptr;
+            for(int out_i = 0; out_i < out_features; ++out_i) {
+                Acc sum = static_cast<Acc>(row[out_i]) + static_cast<Acc>(biases[out_i]);
+                if(pre_row) {
+                    pre_row[out_i] = sum; // cache pre-activation
+                }
+                if (is_activated) {
+                    sum = std::max(static_cast<Acc>(0.0), sum); // ReLU activation
+                }
+                row[out_i] = sum;
             }
-            output->data[n][out_i][0][0] = sum;
         }
+    });
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> FullyConnectedOperation<Type>::forward(const std::shared_ptr<Tensor<Type>> &inputs) {
+    this->inputs = inputs; // store for backward
+
+    // assume input has shape: (batch_size, channels, height, width)
+    auto output = this->acquire(0, inputs->batch(), fcLayer.out_features, 1, 1);
+    pre_activation = is_activated ? this->acquire(1, inputs->batch(), fcLayer.out_features, 1, 1, false) : nullptr;
+    compute(*inputs, *output, pre_activation.get());
+    return output;
+}
+
+template <typename Type>
+std::vector<typename Tensor<Type>::Shape> FullyConnectedOperation<Type>::plannedShapes(const typename Tensor<Type>::Shape& input_shape) const {
+    typename Tensor<Type>::Shape out = {input_shape[0], fcLayer.out_features, 1, 1};
+    if(!is_activated) {
+        return {out};
     }
+    return {out, out};
+}
 
+template <typename Type>
+std::shared_ptr<Tensor<Type>> FullyConnectedOperation<Type>::infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) {
+    auto& output = Tensor<Type>::reuse(out, input->batch(), fcLayer.out_features, 1, 1);
+    compute(*input, *output, nullptr);
     return output;
 }
 
+/*
+ * backward pass, three GEMMs on the whole batch
+ *  - G = dOut masked by the ReLU derivative of the cached pre-activation
+ *  - dW = G^T * X and db = column sums of G overwrite the layer's gradients
+ *  - dX = G * W is accumulated into the input's grad, skipped when the input has no grad
+ */
 template <typename Type>
 std::shared_ptr<Tensor<Type>> FullyConnectedOperation<Type>::backward(const std::shared_ptr<Tensor<Type>> &output_grad) {
-    if(this->inputs->data.empty() || this->inputs->data[0].empty()) {
+    if(!this->inputs || this->inputs->empty()) {
         throw std::runtime_error("FullyConnectedOperation has no stored inputs. Perform forward pass first.");
     }
-    auto input = this->inputs->data; // original input
-    int batch_size = static_cast<int>(input.size());
+    auto input = this->inputs; // original input
+    int batch_size = input->batch();
 
     if(batch_size == 0) {
         throw std::invalid_argument("Input batch size is zero.");
     }
 
-    int channels = static_cast<int>(input[0].size());
-    int height   = static_cast<int>(input[0][0].size());
-    int width    = static_cast<int>(input[0][0][0].size());
-    int flatten_dim = channels * height * width;
+    int in_features = fcLayer.in_features;
+    int out_features = fcLayer.out_features;
 
     // Validate fcLayer dimensions
-    if(fcLayer.in_features != flatten_dim) {
+    if(static_cast<std::size_t>(in_features) != features(*input)) {
         throw std::invalid_argument("fcLayer.in_features does not match input dimensions.");
     }
 
-    // Add checks for output_grad dimensions before the parallel region
     if(output_grad == nullptr) {
         throw std::invalid_argument("output_grad is null.");
     }
-    if(output_grad->grad.size() != static_cast<size_t>(batch_size)) {
+    if(output_grad->batch() != batch_size) {
         throw std::invalid_argument("output_grad->grad size does not match batch_size.");
     }
-    for(int n = 0; n < batch_size; ++n) {
-        if(output_grad->grad.at(n).size() != static_cast<size_t>(fcLayer.out_features)) {
-            throw std::invalid_argument("output_grad->grad at sample " + std::to_string(n) + " does not match fcLayer.out_features.");
-        }
-        for(int out_i = 0; out_i < fcLayer.out_features; ++out_i) {
-            if(output_grad->grad.at(n).at(out_i).size() != 1 || output_grad->grad.at(n).at(out_i).at(0).size() != 1) {
-                throw std::invalid_argument("output_grad->grad at sample " + std::to_string(n) + ", feature " + std::to_string(out_i) + " has incorrect dimensions.");
-            }
-        }
+    if(output_grad->channels() != out_features || output_grad->height() != 1 || output_grad->width() != 1) {
+        throw std::invalid_argument("output_grad->grad does not match fcLayer.out_features.");
     }
-
-    // Initialize dInput with zeros
-    auto dInput = std::make_shared<Tensor<Type>>(batch_size, channels, height, width, static_cast<Type>(0.0));
-
-    // Zero existing gradients
-    fcLayer.zeroGrad();
-
-    // Determine number of threads
-    int num_threads = omp_get_max_threads();
-
-    // Validate thread count
-    if(num_threads <= 0) {
-        throw std::runtime_error("Number of threads must be positive.");
+    if(is_activated && (!pre_activation || pre_activation->batch() != batch_size)) {
+        throw std::runtime_error("FullyConnectedOperation has no cached pre-activation for this batch. Perform forward pass first.");
     }
 
-    // Create thread-local accumulators for dWeights and dBiases
-    std::vector<std::vector<std::vector<Type>>> dWeights_local(
-        num_threads,
-        std::vector<std::vector<Type>>(fcLayer.out_features, std::vector<Type>(fcLayer.in_features, static_cast<Type>(0.0)))
-    );
-    std::vector<std::vector<Type>> dBiases_local(
-        num_threads,
-        std::vector<Type>(fcLayer.out_features, static_cast<Type>(0.0))
-    );
-
-    // Initialize thread-local dInput_local as 4D: [num_threads][batch_size][channels][height * width]
-    std::vector<std::vector<std::vector<std::vector<Type>>>> dInput_local(
-        num_threads,
-        std::vector<std::vector<std::vector<Type>>>(batch_size,
-            std::vector<std::vector<Type>>(channels,
-                std::vector<Type>(height * width, static_cast<Type>(0.0))))
-    );
-
-    // Parallelize over the batch dimension
-    #pragma omp parallel for
+    // G, the output gradient through the ReLU
+    masked_grad.resize(static_cast<std::size_t>(batch_size) * out_features);
     for(int n = 0; n < batch_size; ++n) {
-        int thread_id = omp_get_thread_num();
-        if(thread_id >= num_threads) {
-            throw std::out_of_range("Thread ID exceeds number of threads.");
+        const Type* upstream = &output_grad->grad(n, 0, 0, 0);
+        const Type* pre = is_activated ? &pre_activation->data(n, 0, 0, 0) : nullptr;
+        Type* g = masked_grad.data() + static_cast<std::ptrdiff_t>(n) * out_features;
+        #pragma omp simd
+        for(int out_i = 0; out_i < out_features; ++out_i) {
+            g[out_i] = (!pre || pre[out_i] > static_cast<Type>(0)) ? upstream[out_i] : static_cast<Type>(0.0);
         }
+    }
 
-        std::vector<Type> x = flattenSample(input, n);
+    const Type* x = flatten(*input, flat_input);
+    const Type* weights = std::as_const(*fcLayer.weights).data_ptr();
+    Type* dWeights = fcLayer.weights->grad_ptr();
+    Type* dBiases = fcLayer.biases->grad_ptr();
 
-         // Ensure that flattenSample returns the correct size
-        if(x.size() != static_cast<size_t>(fcLayer.in_features)) {
-            throw std::out_of_range("flattenSample returned incorrect size.");
-        }
+    // dW[out][in] = G^T[out][batch] * X[batch][in], a few rows are summed directly instead
+    bool use_gemm = batch_size >= GEMV_BATCH;
+    if(use_gemm) {
+        Gemm<Type>::multiply(true, false, out_features, in_features, batch_size, masked_grad.data(), out_features, x, in_features,
+                             dWeights, in_features);
+    }
 
-        for(int out_i = 0; out_i < fcLayer.out_features; ++out_i) {
-            // Removed redundant out_i range check
-            Type go = output_grad->grad.at(n).at(out_i).at(0).at(0); // problem line
-            dBiases_local[thread_id].at(out_i) += go;
-
-            #pragma omp simd
-            for(int in_j = 0; in_j < fcLayer.in_features; ++in_j) {
-                // Removed redundant in_j range check
-                dWeights_local[thread_id][out_i][in_j] += go * x[in_j];
-
-                // Compute mapping from in_j to channel, height, and width
-                int channel_idx = in_j / (height * width);
-                int hw_reduced = in_j % (height * width);
-                int h = hw_reduced / width;
-                int w = hw_reduced % width;
-
-                // Bounds check for channel_idx, h, and w
-                if(channel_idx < 0 || channel_idx >= channels || h < 0 || h >= height || w < 0 || w >= width) {
-                    throw std::out_of_range("channel_idx, h, or w out of range.");
+    ThreadPool::parallelFor(out_features, ThreadPool::grainFor(use_gemm ? batch_size : static_cast<std::size_t>(batch_size) * in_features),
+                            [&](int first, int last) {
+        for(int out_i = first; out_i < last; ++out_i) {
+            if(!use_gemm) {
+                // each weight is summed over the few rows before it is stored, so bfloat16 rounds it once
+                Type* dw = dWeights + static_cast<std::ptrdiff_t>(out_i) * in_features;
+                const Type* g = masked_grad.data() + out_i;
+                #pragma omp simd
+                for(int in_j = 0; in_j < in_features; ++in_j) {
+                    Acc sum = static_cast<Acc>(0.0);
+                    for(int n = 0; n < batch_size; ++n) {
+                        sum += static_cast<Acc>(g[static_cast<std::ptrdiff_t>(n) * out_features]) * static_cast<Acc>(x[static_cast<std::ptrdiff_t>(n) * in_features + in_j]);
+                    }
+                    dw[in_j] = sum;
                 }
-
-                dInput_local[thread_id][n][channel_idx][hw_reduced] += fcLayer.weights[out_i][in_j] * go;
             }
-        }
-    }
-
-    // Aggregate thread-local dWeights and dBiases into the global gradients
-    for(int t = 0; t < num_threads; ++t) {
-        for(int out_i = 0; out_i < fcLayer.out_features; ++out_i) {
-            fcLayer.dBiases.at(out_i) += dBiases_local.at(t).at(out_i);
-            for(int in_j = 0; in_j < fcLayer.in_features; ++in_j) {
-                fcLayer.dWeights.at(out_i).at(in_j) += dWeights_local.at(t).at(out_i).at(in_j);
+            Acc db = static_cast<Acc>(0.0);
+            for(int n = 0; n < batch_size; ++n) {
+                db += masked_grad[static_cast<std::size_t>(n) * out_features + out_i];
             }
+            dBiases[out_i] = db;
         }
-    }
+    });
 
-    // Aggregate thread-local dInput
-    #pragma omp parallel for collapse(3)
-    for(int n = 0; n < batch_size; ++n) {
-        for(int c = 0; c < channels; ++c) {
-            for(int hw_reduced = 0; hw_reduced < height * width; ++hw_reduced) {
-                int h = hw_reduced / width;
-                int w = hw_reduced % width;
-
-                if(h < 0 || h >= height || w < 0 || w >= width) {
-                    throw std::out_of_range("h or w index out of range during aggregation.");
-                }
-
-                for(int t = 0; t < num_threads; ++t) {
-                    dInput->grad.at(n).at(c).at(h).at(w) += dInput_local.at(t).at(n).at(c).at(hw_reduced);
+    // dX[batch][in] += G[batch][out] * W[out][in]
+    if(input->grad_ptr()) {
+        if(!input->isContiguous()) {
+            throw std::invalid_argument("FullyConnectedOperation: the input gradient must be contiguous.");
+        }
+        if(block == 1) {
+            Gemm<Type>::multiply(false, false, batch_size, in_features, out_features, masked_grad.data(), out_features,
+                                 weights, in_features, input->grad_ptr(), in_features, true);
+            return input;
+        }
+        // the blocked input's gradient gets dX of each feature added to its lane
+        flat_grad.resize(static_cast<std::size_t>(batch_size) * in_features);
+        Gemm<Type>::multiply(false, false, batch_size, in_features, out_features, masked_grad.data(), out_features,
+                             weights, in_features, flat_grad.data(), in_features);
+        int pixels = input->height() * (input->width() / block);
+        ThreadPool::parallelFor(batch_size, ThreadPool::grainFor(in_features), [&](int first, int last) {
+            for(int n = first; n < last; ++n) {
+                Type* sample = &input->grad(n, 0, 0, 0);
+                const Type* row = flat_grad.data() + static_cast<std::ptrdiff_t>(n) * in_features;
+                for(int c = 0; c < in_features / pixels; ++c) {
+                    Type* dst = sample + static_cast<std::ptrdiff_t>(c / block) * pixels * block + c % block;
+                    for(int i = 0; i < pixels; ++i) {
+                        dst[static_cast<std::ptrdiff_t>(i) * block] = static_cast<Acc>(dst[static_cast<std::ptrdiff_t>(i) * block]) +
+                                                                      static_cast<Acc>(row[c * pixels + i]);
+                    }
                 }
             }
-        }
+        });
     }
 
-    return dInput; // let the graph handle adding this to the actual input->grad if needed
+    return input;
 }
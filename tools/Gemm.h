@@ -0,0 +1,73 @@
+//
+// Created by Vijay Goyal on 2025-01-16.
+//
+
+#ifndef INC_12_FINALPROJ_2_GEMM_H
+#define INC_12_FINALPROJ_2_GEMM_H
+
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+#include "BFloat16.h"
+
+/**
+ * @brief Cache-blocked, register-tiled matrix multiply on row-major matrices.
+ *        C[M][N] (+)= op(A)[M][K] * op(B)[K][N], where op(X) is X or its transpose.
+ *        - A and B are packed into MC x KC / KC x NC panels so the micro-kernel streams from L1/L2
+ *        - the micro-kernel computes one MR x NR tile of C in registers
+ *        - for float and bfloat16 on x86 an AVX-512 or AVX2/FMA micro-kernel is picked at runtime, every other
+ *          case goes through a portable kernel that the compiler vectorises
+ *        - when called outside a ThreadPool loop C is split across the pool by columns, and also by rows
+ *          when it has too few columns for every thread
+ *        - bfloat16 operands are widened to float while packing and C is accumulated in a float copy over the
+ *          whole depth, it is rounded back to bfloat16 once at the end
+ */
+template <typename Type>
+class Gemm {
+public:
+    typedef typename Accumulator<Type>::type Acc;
+
+    // signature of a micro-kernel: C[MR][NR] (+)= Ap[kc][MR]^T * Bp[kc][NR]
+    typedef void (*MicroKernel)(int kc, const Acc* Ap, const Acc* Bp, Acc* C, int ldc, bool accumulate);
+
+    struct Kernel {
+        int mr;
+        int nr;
+        MicroKernel run;
+        const char* name;
+    };
+
+    static constexpr int MC = 72;   // rows of A kept in L2
+    static constexpr int KC = 256;  // depth of a packed panel
+    static constexpr int NC = 3072; // columns of B kept in L3
+
+    static void multiply(bool transA, bool transB, int M, int N, int K,
+                         const Type* A, int lda, const Type* B, int ldb,
+                         Type* C, int ldc, bool accumulate = false);
+
+    // same product written to a C kept in the accumulation type, for gradients summed over many products
+    static void multiply(bool transA, bool transB, int M, int N, int K,
+                         const Type* A, int lda, const Type* B, int ldb,
+                         Acc* C, int ldc, bool accumulate = false) requires (!std::is_same_v<Type, Acc>);
+
+    static const Kernel& kernel(); // micro-kernel picked for this CPU
+    static const char* kernelName() { return kernel().name; }
+
+private:
+    static void multiplyAcc(bool transA, bool transB, int M, int N, int K,
+                            const Type* A, int lda, const Type* B, int ldb,
+                            Acc* C, int ldc, bool accumulate);
+
+    static void multiplyColumns(const Kernel& k, bool transA, bool transB, int M, int K, int j_begin, int j_end,
+                                const Type* A, int lda, const Type* B, int ldb,
+                                Acc* C, int ldc, bool accumulate);
+
+    static void packA(const Kernel& k, bool transA, const Type* A, int lda, int i0, int mc, int p0, int kc, Acc* Ap);
+    static void packB(const Kernel& k, bool transB, const Type* B, int ldb, int p0, int kc, int j0, int nc, Acc* Bp);
+
+    static void genericKernel(int kc, const Acc* Ap, const Acc* Bp, Acc* C, int ldc, bool accumulate);
+};
+
+#include "Gemm.tpp"
+
+#endif //INC_12_FINALPROJ_2_GEMM_H
@@ -0,0 +1,319 @@
+//
+// Created by Vijay Goyal on 2025-01-16.
+//
+
+#include "Gemm.h"
+#include <algorithm>
+#include <type_traits>
+#include "ThreadPool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * AVX2/FMA micro-kernel, 6x16 tile of C held in 12 ymm registers
+ */
+__attribute__((target("avx2,fma")))
+inline void gemmKernelAvx2(int kc, const float* Ap, const float* Bp, float* C, int ldc, bool accumulate) {
+    __m256 acc[6][2];
+    #pragma GCC unroll 6
+    for(int i = 0; i < 6; ++i) {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+
+    for(int p = 0; p < kc; ++p) {
+        __m256 b0 = _mm256_loadu_ps(Bp);
+        __m256 b1 = _mm256_loadu_ps(Bp + 8);
+        #pragma GCC unroll 6
+        for(int i = 0; i < 6; ++i) {
+            __m256 a = _mm256_broadcast_ss(Ap + i);
+            acc[i][0] = _mm256_fmadd_ps(a, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(a, b1, acc[i][1]);
+        }
+        Ap += 6;
+        Bp += 16;
+    }
+
+    #pragma GCC unroll 6
+    for(int i = 0; i < 6; ++i) {
+        float* row = C + i * ldc;
+        if(accumulate) {
+            acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(row));
+            acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(row + 8));
+        }
+        _mm256_storeu_ps(row, acc[i][0]);
+        _mm256_storeu_ps(row + 8, acc[i][1]);
+    }
+}
+
+/*
+ * AVX-512 micro-kernel, 8x32 tile of C held in 16 zmm registers
+ */
+__attribute__((target("avx512f")))
+inline void gemmKernelAvx512(int kc, const float* Ap, const float* Bp, float* C, int ldc, bool accumulate) {
+    __m512 acc[8][2];
+    #pragma GCC unroll 8
+    for(int i = 0; i < 8; ++i) {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+
+    for(int p = 0; p < kc; ++p) {
+        __m512 b0 = _mm512_loadu_ps(Bp);
+        __m512 b1 = _mm512_loadu_ps(Bp + 16);
+        #pragma GCC unroll 8
+        for(int i = 0; i < 8; ++i) {
+            __m512 a = _mm512_set1_ps(Ap[i]);
+            acc[i][0] = _mm512_fmadd_ps(a, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(a, b1, acc[i][1]);
+        }
+        Ap += 8;
+        Bp += 32;
+    }
+
+    #pragma GCC unroll 8
+    for(int i = 0; i < 8; ++i) {
+        float* row = C + i * ldc;
+        if(accumulate) {
+            acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_loadu_ps(row));
+            acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_loadu_ps(row + 16));
+        }
+        _mm512_storeu_ps(row, acc[i][0]);
+        _mm512_storeu_ps(row + 16, acc[i][1]);
+    }
+}
+#endif
+
+/*
+ * portable 4x16 micro-kernel, the inner loop is left for the compiler to vectorise
+ */
+template <typename Type>
+void Gemm<Type>::genericKernel(int kc, const Acc* Ap, const Acc* Bp, Acc* C, int ldc, bool accumulate) {
+    constexpr int MR = 4;
+    constexpr int NR = 16;
+    Acc acc[MR][NR] = {};
+
+    for(int p = 0; p < kc; ++p) {
+        for(int i = 0; i < MR; ++i) {
+            Acc a = Ap[i];
+            #pragma omp simd
+            for(int j = 0; j < NR; ++j) {
+                acc[i][j] += a * Bp[j];
+            }
+        }
+        Ap += MR;
+        Bp += NR;
+    }
+
+    for(int i = 0; i < MR; ++i) {
+        Acc* row = C + i * ldc;
+        #pragma omp simd
+        for(int j = 0; j < NR; ++j) {
+            row[j] = accumulate ? row[j] + acc[i][j] : acc[i][j];
+        }
+    }
+}
+
+template <typename Type>
+const typename Gemm<Type>::Kernel& Gemm<Type>::kernel() {
+    static const Kernel selected = []() -> Kernel {
+#if defined(__x86_64__) || defined(__i386__)
+        if constexpr (std::is_same_v<Acc, float>) {
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx512f")) {
+                return {8, 32, &gemmKernelAvx512, "avx512"};
+            }
+            if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                return {6, 16, &gemmKernelAvx2, "avx2"};
+            }
+        }
+#endif
+        return {4, 16, &Gemm<Type>::genericKernel, "generic"};
+    }();
+    return selected;
+}
+
+/*
+ * pack an mc x kc block of op(A) into panels of MR rows, zero padding the last panel
+ */
+template <typename Type>
+void Gemm<Type>::packA(const Kernel& k, bool transA, const Type* A, int lda, int i0, int mc, int p0, int kc, Acc* Ap) {
+    for(int ir = 0; ir < mc; ir += k.mr) {
+        int rows = std::min(k.mr, mc - ir);
+        for(int p = 0; p < kc; ++p) {
+            for(int i = 0; i < rows; ++i) {
+                int row = i0 + ir + i;
+                int col = p0 + p;
+                Ap[i] = static_cast<Acc>(transA ? A[static_cast<std::ptrdiff_t>(col) * lda + row] : A[static_cast<std::ptrdiff_t>(row) * lda + col]);
+            }
+            for(int i = rows; i < k.mr; ++i) {
+                Ap[i] = static_cast<Acc>(0.0);
+            }
+            Ap += k.mr;
+        }
+    }
+}
+
+/*
+ * pack a kc x nc block of op(B) into panels of NR columns, zero padding the last panel
+ */
+template <typename Type>
+void Gemm<Type>::packB(const Kernel& k, bool transB, const Type* B, int ldb, int p0, int kc, int j0, int nc, Acc* Bp) {
+    for(int jr = 0; jr < nc; jr += k.nr) {
+        int cols = std::min(k.nr, nc - jr);
+        for(int p = 0; p < kc; ++p) {
+            int row = p0 + p;
+            if(!transB) {
+                const Type* src = B + static_cast<std::ptrdiff_t>(row) * ldb + j0 + jr;
+                std::copy(src, src + cols, Bp);
+            }
+            else {
+                for(int j = 0; j < cols; ++j) {
+                    Bp[j] = static_cast<Acc>(B[static_cast<std::ptrdiff_t>(j0 + jr + j) * ldb + row]);
+                }
+            }
+            std::fill(Bp + cols, Bp + k.nr, static_cast<Acc>(0.0));
+            Bp += k.nr;
+        }
+    }
+}
+
+/*
+ * single threaded blocked multiply restricted to the columns [j_begin, j_end) of C
+ */
+template <typename Type>
+void Gemm<Type>::multiplyColumns(const Kernel& k, bool transA, bool transB, int M, int K, int j_begin, int j_end,
+                                 const Type* A, int lda, const Type* B, int ldb,
+                                 Acc* C, int ldc, bool accumulate) {
+    // packing buffers are reused by every call made on this thread, this function starts no pool loop so no other
+    // thread ever sees them
+    thread_local std::vector<Acc> Ap;
+    thread_local std::vector<Acc> Bp;
+    thread_local std::vector<Acc> edge;
+    Ap.resize(static_cast<std::size_t>((MC + k.mr - 1) / k.mr * k.mr) * KC);
+    Bp.resize(static_cast<std::size_t>((NC + k.nr - 1) / k.nr * k.nr) * KC);
+    edge.resize(static_cast<std::size_t>(k.mr) * k.nr);
+
+    if(K == 0) {
+        if(!accumulate) {
+            for(int i = 0; i < M; ++i) {
+                std::fill(C + static_cast<std::ptrdiff_t>(i) * ldc + j_begin, C + static_cast<std::ptrdiff_t>(i) * ldc + j_end, static_cast<Acc>(0.0));
+            }
+        }
+        return;
+    }
+
+    for(int jc = j_begin; jc < j_end; jc += NC) {
+        int nc = std::min(NC, j_end - jc);
+        for(int pc = 0; pc < K; pc += KC) {
+            int kc = std::min(KC, K - pc);
+            bool acc = accumulate || pc > 0;
+            packB(k, transB, B, ldb, pc, kc, jc, nc, Bp.data());
+
+            for(int ic = 0; ic < M; ic += MC) {
+                int mc = std::min(MC, M - ic);
+                packA(k, transA, A, lda, ic, mc, pc, kc, Ap.data());
+
+                for(int jr = 0; jr < nc; jr += k.nr) {
+                    int cols = std::min(k.nr, nc - jr);
+                    const Acc* b_panel = Bp.data() + static_cast<std::ptrdiff_t>(jr) * kc;
+                    for(int ir = 0; ir < mc; ir += k.mr) {
+                        int rows = std::min(k.mr, mc - ir);
+                        const Acc* a_panel = Ap.data() + static_cast<std::ptrdiff_t>(ir) * kc;
+                        Acc* c_tile = C + static_cast<std::ptrdiff_t>(ic + ir) * ldc + jc + jr;
+                        if(rows == k.mr && cols == k.nr) {
+                            k.run(kc, a_panel, b_panel, c_tile, ldc, acc);
+                            continue;
+                        }
+                        // partial tile, compute into scratch then copy the valid part out
+                        k.run(kc, a_panel, b_panel, edge.data(), k.nr, false);
+                        for(int i = 0; i < rows; ++i) {
+                            Acc* dst = c_tile + static_cast<std::ptrdiff_t>(i) * ldc;
+                            const Acc* src = edge.data() + i * k.nr;
+                            for(int j = 0; j < cols; ++j) {
+                                dst[j] = acc ? dst[j] + src[j] : src[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Type>
+void Gemm<Type>::multiply(bool transA, bool transB, int M, int N, int K,
+                          const Type* A, int lda, const Type* B, int ldb,
+                          Type* C, int ldc, bool accumulate) {
+    if constexpr (std::is_same_v<Type, Acc>) {
+        multiplyAcc(transA, transB, M, N, K, A, lda, B, ldb, C, ldc, accumulate);
+    }
+    else {
+        if(M <= 0 || N <= 0) {
+            return;
+        }
+        // C is widened once, accumulated over the whole depth and rounded once, multiplyAcc's pool threads get wide
+        // as a raw pointer so they write this thread's buffer, not their own thread_local
+        thread_local std::vector<Acc> wide;
+        wide.resize(static_cast<std::size_t>(M) * N);
+        if(accumulate) {
+            for(int i = 0; i < M; ++i) {
+                std::copy(C + static_cast<std::ptrdiff_t>(i) * ldc, C + static_cast<std::ptrdiff_t>(i) * ldc + N,
+                          wide.begin() + static_cast<std::ptrdiff_t>(i) * N);
+            }
+        }
+        multiplyAcc(transA, transB, M, N, K, A, lda, B, ldb, wide.data(), N, accumulate);
+        for(int i = 0; i < M; ++i) {
+            std::copy(wide.begin() + static_cast<std::ptrdiff_t>(i) * N, wide.begin() + static_cast<std::ptrdiff_t>(i + 1) * N,
+                      C + static_cast<std::ptrdiff_t>(i) * ldc);
+        }
+    }
+}
+
+template <typename Type>
+void Gemm<Type>::multiply(bool transA, bool transB, int M, int N, int K,
+                          const Type* A, int lda, const Type* B, int ldb,
+                          Acc* C, int ldc, bool accumulate) requires (!std::is_same_v<Type, Acc>) {
+    multiplyAcc(transA, transB, M, N, K, A, lda, B, ldb, C, ldc, accumulate);
+}
+
+template <typename Type>
+void Gemm<Type>::multiplyAcc(bool transA, bool transB, int M, int N, int K,
+                             const Type* A, int lda, const Type* B, int ldb,
+                             Acc* C, int ldc, bool accumulate) {
+    if(M <= 0 || N <= 0) {
+        return;
+    }
+    const Kernel& k = kernel();
+
+    // split C across threads, by columns in multiples of NR and, when there are too few columns to go round
+    // (e.g. X * W^T with a handful of outputs), also by rows in multiples of MR, small problems stay on one thread
+    double work = static_cast<double>(M) * N * K;
+    int num_threads = work < 1.0e6 ? 1 : ThreadPool::width();
+    int col_parts = std::max(1, std::min(num_threads, (N + k.nr - 1) / k.nr));
+    int col_chunk = (N + col_parts - 1) / col_parts;
+    col_chunk = (col_chunk + k.nr - 1) / k.nr * k.nr;
+    col_parts = (N + col_chunk - 1) / col_chunk;
+    int row_parts = std::max(1, std::min(num_threads / col_parts, (M + k.mr - 1) / k.mr));
+    int row_chunk = (M + row_parts - 1) / row_parts;
+    row_chunk = (row_chunk + k.mr - 1) / k.mr * k.mr;
+    row_parts = (M + row_chunk - 1) / row_chunk;
+
+    if(col_parts * row_parts <= 1) {
+        multiplyColumns(k, transA, transB, M, K, 0, N, A, lda, B, ldb, C, ldc, accumulate);
+        return;
+    }
+
+    ThreadPool::parallelSlots(static_cast<std::size_t>(col_parts) * row_parts, [&](std::size_t part) {
+        int r = static_cast<int>(part) / col_parts;
+        int t = static_cast<int>(part) % col_parts;
+        int i_begin = r * row_chunk;
+        int rows = std::min(M, i_begin + row_chunk) - i_begin;
+        int j_begin = t * col_chunk;
+        int j_end = std::min(N, j_begin + col_chunk);
+        const Type* A_rows = transA ? A + i_begin : A + static_cast<std::ptrdiff_t>(i_begin) * lda;
+        multiplyColumns(k, transA, transB, rows, K, j_begin, j_end, A_rows, lda, B, ldb,
+                        C + static_cast<std::ptrdiff_t>(i_begin) * ldc, ldc, accumulate);
+    });
+}
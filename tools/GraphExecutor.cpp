@@ -0,0 +1,190 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#include "GraphExecutor.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "ThreadPool.h"
+
+GraphExecutor::GraphExecutor(int workers) {
+    if(workers < 1) {
+        throw std::invalid_argument("GraphExecutor needs at least one worker.");
+    }
+    for(int w = 0; w < workers; ++w) {
+        queues.push_back(std::make_unique<Worker>());
+    }
+    for(int w = 0; w < workers; ++w) {
+        threads.emplace_back(&GraphExecutor::background, this, w);
+    }
+}
+
+GraphExecutor::~GraphExecutor() {
+    stopping.store(true);
+    generation.fetch_add(1);
+    generation.notify_all();
+    for(auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void GraphExecutor::push(int worker, int id) {
+    {
+        std::lock_guard<std::mutex> guard(queues[worker]->lock);
+        queues[worker]->ready.push_back(id);
+    }
+    queued.fetch_add(1);
+    signal.fetch_add(1);
+    signal.notify_all();
+}
+
+// newest task of this worker, otherwise the oldest task of the next worker that has one
+bool GraphExecutor::take(int worker, int& id) {
+    int count = size();
+    for(int k = 0; k < count; ++k) {
+        Worker& victim = *queues[(worker + k) % count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(victim.ready.empty()) {
+            continue;
+        }
+        if(k == 0) {
+            id = victim.ready.back();
+            victim.ready.pop_back();
+        }
+        else {
+            id = victim.ready.front();
+            victim.ready.pop_front();
+        }
+        queued.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+// run one task and release its successors, after a failure tasks are only counted as done so the run still ends
+void GraphExecutor::execute(int worker, int id) {
+    if(!failed.load()) {
+        try {
+            (*task)(id);
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> guard(error_lock);
+            if(!error) {
+                error = std::current_exception();
+            }
+            failed.store(true);
+        }
+    }
+
+    for(int next : (*successors)[id]) {
+        if(pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            push(worker, next);
+        }
+    }
+    if(remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        signal.fetch_add(1);
+        signal.notify_all();
+    }
+}
+
+/*
+ * a worker with nothing to take spins briefly, then sleeps until a task is queued or the run ends
+ *  - signal is read before queued is checked, a push after that check changes signal and wait returns at once
+ */
+void GraphExecutor::work(int worker) {
+    int idle = 0;
+    while(remaining.load(std::memory_order_acquire) > 0) {
+        int id;
+        if(take(worker, id)) {
+            execute(worker, id);
+            idle = 0;
+            continue;
+        }
+        unsigned seen = signal.load();
+        if(remaining.load(std::memory_order_acquire) == 0) {
+            break;
+        }
+        if(queued.load() > 0) {
+            continue;
+        }
+        if(++idle < 64) {
+            std::this_thread::yield();
+            continue;
+        }
+        signal.wait(seen);
+    }
+}
+
+void GraphExecutor::background(int worker) {
+    unsigned seen = 0;
+    while(true) {
+        generation.wait(seen);
+        seen = generation.load();
+        if(stopping.load()) {
+            return;
+        }
+        {
+            ThreadPool::Limit share(worker_threads);
+            work(worker);
+        }
+        attached.fetch_sub(1, std::memory_order_release);
+        attached.notify_all();
+    }
+}
+
+/*
+ * run a graph
+ *  - the first ready tasks are dealt round-robin over the workers
+ *  - run returns only once every worker has left the run, so none of them still reads its state
+ */
+void GraphExecutor::run(const std::vector<std::vector<int>>& successors_of, const std::vector<int>& dependencies,
+                        const std::function<void(int)>& fn) {
+    int count = static_cast<int>(dependencies.size());
+    if(successors_of.size() != dependencies.size()) {
+        throw std::invalid_argument("GraphExecutor: successors and dependencies must have one entry per task.");
+    }
+    if(count == 0) {
+        return;
+    }
+    if(std::none_of(dependencies.begin(), dependencies.end(), [](int d) { return d == 0; })) {
+        throw std::invalid_argument("GraphExecutor: no task is ready to run, the graph has a cycle.");
+    }
+
+    if(pending_capacity < static_cast<std::size_t>(count)) {
+        pending = std::make_unique<std::atomic<int>[]>(count);
+        pending_capacity = count;
+    }
+    for(int i = 0; i < count; ++i) {
+        pending[i].store(dependencies[i], std::memory_order_relaxed);
+    }
+    successors = &successors_of;
+    task = &fn;
+    worker_threads = std::max(1, ThreadPool::width() / size());
+    error = nullptr;
+    failed.store(false);
+    remaining.store(count);
+
+    int next_worker = 0;
+    for(int i = 0; i < count; ++i) {
+        if(dependencies[i] == 0) {
+            std::lock_guard<std::mutex> guard(queues[next_worker]->lock);
+            queues[next_worker]->ready.push_back(i);
+            queued.fetch_add(1);
+            next_worker = (next_worker + 1) % size();
+        }
+    }
+
+    attached.store(size());
+    generation.fetch_add(1);
+    generation.notify_all();
+    for(int left = attached.load(std::memory_order_acquire); left != 0; left = attached.load(std::memory_order_acquire)) {
+        attached.wait(left, std::memory_order_acquire);
+    }
+
+    successors = nullptr;
+    task = nullptr;
+    if(error) {
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
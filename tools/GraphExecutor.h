@@ -0,0 +1,77 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#ifndef INC_12_FINALPROJ_2_GRAPHEXECUTOR_H
+#define INC_12_FINALPROJ_2_GRAPHEXECUTOR_H
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing executor for the tasks of a dependency graph, on a fixed set of threads.
+ *        - a task runs once all the tasks it depends on are done, tasks that do not depend on each other run at once
+ *        - each worker keeps a deque of ready tasks, it runs its newest one (the successor it just made ready, whose
+ *          inputs are still in its cache) and when it has none steals the oldest one of another worker
+ *        - the workers sleep between runs, the thread calling run waits for them
+ *        - each worker's tasks run their kernels on at most an equal share of the caller's ThreadPool width, so
+ *          concurrent tasks do not oversubscribe the cores
+ *        - the first exception thrown by a task is rethrown by run, the tasks not started by then are skipped
+ *        - run is not reentrant, one graph at a time per executor
+ */
+class GraphExecutor {
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<int> ready;
+    };
+
+    std::vector<std::unique_ptr<Worker>> queues; // one per worker
+    std::vector<std::thread> threads;
+
+    // state of the current run, published by bumping generation
+    const std::vector<std::vector<int>>* successors = nullptr;
+    const std::function<void(int)>* task = nullptr;
+    std::unique_ptr<std::atomic<int>[]> pending; // dependencies of each task not done yet
+    std::size_t pending_capacity = 0;
+    int worker_threads = 1;                      // ThreadPool width of each worker
+
+    std::atomic<int> remaining{0}; // tasks of the run not done yet
+    std::atomic<int> queued{0};    // ready tasks in the deques
+    std::atomic<unsigned> signal{0};        // bumped when a task is queued or the run ends, idle workers wait on it
+    std::atomic<unsigned> generation{0};    // bumped when a run starts or the executor stops
+    std::atomic<int> attached{0};           // workers that have not yet left the current run
+    std::atomic<bool> stopping{false};
+
+    std::mutex error_lock;
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+
+    void push(int worker, int id);
+    bool take(int worker, int& id);
+    void execute(int worker, int id);
+    void work(int worker);       // until every task of the run is done
+    void background(int worker); // thread body
+
+public:
+    explicit GraphExecutor(int workers);
+    ~GraphExecutor();
+
+    GraphExecutor(const GraphExecutor&) = delete;
+    GraphExecutor& operator=(const GraphExecutor&) = delete;
+
+    // runs task(i) for i in [0, dependencies.size()), task i after every task that lists i among its successors,
+    // dependencies[i] is the number of those
+    void run(const std::vector<std::vector<int>>& successors, const std::vector<int>& dependencies,
+             const std::function<void(int)>& task);
+
+    [[nodiscard]] int size() const { return static_cast<int>(queues.size()); }
+};
+
+#endif //INC_12_FINALPROJ_2_GRAPHEXECUTOR_H
@@ -0,0 +1,30 @@
+//
+// Created by Vijay Goyal on 2025-01-16.
+//
+
+#ifndef INC_12_FINALPROJ_2_IM2COL_H
+#define INC_12_FINALPROJ_2_IM2COL_H
+
+/**
+ * @brief Lowers convolution windows of one (channels, height, width) sample to a matrix so a
+ *        convolution becomes a single GEMM.
+ *        - col has shape [channels * filter_height * filter_width][out_height * out_width]
+ *        - row (c * filter_height + kh) * filter_width + kw holds input[c][oh * stride + kh - padding][ow * stride + kw - padding]
+ *        - padding is applied on the fly, so no padded copy of the input is needed
+ */
+template <typename Type>
+class Im2Col {
+public:
+    static void im2col(const Type* input, int channels, int height, int width,
+                       int filter_height, int filter_width, int stride, int padding,
+                       int out_height, int out_width, Type* col);
+
+    // inverse scatter, accumulates every column entry back into input_grad
+    static void col2im(const Type* col, int channels, int height, int width,
+                       int filter_height, int filter_width, int stride, int padding,
+                       int out_height, int out_width, Type* input_grad);
+};
+
+#include "Im2Col.tpp"
+
+#endif //INC_12_FINALPROJ_2_IM2COL_H
@@ -0,0 +1,90 @@
+//
+// Created by Vijay Goyal on 2025-01-16.
+//
+
+#include "Im2Col.h"
+#include <algorithm>
+#include <cstddef>
+
+/*
+ * first and last+1 output column whose input column ow * stride + offset lies inside [0, width)
+ */
+static inline void validOutputRange(int offset, int stride, int width, int out_width, int& begin, int& end) {
+    begin = offset >= 0 ? 0 : (-offset + stride - 1) / stride;
+    end = width - offset <= 0 ? 0 : std::min(out_width, (width - offset - 1) / stride + 1);
+    begin = std::min(begin, end);
+}
+
+template <typename Type>
+void Im2Col<Type>::im2col(const Type* input, int channels, int height, int width,
+                          int filter_height, int filter_width, int stride, int padding,
+                          int out_height, int out_width, Type* col) {
+    for(int c = 0; c < channels; ++c) {
+        const Type* plane = input + static_cast<std::ptrdiff_t>(c) * height * width;
+        for(int kh = 0; kh < filter_height; ++kh) {
+            for(int kw = 0; kw < filter_width; ++kw) {
+                int w_offset = kw - padding;
+                int ow_begin, ow_end;
+                validOutputRange(w_offset, stride, width, out_width, ow_begin, ow_end);
+
+                for(int oh = 0; oh < out_height; ++oh) {
+                    Type* dst = col + static_cast<std::ptrdiff_t>(oh) * out_width;
+                    int ih = oh * stride + kh - padding;
+                    if(ih < 0 || ih >= height) {
+                        std::fill(dst, dst + out_width, static_cast<Type>(0.0));
+                        continue;
+                    }
+                    const Type* src = plane + static_cast<std::ptrdiff_t>(ih) * width + w_offset;
+                    std::fill(dst, dst + ow_begin, static_cast<Type>(0.0));
+                    if(stride == 1) {
+                        std::copy(src + ow_begin, src + ow_end, dst + ow_begin);
+                    }
+                    else {
+                        for(int ow = ow_begin; ow < ow_end; ++ow) {
+                            dst[ow] = src[ow * stride];
+                        }
+                    }
+                    std::fill(dst + ow_end, dst + out_width, static_cast<Type>(0.0));
+                }
+                col += static_cast<std::ptrdiff_t>(out_height) * out_width;
+            }
+        }
+    }
+}
+
+template <typename Type>
+void Im2Col<Type>::col2im(const Type* col, int channels, int height, int width,
+                          int filter_height, int filter_width, int stride, int padding,
+                          int out_height, int out_width, Type* input_grad) {
+    for(int c = 0; c < channels; ++c) {
+        Type* plane = input_grad + static_cast<std::ptrdiff_t>(c) * height * width;
+        for(int kh = 0; kh < filter_height; ++kh) {
+            for(int kw = 0; kw < filter_width; ++kw) {
+                int w_offset = kw - padding;
+                int ow_begin, ow_end;
+                validOutputRange(w_offset, stride, width, out_width, ow_begin, ow_end);
+
+                for(int oh = 0; oh < out_height; ++oh) {
+                    int ih = oh * stride + kh - padding;
+                    if(ih < 0 || ih >= height) {
+                        continue;
+                    }
+                    const Type* src = col + static_cast<std::ptrdiff_t>(oh) * out_width;
+                    Type* dst = plane + static_cast<std::ptrdiff_t>(ih) * width + w_offset;
+                    if(stride == 1) {
+                        #pragma omp simd
+                        for(int ow = ow_begin; ow < ow_end; ++ow) {
+                            dst[ow] += src[ow];
+                        }
+                    }
+                    else {
+                        for(int ow = ow_begin; ow < ow_end; ++ow) {
+                            dst[ow * stride] += src[ow];
+                        }
+                    }
+                }
+                col += static_cast<std::ptrdiff_t>(out_height) * out_width;
+            }
+        }
+    }
+}
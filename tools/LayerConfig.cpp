@@ -3,6 +3,7 @@
 //
 
 #include "LayerConfig.h"
+#include <utility>
 
 LayerConfig LayerConfig::conv(int in_c, int out_c, int fh, int fw, int st, int pad) {
     LayerConfig lc;
@@ -32,4 +33,18 @@ LayerConfig LayerConfig::fc(int in_f, int out_f) {
     lc.in_features = in_f;
     lc.out_features = out_f;
     return lc;
+}
+
+LayerConfig LayerConfig::add(std::vector<int> inputs) {
+    LayerConfig lc;
+    lc.type = "add";
+    lc.inputs = std::move(inputs);
+    return lc;
+}
+
+LayerConfig LayerConfig::concat(std::vector<int> inputs) {
+    LayerConfig lc;
+    lc.type = "concat";
+    lc.inputs = std::move(inputs);
+    return lc;
 }
\ No newline at end of file
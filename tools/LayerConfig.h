@@ -7,13 +7,20 @@
 
 #include <cstddef>
 #include <string>
+#include <vector>
 
 /**
- * @brief A simple struct describing one layer in the CNN by type ("conv", "pool", "fc")
+ * @brief A simple struct describing one layer in the CNN by type ("conv", "pool", "fc", "add", "concat")
  *        and the associated parameters.
+ *        - inputs lists the layers this one reads by index, -1 being the network input, and an empty list reads the
+ *          layer before it (the network input for the first), so a plain sequence of layers needs none
  */
 struct LayerConfig {
-    std::string type;  // "conv", "pool", or "fc"
+    std::string type;  // "conv", "pool", "fc", "add" or "concat"
+
+    std::vector<int> inputs; // earlier layers (or -1) read by this one, empty for the previous layer
+
+    bool recompute = false; // drop the layer's activations after forward and recompute them in backward, see ModularCNN
 
     // Convolution parameters
     int in_channels = 0;
@@ -22,6 +29,7 @@ struct LayerConfig {
     int filter_width  = 0;
     int stride        = 1;
     int padding       = 0;
+    int winograd_tile = 0; // 2 or 4 runs a 3x3 stride 1 convolution as Winograd F(tile x tile, 3x3), 0 keeps it direct
 
     // Pooling parameters
     int pool_height   = 0;
@@ -37,6 +45,11 @@ struct LayerConfig {
     static LayerConfig pool(int ph, int pw, int st = 1, int pad = 0);
 
     static LayerConfig fc(int in_f, int out_f);
+
+    // element-wise sum of layers of one shape (e.g. a residual connection), or their outputs stacked along the channels
+    static LayerConfig add(std::vector<int> inputs);
+
+    static LayerConfig concat(std::vector<int> inputs);
 };
 
 
@@ -0,0 +1,49 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#ifndef INC_12_FINALPROJ_2_LAYOUT_H
+#define INC_12_FINALPROJ_2_LAYOUT_H
+
+#include "Tensor.h"
+#include <string>
+
+enum class Layout : int {
+    NCHW = 0,    // a plane per channel, what every tensor outside a blocked graph uses
+    NCHW8c = 8,  // channels in blocks of 8, each pixel holds the 8 values of its block next to each other
+    NCHW16c = 16 // same with blocks of 16
+};
+
+// channels per block, 1 for NCHW
+inline int channelBlock(Layout layout) { return layout == Layout::NCHW ? 1 : static_cast<int>(layout); }
+
+inline std::string layoutName(Layout layout) {
+    return layout == Layout::NCHW ? "nchw" : "nchw" + std::to_string(channelBlock(layout)) + "c";
+}
+
+/**
+ * @brief Conversion between NCHW tensors and channel-blocked ones.
+ *        - a (batch, channels, height, width) activation in blocks of B channels is held in a Tensor of shape
+ *          (batch, ceil(channels / B), height, width * B): value (n, c, h, w) is element (n, c / B, h, w * B + c % B)
+ *        - so the B channels of a pixel are one contiguous vector, kernels vectorise over them instead of over a row
+ *        - when channels is not a multiple of B the last block is padded with lanes that hold 0, blocked kernels
+ *          keep them 0 (zero weights and biases, max of zeros, sums of zeros)
+ *        - such a tensor is contiguous, so the memory planner, views and gradients work on it unchanged
+ */
+template <typename Type>
+class ChannelBlocking {
+public:
+    typedef typename Tensor<Type>::Shape Shape;
+
+    static Shape blocked(const Shape& plain, int block);
+    static Shape plain(const Shape& blocked, int channels, int block); // channels of the plain tensor
+
+    // blocked = plain (data or grad), the padding lanes are set to 0, or blocked += plain leaving them alone
+    static void toBlocked(const Tensor<Type>& plain, Tensor<Type>& blocked, int block, bool grad, bool accumulate);
+    // plain = blocked, or plain += blocked, for the channels of plain
+    static void toPlain(const Tensor<Type>& blocked, Tensor<Type>& plain, int block, bool grad, bool accumulate);
+};
+
+#include "Layout.tpp"
+
+#endif //INC_12_FINALPROJ_2_LAYOUT_H
@@ -0,0 +1,103 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#include "Layout.h"
+#include "BFloat16.h"
+#include <algorithm>
+#include <stdexcept>
+#include "ThreadPool.h"
+
+template <typename Type>
+typename ChannelBlocking<Type>::Shape ChannelBlocking<Type>::blocked(const Shape& plain, int block) {
+    return {plain[0], (plain[1] + block - 1) / block, plain[2], plain[3] * block};
+}
+
+template <typename Type>
+typename ChannelBlocking<Type>::Shape ChannelBlocking<Type>::plain(const Shape& blocked, int channels, int block) {
+    return {blocked[0], channels, blocked[2], blocked[3] / block};
+}
+
+/*
+ * one (n, block, h) row at a time, the B source rows are interleaved into the destination row
+ *  - the plain tensor may be any view whose rows are contiguous, the blocked one is contiguous
+ */
+template <typename Type>
+void ChannelBlocking<Type>::toBlocked(const Tensor<Type>& plain, Tensor<Type>& blocked, int block, bool grad, bool accumulate) {
+    typedef typename Accumulator<Type>::type Acc;
+    int channels = plain.channels();
+    int height = plain.height();
+    int width = plain.width();
+    if(blocked.shape() != ChannelBlocking<Type>::blocked(plain.shape(), block) || !blocked.isContiguous()) {
+        throw std::invalid_argument("ChannelBlocking: the blocked tensor does not match the plain one.");
+    }
+    const Type* src_base = grad ? plain.grad_ptr() : plain.data_ptr();
+    Type* dst_base = grad ? blocked.grad_ptr() : blocked.data_ptr();
+    int blocks = blocked.channels();
+
+    ThreadPool::parallelFor(plain.batch() * blocks, ThreadPool::grainFor(static_cast<std::size_t>(height) * width * block), [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / blocks;
+            int b = i % blocks;
+            int lanes = std::min(block, channels - b * block);
+            for(int h = 0; h < height; ++h) {
+                Type* dst = dst_base + blocked.offset(n, b, h, 0);
+                for(int l = 0; l < lanes; ++l) {
+                    const Type* src = src_base + plain.offset(n, b * block + l, h, 0);
+                    if(accumulate) {
+                        for(int w = 0; w < width; ++w) {
+                            dst[w * block + l] = static_cast<Acc>(dst[w * block + l]) + static_cast<Acc>(src[w]);
+                        }
+                        continue;
+                    }
+                    for(int w = 0; w < width; ++w) {
+                        dst[w * block + l] = src[w];
+                    }
+                }
+                if(accumulate) {
+                    continue;
+                }
+                for(int l = lanes; l < block; ++l) {
+                    for(int w = 0; w < width; ++w) {
+                        dst[w * block + l] = static_cast<Type>(0.0);
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename Type>
+void ChannelBlocking<Type>::toPlain(const Tensor<Type>& blocked, Tensor<Type>& plain, int block, bool grad, bool accumulate) {
+    typedef typename Accumulator<Type>::type Acc;
+    int channels = plain.channels();
+    int height = plain.height();
+    int width = plain.width();
+    if(blocked.shape() != ChannelBlocking<Type>::blocked(plain.shape(), block) || !blocked.isContiguous()) {
+        throw std::invalid_argument("ChannelBlocking: the blocked tensor does not match the plain one.");
+    }
+    const Type* src_base = grad ? blocked.grad_ptr() : blocked.data_ptr();
+    Type* dst_base = grad ? plain.grad_ptr() : plain.data_ptr();
+
+    ThreadPool::parallelFor(plain.batch() * channels, ThreadPool::grainFor(static_cast<std::size_t>(height) * width), [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / channels;
+            int c = i % channels;
+            int b = c / block;
+            int l = c % block;
+            for(int h = 0; h < height; ++h) {
+                const Type* src = src_base + blocked.offset(n, b, h, 0) + l;
+                Type* dst = dst_base + plain.offset(n, c, h, 0);
+                if(accumulate) {
+                    for(int w = 0; w < width; ++w) {
+                        dst[w] = static_cast<Acc>(dst[w]) + static_cast<Acc>(src[w * block]);
+                    }
+                    continue;
+                }
+                for(int w = 0; w < width; ++w) {
+                    dst[w] = src[w * block];
+                }
+            }
+        }
+    });
+}
@@ -7,30 +7,68 @@
 
 #include "Operation.h"
 #include "Tensor.h"
+#include "BFloat16.h"
+#include "Layout.h"
+#include <cstdint>
 #include <vector>
-#include <utility>
 
 template <typename Type>
 class MaxPoolingOperation : public Operation<Type> {
-    typedef std::vector<std::vector<std::vector<Type>>> Tensor3D; // (channels, height, width)
-    typedef std::vector<std::vector<std::vector<std::vector<Type>>>> Tensor4D; // (batch_size, channels, height, width)
 private:
+    typedef typename Accumulator<Type>::type Acc; // values are compared in it, bfloat16 structs do not vectorise
+
     int pool_height;
     int pool_width;
     int stride;
     int padding;
+    int channel_block; // values per pixel, 1 in NCHW, the block in a channel-blocked layout
+
+    // argmax of each output as its offset inside the pooling window (ph * pool_width + pw), one byte per output (per lane)
+    std::vector<std::uint8_t> max_offsets;
+    typename Tensor<Type>::Shape recorded_shape = {0, 0, 0, 0};
+    bool training = true;
 
-    // indices of maxima for each pooling window
-    std::vector<std::vector<std::vector<std::vector<std::pair<int, int>>>>> max_indices;
+    [[nodiscard]] bool isHalving() const { return pool_height == 2 && pool_width == 2 && stride == 2 && padding == 0; }
 
-    std::shared_ptr<Tensor<Type>> inputs;
+    // pool one plane and record the argmax offsets, the 2x2 stride 2 case runs through a branch free vectorised kernel
+    void poolPlaneArgmax(const Type* src, int height, int width, Type* dst, std::uint8_t* offsets) const;
+    void poolPlaneHalving(const Type* src, int width, int out_height, int out_width, Type* dst) const;
+    // one block of a blocked layout, every window is a max over vectors of channel_block lanes, offsets may be nullptr
+    void poolBlock(const Type* src, int height, int width, Type* dst, std::uint8_t* offsets) const;
+    template <int B>
+    void poolBlockLanes(const Type* src, int height, int width, Type* dst, std::uint8_t* offsets) const;
 
 public:
-    MaxPoolingOperation(int pool_height, int pool_width, int stride = 1, int padding = 0);
+    // in a blocked layout every tensor is a ChannelBlocking tensor of that layout
+    MaxPoolingOperation(int pool_height, int pool_width, int stride = 1, int padding = 0, Layout layout = Layout::NCHW);
 
     std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>> &input) override;
 
     std::shared_ptr<Tensor<Type>> backward(const std::shared_ptr<Tensor<Type>>& output_grad) override;
+
+    std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) override;
+
+    std::vector<typename Tensor<Type>::Shape> plannedShapes(const typename Tensor<Type>::Shape& input_shape) const override;
+
+    [[nodiscard]] const char* name() const override { return "pool"; }
+    // one comparison per window element forward, one add per output backward
+    [[nodiscard]] double flops(const typename Tensor<Type>::Shape& input_shape, bool backward) const override {
+        double outputs = static_cast<double>(input_shape[0]) * input_shape[1] * channel_block * outputHeight(input_shape[2])
+                         * outputWidth(input_shape[3] / channel_block);
+        return backward ? outputs : outputs * pool_height * pool_width;
+    }
+
+    [[nodiscard]] int outputHeight(int input_height) const { return (input_height + 2 * padding - pool_height) / stride + 1; }
+    [[nodiscard]] int outputWidth(int input_width) const { return (input_width + 2 * padding - pool_width) / stride + 1; }
+
+    // when not training forward skips recording the argmax and backward is unavailable
+    void setTraining(bool is_training) { training = is_training; }
+    [[nodiscard]] bool isTraining() const { return training; }
+
+    // pool one (height, width) plane into dst without recording the argmax, used by inference and fused kernels,
+    // in a blocked layout the plane is one block of channels, (height, width * block) values
+    void poolPlane(const Type* src, int height, int width, Type* dst) const;
+    [[nodiscard]] int block() const { return channel_block; }
 };
 
 #include "MaxPoolingOperation.tpp"
@@ -5,261 +5,330 @@
 #include "MaxPoolingOperation.h"
 #include <algorithm>
 #include <limits>
-#include <omp.h>
+#include <stdexcept>
+#include "ThreadPool.h"
 
 template <typename Type>
-MaxPoolingOperation<Type>::MaxPoolingOperation(int pool_height, int pool_width, int stride, int padding) :
-        pool_height(pool_height), pool_width(pool_width), stride(stride), padding(padding) {}
+MaxPoolingOperation<Type>::MaxPoolingOperation(int pool_height, int pool_width, int stride, int padding, Layout layout) :
+        pool_height(pool_height), pool_width(pool_width), stride(stride), padding(padding), channel_block(channelBlock(layout)) {
+    if(pool_height <= 0 || pool_width <= 0 || stride <= 0 || padding < 0) {
+        throw std::invalid_argument("MaxPoolingOperation needs a positive window and stride and a non-negative padding.");
+    }
+    if(pool_height * pool_width > 256) {
+        throw std::invalid_argument("MaxPoolingOperation windows are limited to 256 elements.");
+    }
+}
 
- 
 template <typename Type>
 std::shared_ptr<Tensor<Type>> MaxPoolingOperation<Type>::forward(const std::shared_ptr<Tensor<Type>> &input) {
-    int batch_size = input->data.size();
-    int channels = input->data[0].size();
-    int input_height = input->data[0][0].size();
-    int input_width = input->data[0][0][0].size();
+    int batch_size = input->batch();
+    int channels = input->channels();
+    int input_height = input->height();
+    int input_width = input->width() / channel_block;
+    int out_height = outputHeight(input_height);
+    int out_width = outputWidth(input_width);
+
+    auto output = this->acquire(0, batch_size, channels, out_height, out_width * channel_block);
+    std::size_t grain = ThreadPool::grainFor(static_cast<std::size_t>(input_height) * input_width * channel_block); // planes per slice
+
+    if(!training) {
+        this->inputs.reset();
+        recorded_shape = {0, 0, 0, 0};
+        ThreadPool::parallelFor(batch_size * channels, grain, [&](int first, int last) {
+            for(int i = first; i < last; ++i) {
+                int n = i / channels;
+                int c = i % channels;
+                poolPlane(&input->data(n, c, 0, 0), input_height, input_width, &output->data(n, c, 0, 0));
+            }
+        });
+        return output;
+    }
 
     this->inputs = input;
-
-    // output dimensions
-    int out_height = (input_height + 2 * padding - pool_height) / stride + 1;
-    int out_width = (input_width + 2 * padding - pool_width) / stride + 1;
-
-    // output tensor
-    Tensor<Type> output(batch_size, channels, out_height, out_width, static_cast<Type>(0.0));
-
-    // max_indices
-    max_indices.resize(batch_size, std::vector<std::vector<std::vector<std::pair<int, int>>>>(
-            channels, std::vector<std::vector<std::pair<int, int>>>(out_height, std::vector<std::pair<int, int>>(out_width, {0, 0}))));
-
-    // Parallelize over the batch and channels dimensions
-    #pragma omp parallel for collapse(2)
-    for(int n = 0; n < batch_size; ++n) {
-        for(int c = 0; c < channels; ++c) {
-            for(int h = 0; h < out_height; ++h) {
-                for(int w = 0; w < out_width; ++w) {
-                    // define pooling window boundaries
-                    int h_start = h * stride - padding;
-                    int w_start = w * stride - padding;
-                    int h_end = std::min(h_start + pool_height, input_height);
-                    int w_end = std::min(w_start + pool_width, input_width);
-                    h_start = std::max(h_start, 0);
-                    w_start = std::max(w_start, 0);
-
-                    Type max_val = -std::numeric_limits<Type>::infinity();
-                    std::pair<int, int> max_pos = {h_start, w_start};
-
-                    // Vectorizable loop
-                    #pragma omp simd reduction(max:max_val)
-                    for(int ph = h_start; ph < h_end; ++ph) {
-                        for(int pw = w_start; pw < w_end; ++pw) {
-                            if(input->data[n][c][ph][pw] > max_val) {
-                                max_val = input->data[n][c][ph][pw];
-                                max_pos = {ph, pw};
-                            }
-                        }
-                    }
-
-                    output.data[n][c][h][w] = max_val;
-                    max_indices[n][c][h][w] = max_pos;
-                }
-            }
+    recorded_shape = output->shape();
+    std::size_t plane = static_cast<std::size_t>(out_height) * out_width * channel_block;
+    max_offsets.resize(static_cast<std::size_t>(batch_size) * channels * plane);
+
+    ThreadPool::parallelFor(batch_size * channels, grain, [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / channels;
+            int c = i % channels;
+            poolPlaneArgmax(&input->data(n, c, 0, 0), input_height, input_width, &output->data(n, c, 0, 0),
+                            max_offsets.data() + (static_cast<std::size_t>(n) * channels + c) * plane);
         }
-    }
+    });
 
-    return std::make_shared<Tensor<Type>>(output);
+    return output;
 }
 
 template <typename Type>
-std::shared_ptr<Tensor<Type>> MaxPoolingOperation<Type>::backward(const std::shared_ptr<Tensor<Type>>& output_grad) {
-    if(this->inputs->data.empty()) {
-        throw std::runtime_error("MaxPoolingOperation has no input tensors stored. Perform forward pass before backward.");
-    }
-
-    auto input_tensor = this->inputs;
-
-    if (output_grad == nullptr) {
-        std::cerr << "Error: output_grad is null in MaxPoolingOperation::backward." << std::endl;
-        throw std::invalid_argument("output_grad is null.");
-    }
-
-    if (output_grad->grad.empty()) {
-        std::cerr << "Error: output_grad->grad is empty in MaxPoolingOperation::backward." << std::endl;
-        throw std::invalid_argument("output_grad->grad is empty.");
-    }
-
-    int batch_size = output_grad->data.size();
-    if (batch_size == 0) {
-        std::cerr << "Error: output_grad->data has zero batch size." << std::endl;
-        throw std::invalid_argument("output_grad->data has zero batch size.");
-    }
-
-    int channels = output_grad->data[0].size();
-    int out_height = output_grad->data[0][0].size();
-    int out_width = output_grad->data[0][0][0].size();
+std::vector<typename Tensor<Type>::Shape> MaxPoolingOperation<Type>::plannedShapes(const typename Tensor<Type>::Shape& input_shape) const {
+    return {{input_shape[0], input_shape[1], outputHeight(input_shape[2]), outputWidth(input_shape[3] / channel_block) * channel_block}};
+}
 
-    // Validate grad dimensions
-    if (output_grad->grad.size() != static_cast<size_t>(batch_size)) {
-        std::cerr << "Error: output_grad->grad size (" << output_grad->grad.size()
-                  << ") does not match batch_size (" << batch_size << ")." << std::endl;
-        throw std::invalid_argument("output_grad->grad size does not match batch_size.");
+/*
+ * argmax pooling of one plane
+ *  - offsets are relative to the unclipped window origin so backward can rebuild the input position without the padding bounds
+ *  - ties keep the first maximum in row major order and a window entirely inside the padding points at its clipped start
+ */
+template <typename Type>
+void MaxPoolingOperation<Type>::poolPlaneArgmax(const Type* src, int height, int width, Type* dst, std::uint8_t* offsets) const {
+    if(channel_block > 1) {
+        poolBlock(src, height, width, dst, offsets);
+        return;
     }
-
-    for(int n = 0; n < batch_size; ++n) {
-        if (output_grad->grad[n].size() != static_cast<size_t>(channels)) {
-            std::cerr << "Error: output_grad->grad[" << n << "].size() ("
-                      << output_grad->grad[n].size() << ") does not match channels ("
-                      << channels << ")." << std::endl;
-            throw std::invalid_argument("output_grad->grad at sample does not match channels.");
-        }
-        for(int c = 0; c < channels; ++c) {
-            if (output_grad->grad[n][c].size() != static_cast<size_t>(out_height)) {
-                std::cerr << "Error: output_grad->grad[" << n << "][" << c
-                          << "].size() (" << output_grad->grad[n][c].size()
-                          << ") does not match out_height (" << out_height << ")." << std::endl;
-                throw std::invalid_argument("output_grad->grad at sample feature has incorrect height.");
-            }
-            for(int h = 0; h < out_height; ++h) {
-                if (output_grad->grad[n][c][h].size() != static_cast<size_t>(out_width)) {
-                    std::cerr << "Error: output_grad->grad[" << n << "][" << c << "]["
-                              << h << "].size() (" << output_grad->grad[n][c][h].size()
-                              << ") does not match out_width (" << out_width << ")." << std::endl;
-                    throw std::invalid_argument("output_grad->grad at sample feature has incorrect width.");
-                }
+    int out_height = outputHeight(height);
+    int out_width = outputWidth(width);
+
+    if(isHalving()) {
+        for(int h = 0; h < out_height; ++h) {
+            const Type* top = src + static_cast<std::ptrdiff_t>(2 * h) * width;
+            const Type* bottom = top + width;
+            Type* out_row = dst + static_cast<std::ptrdiff_t>(h) * out_width;
+            std::uint8_t* offset_row = offsets + static_cast<std::ptrdiff_t>(h) * out_width;
+            #pragma omp simd
+            for(int w = 0; w < out_width; ++w) {
+                Acc a = top[2 * w], b = top[2 * w + 1];
+                Acc c = bottom[2 * w], d = bottom[2 * w + 1];
+                bool right_top = b > a;
+                bool right_bottom = d > c;
+                Acc upper = right_top ? b : a;
+                Acc lower = right_bottom ? d : c;
+                bool take_lower = lower > upper;
+                out_row[w] = take_lower ? lower : upper;
+                offset_row[w] = static_cast<std::uint8_t>(take_lower ? 2 + right_bottom : right_top);
             }
         }
+        return;
     }
 
-    // calculate input dimensions based on stride and padding
-    int input_height_calc = stride * (out_height - 1) + pool_height - 2 * padding;
-    int input_width_calc = stride * (out_width - 1) + pool_width - 2 * padding;
-
-    // Validate max_indices dimensions
-    if (max_indices.size() != static_cast<size_t>(batch_size)) {
-        std::cerr << "Error: max_indices size (" << max_indices.size()
-                << ") does not match batch_size (" << batch_size << ")." << std::endl;
-        throw std::invalid_argument("max_indices size does not match batch_size.");
-    }
-
-    for(int n = 0; n < batch_size; ++n) {
-        if (max_indices[n].size() != static_cast<size_t>(channels)) {
-            std::cerr << "Error: max_indices[" << n << "].size() ("
-                    << max_indices[n].size() << ") does not match channels ("
-                    << channels << ")." << std::endl;
-            throw std::invalid_argument("max_indices at sample does not match channels.");
-        }
-        for(int c = 0; c < channels; ++c) {
-            if (max_indices[n][c].size() != static_cast<size_t>(out_height)) {
-                std::cerr << "Error: max_indices[" << n << "][" << c
-                        << "].size() (" << max_indices[n][c].size()
-                        << ") does not match out_height (" << out_height << ")." << std::endl;
-                throw std::invalid_argument("max_indices at sample feature has incorrect height.");
-            }
-            for(int h = 0; h < out_height; ++h) {
-                if (max_indices[n][c][h].size() != static_cast<size_t>(out_width)) {
-                    std::cerr << "Error: max_indices[" << n << "][" << c << "]["
-                            << h << "].size() (" << max_indices[n][c][h].size()
-                            << ") does not match out_width (" << out_width << ")." << std::endl;
-                    throw std::invalid_argument("max_indices at sample feature has incorrect width.");
+    for(int h = 0; h < out_height; ++h) {
+        int h_origin = h * stride - padding;
+        int h_start = std::max(h_origin, 0);
+        int h_end = std::min(h_origin + pool_height, height);
+        for(int w = 0; w < out_width; ++w) {
+            int w_origin = w * stride - padding;
+            int w_start = std::max(w_origin, 0);
+            int w_end = std::min(w_origin + pool_width, width);
+
+            Acc max_val = -std::numeric_limits<Acc>::infinity();
+            int max_offset = (h_start - h_origin) * pool_width + (w_start - w_origin);
+            for(int ph = h_start; ph < h_end; ++ph) {
+                const Type* row = src + static_cast<std::ptrdiff_t>(ph) * width;
+                for(int pw = w_start; pw < w_end; ++pw) {
+                    if(static_cast<Acc>(row[pw]) > max_val) {
+                        max_val = row[pw];
+                        max_offset = (ph - h_origin) * pool_width + (pw - w_origin);
+                    }
                 }
             }
+            dst[h * out_width + w] = max_val;
+            offsets[h * out_width + w] = static_cast<std::uint8_t>(max_offset);
         }
     }
+}
 
-    // Debug: Verify max_indices content
-    for(int n = 0; n < batch_size; ++n) {
-        for(int c = 0; c < channels; ++c) {
-            for(int h = 0; h < out_height; ++h) {
-                for(int w = 0; w < out_width; ++w) {
-                    auto& pos = max_indices[n][c][h][w];
-                    if(pos.first < 0 || pos.first >= input_height_calc || pos.second < 0 || pos.second >= input_width_calc) {
-                        std::cerr << "Error: Invalid max_indices[" << n << "][" << c << "][" << h << "][" << w << "] = ("
-                                  << pos.first << ", " << pos.second << ")." << std::endl;
-                        throw std::out_of_range("max_indices contains out-of-bound positions.");
+/*
+ * blocked pooling of one block, the window loops of poolPlaneArgmax with the B lanes of a pixel compared at once
+ *  - lanes keep their own maximum and argmax offset, ties keep the first as in NCHW
+ *  - 2x2 stride 2 windows compare four whole vectors, the offsets are those of the halving kernel
+ */
+template <typename Type>
+template <int B>
+void MaxPoolingOperation<Type>::poolBlockLanes(const Type* src, int height, int width, Type* dst, std::uint8_t* offsets) const {
+    int out_height = outputHeight(height);
+    int out_width = outputWidth(width);
+    if(isHalving()) {
+        for(int h = 0; h < out_height; ++h) {
+            const Type* top = src + static_cast<std::ptrdiff_t>(2 * h) * width * B;
+            const Type* bottom = top + static_cast<std::ptrdiff_t>(width) * B;
+            Type* out_row = dst + static_cast<std::ptrdiff_t>(h) * out_width * B;
+            std::uint8_t* offset_row = offsets ? offsets + static_cast<std::ptrdiff_t>(h) * out_width * B : nullptr;
+            for(int w = 0; w < out_width; ++w) {
+                std::ptrdiff_t left = static_cast<std::ptrdiff_t>(2 * w) * B;
+                #pragma omp simd
+                for(int l = 0; l < B; ++l) {
+                    Acc a = top[left + l], b = top[left + B + l];
+                    Acc c = bottom[left + l], d = bottom[left + B + l];
+                    bool right_top = b > a;
+                    bool right_bottom = d > c;
+                    Acc upper = right_top ? b : a;
+                    Acc lower = right_bottom ? d : c;
+                    bool take_lower = lower > upper;
+                    out_row[w * B + l] = take_lower ? lower : upper;
+                    if(offset_row) {
+                        offset_row[w * B + l] = static_cast<std::uint8_t>(take_lower ? 2 + right_bottom : right_top);
                     }
                 }
             }
         }
+        return;
     }
 
-    // initialize dInput_padded with zeros
-    Tensor4D dInput_padded(batch_size, Tensor3D(channels, std::vector<std::vector<Type>>(
-            input_height_calc + 2 * padding, std::vector<Type>(input_width_calc + 2 * padding, static_cast<Type>(0.0)))));
-
-    // Parallelize the gradient assignment
-    #pragma omp parallel for collapse(2)
-    for(int n = 0; n < batch_size; ++n) {
-        for(int c = 0; c < channels; ++c) {
-            for(int h = 0; h < out_height; ++h) {
-                Type* row = &dInput_padded[n][c][h][0];
-                #pragma omp simd
-                for(int w = 0; w < out_width; ++w) {
-                    std::pair<int, int> max_pos = max_indices[n][c][h][w];
-                    #pragma omp atomic
-                    dInput_padded[n][c][max_pos.first][max_pos.second] += output_grad->grad[n][c][h][w];
+    for(int h = 0; h < out_height; ++h) {
+        int h_origin = h * stride - padding;
+        int h_start = std::max(h_origin, 0);
+        int h_end = std::min(h_origin + pool_height, height);
+        for(int w = 0; w < out_width; ++w) {
+            int w_origin = w * stride - padding;
+            int w_start = std::max(w_origin, 0);
+            int w_end = std::min(w_origin + pool_width, width);
+
+            Acc max_val[B];
+            std::uint8_t max_offset[B];
+            auto first = static_cast<std::uint8_t>((h_start - h_origin) * pool_width + (w_start - w_origin));
+            #pragma omp simd
+            for(int l = 0; l < B; ++l) {
+                max_val[l] = -std::numeric_limits<Acc>::infinity();
+                max_offset[l] = first;
+            }
+            for(int ph = h_start; ph < h_end; ++ph) {
+                for(int pw = w_start; pw < w_end; ++pw) {
+                    const Type* x = src + (static_cast<std::ptrdiff_t>(ph) * width + pw) * B;
+                    auto offset = static_cast<std::uint8_t>((ph - h_origin) * pool_width + (pw - w_origin));
+                    #pragma omp simd
+                    for(int l = 0; l < B; ++l) {
+                        bool larger = static_cast<Acc>(x[l]) > max_val[l];
+                        max_val[l] = larger ? static_cast<Acc>(x[l]) : max_val[l];
+                        max_offset[l] = larger ? offset : max_offset[l];
+                    }
                 }
             }
+            std::ptrdiff_t at = (static_cast<std::ptrdiff_t>(h) * out_width + w) * B;
+            #pragma omp simd
+            for(int l = 0; l < B; ++l) {
+                dst[at + l] = max_val[l];
+            }
+            if(offsets) {
+                std::copy(max_offset, max_offset + B, offsets + at);
+            }
         }
     }
+}
 
-    // Remove padding from dInput if necessary
-    if(padding > 0) {
-        Tensor4D dInput_unpadded(batch_size, Tensor3D(channels, std::vector<std::vector<Type>>(
-                input_height_calc, std::vector<Type>(input_width_calc, static_cast<Type>(0.0)))));
+template <typename Type>
+void MaxPoolingOperation<Type>::poolBlock(const Type* src, int height, int width, Type* dst, std::uint8_t* offsets) const {
+    if(channel_block == 8) {
+        poolBlockLanes<8>(src, height, width, dst, offsets);
+        return;
+    }
+    poolBlockLanes<16>(src, height, width, dst, offsets);
+}
 
-        #pragma omp parallel for collapse(2)
-        for(int n = 0; n < batch_size; ++n) {
-            for(int c = 0; c < channels; ++c) {
-                for(int h = 0; h < input_height_calc; ++h) {
-                    Type* dst_row = &dInput_unpadded[n][c][h][0];
-                    Type* src_row = &dInput_padded[n][c][h + padding][0];
-                    #pragma omp simd
-                    for(int w = 0; w < input_width_calc; ++w) {
-                        dst_row[w] = src_row[w + padding];
-                    }
-                }
-            }
+template <typename Type>
+void MaxPoolingOperation<Type>::poolPlaneHalving(const Type* src, int width, int out_height, int out_width, Type* dst) const {
+    for(int h = 0; h < out_height; ++h) {
+        const Type* top = src + static_cast<std::ptrdiff_t>(2 * h) * width;
+        const Type* bottom = top + width;
+        Type* out_row = dst + static_cast<std::ptrdiff_t>(h) * out_width;
+        #pragma omp simd
+        for(int w = 0; w < out_width; ++w) {
+            Acc upper = std::max<Acc>(top[2 * w], top[2 * w + 1]);
+            Acc lower = std::max<Acc>(bottom[2 * w], bottom[2 * w + 1]);
+            out_row[w] = lower > upper ? lower : upper;
         }
+    }
+}
 
-        // Assign dInputUnpadded to the input tensor's grad
-        #pragma omp parallel for collapse(2)
-        for(int n = 0; n < batch_size; ++n) {
-            for(int c = 0; c < channels; ++c) {
-                for(int h = 0; h < input_height_calc; ++h) {
-                    for(int w = 0; w < input_width_calc; ++w) {
-                        input_tensor->grad[n][c][h][w] += dInput_unpadded[n][c][h][w];
-                    }
+template <typename Type>
+void MaxPoolingOperation<Type>::poolPlane(const Type* src, int height, int width, Type* dst) const {
+    if(channel_block > 1) {
+        poolBlock(src, height, width, dst, nullptr);
+        return;
+    }
+    int out_height = outputHeight(height);
+    int out_width = outputWidth(width);
+    if(isHalving()) {
+        poolPlaneHalving(src, width, out_height, out_width, dst);
+        return;
+    }
+    for(int h = 0; h < out_height; ++h) {
+        int h_start = std::max(h * stride - padding, 0);
+        int h_end = std::min(h * stride - padding + pool_height, height);
+        for(int w = 0; w < out_width; ++w) {
+            int w_start = std::max(w * stride - padding, 0);
+            int w_end = std::min(w * stride - padding + pool_width, width);
+            Acc max_val = -std::numeric_limits<Acc>::infinity();
+            for(int ph = h_start; ph < h_end; ++ph) {
+                const Type* row = src + static_cast<std::ptrdiff_t>(ph) * width;
+                for(int pw = w_start; pw < w_end; ++pw) {
+                    max_val = std::max<Acc>(max_val, row[pw]);
                 }
             }
+            dst[h * out_width + w] = max_val;
         }
+    }
+}
 
-        auto dInput_tensor = std::make_shared<Tensor<Type>>();
-        dInput_tensor->data = dInput_unpadded;
-        dInput_tensor->grad = Tensor4D(dInput_unpadded.size(), Tensor3D(dInput_unpadded[0].size(),
-                                                                        std::vector<std::vector<Type>>(dInput_unpadded[0][0].size(),
-                                                                                std::vector<Type>(dInput_unpadded[0][0][0].size(), static_cast<Type>(0.0)))));
+template <typename Type>
+std::shared_ptr<Tensor<Type>> MaxPoolingOperation<Type>::infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) {
+    int batch_size = input->batch();
+    int channels = input->channels();
+    int input_height = input->height();
+    int input_width = input->width() / channel_block;
+    int out_height = outputHeight(input_height);
+    int out_width = outputWidth(input_width);
+
+    auto& output = Tensor<Type>::reuse(out, batch_size, channels, out_height, out_width * channel_block);
+    std::size_t grain = ThreadPool::grainFor(static_cast<std::size_t>(input_height) * input_width * channel_block);
+
+    ThreadPool::parallelFor(batch_size * channels, grain, [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / channels;
+            int c = i % channels;
+            poolPlane(&input->data(n, c, 0, 0), input_height, input_width, &output->data(n, c, 0, 0));
+        }
+    });
+    return output;
+}
 
-        return dInput_tensor;
+// scatter each output gradient to the input position its argmax offset points at
+template <typename Type>
+std::shared_ptr<Tensor<Type>> MaxPoolingOperation<Type>::backward(const std::shared_ptr<Tensor<Type>>& output_grad) {
+    if(!this->inputs) {
+        throw std::runtime_error("MaxPoolingOperation has no recorded forward pass, run forward in training mode before backward.");
+    }
+    if(!output_grad || !output_grad->grad_ptr() || output_grad->shape() != recorded_shape) {
+        throw std::invalid_argument("MaxPoolingOperation output_grad does not match the last forward pass.");
     }
-    else {
-        // Assign dInput_padded to the input tensor's grad
-        #pragma omp parallel for collapse(2)
-        for(int n = 0; n < batch_size; ++n) {
-            for(int c = 0; c < channels; ++c) {
-                for(int h = 0; h < input_height_calc; ++h) {
-                    for(int w = 0; w < input_width_calc; ++w) {
-                        input_tensor->grad[n][c][h][w] += dInput_padded[n][c][h][w];
+
+    auto input_tensor = this->inputs;
+    int batch_size = recorded_shape[0];
+    int channels = recorded_shape[1];
+    int out_height = recorded_shape[2];
+    int lanes = channel_block;
+    int out_width = recorded_shape[3] / lanes;
+    int input_width = input_tensor->width() / lanes;
+    std::size_t plane = static_cast<std::size_t>(out_height) * out_width * lanes;
+    bool halving = isHalving();
+
+    ThreadPool::parallelFor(batch_size * channels, ThreadPool::grainFor(plane), [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / channels;
+            int c = i % channels;
+            const std::uint8_t* offsets = max_offsets.data() + (static_cast<std::size_t>(n) * channels + c) * plane;
+            const Type* dout = &output_grad->grad(n, c, 0, 0);
+            Type* din = &input_tensor->grad(n, c, 0, 0);
+            for(int h = 0; h < out_height; ++h) {
+                for(int w = 0; w < out_width; ++w) {
+                    // one lane per pixel in NCHW, a block of them otherwise
+                    for(int l = 0; l < lanes; ++l) {
+                        int at = (h * out_width + w) * lanes + l;
+                        int offset = offsets[at];
+                        int ih, iw;
+                        if(halving) {
+                            ih = 2 * h + (offset >> 1);
+                            iw = 2 * w + (offset & 1);
+                        } else {
+                            ih = h * stride - padding + offset / pool_width;
+                            iw = w * stride - padding + offset % pool_width;
+                        }
+                        din[(ih * input_width + iw) * lanes + l] += dout[at];
                     }
                 }
             }
         }
+    });
 
-        auto dInput_tensor = std::make_shared<Tensor<Type>>();
-        dInput_tensor->data = dInput_padded;
-        dInput_tensor->grad = Tensor4D(dInput_padded.size(), Tensor3D(dInput_padded[0].size(),
-                                                                      std::vector<std::vector<Type>>(dInput_padded[0][0].size(),
-                                                                              std::vector<Type>(dInput_padded[0][0][0].size(), static_cast<Type>(0.0)))));
-
-        return dInput_tensor;
-    }
-}
\ No newline at end of file
+    return input_tensor;
+}
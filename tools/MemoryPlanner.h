@@ -0,0 +1,59 @@
+//
+// Created by Vijay Goyal on 2025-01-17.
+//
+
+#ifndef INC_12_FINALPROJ_2_MEMORYPLANNER_H
+#define INC_12_FINALPROJ_2_MEMORYPLANNER_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <functional>
+
+/**
+ * @brief Static planner that places short-lived buffers in one reusable arena.
+ *        - each buffer is requested with its size and the first and last step of a schedule that touch it
+ *        - buffers are placed largest first at the lowest offset that does not collide with an already placed
+ *          buffer whose lifetime overlaps, so buffers that are never alive together share memory
+ *        - a schedule that is only partially ordered (e.g. branches of a graph running at once) passes its own test of
+ *          whether two buffers can be alive together instead, the steps then only need to be an order it may run in
+ *        - every offset is a multiple of Tensor::ALIGNMENT bytes
+ *        - the arena only ever grows, a new plan that fits in it reuses it without allocating
+ */
+template <typename Type>
+class MemoryPlanner {
+public:
+    struct Block {
+        std::size_t size;   // elements
+        int first_use;      // inclusive schedule steps
+        int last_use;
+        std::size_t offset; // elements from the start of the arena, set by plan()
+    };
+
+private:
+    std::vector<Block> blocks;
+    std::shared_ptr<Type> arena;
+    std::size_t arena_capacity = 0; // elements
+    std::size_t planned_size = 0;   // elements used by the current plan
+
+    static std::size_t alignedSize(std::size_t count);
+
+public:
+    void clear(); // drop every request, the arena is kept for the next plan
+
+    int request(std::size_t count, int first_use, int last_use); // returns the id of the buffer
+
+    void plan(); // assign offsets and grow the arena if the plan does not fit
+    void plan(const std::function<bool(int, int)>& overlapping); // same, with overlapping(a, b) deciding which buffers collide
+
+    std::shared_ptr<Type> buffer(int id) const; // start of a buffer, keeps the arena alive
+
+    [[nodiscard]] std::size_t peakBytes() const { return planned_size * sizeof(Type); }
+    [[nodiscard]] std::size_t arenaBytes() const { return arena_capacity * sizeof(Type); }
+    [[nodiscard]] std::size_t unplannedBytes() const; // what giving every buffer its own allocation would take
+    [[nodiscard]] const std::vector<Block>& plannedBlocks() const { return blocks; }
+};
+
+#include "MemoryPlanner.tpp"
+
+#endif //INC_12_FINALPROJ_2_MEMORYPLANNER_H
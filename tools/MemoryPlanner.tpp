@@ -0,0 +1,103 @@
+//
+// Created by Vijay Goyal on 2025-01-17.
+//
+
+#include "MemoryPlanner.h"
+#include "Tensor.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+template <typename Type>
+std::size_t MemoryPlanner<Type>::alignedSize(std::size_t count) {
+    constexpr std::size_t per_line = std::max<std::size_t>(1, Tensor<Type>::ALIGNMENT / sizeof(Type));
+    return (count + per_line - 1) / per_line * per_line;
+}
+
+template <typename Type>
+void MemoryPlanner<Type>::clear() {
+    blocks.clear();
+    planned_size = 0;
+}
+
+template <typename Type>
+int MemoryPlanner<Type>::request(std::size_t count, int first_use, int last_use) {
+    if(first_use > last_use) {
+        throw std::invalid_argument("MemoryPlanner: a buffer cannot be released before it is first used.");
+    }
+    blocks.push_back({alignedSize(count), first_use, last_use, 0});
+    return static_cast<int>(blocks.size()) - 1;
+}
+
+// lifetimes are intervals of one total order of steps
+template <typename Type>
+void MemoryPlanner<Type>::plan() {
+    plan([this](int a, int b) {
+        return blocks[a].first_use <= blocks[b].last_use && blocks[b].first_use <= blocks[a].last_use;
+    });
+}
+
+/*
+ * greedy placement, largest buffer first
+ *  - the buffers already placed that are alive at the same time as this one are visited by offset and the
+ *    buffer goes into the first gap large enough for it
+ */
+template <typename Type>
+void MemoryPlanner<Type>::plan(const std::function<bool(int, int)>& overlapping) {
+    std::vector<int> order(blocks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return blocks[a].size > blocks[b].size; });
+
+    std::vector<int> placed;
+    std::vector<int> conflicts;
+    planned_size = 0;
+    for(int id : order) {
+        Block& block = blocks[id];
+        conflicts.clear();
+        for(int other : placed) {
+            if(overlapping(other, id)) {
+                conflicts.push_back(other);
+            }
+        }
+        std::sort(conflicts.begin(), conflicts.end(), [&](int a, int b) { return blocks[a].offset < blocks[b].offset; });
+
+        std::size_t offset = 0;
+        for(int other : conflicts) {
+            if(offset + block.size <= blocks[other].offset) {
+                break;
+            }
+            offset = std::max(offset, blocks[other].offset + blocks[other].size);
+        }
+        block.offset = offset;
+        planned_size = std::max(planned_size, offset + block.size);
+        placed.push_back(id);
+    }
+
+    if(planned_size > arena_capacity) {
+        arena = Tensor<Type>::allocate(planned_size, static_cast<Type>(0.0));
+        arena_capacity = planned_size;
+    }
+}
+
+template <typename Type>
+std::shared_ptr<Type> MemoryPlanner<Type>::buffer(int id) const {
+    if(id < 0 || id >= static_cast<int>(blocks.size())) {
+        throw std::out_of_range("MemoryPlanner: unknown buffer id.");
+    }
+    if(blocks[id].size == 0) {
+        return nullptr;
+    }
+    if(!arena || blocks[id].offset + blocks[id].size > arena_capacity) {
+        throw std::runtime_error("MemoryPlanner: plan() must run before buffers are handed out.");
+    }
+    return std::shared_ptr<Type>(arena, arena.get() + blocks[id].offset);
+}
+
+template <typename Type>
+std::size_t MemoryPlanner<Type>::unplannedBytes() const {
+    std::size_t total = 0;
+    for(const auto& block : blocks) {
+        total += block.size;
+    }
+    return total * sizeof(Type);
+}
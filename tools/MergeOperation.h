@@ -0,0 +1,70 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#ifndef INC_12_FINALPROJ_2_MERGEOPERATION_H
+#define INC_12_FINALPROJ_2_MERGEOPERATION_H
+
+#include "Operation.h"
+#include "Tensor.h"
+#include "BFloat16.h"
+#include "Layout.h"
+#include <memory>
+#include <vector>
+
+enum class MergeKind : int {
+    Add = 0,   // element-wise sum of inputs of one shape, e.g. a residual connection
+    Concat = 1 // inputs of one batch, height and width stacked along the channels, e.g. the branches of an Inception block
+};
+
+/**
+ * @brief Operation of several inputs that joins the branches of a graph.
+ *        - backward accumulates the output gradient into every input's gradient (its channel slice for Concat)
+ *        - no parameters, no caches besides the inputs of the last forward
+ *        - as a single-input operation it is the identity (Add) or a copy (Concat)
+ *        - in a blocked layout Concat needs the channels of every input, when one before the last does not fill its
+ *          last block the channels are moved lane by lane, otherwise sample by sample as in NCHW
+ */
+template <typename Type>
+class MergeOperation : public Operation<Type> {
+private:
+    typedef typename Accumulator<Type>::type Acc;
+    typedef typename Tensor<Type>::Shape Shape;
+
+    MergeKind kind;
+    int block;                 // channels per block, 1 in NCHW
+    std::vector<int> channels; // of each input, Concat in a blocked layout only
+    typename Operation<Type>::Inputs sources; // inputs of the last forward
+
+    [[nodiscard]] bool lanewise() const; // a blocked Concat whose inputs do not all end on a block boundary
+    // dst (data) = or dst (grad) += the channels of every input packed lane by lane, see lanewise
+    void concatLanes(const typename Operation<Type>::Inputs& input_tensors, Tensor<Type>& output, bool backward) const;
+
+    Shape outputShape(const std::vector<Shape>& input_shapes) const; // throws when the inputs cannot be merged
+    void compute(const typename Operation<Type>::Inputs& input_tensors, Tensor<Type>& output) const;
+
+public:
+    explicit MergeOperation(MergeKind kind, Layout layout = Layout::NCHW, std::vector<int> input_channels = {});
+
+    std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& input) override { return forwardInputs({input}); }
+    std::shared_ptr<Tensor<Type>> backward(const std::shared_ptr<Tensor<Type>>& output_grad) override;
+    std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) override {
+        return inferInputs({input}, out);
+    }
+    std::vector<Shape> plannedShapes(const Shape& input_shape) const override { return plannedShapesInputs({input_shape}); }
+
+    std::shared_ptr<Tensor<Type>> forwardInputs(const typename Operation<Type>::Inputs& input_tensors) override;
+    std::shared_ptr<Tensor<Type>> inferInputs(const typename Operation<Type>::Inputs& input_tensors, std::shared_ptr<Tensor<Type>>& out) override;
+    std::vector<Shape> plannedShapesInputs(const std::vector<Shape>& input_shapes) const override; // output
+
+    [[nodiscard]] const char* name() const override { return kind == MergeKind::Add ? "add" : "concat"; }
+    // one add per input element, forward and backward
+    [[nodiscard]] double flops(const Shape& input_shape, bool backward) const override { return flopsInputs({input_shape}, backward); }
+    [[nodiscard]] double flopsInputs(const std::vector<Shape>& input_shapes, bool backward) const override;
+
+    [[nodiscard]] MergeKind getKind() const { return kind; }
+};
+
+#include "MergeOperation.tpp"
+
+#endif //INC_12_FINALPROJ_2_MERGEOPERATION_H
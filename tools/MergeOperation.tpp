@@ -0,0 +1,244 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#include "MergeOperation.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "ThreadPool.h"
+
+template <typename Type>
+MergeOperation<Type>::MergeOperation(MergeKind kind, Layout layout, std::vector<int> input_channels)
+        : kind(kind), block(channelBlock(layout)), channels(std::move(input_channels)) {
+    if(kind != MergeKind::Add && kind != MergeKind::Concat) {
+        throw std::invalid_argument("MergeOperation: unknown kind " + std::to_string(static_cast<int>(kind)));
+    }
+    if(kind == MergeKind::Concat && block > 1 && channels.empty()) {
+        throw std::invalid_argument("MergeOperation: concat in " + layoutName(layout) + " needs the channels of its inputs.");
+    }
+}
+
+template <typename Type>
+bool MergeOperation<Type>::lanewise() const {
+    if(kind != MergeKind::Concat || block == 1) {
+        return false;
+    }
+    return std::any_of(channels.begin(), channels.end() - 1, [&](int c) { return c % block != 0; });
+}
+
+template <typename Type>
+typename MergeOperation<Type>::Shape MergeOperation<Type>::outputShape(const std::vector<Shape>& input_shapes) const {
+    if(input_shapes.empty()) {
+        throw std::invalid_argument("MergeOperation needs at least one input.");
+    }
+    Shape out = input_shapes.front();
+    for(std::size_t k = 1; k < input_shapes.size(); ++k) {
+        const Shape& shape = input_shapes[k];
+        bool same = kind == MergeKind::Add ? shape == out
+                                           : shape[0] == out[0] && shape[2] == out[2] && shape[3] == out[3];
+        if(!same) {
+            throw std::invalid_argument(std::string("MergeOperation: input ") + std::to_string(k) + " of " + name() +
+                                        " does not match the shape of input 0");
+        }
+        if(kind == MergeKind::Concat) {
+            out[1] += shape[1];
+        }
+    }
+    if(kind != MergeKind::Concat || block == 1) {
+        return out;
+    }
+    // blocks of the channels of all inputs together
+    if(channels.size() != input_shapes.size()) {
+        throw std::invalid_argument("MergeOperation: concat was built for " + std::to_string(channels.size()) + " inputs.");
+    }
+    int total = 0;
+    for(std::size_t k = 0; k < input_shapes.size(); ++k) {
+        if(input_shapes[k][1] != (channels[k] + block - 1) / block) {
+            throw std::invalid_argument("MergeOperation: input " + std::to_string(k) + " of concat is not a blocked tensor of " +
+                                        std::to_string(channels[k]) + " channels.");
+        }
+        total += channels[k];
+    }
+    out[1] = (total + block - 1) / block;
+    return out;
+}
+
+template <typename Type>
+std::vector<typename MergeOperation<Type>::Shape> MergeOperation<Type>::plannedShapesInputs(const std::vector<Shape>& input_shapes) const {
+    return {outputShape(input_shapes)};
+}
+
+template <typename Type>
+double MergeOperation<Type>::flopsInputs(const std::vector<Shape>& input_shapes, bool backward) const {
+    double elements = 0.0;
+    for(const Shape& shape : input_shapes) {
+        elements += static_cast<double>(shape[0]) * shape[1] * shape[2] * shape[3];
+    }
+    return elements;
+}
+
+/*
+ * Add: out = sum of the inputs, summed in Acc so bfloat16 rounds once
+ * Concat: sample n of the output is the samples n of the inputs one after the other, each a contiguous block of
+ *         channels * height * width values
+ */
+template <typename Type>
+void MergeOperation<Type>::compute(const typename Operation<Type>::Inputs& input_tensors, Tensor<Type>& output) const {
+    for(const auto& input : input_tensors) {
+        if(!input->isContiguous()) {
+            throw std::invalid_argument("MergeOperation: inputs must be contiguous tensors.");
+        }
+    }
+    Type* out = output.data_ptr();
+
+    if(kind == MergeKind::Add) {
+        std::size_t count = output.size();
+        int k_count = static_cast<int>(input_tensors.size());
+        ThreadPool::parallelFor(count, ThreadPool::MIN_SLICE, [&](std::size_t from, std::size_t to) {
+            for(std::size_t block = from; block < to; block += 4096) {
+                std::size_t end = std::min(to, block + 4096);
+                const Type* first = input_tensors[0]->data_ptr();
+                #pragma omp simd
+                for(std::size_t i = block; i < end; ++i) {
+                    out[i] = first[i];
+                }
+                for(int k = 1; k < k_count; ++k) {
+                    const Type* x = input_tensors[k]->data_ptr();
+                    #pragma omp simd
+                    for(std::size_t i = block; i < end; ++i) {
+                        out[i] = static_cast<Type>(static_cast<Acc>(out[i]) + static_cast<Acc>(x[i]));
+                    }
+                }
+            }
+        });
+        return;
+    }
+
+    if(lanewise()) {
+        concatLanes(input_tensors, output, false);
+        return;
+    }
+    int batch_size = output.batch();
+    std::size_t out_sample = output.sampleSize();
+    ThreadPool::parallelFor(batch_size, ThreadPool::grainFor(out_sample), [&](int from, int to) {
+        for(int n = from; n < to; ++n) {
+            Type* dst = out + n * out_sample;
+            for(const auto& input : input_tensors) {
+                std::size_t sample = input->sampleSize();
+                const Type* src = input->data_ptr() + n * sample;
+                std::copy(src, src + sample, dst);
+                dst += sample;
+            }
+        }
+    });
+}
+
+/*
+ * blocked Concat lane by lane: channel c of input k is channel offset_k + c of the output, one strided plane each
+ *  - forward clears the last block of every output sample first, so its padding lanes stay 0
+ *  - backward adds the output gradient of each channel into its input's gradient
+ */
+template <typename Type>
+void MergeOperation<Type>::concatLanes(const typename Operation<Type>::Inputs& input_tensors, Tensor<Type>& output, bool backward) const {
+    int batch_size = output.batch();
+    std::size_t plane = static_cast<std::size_t>(output.height()) * output.width(); // of one block
+    std::size_t out_sample = output.sampleSize();
+    Type* out = backward ? output.grad_ptr() : output.data_ptr();
+
+    ThreadPool::parallelFor(batch_size, ThreadPool::grainFor(out_sample), [&](int from, int to) {
+        for(int n = from; n < to; ++n) {
+            Type* dst = out + n * out_sample;
+            if(!backward) {
+                std::fill(dst + out_sample - plane, dst + out_sample, static_cast<Type>(0.0));
+            }
+            int first = 0; // output channel of the input's channel 0
+            for(std::size_t k = 0; k < input_tensors.size(); ++k) {
+                const auto& input = input_tensors[k];
+                Type* base = backward ? input->grad_ptr() : input->data_ptr();
+                if(base) {
+                    Type* src = base + n * input->sampleSize();
+                    for(int c = 0; c < channels[k]; ++c) {
+                        int o = first + c;
+                        Type* x = src + (c / block) * plane + c % block;
+                        Type* y = dst + (o / block) * plane + o % block;
+                        for(std::size_t i = 0; i < plane; i += block) {
+                            if(backward) {
+                                x[i] = static_cast<Type>(static_cast<Acc>(x[i]) + static_cast<Acc>(y[i]));
+                                continue;
+                            }
+                            y[i] = x[i];
+                        }
+                    }
+                }
+                first += channels[k];
+            }
+        }
+    });
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> MergeOperation<Type>::forwardInputs(const typename Operation<Type>::Inputs& input_tensors) {
+    std::vector<Shape> shapes;
+    for(const auto& input : input_tensors) {
+        shapes.push_back(input->shape());
+    }
+    Shape shape = outputShape(shapes);
+    auto output = this->acquire(0, shape[0], shape[1], shape[2], shape[3]);
+    compute(input_tensors, *output);
+    sources = input_tensors;
+    return output;
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> MergeOperation<Type>::inferInputs(const typename Operation<Type>::Inputs& input_tensors,
+                                                                std::shared_ptr<Tensor<Type>>& out) {
+    std::vector<Shape> shapes;
+    for(const auto& input : input_tensors) {
+        shapes.push_back(input->shape());
+    }
+    Shape shape = outputShape(shapes);
+    auto& output = Tensor<Type>::reuse(out, shape[0], shape[1], shape[2], shape[3]);
+    compute(input_tensors, *output);
+    return output;
+}
+
+// the gradient of every input gets its part of output_grad added, inputs without a gradient buffer are skipped
+template <typename Type>
+std::shared_ptr<Tensor<Type>> MergeOperation<Type>::backward(const std::shared_ptr<Tensor<Type>>& output_grad) {
+    if(sources.empty()) {
+        throw std::runtime_error("MergeOperation has no recorded forward pass, run forward before backward.");
+    }
+    if(!output_grad || !output_grad->grad_ptr() || !output_grad->isContiguous()) {
+        throw std::invalid_argument("MergeOperation output_grad has no contiguous gradient.");
+    }
+    if(lanewise()) {
+        concatLanes(sources, *output_grad, true);
+        return sources.front();
+    }
+    const Type* dout = output_grad->grad_ptr();
+    int batch_size = output_grad->batch();
+    std::size_t out_sample = output_grad->sampleSize();
+    std::size_t offset = 0; // of the current input's channels inside an output sample
+    for(const auto& input : sources) {
+        std::size_t sample = input->sampleSize();
+        Type* din = input->grad_ptr();
+        if(din) {
+            ThreadPool::parallelFor(batch_size, ThreadPool::grainFor(sample), [&](int from, int to) {
+                for(int n = from; n < to; ++n) {
+                    const Type* src = dout + n * out_sample + offset; // for Add out_sample is sample and offset stays 0
+                    Type* dst = din + n * sample;
+                    #pragma omp simd
+                    for(std::size_t i = 0; i < sample; ++i) {
+                        dst[i] = static_cast<Type>(static_cast<Acc>(dst[i]) + static_cast<Acc>(src[i]));
+                    }
+                }
+            });
+        }
+        if(kind == MergeKind::Concat) {
+            offset += sample;
+        }
+    }
+    return sources.front();
+}
@@ -0,0 +1,31 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#ifndef INC_12_FINALPROJ_2_MERGEWEIGHTS_H
+#define INC_12_FINALPROJ_2_MERGEWEIGHTS_H
+
+#include "WeightStruct.h"
+#include "MergeOperation.h"
+
+template <typename Type>
+class MergeLayer;
+
+/**
+ * @brief Add or concat layer entry of a model file.
+ *        - config: kind (MergeKind)
+ *        - no tensors, the layers it reads are in the file's input table (see ModelFile)
+ */
+template <typename Type>
+struct MergeWeights : public WeightStruct<Type> {
+    MergeKind kind;
+
+    explicit MergeWeights(const MergeLayer<Type>& layer);
+    [[nodiscard]] WeightStructType getType() const override;
+    void describe(LayerRecord& record) const override;
+    static std::shared_ptr<MergeLayer<Type>> deserialize(const LayerRecord& record);
+};
+
+#include "MergeWeights.tpp"
+
+#endif //INC_12_FINALPROJ_2_MERGEWEIGHTS_H
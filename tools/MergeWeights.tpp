@@ -0,0 +1,27 @@
+//
+// Created by Vijay Goyal on 2025-01-30.
+//
+
+#include "MergeWeights.h"
+#include "../layers/MergeLayer.h"
+
+template <typename Type>
+MergeWeights<Type>::MergeWeights(const MergeLayer<Type>& layer) : kind(layer.kind) {}
+
+template <typename Type>
+WeightStructType MergeWeights<Type>::getType() const {
+    return WeightStructType::MergeWeights;
+}
+
+template <typename Type>
+void MergeWeights<Type>::describe(LayerRecord& record) const {
+    record.type = static_cast<std::uint32_t>(getType());
+    record.tensor_count = 0;
+    record.config[0] = static_cast<std::int32_t>(kind);
+}
+
+// MergeLayer rejects a kind it does not know
+template <typename Type>
+std::shared_ptr<MergeLayer<Type>> MergeWeights<Type>::deserialize(const LayerRecord& record) {
+    return std::make_shared<MergeLayer<Type>>(static_cast<MergeKind>(record.config[0]));
+}
@@ -0,0 +1,63 @@
+//
+// Created by Vijay Goyal on 2025-01-19.
+//
+
+#ifndef INC_12_FINALPROJ_2_MODELFILE_H
+#define INC_12_FINALPROJ_2_MODELFILE_H
+
+#include "WeightStruct.h"
+#include "ParameterBuffer.h"
+#include "../layers/Layer.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+/**
+ * @brief Binary model file, in native byte order.
+ *        - a 64-byte Header, one 64-byte LayerRecord per layer, the input table, then the weight image at a 64-byte
+ *          aligned offset
+ *        - the input table (version 2) lists the layers each layer reads as int32 values: per layer a count, then the
+ *          indices (-1 for the network input), a file without one is a chain where each layer reads the one before
+ *        - the weight image is the model's ParameterBuffer verbatim, so every tensor in it is 64-byte aligned
+ *        - load() maps the file copy-on-write and the layers' parameters become views into the mapping, a loaded
+ *          model parses and copies no weights, and training it never writes back to the file
+ */
+template <typename Type>
+class ModelFile {
+public:
+    static constexpr char MAGIC[8] = {'M', 'C', 'N', 'N', 'W', 'G', 'T', 'S'};
+    static constexpr std::uint32_t VERSION = 2; // 1 had no input table, it still loads
+    static constexpr std::uint32_t ENDIAN_MARK = 0x01020304; // reads back differently on a machine of the other endianness
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t element_size; // sizeof(Type) of the weights
+        std::uint32_t layer_count;
+        std::uint64_t records_offset; // bytes from the start of the file
+        std::uint64_t weights_offset; // bytes from the start of the file, 64-byte aligned
+        std::uint64_t weights_count;  // elements in the weight image
+        std::uint64_t inputs_offset;  // bytes from the start of the file, 0 for a chain
+        std::uint32_t inputs_count;   // int32 values in the input table
+        std::uint8_t reserved[4];
+    };
+    static_assert(sizeof(Header) == 64, "Header is part of the file format");
+
+    // layer_inputs holds the inputs of each layer, or nothing for a chain
+    static void save(const std::string& path, const std::vector<std::shared_ptr<Layer<Type>>>& layers, const ParameterBuffer<Type>& parameters,
+                     const std::vector<std::vector<int>>& layer_inputs = {});
+
+    // layers and their type names ("conv", "pool", "fc", "add", "concat") in file order, the inputs of each layer
+    // (each one's predecessor for a chain), parameters adopts the mapped weight image
+    static void load(const std::string& path, std::vector<std::shared_ptr<Layer<Type>>>& layers, std::vector<std::string>& layer_types,
+                     std::vector<std::vector<int>>& layer_inputs, ParameterBuffer<Type>& parameters);
+
+private:
+    static std::shared_ptr<Type> zeroPages(std::size_t count); // zeroed memory that costs nothing until it is written
+};
+
+#include "ModelFile.tpp"
+
+#endif //INC_12_FINALPROJ_2_MODELFILE_H
@@ -0,0 +1,190 @@
+//
+// Created by Vijay Goyal on 2025-01-19.
+//
+
+#include "ModelFile.h"
+#include "ConvolutionalWeights.h"
+#include "ConnectedWeights.h"
+#include "PoolingWeights.h"
+#include "MergeWeights.h"
+#include "../layers/MergeLayer.h"
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+template <typename Type>
+void ModelFile<Type>::save(const std::string& path, const std::vector<std::shared_ptr<Layer<Type>>>& layers, const ParameterBuffer<Type>& parameters,
+                           const std::vector<std::vector<int>>& layer_inputs) {
+    if(!layer_inputs.empty() && layer_inputs.size() != layers.size()) {
+        throw std::invalid_argument("ModelFile: layer_inputs must be empty or list the inputs of every layer.");
+    }
+    std::vector<LayerRecord> records(layers.size());
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        layers[i]->saveWeights()->describe(records[i]);
+        auto tensors = layers[i]->parameters();
+        if(tensors.size() != records[i].tensor_count || tensors.size() > std::size(records[i].offset)) {
+            throw std::runtime_error("ModelFile: a layer's parameters do not match its description.");
+        }
+        for(std::size_t t = 0; t < tensors.size(); ++t) {
+            records[i].offset[t] = parameters.offsetOf(*tensors[t]);
+        }
+    }
+    std::vector<std::int32_t> table;
+    for(const auto& inputs : layer_inputs) {
+        table.push_back(static_cast<std::int32_t>(inputs.size()));
+        table.insert(table.end(), inputs.begin(), inputs.end());
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = ENDIAN_MARK;
+    header.element_size = sizeof(Type);
+    header.layer_count = static_cast<std::uint32_t>(layers.size());
+    header.records_offset = sizeof(Header);
+    std::uint64_t records_end = header.records_offset + records.size() * sizeof(LayerRecord);
+    header.inputs_offset = table.empty() ? 0 : records_end;
+    header.inputs_count = static_cast<std::uint32_t>(table.size());
+    std::uint64_t table_end = records_end + table.size() * sizeof(std::int32_t);
+    header.weights_offset = (table_end + Tensor<Type>::ALIGNMENT - 1) / Tensor<Type>::ALIGNMENT * Tensor<Type>::ALIGNMENT;
+    header.weights_count = parameters.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file) {
+        throw std::runtime_error("ModelFile: cannot open " + path + " for writing.");
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(LayerRecord)));
+    file.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(std::int32_t)));
+    const char padding[Tensor<Type>::ALIGNMENT] = {};
+    file.write(padding, static_cast<std::streamsize>(header.weights_offset - table_end));
+    file.write(reinterpret_cast<const char*>(parameters.data()), static_cast<std::streamsize>(parameters.size() * sizeof(Type)));
+    if(!file) {
+        throw std::runtime_error("ModelFile: failed writing " + path + ".");
+    }
+}
+
+/*
+ * map the whole file copy-on-write and check the header before any record is trusted
+ *  - every record's tensors are bounds checked against the weight image by the WeightStruct that views them
+ *  - the input table is checked to list, for every layer, only the network input or earlier layers
+ */
+template <typename Type>
+void ModelFile<Type>::load(const std::string& path, std::vector<std::shared_ptr<Layer<Type>>>& layers, std::vector<std::string>& layer_types,
+                           std::vector<std::vector<int>>& layer_inputs, ParameterBuffer<Type>& parameters) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("ModelFile: cannot open " + path + ".");
+    }
+    struct stat info = {};
+    if(::fstat(fd, &info) != 0 || static_cast<std::uint64_t>(info.st_size) < sizeof(Header)) {
+        ::close(fd);
+        throw std::runtime_error("ModelFile: " + path + " is too small to be a model file.");
+    }
+    std::size_t file_size = static_cast<std::size_t>(info.st_size);
+    void* address = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if(address == MAP_FAILED) {
+        throw std::runtime_error("ModelFile: cannot map " + path + ".");
+    }
+    std::shared_ptr<char> mapping(static_cast<char*>(address), [file_size](char* p) { ::munmap(p, file_size); });
+
+    Header header;
+    std::memcpy(&header, mapping.get(), sizeof(header));
+    if(std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("ModelFile: " + path + " is not a model file.");
+    }
+    if(header.version != 1 && header.version != VERSION) {
+        throw std::runtime_error("ModelFile: " + path + " has format version " + std::to_string(header.version) +
+                                 ", expected " + std::to_string(VERSION) + ".");
+    }
+    if(header.byte_order != ENDIAN_MARK || header.element_size != sizeof(Type)) {
+        throw std::runtime_error("ModelFile: " + path + " was written with a different byte order or element type.");
+    }
+    if(header.records_offset > file_size || header.layer_count > (file_size - header.records_offset) / sizeof(LayerRecord)
+       || header.weights_offset % Tensor<Type>::ALIGNMENT != 0 || header.weights_offset > file_size
+       || header.weights_count > (file_size - header.weights_offset) / sizeof(Type)) {
+        throw std::runtime_error("ModelFile: " + path + " is truncated or corrupt.");
+    }
+    if(header.version == 1) {
+        header.inputs_offset = 0;
+        header.inputs_count = 0;
+    }
+    if(header.inputs_count > 0 && (header.inputs_offset > file_size || header.inputs_count > (file_size - header.inputs_offset) / sizeof(std::int32_t))) {
+        throw std::runtime_error("ModelFile: " + path + " is truncated or corrupt.");
+    }
+
+    std::size_t count = header.weights_count;
+    std::shared_ptr<Type> values(mapping, reinterpret_cast<Type*>(mapping.get() + header.weights_offset));
+    std::shared_ptr<Type> grads = zeroPages(count);
+
+    layers.clear();
+    layer_types.clear();
+    for(std::uint32_t i = 0; i < header.layer_count; ++i) {
+        LayerRecord record;
+        std::memcpy(&record, mapping.get() + header.records_offset + i * sizeof(LayerRecord), sizeof(record));
+        switch(static_cast<WeightStructType>(record.type)) {
+            case WeightStructType::ConvolutionalWeights:
+                layers.emplace_back(ConvolutionalWeights<Type>::deserialize(record, values, grads, count));
+                layer_types.emplace_back("conv");
+                break;
+            case WeightStructType::ConnectedWeights:
+                layers.emplace_back(ConnectedWeights<Type>::deserialize(record, values, grads, count));
+                layer_types.emplace_back("fc");
+                break;
+            case WeightStructType::PoolingWeights:
+                layers.emplace_back(PoolingWeights<Type>::deserialize(record));
+                layer_types.emplace_back("pool");
+                break;
+            case WeightStructType::MergeWeights: {
+                auto merge = MergeWeights<Type>::deserialize(record);
+                layer_types.emplace_back(merge->typeName());
+                layers.emplace_back(std::move(merge));
+                break;
+            }
+            default:
+                throw std::runtime_error("ModelFile: unknown layer type " + std::to_string(record.type) + " in " + path + ".");
+        }
+    }
+
+    layer_inputs.assign(header.layer_count, {});
+    std::vector<std::int32_t> table(header.inputs_count);
+    std::memcpy(table.data(), mapping.get() + header.inputs_offset, table.size() * sizeof(std::int32_t));
+    std::size_t at = 0;
+    for(std::uint32_t i = 0; i < header.layer_count; ++i) {
+        if(table.empty()) {
+            layer_inputs[i] = {static_cast<int>(i) - 1};
+            continue;
+        }
+        std::int32_t inputs = at < table.size() ? table[at++] : -1;
+        if(inputs < 1 || static_cast<std::size_t>(inputs) > table.size() - at) {
+            throw std::runtime_error("ModelFile: the input table of " + path + " is corrupt.");
+        }
+        for(std::int32_t k = 0; k < inputs; ++k) {
+            std::int32_t input = table[at++];
+            if(input < -1 || input >= static_cast<std::int32_t>(i)) {
+                throw std::runtime_error("ModelFile: layer " + std::to_string(i) + " of " + path + " reads a layer that is not before it.");
+            }
+            layer_inputs[i].push_back(input);
+        }
+    }
+    parameters.adopt(values, grads, count, layers);
+}
+
+template <typename Type>
+std::shared_ptr<Type> ModelFile<Type>::zeroPages(std::size_t count) {
+    if(count == 0) {
+        return nullptr;
+    }
+    std::size_t bytes = count * sizeof(Type);
+    void* address = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(address == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    return std::shared_ptr<Type>(static_cast<Type*>(address), [bytes](Type* p) { ::munmap(p, bytes); });
+}
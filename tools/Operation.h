@@ -12,6 +12,8 @@
 template <typename Type>
 class Operation {
 public:
+    typedef std::vector<std::shared_ptr<Tensor<Type>>> Inputs;
+
     std::shared_ptr<Tensor<Type>> inputs;
 
     virtual ~Operation() = default;
@@ -19,6 +21,50 @@ public:
     virtual std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& inputs) = 0;
 
     virtual std::shared_ptr<Tensor<Type>> backward(const std::shared_ptr<Tensor<Type>>& output_grad) = 0;
+
+    // forward pass that caches nothing for backward, writing into out when it can be reused
+    virtual std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) {
+        return forward(input);
+    }
+
+    // shapes of the tensors forward writes for this input shape, the first is the output and the rest are caches
+    // kept until backward, an op returning nothing allocates its own tensors
+    virtual std::vector<typename Tensor<Type>::Shape> plannedShapes(const typename Tensor<Type>::Shape& input_shape) const {
+        return {};
+    }
+
+    // the graph calls an operation through these, one tensor (or shape) per input edge, an operation of several inputs
+    // (see MergeOperation) overrides them, the others take their single input
+    virtual std::shared_ptr<Tensor<Type>> forwardInputs(const Inputs& input_tensors) { return forward(input_tensors.front()); }
+    virtual std::shared_ptr<Tensor<Type>> inferInputs(const Inputs& input_tensors, std::shared_ptr<Tensor<Type>>& out) {
+        return infer(input_tensors.front(), out);
+    }
+    virtual std::vector<typename Tensor<Type>::Shape> plannedShapesInputs(const std::vector<typename Tensor<Type>::Shape>& input_shapes) const {
+        return plannedShapes(input_shapes.front());
+    }
+    [[nodiscard]] virtual double flopsInputs(const std::vector<typename Tensor<Type>::Shape>& input_shapes, bool backward) const {
+        return flops(input_shapes.front(), backward);
+    }
+
+    // short label for profiles and traces
+    [[nodiscard]] virtual const char* name() const { return "op"; }
+
+    // floating point operations of forward (or backward) for this input shape, 0 when unknown, used by the profiler
+    [[nodiscard]] virtual double flops(const typename Tensor<Type>::Shape& input_shape, bool backward) const { return 0.0; }
+
+    // tensors placed by the graph's memory planner, in the order of plannedShapes, an empty list drops the plan
+    void setPlanned(std::vector<std::shared_ptr<Tensor<Type>>> tensors) { planned = std::move(tensors); }
+
+protected:
+    std::vector<std::shared_ptr<Tensor<Type>>> planned;
+
+    // planned tensor idx when it has this shape, otherwise a freshly allocated one
+    std::shared_ptr<Tensor<Type>> acquire(std::size_t idx, int batch_size, int channels, int height, int width, bool with_grad = true) const {
+        if(idx < planned.size() && planned[idx] && planned[idx]->shape() == typename Tensor<Type>::Shape{batch_size, channels, height, width}) {
+            return planned[idx];
+        }
+        return std::make_shared<Tensor<Type>>(batch_size, channels, height, width, static_cast<Type>(0.0), with_grad);
+    }
 };
 
 
@@ -0,0 +1,59 @@
+//
+// Created by Vijay Goyal on 2025-02-06.
+//
+
+#ifndef INC_12_FINALPROJ_2_OVERLAPPEDUPDATE_H
+#define INC_12_FINALPROJ_2_OVERLAPPEDUPDATE_H
+
+#include "AMSGrad.h"
+#include "ParameterBuffer.h"
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Worker thread taking an AMSGrad step one range of a ParameterBuffer at a time while the caller goes on, e.g. a
+ *        layer's parameters as soon as backward has finished their gradients (see ModularCNN::backwardAndStep).
+ *        - begin starts a step, post queues a range, finish returns once every posted range has been stepped and its
+ *          gradients zeroed, nothing may touch a posted range until then
+ *        - ranges are stepped in the order they are posted, at most max_ranges per step
+ *        - the worker runs its loops on its own thread without the ThreadPool, it shares the cores with the pass that posts
+ */
+template <typename Type>
+class OverlappedUpdate {
+private:
+    struct Range {
+        std::size_t offset;
+        std::size_t count;
+    };
+
+    std::vector<Range> queue; // ring of posted ranges, indexed by the running count of posts
+    std::size_t posted_this_step = 0;
+    AMSGrad<Type>* optimizer = nullptr;
+    ParameterBuffer<Type>* parameters = nullptr;
+
+    std::thread worker;
+    std::atomic<long long> posted{0};  // counted over every step
+    std::atomic<long long> updated{0};
+    std::atomic<bool> stopping{false};
+    std::exception_ptr error; // set by the worker, rethrown by finish
+
+    void run();
+
+public:
+    explicit OverlappedUpdate(std::size_t max_ranges);
+    ~OverlappedUpdate();
+
+    OverlappedUpdate(const OverlappedUpdate&) = delete;
+    OverlappedUpdate& operator=(const OverlappedUpdate&) = delete;
+
+    void begin(AMSGrad<Type>& step_optimizer, ParameterBuffer<Type>& step_parameters); // runs optimizer.beginStep
+    void post(std::size_t offset, std::size_t count); // from one thread at a time
+    void finish();
+};
+
+#include "OverlappedUpdate.tpp"
+
+#endif //INC_12_FINALPROJ_2_OVERLAPPEDUPDATE_H
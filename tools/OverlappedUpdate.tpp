@@ -0,0 +1,89 @@
+//
+// Created by Vijay Goyal on 2025-02-06.
+//
+
+#include "OverlappedUpdate.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "ThreadPool.h"
+
+template <typename Type>
+OverlappedUpdate<Type>::OverlappedUpdate(std::size_t max_ranges) : queue(std::max<std::size_t>(1, max_ranges)) {
+    worker = std::thread(&OverlappedUpdate<Type>::run, this);
+}
+
+template <typename Type>
+OverlappedUpdate<Type>::~OverlappedUpdate() {
+    stopping.store(true, std::memory_order_release);
+    posted.store(std::numeric_limits<long long>::max() / 2, std::memory_order_release);
+    posted.notify_all();
+    if(worker.joinable()) {
+        worker.join();
+    }
+}
+
+// worker: step the ranges in the order they are posted, one at a time
+template <typename Type>
+void OverlappedUpdate<Type>::run() {
+    ThreadPool::Limit single(1);
+    long long k = 0;
+    while(true) {
+        long long ready = posted.load(std::memory_order_acquire);
+        while(ready <= k) {
+            posted.wait(ready, std::memory_order_acquire);
+            ready = posted.load(std::memory_order_acquire);
+        }
+        if(stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        for(; k < ready; ++k) {
+            const Range& range = queue[k % static_cast<long long>(queue.size())];
+            try {
+                optimizer->updateRange(parameters->data() + range.offset, parameters->grad() + range.offset, range.offset, range.count);
+            }
+            catch(...) {
+                error = std::current_exception();
+            }
+            updated.store(k + 1, std::memory_order_release);
+            updated.notify_all();
+        }
+    }
+}
+
+template <typename Type>
+void OverlappedUpdate<Type>::begin(AMSGrad<Type>& step_optimizer, ParameterBuffer<Type>& step_parameters) {
+    finish();
+    step_optimizer.beginStep(step_parameters.size());
+    optimizer = &step_optimizer;
+    parameters = &step_parameters;
+    posted_this_step = 0;
+}
+
+template <typename Type>
+void OverlappedUpdate<Type>::post(std::size_t offset, std::size_t count) {
+    if(posted_this_step == queue.size()) {
+        throw std::length_error("OverlappedUpdate: more than " + std::to_string(queue.size()) + " ranges in one step.");
+    }
+    ++posted_this_step;
+    long long k = posted.load(std::memory_order_relaxed);
+    queue[k % static_cast<long long>(queue.size())] = {offset, count};
+    posted.store(k + 1, std::memory_order_release);
+    posted.notify_one();
+}
+
+template <typename Type>
+void OverlappedUpdate<Type>::finish() {
+    long long target = posted.load(std::memory_order_relaxed);
+    long long done = updated.load(std::memory_order_acquire);
+    while(done < target) {
+        updated.wait(done, std::memory_order_acquire);
+        done = updated.load(std::memory_order_acquire);
+    }
+    if(error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
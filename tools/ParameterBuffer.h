@@ -0,0 +1,57 @@
+//
+// Created by Vijay Goyal on 2025-01-18.
+//
+
+#ifndef INC_12_FINALPROJ_2_PARAMETERBUFFER_H
+#define INC_12_FINALPROJ_2_PARAMETERBUFFER_H
+
+#include "Tensor.h"
+#include "../layers/Layer.h"
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+/**
+ * @brief Every trainable parameter of a model in one contiguous, aligned buffer, with the gradients in a second one.
+ *        - pack() rebinds each layer's parameter tensors as views into the buffers, in layer order, so an optimizer
+ *          can sweep the whole model in a single pass
+ *        - the layers keep working on their own tensors, they just no longer own the memory
+ *        - every tensor starts on a Tensor::ALIGNMENT boundary, the padding in between stays zero, so the values
+ *          buffer is also the weight image of a model file (see ModelFile)
+ *        - the views share one write counter (see Tensor::trackWrites), the non-const data() stamps it too, so a layer
+ *          that caches a transform of its parameters sees writes made through the buffer
+ */
+template <typename Type>
+class ParameterBuffer {
+private:
+    std::shared_ptr<Type> values;
+    std::shared_ptr<Type> grads;
+    std::size_t count = 0; // elements
+    typename Tensor<Type>::WriteCounter writes = Tensor<Type>::writeCounter();
+
+public:
+    static std::size_t alignedSize(std::size_t count); // count rounded up to a whole number of aligned lines
+
+    void pack(const std::vector<std::shared_ptr<Layer<Type>>>& layers); // current values and gradients are carried over
+
+    // take over buffers the layers' parameters are already views into (e.g. a mapped model file), nothing is copied
+    void adopt(std::shared_ptr<Type> values, std::shared_ptr<Type> grads, std::size_t count,
+               const std::vector<std::shared_ptr<Layer<Type>>>& layers);
+
+    std::size_t offsetOf(const Tensor<Type>& tensor) const; // element offset of a parameter tensor in the buffer
+
+    Type* data() { touch(); return values.get(); }
+    const Type* data() const { return values.get(); }
+    Type* grad() { return grads.get(); }
+    const Type* grad() const { return grads.get(); }
+    [[nodiscard]] std::size_t size() const { return count; }
+
+    // marks the values as written, for writes through a pointer taken from data() before the last forward
+    void touch() { Tensor<Type>::stamp(*writes); }
+
+    void zeroGrad(); // one fill over every gradient of the model
+};
+
+#include "ParameterBuffer.tpp"
+
+#endif //INC_12_FINALPROJ_2_PARAMETERBUFFER_H
@@ -0,0 +1,85 @@
+//
+// Created by Vijay Goyal on 2025-01-18.
+//
+
+#include "ParameterBuffer.h"
+#include <algorithm>
+#include <stdexcept>
+
+template <typename Type>
+std::size_t ParameterBuffer<Type>::alignedSize(std::size_t count) {
+    constexpr std::size_t per_line = std::max<std::size_t>(1, Tensor<Type>::ALIGNMENT / sizeof(Type));
+    return (count + per_line - 1) / per_line * per_line;
+}
+
+template <typename Type>
+void ParameterBuffer<Type>::pack(const std::vector<std::shared_ptr<Layer<Type>>>& layers) {
+    std::vector<std::vector<std::shared_ptr<Tensor<Type>>>> owned;
+    count = 0;
+    for(const auto& layer : layers) {
+        owned.push_back(layer->parameters());
+        for(const auto& tensor : owned.back()) {
+            if(!tensor->isContiguous() || !tensor->hasGrad()) {
+                throw std::invalid_argument("ParameterBuffer: parameters must be contiguous and have a gradient buffer.");
+            }
+            count += alignedSize(tensor->size());
+        }
+    }
+
+    // the old buffers stay alive until every layer has been moved off them
+    auto new_values = Tensor<Type>::allocate(count, static_cast<Type>(0.0));
+    auto new_grads = Tensor<Type>::allocate(count, static_cast<Type>(0.0));
+    std::size_t offset = 0;
+    for(std::size_t i = 0; i < layers.size(); ++i) {
+        std::vector<std::shared_ptr<Tensor<Type>>> views;
+        for(const auto& tensor : owned[i]) {
+            const auto& shape = tensor->shape();
+            auto view = Tensor<Type>::wrap(std::shared_ptr<Type>(new_values, new_values.get() + offset),
+                                           std::shared_ptr<Type>(new_grads, new_grads.get() + offset),
+                                           shape[0], shape[1], shape[2], shape[3]);
+            view->trackWrites(writes);
+            const Tensor<Type>& source = *tensor;
+            std::copy(source.data_ptr(), source.data_ptr() + source.size(), view->data_ptr());
+            std::copy(source.grad_ptr(), source.grad_ptr() + source.size(), view->grad_ptr());
+            views.push_back(view);
+            offset += alignedSize(tensor->size());
+        }
+        if(!views.empty()) {
+            layers[i]->setParameters(views);
+        }
+    }
+    values = std::move(new_values);
+    grads = std::move(new_grads);
+}
+
+template <typename Type>
+void ParameterBuffer<Type>::adopt(std::shared_ptr<Type> new_values, std::shared_ptr<Type> new_grads, std::size_t new_count,
+                                  const std::vector<std::shared_ptr<Layer<Type>>>& layers) {
+    values = std::move(new_values);
+    grads = std::move(new_grads);
+    count = new_count;
+    for(const auto& layer : layers) {
+        auto tensors = layer->parameters();
+        for(const auto& tensor : tensors) {
+            tensor->trackWrites(writes);
+        }
+        if(!tensors.empty()) {
+            layer->setParameters(tensors); // drops anything the layer derived from its parameters
+        }
+    }
+}
+
+template <typename Type>
+std::size_t ParameterBuffer<Type>::offsetOf(const Tensor<Type>& tensor) const {
+    const Type* begin = values.get();
+    const Type* p = tensor.data_ptr();
+    if(!begin || p < begin || p + tensor.size() > begin + count) {
+        throw std::invalid_argument("ParameterBuffer: tensor is not part of this buffer.");
+    }
+    return static_cast<std::size_t>(p - begin);
+}
+
+template <typename Type>
+void ParameterBuffer<Type>::zeroGrad() {
+    std::fill(grads.get(), grads.get() + count, static_cast<Type>(0.0));
+}
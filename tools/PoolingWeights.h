@@ -10,6 +10,11 @@
 template <typename Type>
 class MaxPoolingLayer;
 
+/**
+ * @brief Max pooling layer entry of a model file.
+ *        - config: pool_height, pool_width, stride, padding
+ *        - no tensors
+ */
 template <typename Type>
 struct PoolingWeights : public WeightStruct<Type> {
     int pool_height;
@@ -19,8 +24,8 @@ struct PoolingWeights : public WeightStruct<Type> {
 
     explicit PoolingWeights(const MaxPoolingLayer<Type>& layer);
     [[nodiscard]] WeightStructType getType() const override;
-    void serialize(std::ofstream& out) const override;
-    static std::shared_ptr<MaxPoolingLayer<Type>> deserialize(std::ifstream& in);
+    void describe(LayerRecord& record) const override;
+    static std::shared_ptr<MaxPoolingLayer<Type>> deserialize(const LayerRecord& record);
 
 };
 
@@ -18,26 +18,16 @@ WeightStructType PoolingWeights<Type>::getType() const {
 }
 
 template<typename Type>
-void PoolingWeights<Type>::serialize(std::ofstream &out) const {
-      out.write(reinterpret_cast<const char*>(&pool_height), sizeof(pool_height));
-      out.write(reinterpret_cast<const char*>(&pool_width), sizeof(pool_width));
-      out.write(reinterpret_cast<const char*>(&stride), sizeof(stride));
-      out.write(reinterpret_cast<const char*>(&padding), sizeof(padding));
+void PoolingWeights<Type>::describe(LayerRecord& record) const {
+      record.type = static_cast<std::uint32_t>(getType());
+      record.tensor_count = 0;
+      record.config[0] = pool_height;
+      record.config[1] = pool_width;
+      record.config[2] = stride;
+      record.config[3] = padding;
 }
 
 template<typename Type>
-std::shared_ptr<MaxPoolingLayer<Type>> PoolingWeights<Type>::deserialize(std::ifstream &in) {
-      int pool_height_t;
-      int pool_width_t;
-      int stride_t;
-      int padding_t;
-
-      in.read(reinterpret_cast<char*>(&pool_height_t), sizeof(pool_height_t));
-      in.read(reinterpret_cast<char*>(&pool_width_t), sizeof(pool_width_t));
-      in.read(reinterpret_cast<char*>(&stride_t), sizeof(stride_t));
-      in.read(reinterpret_cast<char*>(&padding_t), sizeof(padding_t));
-
-
-      auto temp = std::make_shared<MaxPoolingLayer<Type>>(pool_height_t, pool_width_t, stride_t, padding_t);
-      return temp;
-}
\ No newline at end of file
+std::shared_ptr<MaxPoolingLayer<Type>> PoolingWeights<Type>::deserialize(const LayerRecord& record) {
+      return std::make_shared<MaxPoolingLayer<Type>>(record.config[0], record.config[1], record.config[2], record.config[3]);
+}
@@ -0,0 +1,85 @@
+//
+// Created by Vijay Goyal on 2025-01-21.
+//
+
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include "ThreadPool.h"
+
+void Profiler::end(const Mark& mark, std::string name, const char* phase, int index, double flops, std::size_t bytes_allocated) {
+    Clock::time_point now = Clock::now();
+    double wall = std::chrono::duration<double>(now - mark.wall).count();
+    double cpu = static_cast<double>(std::clock() - mark.cpu) / CLOCKS_PER_SEC;
+    double utilisation = wall > 0.0 ? cpu / (wall * ThreadPool::width()) : 0.0;
+
+    records.push_back({std::move(name), phase, index,
+                       std::chrono::duration<double, std::micro>(mark.wall - origin).count(), wall * 1e6,
+                       flops, bytes_allocated - mark.bytes, std::min(utilisation, 1.0)});
+}
+
+void Profiler::clear() {
+    records.clear();
+    origin = Clock::now();
+}
+
+std::string Profiler::summary() const {
+    struct Total {
+        int calls = 0;
+        double us = 0.0;
+        double flops = 0.0;
+        std::size_t bytes = 0;
+        double busy_us = 0.0; // utilisation weighted by time
+    };
+    std::map<std::pair<int, std::string>, std::pair<std::string, Total>> totals;
+    for(const auto& r : records) {
+        auto& [name, total] = totals[{r.index, r.phase}];
+        name = r.name;
+        ++total.calls;
+        total.us += r.duration_us;
+        total.flops += r.flops;
+        total.bytes += r.bytes;
+        total.busy_us += r.utilisation * r.duration_us;
+    }
+
+    std::vector<std::pair<std::pair<int, std::string>, std::pair<std::string, Total>>> rows(totals.begin(), totals.end());
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.second.second.us > b.second.second.us; });
+
+    std::string out;
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-4s %-12s %-9s %7s %12s %12s %9s %14s %6s\n",
+                  "op", "name", "phase", "calls", "total ms", "mean ms", "GFLOP/s", "bytes", "util");
+    out += line;
+    for(const auto& [key, value] : rows) {
+        const auto& [name, total] = value;
+        std::snprintf(line, sizeof(line), "%-4d %-12s %-9s %7d %12.3f %12.3f %9.2f %14zu %5.0f%%\n",
+                      key.first, name.c_str(), key.second.c_str(), total.calls, total.us * 1e-3, total.us * 1e-3 / total.calls,
+                      total.us > 0.0 ? total.flops / total.us * 1e-3 : 0.0, total.bytes,
+                      total.us > 0.0 ? 100.0 * total.busy_us / total.us : 0.0);
+        out += line;
+    }
+    return out;
+}
+
+/*
+ * Chrome trace-event format, every record is a complete ("X") event on one track per phase
+ */
+void Profiler::writeChromeTrace(const std::string& path) const {
+    std::ofstream out(path);
+    if(!out) {
+        throw std::runtime_error("Cannot open " + path + " for writing.");
+    }
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for(std::size_t i = 0; i < records.size(); ++i) {
+        const auto& r = records[i];
+        int track = r.phase == "forward" ? 0 : r.phase == "backward" ? 1 : r.phase == "infer" ? 2 : 3;
+        out << (i ? ",\n" : "\n") << "{\"name\": \"" << r.name << "#" << r.index << "\", \"cat\": \"" << r.phase
+            << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << track << ", \"ts\": " << r.start_us << ", \"dur\": " << r.duration_us
+            << ", \"args\": {\"flops\": " << r.flops << ", \"bytes\": " << r.bytes << ", \"utilisation\": " << r.utilisation << "}}";
+    }
+    out << "\n]}\n";
+}
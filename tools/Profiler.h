@@ -0,0 +1,64 @@
+//
+// Created by Vijay Goyal on 2025-01-21.
+//
+
+#ifndef INC_12_FINALPROJ_2_PROFILER_H
+#define INC_12_FINALPROJ_2_PROFILER_H
+
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <vector>
+
+// one timed call of an operation (or of the optimizer)
+struct ProfileRecord {
+    std::string name;   // e.g. "conv", "pool", "fc", "conv+pool"
+    std::string phase;  // "forward", "backward", "recompute", "infer" or "update"
+    int index;          // position of the operation in the graph, -1 for work outside it
+    double start_us;    // since the profiler was created or last cleared
+    double duration_us;
+    double flops;       // 0 when the operation does not report them
+    std::size_t bytes;  // tensor bytes allocated during the call
+    double utilisation; // process CPU time over wall time times the ThreadPool width, 1 means every thread was busy
+};
+
+/**
+ * @brief Per-operation profiler, filled in by ComputationGraph and ModularCNN when enabled.
+ *        - off by default, a disabled profiler costs one branch per operation
+ *        - records can be summarised per (name, phase) or exported as Chrome trace events
+ *          (open the JSON in chrome://tracing or ui.perfetto.dev)
+ */
+class Profiler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // state captured when a call starts
+    struct Mark {
+        Clock::time_point wall;
+        std::clock_t cpu;
+        std::size_t bytes;
+    };
+
+private:
+    bool enabled = false;
+    Clock::time_point origin = Clock::now();
+    std::vector<ProfileRecord> records;
+
+public:
+    void setEnabled(bool on) { enabled = on; }
+    [[nodiscard]] bool isEnabled() const { return enabled; }
+
+    [[nodiscard]] Mark begin(std::size_t bytes_allocated) const { return {Clock::now(), std::clock(), bytes_allocated}; }
+    void end(const Mark& mark, std::string name, const char* phase, int index, double flops, std::size_t bytes_allocated);
+
+    [[nodiscard]] const std::vector<ProfileRecord>& getRecords() const { return records; }
+    void clear();
+
+    // table of calls, total and mean time, GFLOP/s, bytes and utilisation per (name, phase), slowest first
+    [[nodiscard]] std::string summary() const;
+
+    void writeChromeTrace(const std::string& path) const;
+};
+
+#endif //INC_12_FINALPROJ_2_PROFILER_H
@@ -0,0 +1,263 @@
+//
+// Created by Vijay Goyal on 2025-01-25.
+//
+
+#include "QuantizedGemm.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "ThreadPool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+namespace {
+    // 4 consecutive weights of a row as one 32-bit lane
+    inline std::int32_t weightQuad(const std::int8_t* A) {
+        std::int32_t quad;
+        std::memcpy(&quad, A, sizeof(quad));
+        return quad;
+    }
+
+    /*
+     * AVX2 micro-kernel, 4x16 tile of C in 8 ymm registers
+     *  - vpmaddubsw multiplies u8 activations by s8 weights and adds neighbouring pairs into int16
+     *  - vpmaddwd by ones adds those pairs into the int32 sum of the quad
+     */
+    __attribute__((target("avx2")))
+    void quantizedKernelAvx2(int quads, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb, std::int32_t* C, int ldc) {
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i acc[4][2];
+        #pragma GCC unroll 4
+        for(int i = 0; i < 4; ++i) {
+            acc[i][0] = _mm256_setzero_si256();
+            acc[i][1] = _mm256_setzero_si256();
+        }
+
+        for(int q = 0; q < quads; ++q) {
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(B));
+            __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(B + 32));
+            #pragma GCC unroll 4
+            for(int i = 0; i < 4; ++i) {
+                __m256i a = _mm256_set1_epi32(weightQuad(A + static_cast<std::ptrdiff_t>(i) * lda + 4 * q));
+                acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(_mm256_maddubs_epi16(b0, a), ones));
+                acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(_mm256_maddubs_epi16(b1, a), ones));
+            }
+            B += ldb;
+        }
+
+        #pragma GCC unroll 4
+        for(int i = 0; i < 4; ++i) {
+            std::int32_t* row = C + static_cast<std::ptrdiff_t>(i) * ldc;
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(row), acc[i][0]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + 8), acc[i][1]);
+        }
+    }
+
+    /*
+     * AVX-512 VNNI micro-kernel, same tile, vpdpbusd does the multiply and both additions in one instruction without saturating
+     */
+    __attribute__((target("avx2,avx512vnni,avx512vl")))
+    void quantizedKernelAvx512Vnni(int quads, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb, std::int32_t* C, int ldc) {
+        __m256i acc[4][2];
+        #pragma GCC unroll 4
+        for(int i = 0; i < 4; ++i) {
+            acc[i][0] = _mm256_setzero_si256();
+            acc[i][1] = _mm256_setzero_si256();
+        }
+
+        for(int q = 0; q < quads; ++q) {
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(B));
+            __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(B + 32));
+            #pragma GCC unroll 4
+            for(int i = 0; i < 4; ++i) {
+                __m256i a = _mm256_set1_epi32(weightQuad(A + static_cast<std::ptrdiff_t>(i) * lda + 4 * q));
+                acc[i][0] = _mm256_dpbusd_epi32(acc[i][0], b0, a);
+                acc[i][1] = _mm256_dpbusd_epi32(acc[i][1], b1, a);
+            }
+            B += ldb;
+        }
+
+        #pragma GCC unroll 4
+        for(int i = 0; i < 4; ++i) {
+            std::int32_t* row = C + static_cast<std::ptrdiff_t>(i) * ldc;
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(row), acc[i][0]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + 8), acc[i][1]);
+        }
+    }
+
+    /*
+     * AVX-VNNI micro-kernel, the VEX encoded vpdpbusd of CPUs without AVX-512
+     */
+    __attribute__((target("avx2,avxvnni")))
+    void quantizedKernelAvxVnni(int quads, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb, std::int32_t* C, int ldc) {
+        __m256i acc[4][2];
+        #pragma GCC unroll 4
+        for(int i = 0; i < 4; ++i) {
+            acc[i][0] = _mm256_setzero_si256();
+            acc[i][1] = _mm256_setzero_si256();
+        }
+
+        for(int q = 0; q < quads; ++q) {
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(B));
+            __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(B + 32));
+            #pragma GCC unroll 4
+            for(int i = 0; i < 4; ++i) {
+                __m256i a = _mm256_set1_epi32(weightQuad(A + static_cast<std::ptrdiff_t>(i) * lda + 4 * q));
+                acc[i][0] = _mm256_dpbusd_avx_epi32(acc[i][0], b0, a);
+                acc[i][1] = _mm256_dpbusd_avx_epi32(acc[i][1], b1, a);
+            }
+            B += ldb;
+        }
+
+        #pragma GCC unroll 4
+        for(int i = 0; i < 4; ++i) {
+            std::int32_t* row = C + static_cast<std::ptrdiff_t>(i) * ldc;
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(row), acc[i][0]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + 8), acc[i][1]);
+        }
+    }
+}
+#endif
+
+/*
+ * portable 4x16 micro-kernel, the inner loop is left for the compiler to vectorise
+ */
+void QuantizedGemm::genericKernel(int quads, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb, std::int32_t* C, int ldc) {
+    std::int32_t acc[MR][NR] = {};
+
+    for(int q = 0; q < quads; ++q) {
+        for(int i = 0; i < MR; ++i) {
+            const std::int8_t* a = A + static_cast<std::ptrdiff_t>(i) * lda + 4 * q;
+            #pragma omp simd
+            for(int j = 0; j < NR; ++j) {
+                const std::uint8_t* b = B + 4 * j;
+                acc[i][j] += b[0] * a[0] + b[1] * a[1] + b[2] * a[2] + b[3] * a[3];
+            }
+        }
+        B += ldb;
+    }
+
+    for(int i = 0; i < MR; ++i) {
+        std::copy(acc[i], acc[i] + NR, C + static_cast<std::ptrdiff_t>(i) * ldc);
+    }
+}
+
+const QuantizedGemm::Kernel& QuantizedGemm::kernel() {
+    static const Kernel selected = []() -> Kernel {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl")) {
+            return {&quantizedKernelAvx512Vnni, "avx512vnni"};
+        }
+        if(__builtin_cpu_supports("avxvnni")) {
+            return {&quantizedKernelAvxVnni, "avxvnni"};
+        }
+        if(__builtin_cpu_supports("avx2")) {
+            return {&quantizedKernelAvx2, "avx2"};
+        }
+#endif
+        return {&QuantizedGemm::genericKernel, "generic"};
+    }();
+    return selected;
+}
+
+/*
+ * every MR x NR tile of C is one micro-kernel call over the whole depth
+ *  - columns are the outer loop so a tile's B panel stays in L1 while the row blocks of A pass over it
+ */
+void QuantizedGemm::multiply(int M, int N, int K, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb,
+                             std::int32_t* C, int ldc) {
+    if(M <= 0 || N <= 0) {
+        return;
+    }
+    const Kernel& k = kernel();
+    int quads = K / 4;
+    int row_blocks = M / MR;
+    int col_blocks = N / NR;
+
+    // small products stay on one thread
+    int tiles = col_blocks * row_blocks;
+    double work = static_cast<double>(M) * N * K;
+    ThreadPool::parallelFor(tiles, work >= 1.0e6 ? 1 : tiles, [&](int first, int last) {
+        for(int t = first; t < last; ++t) {
+            int jb = t / row_blocks;
+            int ib = t % row_blocks;
+            k.run(quads, A + static_cast<std::ptrdiff_t>(ib) * MR * lda, lda, B + static_cast<std::ptrdiff_t>(jb) * NR * 4, ldb,
+                  C + static_cast<std::ptrdiff_t>(ib) * MR * ldc + jb * NR, ldc);
+        }
+    });
+}
+
+/*
+ * depth row k = (c * filter_height + kh) * filter_width + kw holds input[c][oh * stride + kh - padding][ow * stride + kw - padding]
+ * at column oh * out_width + ow, the same order as Im2Col and the filters
+ *  - the sample is padded with fill once, then every quad of an output row is one 32-bit word built from 4 input rows,
+ *    depth k % 4 in byte k % 4 of it, which is its place in memory on a little-endian CPU
+ */
+void QuantizedGemm::packColumns(const std::uint8_t* input, int channels, int height, int width,
+                                int filter_height, int filter_width, int stride, int padding, std::uint8_t fill,
+                                int out_height, int out_width, std::uint8_t* B) {
+    int K = channels * filter_height * filter_width;
+    int spatial = out_height * out_width;
+    int columns = padColumns(spatial);
+    int padded_height = height + 2 * padding;
+    int padded_width = width + 2 * padding;
+
+    // per-thread scratch, nothing here runs on the pool
+    thread_local std::vector<std::uint8_t> padded;
+    thread_local std::vector<std::uint8_t> zeros;
+    const std::uint8_t* source = input;
+    if(padding > 0) {
+        padded.assign(static_cast<std::size_t>(channels) * padded_height * padded_width, fill);
+        for(int c = 0; c < channels; ++c) {
+            for(int h = 0; h < height; ++h) {
+                const std::uint8_t* row = input + (static_cast<std::ptrdiff_t>(c) * height + h) * width;
+                std::copy(row, row + width, padded.data() + (static_cast<std::ptrdiff_t>(c) * padded_height + h + padding) * padded_width + padding);
+            }
+        }
+        source = padded.data();
+    }
+    zeros.assign(static_cast<std::size_t>(out_width) * stride, 0); // read by the depth rows past K
+
+    for(int q = 0; q < padDepth(K) / 4; ++q) {
+        std::uint32_t* dst = reinterpret_cast<std::uint32_t*>(B + static_cast<std::ptrdiff_t>(q) * columns * 4);
+        for(int oh = 0; oh < out_height; ++oh) {
+            const std::uint8_t* rows[4];
+            for(int r = 0; r < 4; ++r) {
+                int k = 4 * q + r;
+                if(k >= K) {
+                    rows[r] = zeros.data();
+                    continue;
+                }
+                int kw = k % filter_width;
+                int kh = (k / filter_width) % filter_height;
+                int c = k / (filter_width * filter_height);
+                rows[r] = source + (static_cast<std::ptrdiff_t>(c) * padded_height + oh * stride + kh) * padded_width + kw;
+            }
+            std::uint32_t* out = dst + static_cast<std::ptrdiff_t>(oh) * out_width;
+            #pragma omp simd
+            for(int ow = 0; ow < out_width; ++ow) {
+                int iw = ow * stride;
+                out[ow] = static_cast<std::uint32_t>(rows[0][iw]) | static_cast<std::uint32_t>(rows[1][iw]) << 8
+                          | static_cast<std::uint32_t>(rows[2][iw]) << 16 | static_cast<std::uint32_t>(rows[3][iw]) << 24;
+            }
+        }
+        std::fill(dst + spatial, dst + columns, 0u);
+    }
+}
+
+void QuantizedGemm::packRows(const std::uint8_t* X, int N, int K, std::uint8_t* B) {
+    int depth = padDepth(K);
+    int columns = padColumns(N);
+    std::ptrdiff_t ldb = static_cast<std::ptrdiff_t>(columns) * 4;
+    for(int q = 0; q < depth / 4; ++q) {
+        std::uint8_t* dst = B + q * ldb;
+        for(int n = 0; n < columns; ++n) {
+            for(int r = 0; r < 4; ++r) {
+                int k = 4 * q + r;
+                dst[n * 4 + r] = (n < N && k < K) ? X[static_cast<std::ptrdiff_t>(n) * K + k] : 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,61 @@
+//
+// Created by Vijay Goyal on 2025-01-25.
+//
+
+#ifndef INC_12_FINALPROJ_2_QUANTIZEDGEMM_H
+#define INC_12_FINALPROJ_2_QUANTIZEDGEMM_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Integer matrix multiply C[M][N] = A[M][K] * B[K][N] with int8 A (weights), uint8 B (activations) and int32 C.
+ *        - B is packed in quads: element (k, n) sits at B[(k / 4) * ldb + n * 4 + k % 4], so the 4 depths of a column
+ *          are one 32-bit lane and a row of A broadcasts 4 weights against 8 or 16 columns at once
+ *        - M is a multiple of MR, N and ldb / 4 of NR and K of 4, callers zero pad their weights and packed columns
+ *        - on x86 an AVX-512 VNNI, AVX-VNNI (vpdpbusd) or AVX2 (vpmaddubsw + vpmaddwd) micro-kernel is picked at runtime,
+ *          otherwise a portable kernel that the compiler vectorises
+ *        - vpmaddubsw adds two u8 * s8 products in a saturating int16, activations are therefore kept below 128 and
+ *          weights within [-127, 127] so every kernel computes the same exact result
+ *        - outside a ThreadPool loop the MR x NR tiles are split across the pool
+ */
+class QuantizedGemm {
+public:
+    static constexpr int MR = 4;  // rows of A per micro-kernel tile
+    static constexpr int NR = 16; // columns of B per micro-kernel tile
+
+    static constexpr int ACTIVATION_MAX = 127; // largest activation the int16 pair sums of vpmaddubsw take without saturating
+    static constexpr int WEIGHT_MAX = 127;
+
+    // signature of a micro-kernel: C[MR][NR] = A[MR][4 * quads] * B[quads][NR][4]
+    typedef void (*MicroKernel)(int quads, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb, std::int32_t* C, int ldc);
+
+    struct Kernel {
+        MicroKernel run;
+        const char* name;
+    };
+
+    static void multiply(int M, int N, int K, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb,
+                         std::int32_t* C, int ldc);
+
+    static const Kernel& kernel(); // micro-kernel picked for this CPU
+    static const char* kernelName() { return kernel().name; }
+
+    [[nodiscard]] static int padDepth(int K) { return (K + 3) / 4 * 4; }
+    [[nodiscard]] static int padRows(int M) { return (M + MR - 1) / MR * MR; }
+    [[nodiscard]] static int padColumns(int N) { return (N + NR - 1) / NR * NR; }
+
+    // im2col of one (channels, height, width) sample straight into packed B, padding reads as fill (the input's zero
+    // point), the columns past out_height * out_width and depth rows past channels * filter_height * filter_width as 0
+    static void packColumns(const std::uint8_t* input, int channels, int height, int width,
+                            int filter_height, int filter_width, int stride, int padding, std::uint8_t fill,
+                            int out_height, int out_width, std::uint8_t* B);
+
+    // the rows of a row-major X[N][K] as the columns of packed B, i.e. B = X^T
+    static void packRows(const std::uint8_t* X, int N, int K, std::uint8_t* B);
+
+private:
+    static void genericKernel(int quads, const std::int8_t* A, int lda, const std::uint8_t* B, int ldb, std::int32_t* C, int ldc);
+};
+
+#endif //INC_12_FINALPROJ_2_QUANTIZEDGEMM_H
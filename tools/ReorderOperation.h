@@ -0,0 +1,46 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#ifndef INC_12_FINALPROJ_2_REORDEROPERATION_H
+#define INC_12_FINALPROJ_2_REORDEROPERATION_H
+
+#include "Operation.h"
+#include "Layout.h"
+#include "Tensor.h"
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Layout conversion at the edge of a channel-blocked graph, NCHW into blocks at the input and back at the
+ *        output, see ChannelBlocking.
+ *        - backward adds the output gradient, converted back, into the input's gradient
+ *        - converting back needs the channel count, the blocked shape only says how many blocks there are
+ */
+template <typename Type>
+class ReorderOperation : public Operation<Type> {
+private:
+    typedef typename Tensor<Type>::Shape Shape;
+
+    Layout layout;
+    bool to_blocked;
+    int channels; // of the plain side, read from the input when converting into blocks
+
+    [[nodiscard]] Shape outputShape(const Shape& input_shape) const;
+    void convert(const Tensor<Type>& input, Tensor<Type>& output) const;
+
+public:
+    // into layout (or back from it, for a tensor of the given channels)
+    ReorderOperation(Layout layout, bool to_blocked, int channels = 0);
+
+    std::shared_ptr<Tensor<Type>> forward(const std::shared_ptr<Tensor<Type>>& input) override;
+    std::shared_ptr<Tensor<Type>> backward(const std::shared_ptr<Tensor<Type>>& output_grad) override;
+    std::shared_ptr<Tensor<Type>> infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) override;
+    std::vector<Shape> plannedShapes(const Shape& input_shape) const override { return {outputShape(input_shape)}; } // output
+
+    [[nodiscard]] const char* name() const override { return "reorder"; }
+};
+
+#include "ReorderOperation.tpp"
+
+#endif //INC_12_FINALPROJ_2_REORDEROPERATION_H
@@ -0,0 +1,78 @@
+//
+// Created by Vijay Goyal on 2025-02-03.
+//
+
+#include "ReorderOperation.h"
+#include <stdexcept>
+
+template <typename Type>
+ReorderOperation<Type>::ReorderOperation(Layout layout, bool to_blocked, int channels)
+        : layout(layout), to_blocked(to_blocked), channels(channels) {
+    if(layout == Layout::NCHW) {
+        throw std::invalid_argument("ReorderOperation: NCHW needs no reorder.");
+    }
+    if(!to_blocked && channels <= 0) {
+        throw std::invalid_argument("ReorderOperation: converting out of blocks needs the channel count.");
+    }
+}
+
+template <typename Type>
+typename ReorderOperation<Type>::Shape ReorderOperation<Type>::outputShape(const Shape& input_shape) const {
+    int block = channelBlock(layout);
+    if(to_blocked) {
+        return ChannelBlocking<Type>::blocked(input_shape, block);
+    }
+    if(input_shape[3] % block != 0 || input_shape[1] != (channels + block - 1) / block) {
+        throw std::invalid_argument("ReorderOperation: the input is not a " + layoutName(layout) + " tensor of " +
+                                    std::to_string(channels) + " channels.");
+    }
+    return ChannelBlocking<Type>::plain(input_shape, channels, block);
+}
+
+template <typename Type>
+void ReorderOperation<Type>::convert(const Tensor<Type>& input, Tensor<Type>& output) const {
+    if(to_blocked) {
+        ChannelBlocking<Type>::toBlocked(input, output, channelBlock(layout), false, false);
+        return;
+    }
+    ChannelBlocking<Type>::toPlain(input, output, channelBlock(layout), false, false);
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ReorderOperation<Type>::forward(const std::shared_ptr<Tensor<Type>>& input) {
+    Shape shape = outputShape(input->shape());
+    auto output = this->acquire(0, shape[0], shape[1], shape[2], shape[3]);
+    convert(*input, *output);
+    this->inputs = input;
+    return output;
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ReorderOperation<Type>::infer(const std::shared_ptr<Tensor<Type>>& input, std::shared_ptr<Tensor<Type>>& out) {
+    Shape shape = outputShape(input->shape());
+    auto& output = Tensor<Type>::reuse(out, shape[0], shape[1], shape[2], shape[3]);
+    convert(*input, *output);
+    return output;
+}
+
+// the input gradient gets the output gradient converted the other way added in, skipped when the input has none
+template <typename Type>
+std::shared_ptr<Tensor<Type>> ReorderOperation<Type>::backward(const std::shared_ptr<Tensor<Type>>& output_grad) {
+    auto input = this->inputs;
+    if(!input) {
+        throw std::runtime_error("ReorderOperation has no recorded forward pass, run forward before backward.");
+    }
+    if(!output_grad || !output_grad->grad_ptr() || output_grad->shape() != outputShape(input->shape())) {
+        throw std::invalid_argument("ReorderOperation output_grad does not match the last forward pass.");
+    }
+    if(!input->grad_ptr()) {
+        return input;
+    }
+    if(to_blocked) {
+        ChannelBlocking<Type>::toPlain(*output_grad, *input, channelBlock(layout), true, true);
+    }
+    else {
+        ChannelBlocking<Type>::toBlocked(*output_grad, *input, channelBlock(layout), true, true);
+    }
+    return input;
+}
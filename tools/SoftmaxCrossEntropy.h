@@ -0,0 +1,48 @@
+//
+// Created by Vijay Goyal on 2025-01-28.
+//
+
+#ifndef INC_12_FINALPROJ_2_SOFTMAXCROSSENTROPY_H
+#define INC_12_FINALPROJ_2_SOFTMAXCROSSENTROPY_H
+
+#include "Tensor.h"
+#include "BFloat16.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Softmax and cross-entropy in one pass over the raw network output, against integer class labels.
+ *        - logits: shape [N, C, 1, 1], the graph output before any softmax (ModularCNN::logits)
+ *        - with z = logits / temperature, loss_n = log(sum_c exp(z_c)) - z_label, using the log-sum-exp of z shifted
+ *          by its max so it neither overflows nor underflows
+ *        - forward also writes the exact gradient dL/dlogits = (softmax(z) - onehot(label)) / (temperature * N) into
+ *          logits->grad (without the 1 / N for a summed loss), so no one-hot tensor and no separate backward pass
+ *        - loss only evaluates it, e.g. on predictLogits
+ *        - every sample is independent, the batch is vectorised (and split across threads when it is large)
+ *        - computed in Accumulator<Type>::type, the loss is returned in double
+ */
+template <typename Type>
+class SoftmaxCrossEntropy {
+private:
+    typedef typename Accumulator<Type>::type Acc;
+
+    double temperature;
+    bool reductionMean;
+
+    template <bool Gradient>
+    double compute(Tensor<Type>& logits, const std::int64_t* labels, std::size_t count) const;
+
+public:
+    explicit SoftmaxCrossEntropy(double temperature = 1.0, bool reductionMean = true);
+
+    // loss of the batch, fills logits->grad, throws if a label is not a class of logits
+    double forward(const std::shared_ptr<Tensor<Type>>& logits, const std::int64_t* labels, std::size_t count) const;
+    double loss(const std::shared_ptr<Tensor<Type>>& logits, const std::int64_t* labels, std::size_t count) const;
+
+    [[nodiscard]] double getTemperature() const { return temperature; }
+};
+
+#include "SoftmaxCrossEntropy.tpp"
+
+#endif //INC_12_FINALPROJ_2_SOFTMAXCROSSENTROPY_H
@@ -0,0 +1,182 @@
+//
+// Created by Vijay Goyal on 2025-01-28.
+//
+
+#include "SoftmaxCrossEntropy.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "ThreadPool.h"
+
+template <typename Type>
+SoftmaxCrossEntropy<Type>::SoftmaxCrossEntropy(double temperature, bool reductionMean)
+        : temperature(temperature), reductionMean(reductionMean) {
+    if(!(temperature > 0.0)) {
+        throw std::invalid_argument("SoftmaxCrossEntropy: temperature must be positive.");
+    }
+}
+
+template <typename Type>
+double SoftmaxCrossEntropy<Type>::forward(const std::shared_ptr<Tensor<Type>>& logits, const std::int64_t* labels, std::size_t count) const {
+    if(!logits->hasGrad()) {
+        throw std::invalid_argument("SoftmaxCrossEntropy: logits have no gradient buffer (use ModularCNN::logits, not predictLogits).");
+    }
+    return compute<true>(*logits, labels, count);
+}
+
+template <typename Type>
+double SoftmaxCrossEntropy<Type>::loss(const std::shared_ptr<Tensor<Type>>& logits, const std::int64_t* labels, std::size_t count) const {
+    return compute<false>(*logits, labels, count);
+}
+
+/*
+ * z = logits / temperature, per sample m = max z, s = sum exp(z - m), loss = log(s) - (z_label - m) and
+ * gradient = (exp(z - m) / s - onehot) * scale / temperature
+ *  - each exponential is computed once and kept (in Acc, or in the gradient row when Type is Acc), for bfloat16 the
+ *    wide rows are recomputed so the gradient is rounded once
+ *  - with few classes the vector lanes run across BLOCK samples, each pass over the block handles one class,
+ *    otherwise across the classes of one sample
+ */
+template <typename Type>
+template <bool Gradient>
+double SoftmaxCrossEntropy<Type>::compute(Tensor<Type>& logits, const std::int64_t* labels, std::size_t count) const {
+    int batch_size = logits.batch();
+    int classes = logits.channels();
+    if(static_cast<std::size_t>(batch_size) != count) {
+        throw std::invalid_argument("SoftmaxCrossEntropy: " + std::to_string(count) + " labels for a batch of " +
+                                    std::to_string(batch_size));
+    }
+    if(logits.height() != 1 || logits.width() != 1 || !logits.isContiguous()) {
+        throw std::invalid_argument("SoftmaxCrossEntropy: logits must be a contiguous [N, C, 1, 1] tensor.");
+    }
+    for(int n = 0; n < batch_size; ++n) {
+        if(labels[n] < 0 || labels[n] >= classes) {
+            throw std::invalid_argument("SoftmaxCrossEntropy: label " + std::to_string(labels[n]) + " of sample " +
+                                        std::to_string(n) + " is not one of " + std::to_string(classes) + " classes");
+        }
+    }
+    if(batch_size == 0) {
+        return 0.0;
+    }
+
+    constexpr int BLOCK = 256;
+    constexpr int FEW_CLASSES = 16;
+    const Type* x = logits.data_ptr();
+    Type* g = Gradient ? logits.grad_ptr() : nullptr;
+    Acc inv_t = static_cast<Acc>(1.0 / temperature);
+    Acc g_scale = inv_t * static_cast<Acc>(reductionMean ? 1.0 / batch_size : 1.0);
+    int blocks = (batch_size + BLOCK - 1) / BLOCK;
+    std::vector<double> losses(blocks, 0.0); // shared by the pool threads, so not thread_local
+
+    // one loss per block, summed in block order so the result does not depend on the threads
+    ThreadPool::parallelFor(blocks, ThreadPool::grainFor(static_cast<std::size_t>(BLOCK) * classes), [&](int from, int to) {
+        for(int block = from; block < to; ++block) {
+            int first = block * BLOCK;
+            int size = std::min(BLOCK, batch_size - first);
+            const Type* z = x + static_cast<std::ptrdiff_t>(first) * classes;
+            const std::int64_t* y = labels + first;
+            Type* dz = Gradient ? g + static_cast<std::ptrdiff_t>(first) * classes : nullptr;
+
+            if(classes < FEW_CLASSES) {
+                // the block transposed to [class][sample] and scaled, so every pass below is a contiguous vector loop
+                Acc zt[FEW_CLASSES][BLOCK];
+                Acc m[BLOCK];
+                Acc s[BLOCK];
+                Acc target[BLOCK];
+                for(int i = 0; i < size; ++i) {
+                    for(int c = 0; c < classes; ++c) {
+                        zt[c][i] = static_cast<Acc>(z[i * classes + c]) * inv_t;
+                    }
+                    target[i] = zt[y[i]][i];
+                }
+                #pragma omp simd
+                for(int i = 0; i < size; ++i) {
+                    m[i] = zt[0][i];
+                    s[i] = 0;
+                }
+                for(int c = 1; c < classes; ++c) {
+                    #pragma omp simd
+                    for(int i = 0; i < size; ++i) {
+                        m[i] = std::max(m[i], zt[c][i]);
+                    }
+                }
+                for(int c = 0; c < classes; ++c) {
+                    #pragma omp simd
+                    for(int i = 0; i < size; ++i) {
+                        zt[c][i] = std::exp(zt[c][i] - m[i]);
+                        s[i] += zt[c][i];
+                    }
+                }
+                double partial = 0.0;
+                #pragma omp simd reduction(+:partial)
+                for(int i = 0; i < size; ++i) {
+                    partial += static_cast<double>(std::log(s[i]) - (target[i] - m[i]));
+                }
+                losses[block] += partial;
+
+                if constexpr(Gradient) {
+                    for(int c = 0; c < classes; ++c) {
+                        #pragma omp simd
+                        for(int i = 0; i < size; ++i) {
+                            zt[c][i] *= g_scale / s[i];
+                        }
+                    }
+                    for(int i = 0; i < size; ++i) {
+                        zt[y[i]][i] -= g_scale;
+                        for(int c = 0; c < classes; ++c) {
+                            dz[i * classes + c] = static_cast<Type>(zt[c][i]);
+                        }
+                    }
+                }
+                continue;
+            }
+
+            for(int i = 0; i < size; ++i) {
+                const Type* row = z + static_cast<std::ptrdiff_t>(i) * classes;
+                Acc m = static_cast<Acc>(row[0]);
+                #pragma omp simd reduction(max:m)
+                for(int c = 1; c < classes; ++c) {
+                    m = std::max(m, static_cast<Acc>(row[c]));
+                }
+                // in full precision the exponentials are kept in the gradient row, otherwise they are recomputed
+                constexpr bool keep = Gradient && std::is_same_v<Type, Acc>;
+                Type* out = Gradient ? dz + static_cast<std::ptrdiff_t>(i) * classes : nullptr;
+                Acc s = 0;
+                #pragma omp simd reduction(+:s)
+                for(int c = 0; c < classes; ++c) {
+                    Acc e = std::exp((static_cast<Acc>(row[c]) - m) * inv_t);
+                    if constexpr(keep) {
+                        out[c] = e;
+                    }
+                    s += e;
+                }
+                auto label = static_cast<int>(y[i]);
+                losses[block] += static_cast<double>(std::log(s) - (static_cast<Acc>(row[label]) - m) * inv_t);
+
+                if constexpr(Gradient) {
+                    Acc p_scale = g_scale / s;
+                    #pragma omp simd
+                    for(int c = 0; c < classes; ++c) {
+                        Acc e;
+                        if constexpr(keep) {
+                            e = out[c];
+                        }
+                        else {
+                            e = std::exp((static_cast<Acc>(row[c]) - m) * inv_t);
+                        }
+                        out[c] = static_cast<Type>(e * p_scale);
+                    }
+                    out[label] = static_cast<Type>(static_cast<Acc>(out[label]) - g_scale);
+                }
+            }
+        }
+    });
+    double total = 0.0;
+    for(double loss : losses) {
+        total += loss;
+    }
+    return reductionMean ? total / batch_size : total;
+}
@@ -8,25 +8,112 @@
 #include <vector>
 #include <memory>
 #include <cstddef>
+#include <array>
+#include <atomic>
+#include <cstdint>
 
 template <typename Type>
 class Operation;
 
+/**
+ * @brief A 4D tensor (batch_size, channels, height, width) stored in one contiguous,
+ *        64-byte aligned buffer in NCHW order.
+ *        - data and grad share the same shape and strides
+ *        - views (reshape, sliceBatch) share the underlying buffers, so no copy is made
+ *        - a tensor whose contents are cached elsewhere (e.g. a layer's transformed filters) can track its writes, every
+ *          non-const data access then stamps a version shared with its views, so the cache can tell when to rebuild
+ */
 template <typename Type>
 class Tensor {
-    typedef std::vector<std::vector<std::vector<Type>>> Tensor3D; // (channels, height, width)
-    typedef std::vector<std::vector<std::vector<std::vector<Type>>>> Tensor4D; // (batch_size, channels, height, width)
 public:
-    Tensor4D data;
-    Tensor4D grad;
+    typedef std::array<int, 4> Shape; // (batch_size, channels, height, width)
+    typedef std::array<std::ptrdiff_t, 4> Strides; // element strides for each dimension
+    typedef std::shared_ptr<std::atomic<std::uint64_t>> WriteCounter; // stamp of the last write, see trackWrites
+
+    static constexpr std::size_t ALIGNMENT = 64;
+
+private:
+    std::shared_ptr<Type> data_buffer; // points at element (0, 0, 0, 0) of this tensor
+    std::shared_ptr<Type> grad_buffer;
+    Shape dims = {0, 0, 0, 0};
+    Strides step = {0, 0, 0, 0};
+    WriteCounter writes; // null unless writes are tracked
+
+    static inline std::atomic<std::size_t> allocated_bytes{0}; // running total of allocate, never decreases
+    static inline std::atomic<std::uint64_t> write_clock{0};   // source of write stamps, so no two writes get the same one
+
+public:
+    // aligned buffer of count elements set to value, released with std::free once the last view is gone
+    static std::shared_ptr<Type> allocate(std::size_t count, Type value);
+    // bytes handed out by allocate so far, the difference across a call is what it allocated (used by the benchmarks)
+    static std::size_t allocatedBytes() { return allocated_bytes.load(std::memory_order_relaxed); }
+
     std::shared_ptr<Operation<Type>> creator; // points to operation that made it/edited it, for computation graphs
 
     Tensor() = default;
-    Tensor(int batch_size, int channels, int height, int width, Type value = 0.0);
+    Tensor(int batch_size, int channels, int height, int width, Type value = 0.0, bool with_grad = true);
+
+    // contiguous NCHW tensor over memory owned elsewhere, the deleter of data decides how it is released
+    static std::shared_ptr<Tensor<Type>> wrap(std::shared_ptr<Type> data, int batch_size, int channels, int height, int width);
+    // same, with the grad buffer also supplied by the caller (nullptr for a gradient-free tensor)
+    static std::shared_ptr<Tensor<Type>> wrap(std::shared_ptr<Type> data, std::shared_ptr<Type> grad, int batch_size, int channels, int height, int width);
+
+    // reuse buffer if nobody else holds it and it already has this shape, otherwise replace it with a fresh gradient-free tensor
+    static std::shared_ptr<Tensor<Type>>& reuse(std::shared_ptr<Tensor<Type>>& buffer, int batch_size, int channels, int height, int width);
+
+    // fresh counter, already stamped so it differs from every version handed out before
+    static WriteCounter writeCounter();
+    // stamp counter with a new version, for writers that bypass the tensor (e.g. the whole-model ParameterBuffer)
+    static void stamp(std::atomic<std::uint64_t>& counter) {
+        counter.store(write_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // start tracking writes in counter (a fresh one when null), views made from here on share it
+    void trackWrites(WriteCounter counter = nullptr);
+    [[nodiscard]] bool tracksWrites() const { return writes != nullptr; }
+    // changes on every non-const data access, 0 for an untracked tensor
+    [[nodiscard]] std::uint64_t version() const { return writes ? writes->load(std::memory_order_acquire) : 0; }
+    void touch() { if(writes) stamp(*writes); }
+
+    // raw access, reads that go through a non-const tensor count as writes, so use std::as_const for them
+    Type* data_ptr() { touch(); return data_buffer.get(); }
+    const Type* data_ptr() const { return data_buffer.get(); }
+    Type* grad_ptr() { return grad_buffer.get(); }
+    const Type* grad_ptr() const { return grad_buffer.get(); }
+
+    // element access
+    Type& data(int n, int c, int h, int w) { touch(); return data_buffer.get()[offset(n, c, h, w)]; }
+    const Type& data(int n, int c, int h, int w) const { return data_buffer.get()[offset(n, c, h, w)]; }
+    Type& grad(int n, int c, int h, int w) { return grad_buffer.get()[offset(n, c, h, w)]; }
+    const Type& grad(int n, int c, int h, int w) const { return grad_buffer.get()[offset(n, c, h, w)]; }
+
+    [[nodiscard]] std::ptrdiff_t offset(int n, int c, int h, int w) const {
+        return n * step[0] + c * step[1] + h * step[2] + w * step[3];
+    }
+
+    // shape metadata
+    [[nodiscard]] const Shape& shape() const { return dims; }
+    [[nodiscard]] const Strides& strides() const { return step; }
+    [[nodiscard]] int batch() const { return dims[0]; }
+    [[nodiscard]] int channels() const { return dims[1]; }
+    [[nodiscard]] int height() const { return dims[2]; }
+    [[nodiscard]] int width() const { return dims[3]; }
+    [[nodiscard]] std::size_t size() const { return static_cast<std::size_t>(dims[0]) * dims[1] * dims[2] * dims[3]; }
+    [[nodiscard]] std::size_t sampleSize() const { return static_cast<std::size_t>(dims[1]) * dims[2] * dims[3]; }
+    [[nodiscard]] bool empty() const { return size() == 0; }
+    [[nodiscard]] bool hasGrad() const { return grad_buffer != nullptr || size() == 0; }
+    [[nodiscard]] bool isContiguous() const;
+
+    // views, these share storage with this tensor
+    std::shared_ptr<Tensor<Type>> reshape(int batch_size, int channels, int height, int width) const;
+    std::shared_ptr<Tensor<Type>> sliceBatch(int begin, int end) const;
+    // same data with another gradient buffer of this shape (nullptr for none), e.g. one consumer's share of a gradient
+    std::shared_ptr<Tensor<Type>> withGrad(std::shared_ptr<Type> grad) const;
 
     void zeroGrad(); // to clear the gradients
 
     void setValue(size_t b, size_t c, size_t h, size_t w, Type value);
+    Type getValue(size_t b, size_t c, size_t h, size_t w) const;
 };
 
 #include "Tensor.tpp"
@@ -3,19 +3,152 @@
 //
 
 #include "Tensor.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include "ThreadPool.h"
 
+/*
+ * allocate an aligned buffer of count elements, released with std::free once the last view is gone
+ *  - filled in ThreadPool slices, so on a NUMA machine each page is first touched by the thread that later works on it
+ */
 template <typename Type>
-Tensor<Type>::Tensor(int batch_size, int channels, int height, int width, Type value) {
-    data = Tensor4D(batch_size, Tensor3D(channels, std::vector<std::vector<Type>>(height, std::vector<Type>(width, value))));
-    grad = Tensor4D(batch_size, Tensor3D(channels, std::vector<std::vector<Type>>(height, std::vector<Type>(width, static_cast<Type>(0.0)))));
+std::shared_ptr<Type> Tensor<Type>::allocate(std::size_t count, Type value) {
+    if(count == 0) {
+        return nullptr;
+    }
+    std::size_t bytes = (count * sizeof(Type) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    Type* raw = static_cast<Type*>(std::aligned_alloc(ALIGNMENT, bytes));
+    if(!raw) {
+        throw std::bad_alloc();
+    }
+    allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    ThreadPool::parallelFor(count, ThreadPool::MIN_SLICE, [&](std::size_t first, std::size_t last) {
+        std::fill(raw + first, raw + last, value);
+    });
+    return std::shared_ptr<Type>(raw, [](Type* p) { std::free(p); });
+}
+
+template <typename Type>
+Tensor<Type>::Tensor(int batch_size, int channels, int height, int width, Type value, bool with_grad) {
+    if(batch_size < 0 || channels < 0 || height < 0 || width < 0) {
+        throw std::invalid_argument("Tensor dimensions must be non-negative.");
+    }
+    dims = {batch_size, channels, height, width};
+    step = {static_cast<std::ptrdiff_t>(channels) * height * width, static_cast<std::ptrdiff_t>(height) * width, width, 1};
+    data_buffer = allocate(size(), value);
+    if(with_grad) {
+        grad_buffer = allocate(size(), static_cast<Type>(0.0));
+    }
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> Tensor<Type>::wrap(std::shared_ptr<Type> data, int batch_size, int channels, int height, int width) {
+    auto tensor = std::make_shared<Tensor<Type>>(0, 0, 0, 0);
+    tensor->dims = {batch_size, channels, height, width};
+    tensor->step = {static_cast<std::ptrdiff_t>(channels) * height * width, static_cast<std::ptrdiff_t>(height) * width, width, 1};
+    tensor->data_buffer = std::move(data);
+    tensor->grad_buffer = allocate(tensor->size(), static_cast<Type>(0.0));
+    return tensor;
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> Tensor<Type>::wrap(std::shared_ptr<Type> data, std::shared_ptr<Type> grad, int batch_size, int channels, int height, int width) {
+    auto tensor = std::make_shared<Tensor<Type>>(0, 0, 0, 0);
+    tensor->dims = {batch_size, channels, height, width};
+    tensor->step = {static_cast<std::ptrdiff_t>(channels) * height * width, static_cast<std::ptrdiff_t>(height) * width, width, 1};
+    tensor->data_buffer = std::move(data);
+    tensor->grad_buffer = std::move(grad);
+    return tensor;
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>>& Tensor<Type>::reuse(std::shared_ptr<Tensor<Type>>& buffer, int batch_size, int channels, int height, int width) {
+    Shape wanted = {batch_size, channels, height, width};
+    if(!buffer || buffer.use_count() > 1 || buffer->dims != wanted || !buffer->isContiguous()) {
+        buffer = std::make_shared<Tensor<Type>>(batch_size, channels, height, width, static_cast<Type>(0.0), false);
+    }
+    return buffer;
+}
+
+template <typename Type>
+bool Tensor<Type>::isContiguous() const {
+    return step[3] == 1 && step[2] == dims[3] && step[1] == static_cast<std::ptrdiff_t>(dims[2]) * dims[3]
+           && step[0] == static_cast<std::ptrdiff_t>(dims[1]) * dims[2] * dims[3];
+}
+
+/*
+ * reinterpret the same contiguous buffer with a new shape, no data is copied
+ */
+template <typename Type>
+std::shared_ptr<Tensor<Type>> Tensor<Type>::reshape(int batch_size, int channels, int height, int width) const {
+    if(!isContiguous()) {
+        throw std::invalid_argument("Tensor::reshape requires a contiguous tensor.");
+    }
+    if(static_cast<std::size_t>(batch_size) * channels * height * width != size()) {
+        throw std::invalid_argument("Tensor::reshape cannot change the number of elements.");
+    }
+    auto view = std::make_shared<Tensor<Type>>(*this);
+    view->dims = {batch_size, channels, height, width};
+    view->step = {static_cast<std::ptrdiff_t>(channels) * height * width, static_cast<std::ptrdiff_t>(height) * width, width, 1};
+    return view;
+}
+
+/*
+ * view of samples [begin, end) along the batch dimension
+ */
+template <typename Type>
+std::shared_ptr<Tensor<Type>> Tensor<Type>::sliceBatch(int begin, int end) const {
+    if(begin < 0 || end > dims[0] || begin > end) {
+        throw std::out_of_range("Tensor::sliceBatch range is out of bounds.");
+    }
+    auto view = std::make_shared<Tensor<Type>>(*this);
+    view->dims[0] = end - begin;
+    if(data_buffer) {
+        view->data_buffer = std::shared_ptr<Type>(data_buffer, data_buffer.get() + begin * step[0]);
+    }
+    if(grad_buffer) {
+        view->grad_buffer = std::shared_ptr<Type>(grad_buffer, grad_buffer.get() + begin * step[0]);
+    }
+    return view;
+}
+
+template <typename Type>
+std::shared_ptr<Tensor<Type>> Tensor<Type>::withGrad(std::shared_ptr<Type> grad) const {
+    if(!isContiguous()) {
+        throw std::invalid_argument("Tensor::withGrad requires a contiguous tensor.");
+    }
+    auto view = std::make_shared<Tensor<Type>>(*this);
+    view->grad_buffer = std::move(grad);
+    return view;
+}
+
+template <typename Type>
+typename Tensor<Type>::WriteCounter Tensor<Type>::writeCounter() {
+    auto counter = std::make_shared<std::atomic<std::uint64_t>>(0);
+    stamp(*counter);
+    return counter;
+}
+
+template <typename Type>
+void Tensor<Type>::trackWrites(WriteCounter counter) {
+    writes = counter ? std::move(counter) : writeCounter();
 }
 
 template <typename Type>
 void Tensor<Type>::zeroGrad() {
-    for(auto& batch : grad) {
-        for(auto& channel : batch) {
-            for(auto& row : channel) {
-                std::fill(row.begin(), row.end(), static_cast<Type>(0.0));
+    if(!grad_buffer) return;
+    if(isContiguous()) {
+        std::fill(grad_buffer.get(), grad_buffer.get() + size(), static_cast<Type>(0.0));
+        return;
+    }
+    for(int n = 0; n < dims[0]; ++n) {
+        for(int c = 0; c < dims[1]; ++c) {
+            for(int h = 0; h < dims[2]; ++h) {
+                for(int w = 0; w < dims[3]; ++w) {
+                    grad(n, c, h, w) = static_cast<Type>(0.0);
+                }
             }
         }
     }
@@ -23,5 +156,10 @@ void Tensor<Type>::zeroGrad() {
 
 template <typename Type>
 void Tensor<Type>::setValue(size_t b, size_t c, size_t h, size_t w, Type value) {
-    data[b][c][h][w] = value;
-}
\ No newline at end of file
+    data(static_cast<int>(b), static_cast<int>(c), static_cast<int>(h), static_cast<int>(w)) = value;
+}
+
+template <typename Type>
+Type Tensor<Type>::getValue(size_t b, size_t c, size_t h, size_t w) const {
+    return data(static_cast<int>(b), static_cast<int>(c), static_cast<int>(h), static_cast<int>(w));
+}
@@ -0,0 +1,38 @@
+//
+// Created by Vijay Goyal on 2025-01-17.
+//
+
+#ifndef INC_12_FINALPROJ_2_TENSORCONVERSION_H
+#define INC_12_FINALPROJ_2_TENSORCONVERSION_H
+
+#include "Tensor.h"
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Bulk conversions from raw host buffers (numpy arrays, decoded images) into Tensors.
+ *        Every conversion is a single pass over the source, parallel over the batch.
+ */
+template <typename Type>
+class TensorConversion {
+public:
+    // (batch, height, width, channels) -> (batch, channels, height, width), every value multiplied by scale
+    template <typename Source>
+    static void fromNHWC(const Source* src, int batch_size, int height, int width, int channels, Type scale, Type* dst);
+
+    // one (height, width, channels) image -> (channels, height, width) on the calling thread, e.g. a DataLoader worker
+    template <typename Source>
+    static void fromHWC(const Source* src, int height, int width, int channels, Type scale, Type* dst);
+
+    // (batch, channels, height, width) -> same layout, every value multiplied by scale
+    template <typename Source>
+    static void fromNCHW(const Source* src, std::size_t count, Type scale, Type* dst);
+
+    // integer class labels -> one-hot (batch, num_classes, 1, 1), throws on labels outside [0, num_classes)
+    template <typename Label>
+    static void oneHot(const Label* labels, int batch_size, int num_classes, Type* dst);
+};
+
+#include "TensorConversion.tpp"
+
+#endif //INC_12_FINALPROJ_2_TENSORCONVERSION_H
@@ -0,0 +1,70 @@
+//
+// Created by Vijay Goyal on 2025-01-17.
+//
+
+#include "TensorConversion.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "ThreadPool.h"
+
+template <typename Type>
+template <typename Source>
+void TensorConversion<Type>::fromNHWC(const Source* src, int batch_size, int height, int width, int channels, Type scale, Type* dst) {
+    std::ptrdiff_t plane = static_cast<std::ptrdiff_t>(height) * width;
+    ThreadPool::parallelFor(batch_size * height, ThreadPool::grainFor(static_cast<std::size_t>(width) * channels), [&](int first, int last) {
+        for(int i = first; i < last; ++i) {
+            int n = i / height;
+            int h = i % height;
+            const Source* row = src + (static_cast<std::ptrdiff_t>(n) * plane + static_cast<std::ptrdiff_t>(h) * width) * channels;
+            Type* out = dst + static_cast<std::ptrdiff_t>(n) * channels * plane + static_cast<std::ptrdiff_t>(h) * width;
+            for(int c = 0; c < channels; ++c) {
+                Type* out_row = out + c * plane;
+                #pragma omp simd
+                for(int w = 0; w < width; ++w) {
+                    out_row[w] = static_cast<Type>(row[w * channels + c]) * scale;
+                }
+            }
+        }
+    });
+}
+
+template <typename Type>
+template <typename Source>
+void TensorConversion<Type>::fromHWC(const Source* src, int height, int width, int channels, Type scale, Type* dst) {
+    std::ptrdiff_t plane = static_cast<std::ptrdiff_t>(height) * width;
+    for(int h = 0; h < height; ++h) {
+        const Source* row = src + static_cast<std::ptrdiff_t>(h) * width * channels;
+        for(int c = 0; c < channels; ++c) {
+            Type* out_row = dst + c * plane + static_cast<std::ptrdiff_t>(h) * width;
+            #pragma omp simd
+            for(int w = 0; w < width; ++w) {
+                out_row[w] = static_cast<Type>(row[w * channels + c]) * scale;
+            }
+        }
+    }
+}
+
+template <typename Type>
+template <typename Source>
+void TensorConversion<Type>::fromNCHW(const Source* src, std::size_t count, Type scale, Type* dst) {
+    ThreadPool::parallelFor(static_cast<std::ptrdiff_t>(count), ThreadPool::MIN_SLICE, [&](std::ptrdiff_t first, std::ptrdiff_t last) {
+        #pragma omp simd
+        for(std::ptrdiff_t i = first; i < last; ++i) {
+            dst[i] = static_cast<Type>(src[i]) * scale;
+        }
+    });
+}
+
+template <typename Type>
+template <typename Label>
+void TensorConversion<Type>::oneHot(const Label* labels, int batch_size, int num_classes, Type* dst) {
+    std::fill(dst, dst + static_cast<std::ptrdiff_t>(batch_size) * num_classes, static_cast<Type>(0.0));
+    for(int n = 0; n < batch_size; ++n) {
+        long long label = static_cast<long long>(labels[n]);
+        if(label < 0 || label >= num_classes) {
+            throw std::invalid_argument("Label " + std::to_string(label) + " at index " + std::to_string(n) + " is invalid");
+        }
+        dst[static_cast<std::ptrdiff_t>(n) * num_classes + label] = static_cast<Type>(1.0);
+    }
+}
@@ -0,0 +1,355 @@
+//
+// Created by Vijay Goyal on 2025-02-07.
+//
+
+#include "ThreadPool.h"
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <omp.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+thread_local int ThreadPool::limit = 0;
+thread_local bool ThreadPool::inside = false;
+thread_local int ThreadPool::home = 0;
+
+namespace {
+    // yields before a pool thread goes to sleep, or before a caller sleeps waiting for its helpers
+    constexpr int SPIN = 64;
+
+    // "0-3,8,10-11" into its cores
+    std::vector<int> parseCpuList(const std::string& list) {
+        std::vector<int> cores;
+        std::stringstream ranges(list);
+        std::string range;
+        while(std::getline(ranges, range, ',')) {
+            if(range.empty() || range == "\n") {
+                continue;
+            }
+            std::size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int c = first; c <= last; ++c) {
+                cores.push_back(c);
+            }
+        }
+        return cores;
+    }
+}
+
+ThreadPool::ThreadPool() {
+    cpus.assign(std::max(1, omp_get_max_threads()) - 1, -1);
+    start();
+#ifdef __linux__
+    pthread_atfork(nullptr, nullptr, [] { instance().afterFork(); });
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+// one thread per entry of cpus
+void ThreadPool::start() {
+    threads.reserve(cpus.size());
+    for(int t = 0; t < static_cast<int>(cpus.size()); ++t) {
+        threads.emplace_back(&ThreadPool::background, this, t);
+    }
+}
+
+void ThreadPool::stop() {
+    stopping.store(true);
+    signal.fetch_add(1);
+    signal.notify_all();
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    stopping.store(false);
+}
+
+/*
+ * the child of a fork has only the thread that forked, the pool threads are gone without having been joined
+ *  - their std::thread objects are leaked, destroying a joinable one terminates
+ *  - the lock may have been held by one of them
+ */
+void ThreadPool::afterFork() {
+    new std::vector<std::thread>(std::move(threads));
+    threads.clear();
+    new (&lock) std::mutex;
+    jobs.clear();
+    sleeping.store(0);
+    stopping.store(false);
+    start();
+}
+
+void ThreadPool::configure(int thread_count, ThreadAffinity thread_affinity) {
+    if(thread_count < 0) {
+        throw std::invalid_argument("ThreadPool: the thread count must be 0 (automatic) or positive.");
+    }
+    if(thread_count == 0) {
+        thread_count = std::max(1, omp_get_max_threads());
+    }
+    stop();
+    affinity = thread_affinity;
+    cpus.assign(thread_count - 1, -1);
+    if(affinity != ThreadAffinity::Unpinned) {
+        auto nodes = numaNodes();
+        std::vector<int> order;
+        if(affinity == ThreadAffinity::Compact) {
+            for(const auto& node : nodes) {
+                order.insert(order.end(), node.begin(), node.end());
+            }
+        }
+        else {
+            std::size_t largest = 0;
+            for(const auto& node : nodes) {
+                largest = std::max(largest, node.size());
+            }
+            for(std::size_t k = 0; k < largest; ++k) {
+                for(const auto& node : nodes) {
+                    if(k < node.size()) {
+                        order.push_back(node[k]);
+                    }
+                }
+            }
+        }
+        // the caller of a loop keeps the first core
+        for(int t = 0; t + 1 < thread_count && !order.empty(); ++t) {
+            cpus[t] = order[(t + 1) % order.size()];
+        }
+    }
+    start();
+}
+
+std::vector<std::vector<int>> ThreadPool::numaNodes() {
+    std::vector<int> allowed;
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if(sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for(int c = 0; c < CPU_SETSIZE; ++c) {
+            if(CPU_ISSET(c, &mask)) {
+                allowed.push_back(c);
+            }
+        }
+    }
+#endif
+    if(allowed.empty()) {
+        for(unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()); ++c) {
+            allowed.push_back(static_cast<int>(c));
+        }
+    }
+
+    std::vector<std::pair<int, std::vector<int>>> nodes;
+#ifdef __linux__
+    std::error_code error;
+    for(const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        std::string name = entry.path().filename().string();
+        if(name.size() <= 4 || name.compare(0, 4, "node") != 0 || name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        std::ifstream file(entry.path() / "cpulist");
+        std::string list;
+        if(!std::getline(file, list)) {
+            continue;
+        }
+        std::vector<int> cores;
+        for(int c : parseCpuList(list)) {
+            if(std::binary_search(allowed.begin(), allowed.end(), c)) {
+                cores.push_back(c);
+            }
+        }
+        if(!cores.empty()) {
+            nodes.emplace_back(std::stoi(name.substr(4)), std::move(cores));
+        }
+    }
+#endif
+    std::sort(nodes.begin(), nodes.end());
+    std::vector<std::vector<int>> groups;
+    for(auto& node : nodes) {
+        groups.push_back(std::move(node.second));
+    }
+    if(groups.empty()) {
+        groups.push_back(allowed);
+    }
+    return groups;
+}
+
+int ThreadPool::width() {
+    if(inside) {
+        return 1;
+    }
+    int threads = instance().size();
+    return limit > 0 ? std::min(limit, threads) : threads;
+}
+
+std::size_t ThreadPool::slices(std::size_t n, std::size_t grain) {
+    std::size_t parts = grain > 1 ? n / grain : n;
+    return std::max<std::size_t>(1, std::min<std::size_t>(parts, width()));
+}
+
+// a job this pool thread may help with, counted as joined
+ThreadPool::Job* ThreadPool::join() {
+    std::lock_guard<std::mutex> guard(lock);
+    for(Job* job : jobs) {
+        if(job->joined.load(std::memory_order_relaxed) < job->helpers) {
+            job->joined.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+// run items of a job until none is left, slot home first in a static job
+void ThreadPool::work(Job& job) {
+    auto attempt = [&](std::size_t item) {
+        if(job.failed.load(std::memory_order_relaxed)) {
+            return;
+        }
+        try {
+            job.run(job.context, item);
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> guard(job.error_lock);
+            if(!job.error) {
+                job.error = std::current_exception();
+            }
+            job.failed.store(true);
+        }
+    };
+    if(job.dynamic) {
+        for(std::size_t i = job.next.fetch_add(1); i < job.items; i = job.next.fetch_add(1)) {
+            attempt(i);
+        }
+        return;
+    }
+    std::size_t mine = static_cast<std::size_t>(home);
+    for(std::size_t k = 0; k < job.items; ++k) {
+        std::size_t slot = (mine + k) % job.items;
+        if(job.claimed[slot].load(std::memory_order_relaxed) == 0 && job.claimed[slot].exchange(1, std::memory_order_acq_rel) == 0) {
+            attempt(slot);
+        }
+    }
+}
+
+/*
+ * pool thread body
+ *  - signal is read before the jobs are searched, a job posted after the search changes it and wait returns at once
+ *  - after leaving a job the thread only touches the pool, the caller may already have destroyed the job
+ */
+void ThreadPool::background(int index) {
+    home = index + 1;
+    inside = true;
+#ifdef __linux__
+    if(cpus[index] >= 0) {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(cpus[index], &mask);
+        pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    }
+#endif
+    omp_set_num_threads(1);
+    unsigned seen = signal.load();
+    int idle = 0;
+    while(!stopping.load()) {
+        if(Job* job = join()) {
+            work(*job);
+            job->left.fetch_add(1, std::memory_order_release);
+            finished.fetch_add(1);
+            finished.notify_all();
+            idle = 0;
+            continue;
+        }
+        unsigned now = signal.load();
+        if(now != seen) {
+            seen = now;
+            continue;
+        }
+        if(++idle < SPIN) {
+            std::this_thread::yield();
+            continue;
+        }
+        sleeping.fetch_add(1);
+        signal.wait(seen);
+        sleeping.fetch_sub(1);
+        idle = 0;
+    }
+}
+
+/*
+ * run a loop of items on the caller and up to participants - 1 pool threads
+ *  - the caller works through the items too, so a loop finishes even when every pool thread is busy elsewhere
+ *  - once the job leaves the list no pool thread can join it, the caller then waits for those that did
+ */
+void ThreadPool::execute(std::size_t items, bool dynamic, int participants, void (*run)(void*, std::size_t), void* context) {
+    thread_local std::unique_ptr<std::atomic<unsigned char>[]> flags;
+    thread_local std::size_t flag_capacity = 0;
+
+    Job job;
+    job.run = run;
+    job.context = context;
+    job.items = items;
+    job.dynamic = dynamic;
+    job.helpers = std::min(participants - 1, static_cast<int>(threads.size()));
+    if(!dynamic) {
+        if(flag_capacity < items) {
+            flags = std::make_unique<std::atomic<unsigned char>[]>(items);
+            flag_capacity = items;
+        }
+        for(std::size_t s = 0; s < items; ++s) {
+            flags[s].store(0, std::memory_order_relaxed);
+        }
+        job.claimed = flags.get();
+    }
+
+    if(job.helpers > 0) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.push_back(&job);
+        }
+        signal.fetch_add(1);
+        if(sleeping.load() > 0) {
+            signal.notify_all();
+        }
+    }
+
+    inside = true;
+    work(job);
+    inside = false;
+
+    if(job.helpers > 0) {
+        int joined;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+            joined = job.joined.load(std::memory_order_relaxed);
+        }
+        int idle = 0;
+        while(job.left.load(std::memory_order_acquire) < joined) {
+            unsigned seen = finished.load();
+            if(job.left.load(std::memory_order_acquire) >= joined) {
+                break;
+            }
+            if(++idle < SPIN) {
+                std::this_thread::yield();
+                continue;
+            }
+            finished.wait(seen);
+        }
+    }
+    if(job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
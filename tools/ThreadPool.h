@@ -0,0 +1,184 @@
+//
+// Created by Vijay Goyal on 2025-02-07.
+//
+
+#ifndef INC_12_FINALPROJ_2_THREADPOOL_H
+#define INC_12_FINALPROJ_2_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum class ThreadAffinity : int {
+    Unpinned = 0, // the OS places the threads
+    Compact = 1,  // pool thread t on the (t + 1)-th allowed core, one NUMA node filled before the next
+    Spread = 2    // same, with consecutive threads on different NUMA nodes
+};
+
+/**
+ * @brief Persistent pool of threads that runs the parallel loops of every kernel, instead of one OpenMP team per loop.
+ *        - parallelSlots runs one body per slot, the caller runs slot 0 and pool thread t runs slot t + 1 whenever it
+ *          is free, parallelFor gives each slot one contiguous slice of [0, n), so a thread works on the same part of
+ *          a buffer from loop to loop, Tensor::allocate first-touches buffers in the same slices so their pages sit on
+ *          that thread's NUMA node
+ *        - parallelTasks hands out tasks one at a time to whichever thread is free, for work of uneven size
+ *        - a loop started inside a loop runs inline on its thread
+ *        - several threads may run loops at once (the workers of a GraphExecutor), each loop uses at most width()
+ *          threads and the pool threads go to whichever loop has room
+ *        - the threads spin briefly after a loop, then sleep until the next one
+ *        - the first exception thrown by a loop body is rethrown by the caller once every slot is done
+ *        - configure may not run while a loop does
+ *        - a child process made by fork starts its own pool threads, with the parent's size and affinity
+ */
+class ThreadPool {
+private:
+    struct Job {
+        void (*run)(void* context, std::size_t item) = nullptr;
+        void* context = nullptr;
+        std::size_t items = 0;
+        bool dynamic = false;                   // items claimed in order by whoever is free, otherwise slot s by thread s first
+        std::atomic<unsigned char>* claimed = nullptr; // per slot, static jobs only
+        int helpers = 0;                        // pool threads that may join
+        std::atomic<std::size_t> next{0};       // next item of a dynamic job
+        std::atomic<int> joined{0};             // pool threads that joined, only changed under the pool's lock
+        std::atomic<int> left{0};               // pool threads that are done with the job
+        std::atomic<bool> failed{false};
+        std::mutex error_lock;
+        std::exception_ptr error;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<int> cpus; // core of each pool thread, -1 when unpinned
+    ThreadAffinity affinity = ThreadAffinity::Unpinned;
+
+    std::mutex lock;
+    std::vector<Job*> jobs;                 // loops that still take helpers
+    std::atomic<unsigned> signal{0};        // bumped when a job is posted or the pool stops
+    std::atomic<int> sleeping{0};
+    std::atomic<unsigned> finished{0};      // bumped when a pool thread leaves a job, callers wait on it
+    std::atomic<bool> stopping{false};
+
+    static thread_local int limit;  // cap on width() set by a Limit, 0 for none
+    static thread_local bool inside; // running a loop body
+    static thread_local int home;   // slot this thread runs first, 0 for threads outside the pool
+
+    ThreadPool();
+
+    void start();
+    void stop();
+    void afterFork();
+    void background(int index);
+    Job* join();
+    static void work(Job& job);
+    void execute(std::size_t items, bool dynamic, int participants, void (*run)(void*, std::size_t), void* context);
+
+public:
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // the pool of the process, started with omp_get_max_threads() threads (OMP_NUM_THREADS) and unpinned
+    static ThreadPool& instance();
+
+    // threads counts the caller of a loop, so threads - 1 run in the pool, 0 picks omp_get_max_threads(),
+    // threads beyond the allowed cores wrap around when pinned
+    void configure(int thread_count, ThreadAffinity thread_affinity);
+
+    [[nodiscard]] int size() const { return static_cast<int>(threads.size()) + 1; }
+    [[nodiscard]] ThreadAffinity getAffinity() const { return affinity; }
+    [[nodiscard]] const std::vector<int>& getCpus() const { return cpus; }
+
+    // allowed cores of the process, grouped by NUMA node (one group when the topology is not known)
+    static std::vector<std::vector<int>> numaNodes();
+
+    // threads a loop started on this thread may use, 1 inside a loop
+    static int width();
+
+    // caps width() on the thread that makes it until it goes out of scope
+    class Limit {
+    private:
+        int previous;
+    public:
+        explicit Limit(int threads) : previous(limit) { limit = std::max(1, threads); }
+        ~Limit() { limit = previous; }
+        Limit(const Limit&) = delete;
+        Limit& operator=(const Limit&) = delete;
+    };
+
+    // body(begin, end) over [0, n) in slices(n, grain) slices, begin and end of the type of n
+    template <typename Index, typename Body>
+    static void parallelFor(Index n, std::size_t grain, Body&& body);
+
+    // body(slot) for slot in [0, count), on at most width() threads, for per-slot scratch sized by slices()
+    template <typename Body>
+    static void parallelSlots(std::size_t count, Body&& body);
+
+    // task(i) for i in [0, count), on at most width() threads
+    template <typename Task>
+    static void parallelTasks(std::size_t count, Task&& task);
+
+    // slices parallelFor(n, grain, ..) makes on this thread: at most width(), each at least grain long
+    static std::size_t slices(std::size_t n, std::size_t grain);
+
+    // elements of streaming work (a copy, an elementwise op) below which a slice is not worth handing to a thread
+    static constexpr std::size_t MIN_SLICE = 32768;
+
+    // grain of a loop whose indices each do work such elements
+    static std::size_t grainFor(std::size_t work) { return std::max<std::size_t>(1, MIN_SLICE / std::max<std::size_t>(1, work)); }
+};
+
+template <typename Index, typename Body>
+void ThreadPool::parallelFor(Index n, std::size_t grain, Body&& body) {
+    static_assert(std::is_integral_v<Index>, "ThreadPool::parallelFor runs over integers.");
+    if(n <= 0) {
+        return;
+    }
+    std::size_t count = static_cast<std::size_t>(n);
+    std::size_t parts = slices(count, grain);
+    if(parts <= 1) {
+        body(Index(0), n);
+        return;
+    }
+    parallelSlots(parts, [&](std::size_t slot) {
+        body(static_cast<Index>(count * slot / parts), static_cast<Index>(count * (slot + 1) / parts));
+    });
+}
+
+template <typename Body>
+void ThreadPool::parallelSlots(std::size_t count, Body&& body) {
+    int threads = static_cast<int>(std::min<std::size_t>(count, width()));
+    if(threads <= 1) {
+        for(std::size_t slot = 0; slot < count; ++slot) {
+            body(slot);
+        }
+        return;
+    }
+    struct Context {
+        Body& body;
+    } context{body};
+    instance().execute(count, false, threads, [](void* c, std::size_t slot) { static_cast<Context*>(c)->body(slot); }, &context);
+}
+
+template <typename Task>
+void ThreadPool::parallelTasks(std::size_t count, Task&& task) {
+    int threads = static_cast<int>(std::min<std::size_t>(count, width()));
+    if(threads <= 1) {
+        for(std::size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    struct Context {
+        Task& task;
+    } context{task};
+    instance().execute(count, true, threads, [](void* c, std::size_t i) { static_cast<Context*>(c)->task(i); }, &context);
+}
+
+#endif //INC_12_FINALPROJ_2_THREADPOOL_H
@@ -0,0 +1,28 @@
+//
+// Created by Vijay Goyal on 2025-01-27.
+//
+
+#ifndef INC_12_FINALPROJ_2_TRANSPORT_H
+#define INC_12_FINALPROJ_2_TRANSPORT_H
+
+#include <cstddef>
+
+/**
+ * @brief Byte transport between the replicas of a data-parallel job, arranged as a ring of size() ranks.
+ *        - a rank only talks to its neighbours: it sends to rank + 1 and receives from rank - 1 (mod size), which is
+ *          all a ring allreduce needs
+ *        - exchange sends and receives at the same time, so a ring step in which every rank sends never deadlocks
+ *        - implementations throw std::runtime_error when a peer is lost, see UnixSocketTransport
+ */
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    [[nodiscard]] virtual int rank() const = 0;
+    [[nodiscard]] virtual int size() const = 0;
+
+    // sends send_bytes to the next rank while receiving recv_bytes from the previous one, either may be 0
+    virtual void exchange(const void* send, std::size_t send_bytes, void* recv, std::size_t recv_bytes) = 0;
+};
+
+#endif //INC_12_FINALPROJ_2_TRANSPORT_H
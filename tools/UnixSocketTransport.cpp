@@ -0,0 +1,222 @@
+//
+// Created by Vijay Goyal on 2025-01-27.
+//
+
+#include "UnixSocketTransport.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    std::runtime_error socketError(const std::string& what) {
+        return std::runtime_error("UnixSocketTransport: " + what + ": " + std::strerror(errno));
+    }
+
+    sockaddr_un address(const std::string& path) {
+        sockaddr_un addr{};
+        if(path.size() >= sizeof(addr.sun_path)) {
+            throw std::invalid_argument("UnixSocketTransport: socket path '" + path + "' is too long");
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+
+    // blocking transfer of a few handshake bytes
+    void sendAll(int fd, const void* data, std::size_t bytes) {
+        const char* p = static_cast<const char*>(data);
+        while(bytes > 0) {
+            ssize_t n = ::send(fd, p, bytes, MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                throw socketError("handshake send failed");
+            }
+            p += n;
+            bytes -= static_cast<std::size_t>(n);
+        }
+    }
+
+    void recvAll(int fd, void* data, std::size_t bytes) {
+        char* p = static_cast<char*>(data);
+        while(bytes > 0) {
+            ssize_t n = ::recv(fd, p, bytes, 0);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                throw socketError("handshake receive failed");
+            }
+            p += n;
+            bytes -= static_cast<std::size_t>(n);
+        }
+    }
+}
+
+/*
+ * ring setup, the same on every rank
+ *  - listen first, so the previous rank's connect succeeds (it queues in the backlog) even before we accept
+ *  - connect to the next rank, retrying while its process starts up, and tell it our rank
+ *  - accept the previous rank and check its rank, then remove our socket file, nobody else connects to it
+ */
+UnixSocketTransport::UnixSocketTransport(const std::string& path, int rank, int size, double timeout_seconds)
+        : my_rank(rank), ranks(size), timeout_ms(static_cast<int>(timeout_seconds * 1000.0)) {
+    if(size <= 0 || rank < 0 || rank >= size) {
+        throw std::invalid_argument("UnixSocketTransport: rank " + std::to_string(rank) + " is not in a job of size " +
+                                    std::to_string(size));
+    }
+    if(size == 1) {
+        return;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    listen_path = path + "." + std::to_string(rank);
+    sockaddr_un own = address(listen_path);
+    sockaddr_un next = address(path + "." + std::to_string((rank + 1) % size));
+
+    int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0) {
+        throw socketError("socket");
+    }
+    ::unlink(listen_path.c_str());
+    if(::bind(listen_fd, reinterpret_cast<sockaddr*>(&own), sizeof(own)) < 0 || ::listen(listen_fd, 1) < 0) {
+        auto error = socketError("cannot listen on " + listen_path);
+        ::close(listen_fd);
+        throw error;
+    }
+
+    try {
+        while(true) {
+            next_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if(next_fd < 0) {
+                throw socketError("socket");
+            }
+            if(::connect(next_fd, reinterpret_cast<sockaddr*>(&next), sizeof(next)) == 0) {
+                break;
+            }
+            ::close(next_fd);
+            next_fd = -1;
+            if(std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("UnixSocketTransport: rank " + std::to_string((rank + 1) % size) + " did not come up");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        sendAll(next_fd, &my_rank, sizeof(my_rank));
+
+        pollfd pending{listen_fd, POLLIN, 0};
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(::poll(&pending, 1, static_cast<int>(std::max<long long>(left, 0))) <= 0) {
+            throw std::runtime_error("UnixSocketTransport: rank " + std::to_string((rank + size - 1) % size) + " did not connect");
+        }
+        previous_fd = ::accept(listen_fd, nullptr, nullptr);
+        if(previous_fd < 0) {
+            throw socketError("accept");
+        }
+        int previous_rank = -1;
+        recvAll(previous_fd, &previous_rank, sizeof(previous_rank));
+        if(previous_rank != (rank + size - 1) % size) {
+            throw std::runtime_error("UnixSocketTransport: rank " + std::to_string(rank) + " was connected by rank " +
+                                     std::to_string(previous_rank) + ", check that every process uses the same size");
+        }
+    }
+    catch(...) {
+        ::close(listen_fd);
+        close();
+        throw;
+    }
+    ::close(listen_fd);
+    ::unlink(listen_path.c_str());
+    listen_path.clear();
+
+    for(int fd : {next_fd, previous_fd}) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+UnixSocketTransport::~UnixSocketTransport() {
+    close();
+}
+
+void UnixSocketTransport::close() {
+    for(int* fd : {&next_fd, &previous_fd}) {
+        if(*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    if(!listen_path.empty()) {
+        ::unlink(listen_path.c_str());
+        listen_path.clear();
+    }
+}
+
+void UnixSocketTransport::exchange(const void* send, std::size_t send_bytes, void* recv, std::size_t recv_bytes) {
+    if(ranks == 1) {
+        // the ring of one rank sends to itself
+        if(send_bytes != recv_bytes) {
+            throw std::invalid_argument("UnixSocketTransport: a job of size 1 must receive what it sends");
+        }
+        if(send_bytes > 0 && send != recv) {
+            std::memmove(recv, send, send_bytes);
+        }
+        return;
+    }
+
+    const char* out = static_cast<const char*>(send);
+    char* in = static_cast<char*>(recv);
+    std::size_t sent = 0;
+    std::size_t received = 0;
+    while(sent < send_bytes || received < recv_bytes) {
+        pollfd fds[2];
+        nfds_t count = 0;
+        if(sent < send_bytes) {
+            fds[count++] = {next_fd, POLLOUT, 0};
+        }
+        if(received < recv_bytes) {
+            fds[count++] = {previous_fd, POLLIN, 0};
+        }
+        int ready = ::poll(fds, count, timeout_ms);
+        if(ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if(ready < 0) {
+            throw socketError("poll");
+        }
+        if(ready == 0) {
+            throw std::runtime_error("UnixSocketTransport: rank " + std::to_string(my_rank) + " timed out waiting for its neighbours");
+        }
+
+        for(nfds_t i = 0; i < count; ++i) {
+            if(fds[i].revents == 0) {
+                continue;
+            }
+            if(fds[i].fd == next_fd) {
+                ssize_t n = ::send(next_fd, out + sent, send_bytes - sent, MSG_NOSIGNAL);
+                if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    throw socketError("send to rank " + std::to_string((my_rank + 1) % ranks));
+                }
+                sent += n > 0 ? static_cast<std::size_t>(n) : 0;
+            }
+            else {
+                ssize_t n = ::recv(previous_fd, in + received, recv_bytes - received, 0);
+                if(n == 0) {
+                    throw std::runtime_error("UnixSocketTransport: rank " + std::to_string((my_rank + ranks - 1) % ranks) +
+                                             " closed the connection");
+                }
+                if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    throw socketError("receive from rank " + std::to_string((my_rank + ranks - 1) % ranks));
+                }
+                received += n > 0 ? static_cast<std::size_t>(n) : 0;
+            }
+        }
+    }
+}
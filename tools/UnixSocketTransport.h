@@ -0,0 +1,43 @@
+//
+// Created by Vijay Goyal on 2025-01-27.
+//
+
+#ifndef INC_12_FINALPROJ_2_UNIXSOCKETTRANSPORT_H
+#define INC_12_FINALPROJ_2_UNIXSOCKETTRANSPORT_H
+
+#include "Transport.h"
+#include <string>
+
+/**
+ * @brief Ring transport between processes on one machine over Unix domain stream sockets.
+ *        - rank r listens on "<path>.<r>", connects to the socket of rank r + 1 (retrying until it exists or
+ *          timeout_seconds pass) and accepts rank r - 1, every process of the job uses the same path and size
+ *        - both connections are non-blocking after the handshake, exchange polls them until both directions are done
+ *          and throws if neither makes progress for timeout_seconds (a peer that died or hangs)
+ *        - a job of size 1 opens no socket and exchange is a copy
+ */
+class UnixSocketTransport : public Transport {
+private:
+    int my_rank;
+    int ranks;
+    std::string listen_path;
+    int next_fd = -1;     // connection to rank + 1
+    int previous_fd = -1; // connection from rank - 1
+    int timeout_ms;       // longest exchange may wait without progress
+
+    void close();
+
+public:
+    UnixSocketTransport(const std::string& path, int rank, int size, double timeout_seconds = 60.0);
+    ~UnixSocketTransport() override;
+
+    UnixSocketTransport(const UnixSocketTransport&) = delete;
+    UnixSocketTransport& operator=(const UnixSocketTransport&) = delete;
+
+    [[nodiscard]] int rank() const override { return my_rank; }
+    [[nodiscard]] int size() const override { return ranks; }
+
+    void exchange(const void* send, std::size_t send_bytes, void* recv, std::size_t recv_bytes) override;
+};
+
+#endif //INC_12_FINALPROJ_2_UNIXSOCKETTRANSPORT_H
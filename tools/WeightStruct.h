@@ -10,18 +10,46 @@
 #include <memory>
 #include <string>
 #include <iostream>
+#include <cstdint>
+#include <stdexcept>
 
 enum class WeightStructType : int {
     ConvolutionalWeights = 0,
     PoolingWeights = 1,
-    ConnectedWeights = 2
+    ConnectedWeights = 2,
+    MergeWeights = 3
 };
 
+/**
+ * @brief Fixed-size description of one layer in a model file (see ModelFile), 64 bytes on disk.
+ *        - config holds the layer's hyper-parameters in the order its WeightStruct documents
+ *        - offset[i] is where parameter tensor i starts in the file's weight image, in elements, and is aligned
+ */
+struct LayerRecord {
+    std::uint32_t type = 0;         // WeightStructType
+    std::uint32_t tensor_count = 0; // parameter tensors stored for the layer
+    std::int32_t config[6] = {};
+    std::uint64_t offset[4] = {};
+};
+static_assert(sizeof(LayerRecord) == 64, "LayerRecord is part of the file format");
+
 template <typename Type>
 struct WeightStruct {
 //    virtual ~WeightStruct() = 0;
     [[nodiscard]] virtual WeightStructType getType() const = 0;
-    virtual void serialize(std::ofstream& out) const = 0;
+    virtual void describe(LayerRecord& record) const = 0; // type and config, the offsets are filled in by the writer
+
+protected:
+    // parameter tensor of this shape at offset of a weight image of count elements, sharing its memory
+    static std::shared_ptr<Tensor<Type>> view(const std::shared_ptr<Type>& values, const std::shared_ptr<Type>& grads, std::size_t count,
+                                              std::uint64_t offset, int batch_size, int channels, int height, int width) {
+        std::size_t size = static_cast<std::size_t>(batch_size) * channels * height * width;
+        if(batch_size < 0 || channels < 0 || height < 0 || width < 0 || offset > count || size > count - offset) {
+            throw std::runtime_error("Model file: a layer's weights lie outside the weight image.");
+        }
+        return Tensor<Type>::wrap(std::shared_ptr<Type>(values, values.get() + offset), std::shared_ptr<Type>(grads, grads.get() + offset),
+                                  batch_size, channels, height, width);
+    }
 };
 
 
@@ -0,0 +1,88 @@
+//
+// Created by Vijay Goyal on 2025-01-23.
+//
+
+#ifndef INC_12_FINALPROJ_2_WINOGRAD_H
+#define INC_12_FINALPROJ_2_WINOGRAD_H
+
+#include <cstddef>
+#include "Gemm.h"
+
+// transform matrices of F(M x M, 3 x 3): B^T (A x A), G (A x 3) and A^T (M x A) with A = M + 2
+template <int M>
+struct WinogradMatrices;
+
+template <>
+struct WinogradMatrices<2> {
+    static constexpr double BT[4][4] = {{1, 0, -1, 0}, {0, 1, 1, 0}, {0, -1, 1, 0}, {0, 1, 0, -1}};
+    static constexpr double G[4][3] = {{1, 0, 0}, {0.5, 0.5, 0.5}, {0.5, -0.5, 0.5}, {0, 0, 1}};
+    static constexpr double AT[2][4] = {{1, 1, 1, 0}, {0, 1, -1, -1}};
+};
+
+// points 0, +-1, +-2 and infinity
+template <>
+struct WinogradMatrices<4> {
+    static constexpr double BT[6][6] = {{4, 0, -5, 0, 1, 0}, {0, -4, -4, 1, 1, 0}, {0, 4, -4, -1, 1, 0},
+                                        {0, -2, -1, 2, 1, 0}, {0, 2, -1, -2, 1, 0}, {0, 4, 0, -5, 0, 1}};
+    static constexpr double G[6][3] = {{1.0 / 4, 0, 0}, {-1.0 / 6, -1.0 / 6, -1.0 / 6}, {-1.0 / 6, 1.0 / 6, -1.0 / 6},
+                                       {1.0 / 24, 1.0 / 12, 1.0 / 6}, {1.0 / 24, -1.0 / 12, 1.0 / 6}, {0, 0, 1}};
+    static constexpr double AT[4][6] = {{1, 1, 1, 1, 1, 0}, {0, 1, -1, 2, -2, 0}, {0, 1, 1, 4, 4, 0}, {0, 1, -1, 8, -8, 1}};
+};
+
+/**
+ * @brief Winograd F(2x2, 3x3) and F(4x4, 3x3) convolution of a batch, for 3x3 filters at stride 1 with any padding.
+ *        - every m x m output tile is computed from an (m + 2) x (m + 2) input tile as A^T [(G g G^T) . (B^T d B)] A,
+ *          4 (m = 2) or 9 (m = 4) times fewer multiplies in the product than the direct 3x3 loop
+ *        - the filters are transformed once into U[(m + 2)^2][out_channels][in_channels], the layer caches them
+ *        - the tiles of the whole batch are transformed into V[(m + 2)^2][in_channels][tiles] one block of tile rows at
+ *          a time, so the product is (m + 2)^2 GEMMs of U x V per block, wide enough for the GEMM even on small images
+ *          and small enough that V and M stay in cache
+ *        - the input and output transforms cost about as much as the product itself on narrow layers, it only pays off
+ *          from about 32 channels, which is why the layer leaves it off unless asked
+ *        - F(4x4, 3x3) has larger transform constants than F(2x2, 3x3), its float error is about ten times higher,
+ *          bench/winograd_accuracy.cpp reports both against the direct path
+ *        - the transformed filters, tiles and products are kept in Acc, for bfloat16 only the input and output are
+ *          bfloat16 since its 8 bit mantissa would not survive the transforms
+ */
+template <typename Type>
+class Winograd {
+public:
+    typedef typename Accumulator<Type>::type Acc;
+
+    // tile is the output tile size m, 2 or 4, any other value is rejected by the layer
+    static bool supports(int tile) { return tile == 2 || tile == 4; }
+    static bool supports(int filter_height, int filter_width, int stride) { return filter_height == 3 && filter_width == 3 && stride == 1; }
+
+    // elements of transformed filters: (tile + 2)^2 * out_channels * in_channels
+    static std::size_t transformedSize(int tile, int out_channels, int in_channels);
+
+    // filters[out_channels][in_channels][3][3] -> U[(tile + 2)^2][out_channels][in_channels]
+    static void transformFilters(int tile, const Type* filters, int out_channels, int in_channels, Acc* transformed);
+
+    // out[batch][out_channels][out_height][out_width] = filters (*) input[batch][channels][height][width] padded by padding,
+    // without a bias, the input samples are sample_stride elements apart
+    static void forward(int tile, const Type* input, int batch, std::ptrdiff_t sample_stride, int channels, int height, int width, int padding,
+                        const Acc* transformed, int out_channels, int out_height, int out_width, Type* out);
+
+private:
+    template <int M>
+    static void transformFilters(const Type* filters, int out_channels, int in_channels, Acc* transformed);
+
+    template <int M>
+    static void forward(const Type* input, int batch, std::ptrdiff_t sample_stride, int channels, int height, int width, int padding,
+                        const Acc* transformed, int out_channels, int out_height, int out_width, Type* out);
+
+    // V[A * A][channels][tiles of rows [r0, r1)] from the padded batch, row r is tile row r % tiles_high of sample r / tiles_high
+    template <int M>
+    static void transformInput(const Acc* padded, int channels, int padded_height, int tiles_high, int tiles_wide,
+                               int r0, int r1, Acc* V);
+
+    // output rows of tile rows [r0, r1) from M[A * A][out_channels][tiles]
+    template <int M>
+    static void transformOutput(const Acc* product, int out_channels, int out_height, int out_width,
+                                int tiles_high, int tiles_wide, int r0, int r1, Type* out);
+};
+
+#include "Winograd.tpp"
+
+#endif //INC_12_FINALPROJ_2_WINOGRAD_H
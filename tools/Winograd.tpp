@@ -0,0 +1,271 @@
+//
+// Created by Vijay Goyal on 2025-01-23.
+//
+
+#include "Winograd.h"
+#include <algorithm>
+#include <vector>
+#include "ThreadPool.h"
+
+template <typename Type>
+std::size_t Winograd<Type>::transformedSize(int tile, int out_channels, int in_channels) {
+    return static_cast<std::size_t>(tile + 2) * (tile + 2) * out_channels * in_channels;
+}
+
+template <typename Type>
+void Winograd<Type>::transformFilters(int tile, const Type* filters, int out_channels, int in_channels, Acc* transformed) {
+    if(tile == 2) {
+        transformFilters<2>(filters, out_channels, in_channels, transformed);
+    }
+    else {
+        transformFilters<4>(filters, out_channels, in_channels, transformed);
+    }
+}
+
+template <typename Type>
+void Winograd<Type>::forward(int tile, const Type* input, int batch, std::ptrdiff_t sample_stride, int channels, int height, int width,
+                             int padding, const Acc* transformed, int out_channels, int out_height, int out_width, Type* out) {
+    if(tile == 2) {
+        forward<2>(input, batch, sample_stride, channels, height, width, padding, transformed, out_channels, out_height, out_width, out);
+    }
+    else {
+        forward<4>(input, batch, sample_stride, channels, height, width, padding, transformed, out_channels, out_height, out_width, out);
+    }
+}
+
+// U = G g G^T for every (filter, channel) pair, computed in double
+template <typename Type>
+template <int M>
+void Winograd<Type>::transformFilters(const Type* filters, int out_channels, int in_channels, Acc* transformed) {
+    constexpr int A = M + 2;
+    using T = WinogradMatrices<M>;
+    std::ptrdiff_t pairs = static_cast<std::ptrdiff_t>(out_channels) * in_channels;
+
+    ThreadPool::parallelFor(pairs, 64, [&](std::ptrdiff_t first, std::ptrdiff_t last) {
+        for(std::ptrdiff_t p = first; p < last; ++p) {
+            const Type* g = filters + p * 9;
+            double Gg[A][3];
+            for(int i = 0; i < A; ++i) {
+                for(int j = 0; j < 3; ++j) {
+                    Gg[i][j] = T::G[i][0] * g[j] + T::G[i][1] * g[3 + j] + T::G[i][2] * g[6 + j];
+                }
+            }
+            for(int i = 0; i < A; ++i) {
+                for(int j = 0; j < A; ++j) {
+                    double u = Gg[i][0] * T::G[j][0] + Gg[i][1] * T::G[j][1] + Gg[i][2] * T::G[j][2];
+                    transformed[(i * A + j) * pairs + p] = static_cast<Acc>(u);
+                }
+            }
+        }
+    });
+}
+
+/*
+ * V = B^T d B of every input tile in tile rows [r0, r1), the tiles of a row are the vector lanes
+ *  - tile (r, t) of a sample starts at padded row r * M and column t * M, neighbouring tiles overlap by 2
+ *  - padded rows are stored as M phases of tiles_wide + 1 columns (columns p, p + M, p + 2M, ... for p < M), so
+ *    column t * M + k is element t + k / M of phase k % M and every load is contiguous across the tiles
+ *  - B^T is applied down the columns of a whole tile row first, then B across each tile
+ */
+template <typename Type>
+template <int M>
+void Winograd<Type>::transformInput(const Acc* padded, int channels, int padded_height, int tiles_high, int tiles_wide,
+                                    int r0, int r1, Acc* V) {
+    constexpr int A = M + 2;
+    using T = WinogradMatrices<M>;
+    int phase = tiles_wide + 1;
+    int row_length = M * phase;
+    std::ptrdiff_t plane = static_cast<std::ptrdiff_t>(padded_height) * row_length;
+    std::ptrdiff_t tiles = static_cast<std::ptrdiff_t>(r1 - r0) * tiles_wide;
+    std::ptrdiff_t xi_stride = channels * tiles;
+
+    thread_local std::vector<Acc> columns; // B^T applied to the A rows of one tile row, runs inside one task only
+    columns.resize(static_cast<std::size_t>(A) * row_length);
+    Acc* cols = columns.data();
+
+    for(int c = 0; c < channels; ++c) {
+        for(int r = r0; r < r1; ++r) {
+            int n = r / tiles_high;
+            const Acc* src = padded + (static_cast<std::ptrdiff_t>(n) * channels + c) * plane
+                              + static_cast<std::ptrdiff_t>(r - n * tiles_high) * M * row_length;
+            #pragma GCC unroll 6
+            for(int i = 0; i < A; ++i) {
+                Acc* dst = cols + i * row_length;
+                #pragma omp simd
+                for(int x = 0; x < row_length; ++x) {
+                    Acc sum = static_cast<Acc>(0.0);
+                    #pragma GCC unroll 6
+                    for(int k = 0; k < A; ++k) {
+                        if(T::BT[i][k] != 0.0) {
+                            sum += static_cast<Acc>(T::BT[i][k]) * src[k * row_length + x];
+                        }
+                    }
+                    dst[x] = sum;
+                }
+            }
+
+            Acc* out = V + c * tiles + static_cast<std::ptrdiff_t>(r - r0) * tiles_wide;
+            #pragma GCC unroll 6
+            for(int i = 0; i < A; ++i) {
+                const Acc* row = cols + i * row_length;
+                #pragma GCC unroll 6
+                for(int j = 0; j < A; ++j) {
+                    Acc* dst = out + (i * A + j) * xi_stride;
+                    #pragma omp simd
+                    for(int t = 0; t < tiles_wide; ++t) {
+                        Acc sum = static_cast<Acc>(0.0);
+                        #pragma GCC unroll 6
+                        for(int k = 0; k < A; ++k) {
+                            if(T::BT[j][k] != 0.0) {
+                                sum += static_cast<Acc>(T::BT[j][k]) * row[(k % M) * phase + k / M + t];
+                            }
+                        }
+                        dst[t] = sum;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Y = A^T m A of every product tile in tile rows [r0, r1)
+ *  - A is applied across each tile first, then A^T down its columns
+ *  - the M x M results are interleaved into M rows of tiles_wide * M columns, which are clipped to the output
+ */
+template <typename Type>
+template <int M>
+void Winograd<Type>::transformOutput(const Acc* product, int out_channels, int out_height, int out_width,
+                                     int tiles_high, int tiles_wide, int r0, int r1, Type* out) {
+    constexpr int A = M + 2;
+    using T = WinogradMatrices<M>;
+    std::ptrdiff_t tiles = static_cast<std::ptrdiff_t>(r1 - r0) * tiles_wide;
+    std::ptrdiff_t xi_stride = out_channels * tiles;
+    std::ptrdiff_t out_plane = static_cast<std::ptrdiff_t>(out_height) * out_width;
+    int row_length = tiles_wide * M;
+
+    thread_local std::vector<Acc> scratch; // runs inside one task, never shared
+    scratch.resize(static_cast<std::size_t>(A) * M * tiles_wide + static_cast<std::size_t>(M) * row_length);
+    Acc* across = scratch.data();                          // [A][M][tiles_wide]
+    Acc* rows = across + static_cast<std::ptrdiff_t>(A) * M * tiles_wide; // [M][tiles_wide * M]
+
+    for(int f = 0; f < out_channels; ++f) {
+        for(int r = r0; r < r1; ++r) {
+            int n = r / tiles_high;
+            int row = (r - n * tiles_high) * M;
+            const Acc* src = product + f * tiles + static_cast<std::ptrdiff_t>(r - r0) * tiles_wide;
+
+            #pragma GCC unroll 6
+            for(int i = 0; i < A; ++i) {
+                #pragma GCC unroll 4
+                for(int j = 0; j < M; ++j) {
+                    Acc* dst = across + (i * M + j) * tiles_wide;
+                    #pragma omp simd
+                    for(int t = 0; t < tiles_wide; ++t) {
+                        Acc sum = static_cast<Acc>(0.0);
+                        #pragma GCC unroll 6
+                        for(int k = 0; k < A; ++k) {
+                            if(T::AT[j][k] != 0.0) {
+                                sum += static_cast<Acc>(T::AT[j][k]) * src[(i * A + k) * xi_stride + t];
+                            }
+                        }
+                        dst[t] = sum;
+                    }
+                }
+            }
+
+            #pragma GCC unroll 4
+            for(int i = 0; i < M; ++i) {
+                Acc* dst = rows + i * row_length;
+                #pragma omp simd
+                for(int t = 0; t < tiles_wide; ++t) {
+                    #pragma GCC unroll 4
+                    for(int j = 0; j < M; ++j) {
+                        Acc sum = static_cast<Acc>(0.0);
+                        #pragma GCC unroll 6
+                        for(int k = 0; k < A; ++k) {
+                            if(T::AT[i][k] != 0.0) {
+                                sum += static_cast<Acc>(T::AT[i][k]) * across[(k * M + j) * tiles_wide + t];
+                            }
+                        }
+                        dst[t * M + j] = sum;
+                    }
+                }
+            }
+
+            Type* dst = out + (static_cast<std::ptrdiff_t>(n) * out_channels + f) * out_plane + static_cast<std::ptrdiff_t>(row) * out_width;
+            for(int i = 0; i < std::min(M, out_height - row); ++i) {
+                std::copy(rows + i * row_length, rows + i * row_length + out_width, dst + static_cast<std::ptrdiff_t>(i) * out_width);
+            }
+        }
+    }
+}
+
+/*
+ * Winograd convolution of a batch
+ *  - the input is copied with padding zeros on the top and left and enough on the bottom and right to cover
+ *    whole tiles, so no tile needs bounds checks, each row in the phase order transformInput reads
+ *  - the tile rows of every sample are cut into blocks of at least MIN_TILES tiles, or as many as keep V and M of a
+ *    block within about 1 MB, and the blocks run in parallel
+ */
+template <typename Type>
+template <int M>
+void Winograd<Type>::forward(const Type* input, int batch, std::ptrdiff_t sample_stride, int channels, int height, int width, int padding,
+                             const Acc* transformed, int out_channels, int out_height, int out_width, Type* out) {
+    constexpr int A = M + 2;
+    constexpr int MIN_TILES = 256; // narrower products leave the GEMM mostly packing
+    int tiles_high = (out_height + M - 1) / M;
+    int tiles_wide = (out_width + M - 1) / M;
+    int padded_height = tiles_high * M + 2;
+    int phase = tiles_wide + 1;
+    int row_length = M * phase;
+    std::ptrdiff_t plane = static_cast<std::ptrdiff_t>(padded_height) * row_length;
+
+    // the pool threads below fill and read it through padded_data, not their own thread_local
+    thread_local std::vector<Acc> padded;
+    padded.resize(static_cast<std::size_t>(batch) * channels * plane);
+    Acc* padded_data = padded.data();
+    ThreadPool::parallelFor(batch * channels, 1, [&](int first, int last) {
+        for(int nc = first; nc < last; ++nc) {
+            Acc* dst = padded_data + nc * plane;
+            const Type* src = input + (nc / channels) * sample_stride + static_cast<std::ptrdiff_t>(nc % channels) * height * width;
+            std::fill(dst, dst + plane, static_cast<Acc>(0.0));
+            for(int h = 0; h < height && h + padding < padded_height; ++h) {
+                const Type* in_row = src + static_cast<std::ptrdiff_t>(h) * width;
+                Acc* row = dst + static_cast<std::ptrdiff_t>(h + padding) * row_length;
+                for(int w = 0; w < width; ++w) {
+                    int x = w + padding;
+                    row[(x % M) * phase + x / M] = in_row[w];
+                }
+            }
+        }
+    });
+
+    int rows = batch * tiles_high;
+    std::size_t bytes_per_row = sizeof(Acc) * A * A * (channels + out_channels) * static_cast<std::size_t>(tiles_wide);
+    std::size_t rows_per_block = std::max((std::size_t(1) << 20) / bytes_per_row, static_cast<std::size_t>((MIN_TILES + tiles_wide - 1) / tiles_wide));
+    int block_rows = static_cast<int>(std::min<std::size_t>(rows_per_block, rows));
+    int blocks = (rows + block_rows - 1) / block_rows;
+
+    ThreadPool::parallelTasks(static_cast<std::size_t>(blocks), [&](std::size_t task) {
+        int b = static_cast<int>(task);
+        int r0 = b * block_rows;
+        int r1 = std::min(rows, r0 + block_rows);
+        int tiles = (r1 - r0) * tiles_wide;
+
+        // declared inside the task, so each pool thread works on its own
+        thread_local std::vector<Acc> V;
+        thread_local std::vector<Acc> product;
+        V.resize(static_cast<std::size_t>(A) * A * channels * tiles);
+        product.resize(static_cast<std::size_t>(A) * A * out_channels * tiles);
+
+        transformInput<M>(padded_data, channels, padded_height, tiles_high, tiles_wide, r0, r1, V.data());
+        for(int xi = 0; xi < A * A; ++xi) {
+            Gemm<Acc>::multiply(false, false, out_channels, tiles, channels,
+                                 transformed + static_cast<std::ptrdiff_t>(xi) * out_channels * channels, channels,
+                                 V.data() + static_cast<std::ptrdiff_t>(xi) * channels * tiles, tiles,
+                                 product.data() + static_cast<std::ptrdiff_t>(xi) * out_channels * tiles, tiles);
+        }
+        transformOutput<M>(product.data(), out_channels, out_height, out_width, tiles_high, tiles_wide, r0, r1, out);
+    });
+}